@@ -57,7 +57,13 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(res[u'txouts'], 200)
         assert_equal(res[u'bytes_serialized'], 14273),
         assert_equal(len(res[u'bestblock']), 64)
-        assert_equal(len(res[u'hash_serialized']), 64)
+        assert_equal(len(res[u'hash_serialized_2']), 64)
+
+        # running counters agree with the full scan
+        fast = node.gettxoutsetinfo(False)
+        for key in [u'total_amount', u'transactions', u'height', u'txouts', u'bytes_serialized', u'bestblock']:
+            assert_equal(fast[key], res[key])
+        assert(u'hash_serialized_2' not in fast)
 
     def _test_getblockheader(self):
         node = self.nodes[0]
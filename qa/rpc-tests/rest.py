@@ -9,6 +9,7 @@
 
 from test_framework import BitcoinTestFramework
 from util import *
+import binascii
 import json
 
 try:
@@ -82,6 +83,48 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(json_string)
         for tx in txs:
             assert_equal(tx in json_obj['tx'], True)
+
+        # check that the streamed hex block matches the binary one
+        response = http_get_call(url.hostname, url.port, '/rest/block/'+newblockhash[0]+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        block_bin = response.read()
+        response = http_get_call(url.hostname, url.port, '/rest/block/'+newblockhash[0]+self.FORMAT_SEPARATOR+'hex', True)
+        assert_equal(response.status, 200)
+        assert_equal(response.read().strip(), binascii.hexlify(block_bin))
+
+        # check /headers, the new block is the tip so only one header comes back
+        response = http_get_call(url.hostname, url.port, '/rest/headers/5/'+bb_hash+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        assert_equal(int(response.getheader('content-length')), 2*80)
+        json_string = http_get_call(url.hostname, url.port, '/rest/headers/5/'+bb_hash+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(len(json_obj), 2)
+        response = http_get_call(url.hostname, url.port, '/rest/headers/0/'+bb_hash+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 400)
+
+        # check /chaininfo
+        json_string = http_get_call(url.hostname, url.port, '/rest/chaininfo'+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(json_obj['bestblockhash'], newblockhash[0])
+
+        # check /mempool, everything has been mined
+        json_string = http_get_call(url.hostname, url.port, '/rest/mempool/info'+self.FORMAT_SEPARATOR+'json')
+        assert_equal(json.loads(json_string)['size'], 0)
+        json_string = http_get_call(url.hostname, url.port, '/rest/mempool/contents'+self.FORMAT_SEPARATOR+'json')
+        assert_equal(json.loads(json_string), {})
+
+        # check /getutxos, the payment to node 2 is unspent and there is no output past the end
+        tx = self.nodes[0].getrawtransaction(txs[0], 1)
+        n = [vout['n'] for vout in tx['vout'] if vout['value'] == 11][0]
+        outpoints = '%s-%d/%s-%d' % (txs[0], n, txs[0], len(tx['vout']))
+        json_string = http_get_call(url.hostname, url.port, '/rest/getutxos/'+outpoints+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(json_obj['chaintipHash'], newblockhash[0])
+        assert_equal(json_obj['bitmap'], '10')
+        assert_equal(len(json_obj['utxos']), 1)
+        assert_equal(json_obj['utxos'][0]['value'], 11)
+        response = http_get_call(url.hostname, url.port, '/rest/getutxos/checkmempool'+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 400)
                 
         
 
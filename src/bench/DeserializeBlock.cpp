@@ -0,0 +1,45 @@
+// Copyright (c) 2015 The Cintamani developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "version.h"
+
+// A block full of ordinary pay-to-pubkey-hash spends, which is what most
+// blocks look like: every output script fits in CScript's inline storage.
+static CDataStream MakeTypicalBlock()
+{
+    CBlock block;
+    for (int i = 0; i < 1000; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(2);
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            tx.vin[j].prevout = COutPoint(uint256(i * 2 + j + 1), j);
+            tx.vin[j].scriptSig << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+        }
+        tx.vout.resize(2);
+        for (unsigned int j = 0; j < tx.vout.size(); j++) {
+            tx.vout[j].nValue = (i + 1) * 1000 + j;
+            tx.vout[j].scriptPubKey << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i & 0xff) << OP_EQUALVERIFY << OP_CHECKSIG;
+        }
+        block.vtx.push_back(CTransaction(tx));
+    }
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block;
+    return stream;
+}
+
+static void DeserializeBlockTest(benchmark::State& state)
+{
+    CDataStream stream = MakeTypicalBlock();
+    while (state.KeepRunning()) {
+        CDataStream ss(stream);
+        CBlock block;
+        ss >> block;
+    }
+}
+
+BENCHMARK(DeserializeBlockTest);
@@ -0,0 +1,43 @@
+// Copyright (c) 2015 The Cintamani developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "crypto/sha256.h"
+#include "primitives/block.h"
+
+#include <vector>
+
+/* Number of bytes to hash per iteration */
+static const uint64_t BUFFER_SIZE = 1000 * 1000;
+
+static void SHA256(benchmark::State& state)
+{
+    uint8_t hash[CSHA256::OUTPUT_SIZE];
+    std::vector<uint8_t> in(BUFFER_SIZE, 0);
+    while (state.KeepRunning())
+        CSHA256().Write(&in[0], in.size()).Finalize(hash);
+}
+
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0), out(32 * 1024);
+    while (state.KeepRunning())
+        SHA256D64(&out[0], &in[0], 1024);
+}
+
+static void MerkleRoot(benchmark::State& state)
+{
+    CBlock block;
+    for (int i = 0; i < 2000; i++) {
+        CMutableTransaction tx;
+        tx.nLockTime = i;
+        block.vtx.push_back(CTransaction(tx));
+    }
+    while (state.KeepRunning())
+        block.BuildMerkleTree();
+}
+
+BENCHMARK(SHA256);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(MerkleRoot);
@@ -0,0 +1,111 @@
+// Copyright (c) 2015 The Cintamani developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+
+#include "main.h"
+#include "util.h"
+
+#include <errno.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool fBlockMmap = DEFAULT_BLOCK_MMAP;
+CBlockFileMapCache blockFileMaps(MAX_MAPPED_BLOCK_FILES);
+
+CMappedBlockFile::CMappedBlockFile(int nFileIn, const unsigned char* pbeginIn, size_t nSizeIn) :
+    nFile(nFileIn), pbegin(pbeginIn), nSize(nSizeIn)
+{
+}
+
+CMappedBlockFile::~CMappedBlockFile()
+{
+#ifndef WIN32
+    munmap((void*)pbegin, nSize);
+#endif
+}
+
+void CMappedBlockFile::Advise(size_t nPos, size_t nLen, BlockFileAccess access) const
+{
+#ifndef WIN32
+    // The whole file is mapped MADV_RANDOM so txindex lookups don't pull in
+    // readahead they never use; ask the kernel to fetch a whole block at once.
+    if (access != BLOCKFILE_ACCESS_SEQUENTIAL || !Contains(nPos, nLen))
+        return;
+    static const size_t nPageSize = sysconf(_SC_PAGESIZE);
+    size_t nStart = nPos - nPos % nPageSize;
+    madvise((void*)(pbegin + nStart), nPos + nLen - nStart, MADV_WILLNEED);
+#endif
+}
+
+CBlockFileMapCache::MappedPtr CBlockFileMapCache::Map(int nFile)
+{
+#ifndef WIN32
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk");
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return MappedPtr();
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return MappedPtr();
+    }
+
+    size_t nSize = st.st_size;
+    void* p = mmap(NULL, nSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps its own reference to the file
+    if (p == MAP_FAILED) {
+        LogPrint("mmap", "CBlockFileMapCache::Map : mmap of %s failed (errno %d)\n", path.string(), errno);
+        return MappedPtr();
+    }
+    madvise(p, nSize, MADV_RANDOM);
+
+    LogPrint("mmap", "CBlockFileMapCache::Map : mapped %s, %u bytes\n", path.string(), nSize);
+    return MappedPtr(new CMappedBlockFile(nFile, (const unsigned char*)p, nSize));
+#else
+    return MappedPtr();
+#endif
+}
+
+CBlockFileMapCache::MappedPtr CBlockFileMapCache::Get(int nFile, size_t nPos, size_t nLen)
+{
+    if (!fBlockMmap)
+        return MappedPtr();
+
+    LOCK(cs);
+
+    std::map<int, MappedList::iterator>::iterator mi = mapMapped.find(nFile);
+    if (mi != mapMapped.end()) {
+        MappedPtr mapped = *mi->second;
+        listMapped.erase(mi->second);
+        mapMapped.erase(mi);
+        if (mapped->Contains(nPos, nLen)) {
+            listMapped.push_front(mapped);
+            mapMapped[nFile] = listMapped.begin();
+            return mapped;
+        }
+        // The file has grown since it was mapped, map it again below
+    }
+
+    MappedPtr mapped = Map(nFile);
+    if (!mapped)
+        return MappedPtr();
+
+    listMapped.push_front(mapped);
+    mapMapped[nFile] = listMapped.begin();
+    while (listMapped.size() > nMaxFiles) {
+        mapMapped.erase(listMapped.back()->nFile);
+        listMapped.pop_back();
+    }
+
+    if (!mapped->Contains(nPos, nLen))
+        return MappedPtr();
+    return mapped;
+}
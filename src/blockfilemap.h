@@ -0,0 +1,88 @@
+// Copyright (c) 2015 The Cintamani developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include "sync.h"
+
+#include <list>
+#include <map>
+#include <stddef.h>
+
+#include <boost/shared_ptr.hpp>
+
+//! -blockmmap default
+static const bool DEFAULT_BLOCK_MMAP = true;
+//! Maximum number of blk?????.dat files kept memory-mapped at the same time
+static const unsigned int MAX_MAPPED_BLOCK_FILES = 16;
+
+/** How a range of a mapped block file is about to be read, passed on to madvise() */
+enum BlockFileAccess
+{
+    BLOCKFILE_ACCESS_RANDOM,      //! small lookups, e.g. transactions via -txindex
+    BLOCKFILE_ACCESS_SEQUENTIAL,  //! whole blocks, e.g. serving peers during their IBD
+};
+
+/** Read-only memory mapping of one block file, unmapped when the last user releases it */
+class CMappedBlockFile
+{
+private:
+    // Disallow copies
+    CMappedBlockFile(const CMappedBlockFile&);
+    CMappedBlockFile& operator=(const CMappedBlockFile&);
+
+public:
+    const int nFile;
+    const unsigned char* const pbegin;
+    const size_t nSize;
+
+    CMappedBlockFile(int nFileIn, const unsigned char* pbeginIn, size_t nSizeIn);
+    ~CMappedBlockFile();
+
+    bool Contains(size_t nPos, size_t nLen) const
+    {
+        return nPos <= nSize && nLen <= nSize - nPos;
+    }
+
+    void Advise(size_t nPos, size_t nLen, BlockFileAccess access) const;
+};
+
+/**
+ * Bounded, least-recently-used set of memory-mapped block files.
+ *
+ * Block files are append-only, so a mapping stays valid for everything it
+ * covers; a request past its end (the file being written to has grown)
+ * replaces it with a fresh mapping. Callers hold on to the returned pointer
+ * while they read, so eviction never unmaps memory that is still in use.
+ */
+class CBlockFileMapCache
+{
+private:
+    typedef boost::shared_ptr<const CMappedBlockFile> MappedPtr;
+    typedef std::list<MappedPtr> MappedList;
+
+    CCriticalSection cs;
+    unsigned int nMaxFiles;
+    MappedList listMapped; //! most recently used first
+    std::map<int, MappedList::iterator> mapMapped;
+
+    MappedPtr Map(int nFile);
+
+public:
+    CBlockFileMapCache(unsigned int nMaxFilesIn) : nMaxFiles(nMaxFilesIn) { }
+
+    /**
+     * Get a mapping of block file nFile that covers [nPos, nPos + nLen).
+     * Returns an empty pointer if the range cannot be mapped (memory mapping
+     * disabled or unsupported, file missing or too short); callers then fall
+     * back to stdio.
+     */
+    MappedPtr Get(int nFile, size_t nPos, size_t nLen);
+};
+
+extern bool fBlockMmap;
+extern CBlockFileMapCache blockFileMaps;
+
+#endif // BITCOIN_BLOCKFILEMAP_H
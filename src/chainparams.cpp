@@ -88,6 +88,24 @@ static const Checkpoints::CCheckpointData dataRegtest = {
         0
     };
 
+/**
+ * UTXO set snapshots loadtxoutset may bootstrap from. Only add one for a
+ * dumptxoutset result that nodes which validated the whole chain themselves
+ * agree on: its hash is all a snapshot node ever checks the set against.
+ */
+static MapTxOutSetSnapshots mapTxOutSetSnapshots;
+static MapTxOutSetSnapshots mapTxOutSetSnapshotsTestnet;
+/**
+ * Regtest: height 30 of the chain snapshot_tests builds, one block a minute
+ * paying the block value to OP_TRUE and splitting each coinbase once it
+ * matures. Its blocks are fixed, so submitblock can replay them on any node.
+ */
+static MapTxOutSetSnapshots mapTxOutSetSnapshotsRegtest =
+        boost::assign::map_list_of
+        ( uint256("0x001a02ed6fd0327c244c156880f22a3740a63b12e61a7075c63cd8dc58bc117a"),
+          CTxOutSetSnapshotData(uint256("0x952b1365341bc8a1b99e6fc87589f6a177731600543940b60b7f2055c185b9b5"), 46))
+        ;
+
 class CMainParams : public CChainParams {
 public:
     CMainParams() {
@@ -177,6 +195,10 @@ public:
     {
         return data;
     }
+    const MapTxOutSetSnapshots& TxOutSetSnapshots() const
+    {
+        return mapTxOutSetSnapshots;
+    }
 };
 static CMainParams mainParams;
 
@@ -238,6 +260,10 @@ public:
     {
         return dataTestnet;
     }
+    const MapTxOutSetSnapshots& TxOutSetSnapshots() const
+    {
+        return mapTxOutSetSnapshotsTestnet;
+    }
 };
 static CTestNetParams testNetParams;
 
@@ -283,6 +309,10 @@ public:
     {
         return dataRegtest;
     }
+    const MapTxOutSetSnapshots& TxOutSetSnapshots() const
+    {
+        return mapTxOutSetSnapshotsRegtest;
+    }
 };
 static CRegTestParams regTestParams;
 
@@ -310,6 +340,10 @@ public:
         // UnitTest share the same checkpoints as MAIN
         return data;
     }
+    const MapTxOutSetSnapshots& TxOutSetSnapshots() const
+    {
+        return mapTxOutSetSnapshotsUnitTest;
+    }
 
     //! Published setters to allow changing values in unit test cases
     virtual void setSubsidyHalvingInterval(int anSubsidyHalvingInterval)  { nSubsidyHalvingInterval=anSubsidyHalvingInterval; }
@@ -319,6 +353,10 @@ public:
     virtual void setDefaultConsistencyChecks(bool afDefaultConsistencyChecks)  { fDefaultConsistencyChecks=afDefaultConsistencyChecks; }
     virtual void setAllowMinDifficultyBlocks(bool afAllowMinDifficultyBlocks) {  fAllowMinDifficultyBlocks=afAllowMinDifficultyBlocks; }
     virtual void setSkipProofOfWorkCheck(bool afSkipProofOfWorkCheck) { fSkipProofOfWorkCheck = afSkipProofOfWorkCheck; }
+    virtual void setTxOutSetSnapshots(const MapTxOutSetSnapshots& aTxOutSetSnapshots) { mapTxOutSetSnapshotsUnitTest = aTxOutSetSnapshots; }
+
+private:
+    MapTxOutSetSnapshots mapTxOutSetSnapshotsUnitTest;
 };
 static CUnitTestParams unitTestParams;
 
@@ -12,6 +12,7 @@
 #include "protocol.h"
 #include "uint256.h"
 
+#include <map>
 #include <vector>
 
 typedef unsigned char MessageStartChars[MESSAGE_START_SIZE];
@@ -21,6 +22,16 @@ struct CDNSSeedData {
     CDNSSeedData(const std::string &strName, const std::string &strHost) : name(strName), host(strHost) {}
 };
 
+/** What a UTXO set snapshot taken at a given block must contain for loadtxoutset to accept it */
+struct CTxOutSetSnapshotData {
+    uint256 hashSerialized; //! hash_serialized_2 of the set, as reported by gettxoutsetinfo
+    uint64_t nChainTx;      //! number of transactions up to and including the block
+    CTxOutSetSnapshotData(const uint256 &hashSerializedIn, uint64_t nChainTxIn) : hashSerialized(hashSerializedIn), nChainTx(nChainTxIn) {}
+};
+
+//! Snapshots loadtxoutset accepts, keyed by the hash of the block they were taken at
+typedef std::map<uint256, CTxOutSetSnapshotData> MapTxOutSetSnapshots;
+
 /**
  * CChainParams defines various tweakable parameters of a given instance of the
  * Cintamani system. There are three: the main network on which people trade goods
@@ -80,6 +91,8 @@ public:
     const std::vector<unsigned char>& Base58Prefix(Base58Type type) const { return base58Prefixes[type]; }
     const std::vector<CAddress>& FixedSeeds() const { return vFixedSeeds; }
     virtual const Checkpoints::CCheckpointData& Checkpoints() const = 0;
+    /** The only UTXO set snapshots a node of this network may bootstrap from */
+    virtual const MapTxOutSetSnapshots& TxOutSetSnapshots() const = 0;
     int PoolMaxTransactions() const { return nPoolMaxTransactions; }
     std::string SporkKey() const { return strSporkKey; }
     std::string DarksendPoolDummyAddress() const { return strDarksendPoolDummyAddress; }
@@ -139,6 +152,7 @@ public:
     virtual void setDefaultConsistencyChecks(bool aDefaultConsistencyChecks)=0;
     virtual void setAllowMinDifficultyBlocks(bool aAllowMinDifficultyBlocks)=0;
     virtual void setSkipProofOfWorkCheck(bool aSkipProofOfWorkCheck)=0;
+    virtual void setTxOutSetSnapshots(const MapTxOutSetSnapshots& aTxOutSetSnapshots)=0;
 };
 
 
@@ -6,6 +6,7 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <deque>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -25,12 +26,25 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Pending verifications are spread over per-worker queues, each with its
+  * own lock. A worker takes batches from the back of its own queue and,
+  * once that is empty, steals from the front of the others, so threads
+  * only contend when they touch the same queue. The shared lock is taken
+  * once per finished batch, to account for it.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    /** Verifications handed to one worker, open to stealing by the others */
+    struct CWorkerQueue
+    {
+        boost::mutex mutex;
+        std::deque<T> checks;
+    };
+
+    //! Mutex to protect the inner state; never held while verifying
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,9 +53,9 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! The per-worker queues, the master uses the first one. Workers beyond
+    //! the number of queues share one. Always locked after mutex, if both.
+    std::vector<CWorkerQueue*> vQueues;
 
     //! The number of workers (including the master) that are idle.
     int nIdle;
@@ -49,86 +63,138 @@ private:
     //! The total number of workers (including the master).
     int nTotal;
 
+    //! The number of worker threads that have started, not counting the master.
+    unsigned int nWorkers;
+
     //! The temporary evaluation result.
     bool fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
-     * This includes elements that are not anymore in queue, but still in
-     * worker's own batches.
+     * This includes elements that are not anymore in a queue, but still in
+     * a worker's own batch.
      */
     unsigned int nTodo;
 
+    //! Incremented by every Add(), so a worker that found no work can tell whether it missed some.
+    unsigned int nAdded;
+
+    //! Queue that receives the next batch added.
+    unsigned int nNextQueue;
+
     //! Whether we're shutting down.
     bool fQuit;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    /**
+     * Move a batch of verifications into vChecks, from queue nQueue if it
+     * has any, otherwise stolen from another one. Returns false when all
+     * queues are empty.
+     */
+    bool Take(unsigned int nQueue, std::vector<T>& vChecks)
+    {
+        for (unsigned int i = 0; i < vQueues.size(); i++) {
+            CWorkerQueue& queue = *vQueues[(nQueue + i) % vQueues.size()];
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            if (queue.checks.empty())
+                continue;
+            // Do not try to do everything at once, but aim for increasingly smaller
+            // batches so all workers finish approximately simultaneously. Don't do
+            // batches smaller than 1 (duh), or larger than nBatchSize.
+            unsigned int nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.checks.size() / 2));
+            vChecks.resize(nNow);
+            for (unsigned int j = 0; j < nNow; j++) {
+                // Swap jobs out instead of copying them. The owner works from
+                // the back, thieves from the front, to keep out of each other's way.
+                if (i == 0) {
+                    vChecks[j].swap(queue.checks.back());
+                    queue.checks.pop_back();
+                } else {
+                    vChecks[j].swap(queue.checks.front());
+                    queue.checks.pop_front();
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
         boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
+        unsigned int nQueue = 0;
+        unsigned int nAddedSeen;
+        bool fOk;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nTotal++;
+            if (!fMaster)
+                nQueue = ++nWorkers % vQueues.size();
+            nAddedSeen = nAdded;
+            fOk = fAllOk;
+        }
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master he can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+            if (Take(nQueue, vChecks)) {
+                if (!fOk) {
+                    // A failure seen earlier may have been in a previous round
+                    // the master has since finished; the batch belongs to the
+                    // current one, so check again.
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    fOk = fAllOk;
                 }
+                // execute work
+                BOOST_FOREACH (T& check, vChecks)
+                    if (fOk)
+                        fOk = check();
+                boost::unique_lock<boost::mutex> lock(mutex);
+                fAllOk &= fOk;
+                nTodo -= vChecks.size();
+                if (nTodo == 0 && !fMaster)
+                    // We processed the last element; inform the master he can exit and return the result
+                    condMaster.notify_one();
                 // Check whether we need to do work at all
                 fOk = fAllOk;
+                nAddedSeen = nAdded;
+                vChecks.clear();
+                continue;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (nAdded != nAddedSeen) {
+                // Work was added while we were looking, look again
+                nAddedSeen = nAdded;
+                fOk = fAllOk;
+                continue;
+            }
+            if ((fMaster || fQuit) && nTodo == 0) {
+                nTotal--;
+                bool fRet = fAllOk;
+                // reset the status for new work later
+                if (fMaster)
+                    fAllOk = true;
+                // return the current status
+                return fRet;
+            }
+            nIdle++;
+            cond.wait(lock); // wait
+            nIdle--;
+            nAddedSeen = nAdded;
+            fOk = fAllOk;
         } while (true);
     }
 
 public:
-    //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    //! Create a new check queue, with nQueues queues to spread the work over
+    CCheckQueue(unsigned int nBatchSizeIn, unsigned int nQueuesIn = 1) : nIdle(0), nTotal(0), nWorkers(0), fAllOk(true), nTodo(0), nAdded(0), nNextQueue(0), fQuit(false), nBatchSize(nBatchSizeIn)
+    {
+        for (unsigned int i = 0; i < std::max(1U, nQueuesIn); i++)
+            vQueues.push_back(new CWorkerQueue());
+    }
 
     //! Worker thread
     void Thread()
@@ -145,26 +211,40 @@ public:
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
+        if (vChecks.empty())
+            return;
         boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        // Split the batch evenly over the queues of the threads that are running
+        unsigned int nQueues = std::min((unsigned int)vQueues.size(), nWorkers + 1);
+        unsigned int nChunk = (vChecks.size() + nQueues - 1) / nQueues;
+        for (unsigned int nPos = 0; nPos < vChecks.size(); nPos += nChunk) {
+            CWorkerQueue& queue = *vQueues[nNextQueue++ % nQueues];
+            boost::unique_lock<boost::mutex> lockQueue(queue.mutex);
+            for (unsigned int i = nPos; i < std::min(nPos + nChunk, (unsigned int)vChecks.size()); i++) {
+                queue.checks.push_back(T());
+                vChecks[i].swap(queue.checks.back());
+            }
         }
         nTodo += vChecks.size();
+        nAdded++;
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
     ~CCheckQueue()
     {
+        BOOST_FOREACH (CWorkerQueue* pqueue, vQueues)
+            delete pqueue;
     }
 
+    //! Whether no verifications are outstanding. Workers may still be on
+    //! their way to sleep after finishing the last ones, which is harmless.
     bool IsIdle()
     {
         boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return (nTodo == 0 && fAllOk == true);
     }
 
 };
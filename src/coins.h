@@ -7,6 +7,7 @@
 #define BITCOIN_COINS_H
 
 #include "compressor.h"
+#include "memusage.h"
 #include "serialize.h"
 #include "uint256.h"
 #include "undo.h"
@@ -256,6 +257,15 @@ public:
                 return false;
         return true;
     }
+
+    //! Heap memory owned by this entry: the vout array and every scriptPubKey
+    size_t DynamicMemoryUsage() const {
+        size_t ret = memusage::DynamicUsage(vout);
+        BOOST_FOREACH(const CTxOut &out, vout) {
+            ret += memusage::DynamicUsage(*static_cast<const CScriptBase*>(&out.scriptPubKey));
+        }
+        return ret;
+    }
 };
 
 class CCoinsKeyHasher
@@ -276,14 +286,29 @@ public:
     }
 };
 
+/** What one coin database entry adds to the UTXO set totals (see CCoinsViewDB) */
+struct CCoinsContribution
+{
+    uint32_t nOutputs;
+    uint32_t nSerializedSize; //! including the key; 0 for a pruned entry, which is not stored
+    CAmount nAmount;
+
+    CCoinsContribution() : nOutputs(0), nSerializedSize(0), nAmount(0) {}
+    explicit CCoinsContribution(const CCoins &coins);
+
+    bool IsNull() const { return nSerializedSize == 0; }
+};
+
 struct CCoinsCacheEntry
 {
     CCoins coins; // The actual cached data.
     unsigned char flags;
+    CCoinsContribution origin; // What the parent view's version contributes, if ORIGIN is set.
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
+        ORIGIN = (1 << 2), // origin holds the contribution of the parent view's version.
     };
 
     CCoinsCacheEntry() : coins(), flags(0) {}
@@ -326,6 +351,10 @@ public:
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats) const;
 
+    //! Counts and totals of the unspent transaction output set kept up to date on
+    //! every write, without hashSerialized. Returns false if not available.
+    virtual bool GetRunningStats(CCoinsStats &stats) const;
+
     //! As we use CCoinsViews polymorphically, have a virtual destructor
     virtual ~CCoinsView() {}
 };
@@ -345,6 +374,7 @@ public:
     void SetBackend(CCoinsView &viewIn);
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+    bool GetRunningStats(CCoinsStats &stats) const;
 };
 
 
@@ -360,7 +390,8 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
+    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
     CCoins* operator->() { return &it->second.coins; }
@@ -383,8 +414,19 @@ protected:
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage for the inner CCoins objects. */
+    mutable size_t cachedCoinsUsage;
+
+    /* Whether entries remember what the base view's version contributes to the UTXO totals. */
+    bool fTrackOrigin;
+
 public:
-    CCoinsViewCache(CCoinsView *baseIn);
+    /**
+     * With fTrackOriginIn, entries fetched from the base remember what they
+     * contribute to the UTXO set totals, so a CCoinsViewDB base can keep its
+     * counters up to date on flush without reading the old entries back.
+     */
+    CCoinsViewCache(CCoinsView *baseIn, bool fTrackOriginIn = false);
     ~CCoinsViewCache();
 
     // Standard CCoinsView methods
@@ -401,6 +443,16 @@ public:
      */
     const CCoins* AccessCoins(const uint256 &txid) const;
 
+    //! Whether an entry for txid is in this cache, without looking at the base view
+    bool HaveCoinsInCache(const uint256 &txid) const;
+
+    /**
+     * Cache coins for txid that someone else read from the base view, as a
+     * lookup would have. coins is swapped in and left empty. Does nothing if
+     * txid is already cached.
+     */
+    void AddFetchedCoins(const uint256 &txid, CCoins &coins);
+
     /**
      * Return a modifiable reference to a CCoins. If no entry with the given
      * txid exists, a new one is created. Simultaneous modifications are not
@@ -415,9 +467,21 @@ public:
      */
     bool Flush();
 
+    /**
+     * Move the modifications applied to this cache out into mapCoinsOut, to be
+     * written to the base by someone else (see CCoinsViewBackgroundFlush), and
+     * return the best block they belong to. With fKeepCache, unspent entries
+     * stay behind as clean copies so the cache is not cold afterwards; the base
+     * must then be able to serve the extracted entries until they are written.
+     */
+    uint256 ExtractDirty(CCoinsMap &mapCoinsOut, bool fKeepCache);
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the size of the cache (in bytes), kept exact on every change
+    size_t DynamicMemoryUsage() const;
+
     /** 
      * Amount of cintamani coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -439,6 +503,9 @@ public:
     friend class CCoinsModifier;
 
 private:
+    //! Record what a just-fetched entry contributes as its origin, if tracking
+    void SetOrigin(CCoinsCacheEntry &entry) const;
+
     CCoinsMap::iterator FetchCoins(const uint256 &txid);
     CCoinsMap::const_iterator FetchCoins(const uint256 &txid) const;
 };
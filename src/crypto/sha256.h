@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -25,4 +26,32 @@ public:
     CSHA256& Reset();
 };
 
+/** Implementations SHA256AutoDetect() may choose from, as a bitmask. */
+enum SHA256Implementation
+{
+    SHA256_STANDARD = 0,
+    SHA256_USE_SSE41 = (1U << 0),
+    SHA256_USE_AVX2 = (1U << 1),
+    SHA256_USE_SHANI = (1U << 2),
+    SHA256_USE_ALL = SHA256_USE_SSE41 | SHA256_USE_AVX2 | SHA256_USE_SHANI,
+};
+
+/**
+ * Pick the fastest SHA-256 implementation the CPU supports, out of those
+ * allowed by nUse, and return a description of it. Must be called once at
+ * startup, before any hashing threads are started; without it the portable
+ * code is used. Tests call it again with a narrower nUse to exercise each
+ * implementation.
+ */
+std::string SHA256AutoDetect(int nUse = SHA256_USE_ALL);
+
+/**
+ * Compute multiple double-SHA256's of 64-byte blobs, as used for the inner
+ * nodes of a merkle tree.
+ * output: pointer to a blocks*32 byte output buffer
+ * input:  pointer to a blocks*64 byte input buffer
+ * blocks: the number of hashes to compute
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
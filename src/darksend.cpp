@@ -27,7 +27,7 @@ CDarksendPool darkSendPool;
 // A helper object for signing messages from Masternodes
 CDarkSendSigner darkSendSigner;
 // The current Darksends in progress on the network
-std::vector<CDarksendQueue> vecDarksendQueue;
+CDarksendQueueList darkSendQueues;
 // Keep track of the used Masternodes
 std::vector<CTxIn> vecMasternodesUsed;
 // Keep track of the scanning errors I've seen
@@ -96,6 +96,7 @@ void CDarksendPool::ProcessMessageDarksend(CNode* pfrom, std::string& strCommand
         } else {
             LogPrintf("dsa -- is compatible, please submit! \n");
             pfrom->PushMessage("dssu", sessionID, GetState(), GetEntriesCount(), MASTERNODE_ACCEPTED, errorID);
+            CheckForCompleteQueue();
             return;
         }
 
@@ -132,9 +133,7 @@ void CDarksendPool::ProcessMessageDarksend(CNode* pfrom, std::string& strCommand
                 PrepareDarksendDenominate();
             }
         } else {
-            BOOST_FOREACH(CDarksendQueue q, vecDarksendQueue){
-                if(q.vin == dsq.vin) return;
-            }
+            if(darkSendQueues.Has(dsq.vin)) return;
 
             LogPrint("darksend", "dsq last %d last2 %d count %d\n", pmn->nLastDsq, pmn->nLastDsq + mnodeman.size()/5, mnodeman.nDsqCount);
             //don't allow a few nodes to dominate the queuing process
@@ -148,7 +147,7 @@ void CDarksendPool::ProcessMessageDarksend(CNode* pfrom, std::string& strCommand
             pmn->allowFreeTx = true;
 
             LogPrint("darksend", "dsq - new Darksend queue object - %s\n", addr.ToString());
-            vecDarksendQueue.push_back(dsq);
+            darkSendQueues.Add(dsq);
             dsq.Relay();
             dsq.time = GetTime();
         }
@@ -407,6 +406,7 @@ void CDarksendPool::SetNull(){
     sessionID = 0;
     sessionDenom = 0;
     entries.clear();
+    IndexEntries();
     finalTransaction.vin.clear();
     finalTransaction.vout.clear();
     lastTimeChanged = GetTimeMillis();
@@ -794,6 +794,9 @@ void CDarksendPool::ChargeRandomFees(){
 void CDarksendPool::CheckTimeout(){
     if(!fEnableDarksend && !fMasterNode) return;
 
+    // nothing below can fire before the earliest deadline
+    if(!IsTimeoutDue()) return;
+
     // catching hanging sessions
     if(!fMasterNode) {
         switch(state) {
@@ -813,15 +816,8 @@ void CDarksendPool::CheckTimeout(){
     }
 
     // check Darksend queue objects for timeouts
-    int c = 0;
-    vector<CDarksendQueue>::iterator it = vecDarksendQueue.begin();
-    while(it != vecDarksendQueue.end()){
-        if((*it).IsExpired()){
-            LogPrint("darksend", "CDarksendPool::CheckTimeout() : Removing expired queue entry - %d\n", c);
-            it = vecDarksendQueue.erase(it);
-        } else ++it;
-        c++;
-    }
+    int c = darkSendQueues.RemoveExpired();
+    if(c > 0) LogPrint("darksend", "CDarksendPool::CheckTimeout() : Removed %d expired queue entries\n", c);
 
     int addLagTime = 0;
     if(!fMasterNode) addLagTime = 10000; //if we're the client, give the server a few extra seconds before resetting.
@@ -835,6 +831,7 @@ void CDarksendPool::CheckTimeout(){
             if((*it2).IsExpired()){
                 LogPrint("darksend", "CDarksendPool::CheckTimeout() : Removing expired entry - %d\n", c);
                 it2 = entries.erase(it2);
+                IndexEntries();
                 if(entries.size() == 0){
                     UnlockCoins();
                     SetNull();
@@ -870,6 +867,66 @@ void CDarksendPool::CheckTimeout(){
     }
 }
 
+// Has anything CheckTimeout() looks at run out? Keep in step with the checks there.
+bool CDarksendPool::IsTimeoutDue(){
+    // session timers run on GetTimeMillis()
+    int64_t addLagTime = 0;
+    if(!fMasterNode) addLagTime = 10000;
+
+    int64_t nTimeout = lastTimeChanged + (DARKSEND_QUEUE_TIMEOUT*1000) + addLagTime;
+    if(state == POOL_STATUS_SIGNING)
+        nTimeout = std::min(nTimeout, lastTimeChanged + (DARKSEND_SIGNING_TIMEOUT*1000) + addLagTime);
+    // clients reset 10 seconds after an error or success, see Check()
+    if(!fMasterNode && (state == POOL_STATUS_ERROR || state == POOL_STATUS_SUCCESS))
+        nTimeout = std::min(nTimeout, lastTimeChanged + 10000);
+    if(GetTimeMillis() >= nTimeout) return true;
+
+    // entries and queues expire on GetTime()
+    int64_t nExpiry = darkSendQueues.GetNextExpiry();
+    if(state == POOL_STATUS_ACCEPTING_ENTRIES || state == POOL_STATUS_QUEUE){
+        BOOST_FOREACH(const CDarkSendEntry& e, entries) {
+            int64_t nEntryExpiry = e.addedTime + DARKSEND_QUEUE_TIMEOUT + 1;
+            if(nExpiry == 0 || nEntryExpiry < nExpiry) nExpiry = nEntryExpiry;
+        }
+    }
+    return nExpiry != 0 && GetTime() >= nExpiry;
+}
+
+//
+// Index the entries by input and merge them into one transaction, so incoming
+// entries and signatures are checked without walking every entry each time
+//
+void CDarksendPool::IndexEntries(){
+    mapEntryInputs.clear();
+    mapEntryDenoms.clear();
+    setEntrySigs.clear();
+    nEntrySigsMissing = 0;
+
+    CMutableTransaction txNew;
+    for(unsigned int i = 0; i < entries.size(); i++){
+        mapEntryDenoms[GetDenominations(entries[i].vout)]++;
+
+        BOOST_FOREACH(const CTxOut& out, entries[i].vout)
+            txNew.vout.push_back(out);
+
+        for(unsigned int j = 0; j < entries[i].sev.size(); j++){
+            const CTxDSIn& s = entries[i].sev[j];
+            CDarkSendEntryInputPos pos;
+            pos.nEntry = i;
+            pos.nInput = j;
+            pos.nTxIn = txNew.vin.size();
+            mapEntryInputs[s.prevout] = pos;
+            setEntrySigs.insert(s.scriptSig);
+            if(!s.fHasSig) nEntrySigsMissing++;
+
+            txNew.vin.push_back(s);
+        }
+    }
+
+    txEntries.Swap(txNew);
+    txdataEntries = PrecomputedTransactionData(txEntries);
+}
+
 //
 // Check for complete queue
 //
@@ -896,36 +953,19 @@ void CDarksendPool::CheckForCompleteQueue(){
 
 // check to see if the signature is valid
 bool CDarksendPool::SignatureValid(const CScript& newSig, const CTxIn& newVin){
-    CMutableTransaction txNew;
-    txNew.vin.clear();
-    txNew.vout.clear();
-
-    int found = -1;
-    CScript sigPubKey = CScript();
-    unsigned int i = 0;
-
-    BOOST_FOREACH(CDarkSendEntry& e, entries) {
-        BOOST_FOREACH(const CTxOut& out, e.vout)
-            txNew.vout.push_back(out);
-
-        BOOST_FOREACH(const CTxDSIn& s, e.sev){
-            txNew.vin.push_back(s);
-
-            if(s == newVin){
-                found = i;
-                sigPubKey = s.prevPubKey;
+    std::map<COutPoint, CDarkSendEntryInputPos>::const_iterator it = mapEntryInputs.find(newVin.prevout);
+
+    if(it != mapEntryInputs.end()){
+        const CTxDSIn& s = entries[it->second.nEntry].sev[it->second.nInput];
+        // the entry's scriptSig is still empty, so match the input the way CDarkSendEntry::AddSig() does
+        if(s.prevout == newVin.prevout && s.nSequence == newVin.nSequence){
+            int n = it->second.nTxIn;
+            LogPrint("darksend", "CDarksendPool::SignatureValid() - Sign with sig %s\n", newSig.ToString().substr(0,24));
+            // the signature hash blanks every scriptSig, so the merged transaction is good as is
+            if (!VerifyScript(newSig, s.prevPubKey, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC, TransactionSignatureChecker(&txEntries, n, &txdataEntries))){
+                LogPrint("darksend", "CDarksendPool::SignatureValid() - Signing - Error signing input %u\n", n);
+                return false;
             }
-            i++;
-        }
-    }
-
-    if(found >= 0){ //might have to do this one input at a time?
-        int n = found;
-        txNew.vin[n].scriptSig = newSig;
-        LogPrint("darksend", "CDarksendPool::SignatureValid() - Sign with sig %s\n", newSig.ToString().substr(0,24));
-        if (!VerifyScript(txNew.vin[n].scriptSig, sigPubKey, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC, MutableTransactionSignatureChecker(&txNew, n))){
-            LogPrint("darksend", "CDarksendPool::SignatureValid() - Signing - Error signing input %u\n", n);
-            return false;
         }
     }
 
@@ -1020,21 +1060,18 @@ bool CDarksendPool::AddEntry(const std::vector<CTxIn>& newInput, const int64_t&
 
     BOOST_FOREACH(CTxIn in, newInput) {
         LogPrint("darksend", "looking for vin -- %s\n", in.ToString());
-        BOOST_FOREACH(const CDarkSendEntry& v, entries) {
-            BOOST_FOREACH(const CTxDSIn& s, v.sev){
-                if((CTxIn)s == in) {
-                    LogPrint("darksend", "CDarksendPool::AddEntry - found in vin\n");
-                    errorID = ERR_ALREADY_HAVE;
-                    sessionUsers--;
-                    return false;
-                }
-            }
+        if(mapEntryInputs.count(in.prevout)) {
+            LogPrint("darksend", "CDarksendPool::AddEntry - found in vin\n");
+            errorID = ERR_ALREADY_HAVE;
+            sessionUsers--;
+            return false;
         }
     }
 
     CDarkSendEntry v;
     v.Add(newInput, nAmount, txCollateral, newOutput);
     entries.push_back(v);
+    IndexEntries();
 
     LogPrint("darksend", "CDarksendPool::AddEntry -- adding %s\n", newInput[0].ToString());
     errorID = MSG_ENTRIES_ADDED;
@@ -1046,13 +1083,9 @@ bool CDarksendPool::AddScriptSig(const CTxIn& newVin){
     LogPrint("darksend", "CDarksendPool::AddScriptSig -- new sig  %s\n", newVin.scriptSig.ToString().substr(0,24));
 
 
-    BOOST_FOREACH(const CDarkSendEntry& v, entries) {
-        BOOST_FOREACH(const CTxDSIn& s, v.sev){
-            if(s.scriptSig == newVin.scriptSig) {
-                LogPrint("darksend", "CDarksendPool::AddScriptSig - already exists\n");
-                return false;
-            }
-        }
+    if(setEntrySigs.count(newVin.scriptSig)) {
+        LogPrint("darksend", "CDarksendPool::AddScriptSig - already exists\n");
+        return false;
     }
 
     if(!SignatureValid(newVin.scriptSig, newVin)){
@@ -1069,8 +1102,13 @@ bool CDarksendPool::AddScriptSig(const CTxIn& newVin){
             LogPrint("darksend", "CDarkSendPool::AddScriptSig -- adding to finalTransaction  %s\n", newVin.scriptSig.ToString().substr(0,24));
         }
     }
-    for(unsigned int i = 0; i < entries.size(); i++){
-        if(entries[i].AddSig(newVin)){
+    std::map<COutPoint, CDarkSendEntryInputPos>::const_iterator it = mapEntryInputs.find(newVin.prevout);
+    if(it != mapEntryInputs.end()){
+        CScript scriptSigOld = entries[it->second.nEntry].sev[it->second.nInput].scriptSig;
+        if(entries[it->second.nEntry].AddSig(newVin)){
+            setEntrySigs.erase(setEntrySigs.find(scriptSigOld));
+            setEntrySigs.insert(newVin.scriptSig);
+            nEntrySigsMissing--;
             LogPrint("darksend", "CDarkSendPool::AddScriptSig -- adding  %s\n", newVin.scriptSig.ToString().substr(0,24));
             return true;
         }
@@ -1082,12 +1120,7 @@ bool CDarksendPool::AddScriptSig(const CTxIn& newVin){
 
 // Check to make sure everything is signed
 bool CDarksendPool::SignaturesComplete(){
-    BOOST_FOREACH(const CDarkSendEntry& v, entries) {
-        BOOST_FOREACH(const CTxDSIn& s, v.sev){
-            if(!s.fHasSig) return false;
-        }
-    }
-    return true;
+    return nEntrySigsMissing == 0;
 }
 
 //
@@ -1176,6 +1209,7 @@ void CDarksendPool::SendDarksendDenominate(std::vector<CTxIn>& vin, std::vector<
     CDarkSendEntry e;
     e.Add(vin, amount, txCollateral, vout);
     entries.push_back(e);
+    IndexEntries();
 
     RelayIn(entries[0].sev, entries[0].amount, txCollateral, entries[0].vout);
     Check();
@@ -1510,11 +1544,15 @@ bool CDarksendPool::DoAutomaticDenominating(bool fDryRun)
         //don't use the queues all of the time for mixing
         if(nUseQueue > 33){
 
+            std::vector<CDarksendQueue> vecQueues;
+            darkSendQueues.GetQueues(vecQueues);
+
+            // whether our coins match a denomination, the same for every queue announcing it
+            std::map<int, bool> mapDenomMatched;
+
             // Look through the queues and see if anything matches
-            BOOST_FOREACH(CDarksendQueue& dsq, vecDarksendQueue){
+            BOOST_FOREACH(CDarksendQueue& dsq, vecQueues){
                 CService addr;
-                if(dsq.time == 0) continue;
-
                 if(!dsq.GetAddress(addr)) continue;
                 if(dsq.IsExpired()) continue;
 
@@ -1535,10 +1573,15 @@ bool CDarksendPool::DoAutomaticDenominating(bool fDryRun)
                 }
                 if(fUsed) continue;
 
-                std::vector<CTxIn> vTempCoins;
-                std::vector<COutput> vTempCoins2;
-                // Try to match their denominations if possible
-                if (!pwalletMain->SelectCoinsByDenominations(dsq.nDenom, nValueMin, nBalanceNeedsAnonymized, vTempCoins, vTempCoins2, nValueIn, 0, nDarksendRounds)){
+                std::map<int, bool>::iterator itDenom = mapDenomMatched.find(dsq.nDenom);
+                if(itDenom == mapDenomMatched.end()){
+                    std::vector<CTxIn> vTempCoins;
+                    std::vector<COutput> vTempCoins2;
+                    // Try to match their denominations if possible
+                    bool fMatched = pwalletMain->SelectCoinsByDenominations(dsq.nDenom, nValueMin, nBalanceNeedsAnonymized, vTempCoins, vTempCoins2, nValueIn, 0, nDarksendRounds);
+                    itDenom = mapDenomMatched.insert(make_pair(dsq.nDenom, fMatched)).first;
+                }
+                if (!itDenom->second){
                     LogPrintf("DoAutomaticDenominating --- Couldn't match denominations %d\n", dsq.nDenom);
                     continue;
                 }
@@ -1563,12 +1606,12 @@ bool CDarksendPool::DoAutomaticDenominating(bool fDryRun)
                     pnode->PushMessage("dsa", sessionDenom, txCollateral);
                     LogPrintf("DoAutomaticDenominating --- connected (from queue), sending dsa for %d - %s\n", sessionDenom, pnode->addr.ToString());
                     strAutoDenomResult = _("Mixing in progress...");
-                    dsq.time = 0; //remove node
+                    darkSendQueues.Remove(dsq.vin);
                     return true;
                 } else {
                     LogPrintf("DoAutomaticDenominating --- error connecting \n");
                     strAutoDenomResult = _("Error connecting to Masternode.");
-                    dsq.time = 0; //remove node
+                    darkSendQueues.Remove(dsq.vin);
                     continue;
                 }
             }
@@ -1821,18 +1864,13 @@ bool CDarksendPool::CreateDenominated(int64_t nTotalValue)
 
 bool CDarksendPool::IsCompatibleWithEntries(std::vector<CTxOut>& vout)
 {
-    if(GetDenominations(vout) == 0) return false;
-
-    BOOST_FOREACH(const CDarkSendEntry v, entries) {
-        LogPrintf(" IsCompatibleWithEntries %d %d\n", GetDenominations(vout), GetDenominations(v.vout));
-/*
-        BOOST_FOREACH(CTxOut o1, vout)
-            LogPrintf(" vout 1 - %s\n", o1.ToString());
+    int nDenom = GetDenominations(vout);
+    if(nDenom == 0) return false;
 
-        BOOST_FOREACH(CTxOut o2, v.vout)
-            LogPrintf(" vout 2 - %s\n", o2.ToString());
-*/
-        if(GetDenominations(vout) != GetDenominations(v.vout)) return false;
+    // every entry must have the same denominations
+    BOOST_FOREACH(const PAIRTYPE(int, unsigned int)& item, mapEntryDenoms) {
+        LogPrintf(" IsCompatibleWithEntries %d %d (%u entries)\n", nDenom, item.first, item.second);
+        if(nDenom != item.first) return false;
     }
 
     return true;
@@ -2180,6 +2218,71 @@ bool CDarksendQueue::CheckSignature()
     return false;
 }
 
+void CDarksendQueueList::Erase(std::map<COutPoint, CDarksendQueue>::iterator it)
+{
+    std::multimap<int64_t, COutPoint>::iterator itTime = mapQueuesByTime.lower_bound(it->second.time);
+    while(itTime != mapQueuesByTime.end() && itTime->first == it->second.time){
+        if(itTime->second == it->first){
+            mapQueuesByTime.erase(itTime);
+            break;
+        }
+        ++itTime;
+    }
+    mapQueues.erase(it);
+}
+
+bool CDarksendQueueList::Has(const CTxIn& vin) const
+{
+    LOCK(cs);
+    return mapQueues.count(vin.prevout);
+}
+
+bool CDarksendQueueList::Add(const CDarksendQueue& dsq)
+{
+    LOCK(cs);
+    if(!mapQueues.insert(make_pair(dsq.vin.prevout, dsq)).second) return false;
+    mapQueuesByTime.insert(make_pair(dsq.time, dsq.vin.prevout));
+    return true;
+}
+
+void CDarksendQueueList::Remove(const CTxIn& vin)
+{
+    LOCK(cs);
+    std::map<COutPoint, CDarksendQueue>::iterator it = mapQueues.find(vin.prevout);
+    if(it != mapQueues.end()) Erase(it);
+}
+
+int CDarksendQueueList::RemoveExpired()
+{
+    LOCK(cs);
+    int nRemoved = 0;
+    // the oldest queues come first, stop at the first one still alive
+    while(!mapQueuesByTime.empty()){
+        std::map<COutPoint, CDarksendQueue>::iterator it = mapQueues.find(mapQueuesByTime.begin()->second);
+        if(!it->second.IsExpired()) break;
+        Erase(it);
+        nRemoved++;
+    }
+    return nRemoved;
+}
+
+int64_t CDarksendQueueList::GetNextExpiry() const
+{
+    LOCK(cs);
+    if(mapQueuesByTime.empty()) return 0;
+    // see CDarksendQueue::IsExpired()
+    return mapQueuesByTime.begin()->first + DARKSEND_QUEUE_TIMEOUT + 1;
+}
+
+void CDarksendQueueList::GetQueues(std::vector<CDarksendQueue>& vecQueuesRet) const
+{
+    LOCK(cs);
+    vecQueuesRet.clear();
+    vecQueuesRet.reserve(mapQueues.size());
+    for(std::multimap<int64_t, COutPoint>::const_iterator it = mapQueuesByTime.begin(); it != mapQueuesByTime.end(); ++it)
+        vecQueuesRet.push_back(mapQueues.find(it->second)->second);
+}
+
 
 void CDarksendPool::RelayFinalTransaction(const int sessionID, const CTransaction& txNew)
 {
@@ -2255,13 +2358,13 @@ void ThreadCheckDarkSendPool()
                 mnodeman.CheckAndRemove();
                 mnodeman.ProcessMasternodeConnections();
                 masternodePayments.CleanPaymentList();
-                CleanTransactionLocksList();
+                txLockManager.CleanTransactionLocksList();
             }
 
             //if(c % MASTERNODES_DUMP_SECONDS == 0) DumpMasternodes();
 
+            // returns right away unless a session timer ran out or something expired
             darkSendPool.CheckTimeout();
-            darkSendPool.CheckForCompleteQueue();
 
             if(darkSendPool.GetState() == POOL_STATUS_IDLE && c % 15 == 0){
                 darkSendPool.DoAutomaticDenominating();
@@ -12,6 +12,7 @@
 #include "masternode-payments.h"
 #include "darksend-relay.h"
 #include "masternode-sync.h"
+#include "script/interpreter.h"
 
 class CTxIn;
 class CDarksendPool;
@@ -19,6 +20,7 @@ class CDarkSendSigner;
 class CMasterNodeVote;
 class CBitcoinAddress;
 class CDarksendQueue;
+class CDarksendQueueList;
 class CDarksendBroadcastTx;
 class CActiveMasternode;
 
@@ -51,7 +53,7 @@ static const int64_t DARKSEND_POOL_MAX = (999.99*COIN);
 
 extern CDarksendPool darkSendPool;
 extern CDarkSendSigner darkSendSigner;
-extern std::vector<CDarksendQueue> vecDarksendQueue;
+extern CDarksendQueueList darkSendQueues;
 extern std::string strMasterNodePrivKey;
 extern map<uint256, CDarksendBroadcastTx> mapDarksendBroadcastTxes;
 extern CActiveMasternode activeMasternode;
@@ -151,6 +153,15 @@ public:
     }
 };
 
+/** Where an input of the pool's entries is, see CDarksendPool::IndexEntries()
+ */
+struct CDarkSendEntryInputPos
+{
+    unsigned int nEntry; // index into the entries
+    unsigned int nInput; // index into the entry's inputs
+    unsigned int nTxIn;  // index into the entries merged into one transaction
+};
+
 
 /**
  * A currently inprogress Darksend merge and denomination information
@@ -229,6 +240,36 @@ public:
 
 };
 
+/** The Darksend queues announced by Masternodes, at most one per Masternode.
+ *  Looked up by the Masternode's collateral outpoint and kept ordered by the
+ *  announced time, so expired queues are dropped from the front without a scan.
+ */
+class CDarksendQueueList
+{
+private:
+    mutable CCriticalSection cs;
+
+    // queues by Masternode collateral outpoint
+    std::map<COutPoint, CDarksendQueue> mapQueues;
+    // the same queues by announced time, oldest first
+    std::multimap<int64_t, COutPoint> mapQueuesByTime;
+
+    void Erase(std::map<COutPoint, CDarksendQueue>::iterator it);
+
+public:
+    /// Does this Masternode have a queue open?
+    bool Has(const CTxIn& vin) const;
+    /// Add a queue, unless the Masternode already has one
+    bool Add(const CDarksendQueue& dsq);
+    void Remove(const CTxIn& vin);
+    /// Drop expired queues, returns how many were dropped
+    int RemoveExpired();
+    /// Time (in seconds) the oldest queue expires, 0 if there are none
+    int64_t GetNextExpiry() const;
+    /// Get a copy of the queues, oldest first
+    void GetQueues(std::vector<CDarksendQueue>& vecQueuesRet) const;
+};
+
 /** Helper class to store Darksend transaction (tx) information.
  */
 class CDarksendBroadcastTx
@@ -263,6 +304,17 @@ private:
     mutable CCriticalSection cs_darksend;
 
     std::vector<CDarkSendEntry> entries; // Masternode/clients entries
+    // entry inputs by outpoint
+    std::map<COutPoint, CDarkSendEntryInputPos> mapEntryInputs;
+    // number of entries per denomination, all entries must share one
+    std::map<int, unsigned int> mapEntryDenoms;
+    // scriptSigs of all entry inputs, signed or not
+    std::multiset<CScript> setEntrySigs;
+    // number of entry inputs without a signature yet
+    unsigned int nEntrySigsMissing;
+    // the entries merged into one transaction, signatures are checked against it
+    CTransaction txEntries;
+    PrecomputedTransactionData txdataEntries;
     CMutableTransaction finalTransaction; // the finalized transaction ready for signing
 
     int64_t lastTimeChanged; // last time the 'state' changed, in UTC milliseconds
@@ -293,6 +345,11 @@ private:
     //debugging data
     std::string strAutoDenomResult;
 
+    /// Rebuild the entry indexes above after entries changed
+    void IndexEntries();
+    /// Has a session timer run out, or an entry or queue expired? See CheckTimeout()
+    bool IsTimeoutDue();
+
 public:
     enum messages {
         ERR_ALREADY_HAVE,
@@ -168,7 +168,7 @@ void CGovernanceManager::ProcessMessage(CNode* pfrom, std::string& strCommand, C
         uint256 nHash = govobj.GetHash();
         std::string strHash = nHash.ToString();
 
-        pfrom->setAskFor.erase(nHash);
+        pfrom->setAskFor.erase(CInv(MSG_GOVERNANCE_OBJECT, nHash));
 
         LogPrint("gobject", "MNGOVERNANCEOBJECT -- Received object: %s\n", strHash);
 
@@ -259,7 +259,7 @@ void CGovernanceManager::ProcessMessage(CNode* pfrom, std::string& strCommand, C
         uint256 nHash = vote.GetHash();
         std::string strHash = nHash.ToString();
 
-        pfrom->setAskFor.erase(nHash);
+        pfrom->setAskFor.erase(CInv(MSG_GOVERNANCE_OBJECT_VOTE, nHash));
 
         if(!AcceptVoteMessage(nHash)) {
             LogPrint("gobject", "MNGOVERNANCEOBJECTVOTE -- Received unrequested vote object: %s, hash: %s, peer = %d\n",
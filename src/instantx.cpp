@@ -17,12 +17,7 @@
 using namespace std;
 using namespace boost;
 
-std::map<uint256, CTransaction> mapTxLockReq;
-std::map<uint256, CTransaction> mapTxLockReqRejected;
-std::map<uint256, CConsensusVote> mapTxLockVote;
-std::map<uint256, CTransactionLock> mapTxLocks;
-std::map<COutPoint, uint256> mapLockedInputs;
-std::map<uint256, int64_t> mapUnknownVotes; //track votes with no tx for DOS
+CTxLockManager txLockManager;
 int nCompleteTXLocks;
 
 //txlock - Locks transaction
@@ -32,7 +27,7 @@ int nCompleteTXLocks;
 //         Send "txvote", CTransaction, Signature, Approve
 //step 3.) Top 1 masternode, waits for INSTANTX_SIGNATURES_REQUIRED messages. Upon success, sends "txlock'
 
-void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
+void CTxLockManager::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
 {
     if(fLiteMode) return; //disable all darksend/masternode related functionality
     if(!IsSporkActive(SPORK_2_INSTANTX)) return;
@@ -44,11 +39,12 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
         CDataStream vMsg(vRecv);
         CTransaction tx;
         vRecv >> tx;
+        uint256 txHash = tx.GetHash();
 
-        CInv inv(MSG_TXLOCK_REQUEST, tx.GetHash());
+        CInv inv(MSG_TXLOCK_REQUEST, txHash);
         pfrom->AddInventoryKnown(inv);
 
-        if(mapTxLockReq.count(tx.GetHash()) || mapTxLockReqRejected.count(tx.GetHash())){
+        if(HasLockRequest(txHash)){
             return;
         }
 
@@ -81,46 +77,52 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
 
             DoConsensusVote(tx, nBlockHeight);
 
-            mapTxLockReq.insert(make_pair(tx.GetHash(), tx));
+            AddLockRequest(tx);
 
             LogPrintf("ProcessMessageInstantX::ix - Transaction Lock Request: %s %s : accepted %s\n",
                 pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str(),
-                tx.GetHash().ToString().c_str()
+                txHash.ToString().c_str()
             );
 
             return;
 
         } else {
-            mapTxLockReqRejected.insert(make_pair(tx.GetHash(), tx));
+            bool fReprocess = false;
+            {
+                LOCK(cs);
+                mapTxLockReqRejected.insert(make_pair(txHash, tx));
+                ScheduleExpiry(txHash, GetTime() + INSTANTX_LOCK_EXPIRATION_SECONDS);
 
-            // can we get the conflicting transaction as proof?
+                // can we get the conflicting transaction as proof?
 
-            LogPrintf("ProcessMessageInstantX::ix - Transaction Lock Request: %s %s : rejected %s\n",
-                pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str(),
-                tx.GetHash().ToString().c_str()
-            );
+                LogPrintf("ProcessMessageInstantX::ix - Transaction Lock Request: %s %s : rejected %s\n",
+                    pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str(),
+                    txHash.ToString().c_str()
+                );
 
-            BOOST_FOREACH(const CTxIn& in, tx.vin){
-                if(!mapLockedInputs.count(in.prevout)){
-                    mapLockedInputs.insert(make_pair(in.prevout, tx.GetHash()));
+                BOOST_FOREACH(const CTxIn& in, tx.vin){
+                    mempool.addLockedInput(in.prevout, txHash);
                 }
-            }
 
-            // resolve conflicts
-            std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(tx.GetHash());
-            if (i != mapTxLocks.end()){
-                //we only care if we have a complete tx lock
-                if((*i).second.CountSignatures() >= INSTANTX_SIGNATURES_REQUIRED){
-                    if(!CheckForConflictingLocks(tx)){
-                        LogPrintf("ProcessMessageInstantX::ix - Found Existing Complete IX Lock\n");
-
-                        //reprocess the last 15 blocks
-                        ReprocessBlocks(15);
-                        mapTxLockReq.insert(make_pair(tx.GetHash(), tx));
+                // resolve conflicts
+                std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(txHash);
+                if (i != mapTxLocks.end()){
+                    //we only care if we have a complete tx lock
+                    if((*i).second.CountSignatures() >= INSTANTX_SIGNATURES_REQUIRED){
+                        if(!CheckForConflictingLocks(tx)){
+                            LogPrintf("ProcessMessageInstantX::ix - Found Existing Complete IX Lock\n");
+
+                            mapTxLockReq.insert(make_pair(txHash, tx));
+                            fReprocess = true;
+                            NotifyTransactionLock(tx);
+                        }
                     }
                 }
             }
 
+            // drop whatever spends its inputs instead
+            if(fReprocess) ProcessTransactionLock(tx, INSTANTX_CONFLICT_SEARCH_BLOCKS);
+
             return;
         }
     }
@@ -132,13 +134,17 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
         CInv inv(MSG_TXLOCK_VOTE, ctx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        if(mapTxLockVote.count(ctx.GetHash())){
+        if(!AddVote(ctx)){
+            return;
+        }
+
+        if(!ProcessConsensusVote(pfrom, ctx)){
             return;
         }
 
-        mapTxLockVote.insert(make_pair(ctx.GetHash(), ctx));
+        {
+            LOCK(cs);
 
-        if(ProcessConsensusVote(pfrom, ctx)){
             //Spam/Dos protection
             /*
                 Masternodes will sometimes propagate votes before the transaction is known to the client.
@@ -161,9 +167,10 @@ void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream&
                     mapUnknownVotes[ctx.vinMasternode.prevout.hash] = GetTime()+(60*10);
                 }
             }
-            RelayInv(inv);
         }
 
+        RelayInv(inv);
+
         return;
     }
 }
@@ -214,7 +221,7 @@ bool IsIXTXValid(const CTransaction& txCollateral){
     return true;
 }
 
-int64_t CreateNewLock(CTransaction tx)
+int64_t CTxLockManager::CreateNewLock(const CTransaction& tx)
 {
 
     int64_t nTxAge = 0;
@@ -233,42 +240,84 @@ int64_t CreateNewLock(CTransaction tx)
         they'll use.
     */
     int nBlockHeight = (chainActive.Tip()->nHeight - nTxAge)+4;
+    uint256 txHash = tx.GetHash();
 
-    if (!mapTxLocks.count(tx.GetHash())){
-        LogPrintf("CreateNewLock - New Transaction Lock %s !\n", tx.GetHash().ToString().c_str());
+    LOCK(cs);
 
-        CTransactionLock newLock;
-        newLock.nBlockHeight = nBlockHeight;
-        newLock.nExpiration = GetTime()+(60*60); //locks expire after 60 minutes (24 confirmations)
-        newLock.nTimeout = GetTime()+(60*5);
-        newLock.txHash = tx.GetHash();
-        mapTxLocks.insert(make_pair(tx.GetHash(), newLock));
+    if (!mapTxLocks.count(txHash)){
+        LogPrintf("CreateNewLock - New Transaction Lock %s !\n", txHash.ToString().c_str());
     } else {
-        mapTxLocks[tx.GetHash()].nBlockHeight = nBlockHeight;
-        LogPrint("instantx", "CreateNewLock - Transaction Lock Exists %s !\n", tx.GetHash().ToString().c_str());
+        LogPrint("instantx", "CreateNewLock - Transaction Lock Exists %s !\n", txHash.ToString().c_str());
     }
 
-
+    GetOrCreateLock(txHash).SetBlockHeight(nBlockHeight);
 
     return nBlockHeight;
 }
 
+void CTxLockManager::AddLockRequest(const CTransaction& tx)
+{
+    LOCK(cs);
+
+    uint256 txHash = tx.GetHash();
+    if(mapTxLockReq.insert(make_pair(txHash, tx)).second)
+        ScheduleExpiry(txHash, GetTime() + INSTANTX_LOCK_EXPIRATION_SECONDS);
+}
+
+bool CTxLockManager::AddVote(const CConsensusVote& ctx)
+{
+    LOCK(cs);
+
+    uint256 voteHash = ctx.GetHash();
+    if(!mapTxLockVote.insert(make_pair(voteHash, ctx)).second)
+        return false;
+
+    std::set<uint256>& setVotes = mapTxLockVotesByTx[ctx.txHash];
+    if(setVotes.empty())
+        ScheduleExpiry(ctx.txHash, GetTime() + INSTANTX_LOCK_EXPIRATION_SECONDS);
+    setVotes.insert(voteHash);
+
+    return true;
+}
+
+void CTxLockManager::ScheduleExpiry(const uint256& txHash, int64_t nTime)
+{
+    mapExpiry[nTime].insert(txHash);
+}
+
+void CTxLockManager::SetExpiration(CTransactionLock& txLock, int64_t nTime)
+{
+    txLock.nExpiration = nTime;
+    ScheduleExpiry(txLock.txHash, nTime);
+}
+
+CTransactionLock& CTxLockManager::GetOrCreateLock(const uint256& txHash)
+{
+    std::map<uint256, CTransactionLock>::iterator it = mapTxLocks.find(txHash);
+    if(it != mapTxLocks.end())
+        return it->second;
+
+    CTransactionLock& txLock = mapTxLocks[txHash];
+    txLock.txHash = txHash;
+    txLock.nTimeout = GetTime() + INSTANTX_LOCK_TIMEOUT_SECONDS;
+    SetExpiration(txLock, GetTime() + INSTANTX_LOCK_EXPIRATION_SECONDS); //locks expire after 60 minutes (24 confirmations)
+    return txLock;
+}
+
 // check if we need to vote on this transaction
-void DoConsensusVote(CTransaction& tx, int64_t nBlockHeight)
+void CTxLockManager::DoConsensusVote(const CTransaction& tx, int64_t nBlockHeight)
 {
     if(!fMasterNode) return;
 
-    int n = mnodeman.GetMasternodeRank(activeMasternode.vin, nBlockHeight, MIN_INSTANTX_PROTO_VERSION);
+    int n = GetQuorumRank(activeMasternode.vin, nBlockHeight);
 
     if(n == -1)
     {
-        LogPrint("instantx", "InstantX::DoConsensusVote - Unknown Masternode\n");
-        return;
-    }
-
-    if(n > INSTANTX_SIGNATURES_TOTAL)
-    {
-        LogPrint("instantx", "InstantX::DoConsensusVote - Masternode not in the top %d (%d)\n", INSTANTX_SIGNATURES_TOTAL, n);
+        if(mnodeman.Find(activeMasternode.vin) == NULL) {
+            LogPrint("instantx", "InstantX::DoConsensusVote - Unknown Masternode\n");
+        } else {
+            LogPrint("instantx", "InstantX::DoConsensusVote - Masternode not in the top %d\n", INSTANTX_SIGNATURES_TOTAL);
+        }
         return;
     }
     /*
@@ -290,16 +339,16 @@ void DoConsensusVote(CTransaction& tx, int64_t nBlockHeight)
         return;
     }
 
-    mapTxLockVote[ctx.GetHash()] = ctx;
+    AddVote(ctx);
 
     CInv inv(MSG_TXLOCK_VOTE, ctx.GetHash());
     RelayInv(inv);
 }
 
 //received a consensus vote
-bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
+bool CTxLockManager::ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
 {
-    int n = mnodeman.GetMasternodeRank(ctx.vinMasternode, ctx.nBlockHeight, MIN_INSTANTX_PROTO_VERSION);
+    int n = GetQuorumRank(ctx.vinMasternode, ctx.nBlockHeight);
 
     CMasternode* pmn = mnodeman.Find(ctx.vinMasternode);
     if(pmn != NULL)
@@ -307,18 +356,17 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
 
     if(n == -1)
     {
-        //can be caused by past versions trying to vote with an invalid protocol
-        LogPrint("instantx", "InstantX::ProcessConsensusVote - Unknown Masternode\n");
-        mnodeman.AskForMN(pnode, ctx.vinMasternode);
-        return false;
-    }
-
-    if(n > INSTANTX_SIGNATURES_TOTAL)
-    {
-        LogPrint("instantx", "InstantX::ProcessConsensusVote - Masternode not in the top %d (%d) - %s\n", INSTANTX_SIGNATURES_TOTAL, n, ctx.GetHash().ToString().c_str());
+        if(pmn == NULL) {
+            //can be caused by past versions trying to vote with an invalid protocol
+            LogPrint("instantx", "InstantX::ProcessConsensusVote - Unknown Masternode\n");
+            mnodeman.AskForMN(pnode, ctx.vinMasternode);
+        } else {
+            LogPrint("instantx", "InstantX::ProcessConsensusVote - Masternode not in the top %d - %s\n", INSTANTX_SIGNATURES_TOTAL, ctx.GetHash().ToString().c_str());
+        }
         return false;
     }
 
+    // checked without holding cs, this is the expensive part
     if(!ctx.SignatureValid()) {
         LogPrintf("InstantX::ProcessConsensusVote - Signature invalid\n");
         // don't ban, it could just be a non-synced masternode
@@ -326,72 +374,114 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
         return false;
     }
 
-    if (!mapTxLocks.count(ctx.txHash)){
-        LogPrintf("InstantX::ProcessConsensusVote - New Transaction Lock %s !\n", ctx.txHash.ToString().c_str());
+    bool fComplete = false;
+    bool fNewLock = false;
+    bool fReprocess = false;
+    CTransaction tx;
+    {
+        LOCK(cs);
 
-        CTransactionLock newLock;
-        newLock.nBlockHeight = 0;
-        newLock.nExpiration = GetTime()+(60*60);
-        newLock.nTimeout = GetTime()+(60*5);
-        newLock.txHash = ctx.txHash;
-        mapTxLocks.insert(make_pair(ctx.txHash, newLock));
-    } else
-        LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Exists %s !\n", ctx.txHash.ToString().c_str());
+        if (!mapTxLocks.count(ctx.txHash)){
+            LogPrintf("InstantX::ProcessConsensusVote - New Transaction Lock %s !\n", ctx.txHash.ToString().c_str());
+        } else
+            LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Exists %s !\n", ctx.txHash.ToString().c_str());
 
-    //compile consessus vote
-    std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(ctx.txHash);
-    if (i != mapTxLocks.end()){
-        (*i).second.AddSignature(ctx);
+        //compile consessus vote
+        CTransactionLock& txLock = GetOrCreateLock(ctx.txHash);
+        bool fWasComplete = txLock.CountSignatures() >= INSTANTX_SIGNATURES_REQUIRED;
+        txLock.AddSignature(ctx);
 
-#ifdef ENABLE_WALLET
-        if(pwalletMain){
-            //when we get back signatures, we'll count them as requests. Otherwise the client will think it didn't propagate.
-            if(pwalletMain->mapRequestCount.count(ctx.txHash))
-                pwalletMain->mapRequestCount[ctx.txHash]++;
-        }
-#endif
+        LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Votes %d - %s !\n", txLock.CountSignatures(), ctx.GetHash().ToString().c_str());
 
-        LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Votes %d - %s !\n", (*i).second.CountSignatures(), ctx.GetHash().ToString().c_str());
+        if(txLock.CountSignatures() >= INSTANTX_SIGNATURES_REQUIRED){
+            LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Is Complete %s !\n", txLock.GetHash().ToString().c_str());
 
-        if((*i).second.CountSignatures() >= INSTANTX_SIGNATURES_REQUIRED){
-            LogPrint("instantx", "InstantX::ProcessConsensusVote - Transaction Lock Is Complete %s !\n", (*i).second.GetHash().ToString().c_str());
+            std::map<uint256, CTransaction>::iterator itReq = mapTxLockReq.find(ctx.txHash);
+            if(itReq != mapTxLockReq.end()) {
+                tx = itReq->second;
+            } else {
+                itReq = mapTxLockReqRejected.find(ctx.txHash);
+                if(itReq != mapTxLockReqRejected.end()) tx = itReq->second;
+            }
 
-            CTransaction& tx = mapTxLockReq[ctx.txHash];
             if(!CheckForConflictingLocks(tx)){
+                fComplete = true;
+                fNewLock = !fWasComplete && tx.GetHash() == ctx.txHash;
 
-#ifdef ENABLE_WALLET
-                if(pwalletMain){
-                    if(pwalletMain->UpdatedTransaction((*i).second.txHash)){
-                        nCompleteTXLocks++;
-                    }
-                }
-#endif
-
-                if(mapTxLockReq.count(ctx.txHash)){
-                    BOOST_FOREACH(const CTxIn& in, tx.vin){
-                        if(!mapLockedInputs.count(in.prevout)){
-                            mapLockedInputs.insert(make_pair(in.prevout, ctx.txHash));
-                        }
-                    }
+                BOOST_FOREACH(const CTxIn& in, tx.vin){
+                    mempool.addLockedInput(in.prevout, ctx.txHash);
                 }
 
                 // resolve conflicts
 
-                //if this tx lock was rejected, we need to remove the conflicting blocks
-                if(mapTxLockReqRejected.count((*i).second.txHash)){
-                    //reprocess the last 15 blocks
-                    ReprocessBlocks(15);
-                }
+                //if this tx lock was rejected, we need to remove the conflicting transactions and blocks
+                fReprocess = mapTxLockReqRejected.count(ctx.txHash);
             }
         }
-        return true;
     }
 
+#ifdef ENABLE_WALLET
+    if(pwalletMain){
+        LOCK(pwalletMain->cs_wallet);
+        //when we get back signatures, we'll count them as requests. Otherwise the client will think it didn't propagate.
+        if(pwalletMain->mapRequestCount.count(ctx.txHash))
+            pwalletMain->mapRequestCount[ctx.txHash]++;
+    }
+
+    if(fComplete && pwalletMain){
+        if(pwalletMain->UpdatedTransaction(ctx.txHash)){
+            nCompleteTXLocks++;
+        }
+    }
+#endif
+
+    if(fNewLock){
+        NotifyTransactionLock(tx);
+    }
+
+    if(fReprocess){
+        ProcessTransactionLock(tx, INSTANTX_CONFLICT_SEARCH_BLOCKS);
+    }
+
+    return true;
+}
+
+int CTxLockManager::GetQuorumRank(const CTxIn& vin, int nBlockHeight)
+{
+    int64_t nNow = GetTime();
+
+    {
+        LOCK(cs);
+        std::map<int, CInstantXQuorum>::iterator it = mapQuorums.find(nBlockHeight);
+        if(it != mapQuorums.end()) {
+            CInstantXQuorum& quorum = it->second;
+            quorum.nTimeUsed = nNow;
+            for(unsigned int i = 0; i < quorum.vecMembers.size(); i++)
+                if(quorum.vecMembers[i].prevout == vin.prevout) return i + 1;
+
+            // a masternode may just have made it in, but don't rank the list again for every vote from outside
+            if(nNow - quorum.nTimeBuilt < INSTANTX_QUORUM_REFRESH_SECONDS) return -1;
+        }
+    }
+
+    // same ranking as GetMasternodeRank, done once for the height instead of once per vote
+    std::vector<pair<int, CMasternode> > vecMasternodeRanks = mnodeman.GetMasternodeRanks(nBlockHeight, MIN_INSTANTX_PROTO_VERSION);
+
+    CInstantXQuorum quorum;
+    for(unsigned int i = 0; i < vecMasternodeRanks.size() && i < INSTANTX_SIGNATURES_TOTAL; i++)
+        quorum.vecMembers.push_back(vecMasternodeRanks[i].second.vin);
+    quorum.nTimeBuilt = nNow;
+    quorum.nTimeUsed = nNow;
+
+    LOCK(cs);
+    mapQuorums[nBlockHeight] = quorum;
+    for(unsigned int i = 0; i < quorum.vecMembers.size(); i++)
+        if(quorum.vecMembers[i].prevout == vin.prevout) return i + 1;
 
-    return false;
+    return -1;
 }
 
-bool CheckForConflictingLocks(CTransaction& tx)
+bool CTxLockManager::CheckForConflictingLocks(const CTransaction& tx)
 {
     /*
         It's possible (very unlikely though) to get 2 conflicting transaction locks approved by the network.
@@ -400,21 +490,25 @@ bool CheckForConflictingLocks(CTransaction& tx)
         Blocks could have been rejected during this time, which is OK. After they cancel out, the client will
         rescan the blocks and find they're acceptable and then take the chain with the most work.
     */
-    BOOST_FOREACH(const CTxIn& in, tx.vin){
-        if(mapLockedInputs.count(in.prevout)){
-            if(mapLockedInputs[in.prevout] != tx.GetHash()){
-                LogPrintf("InstantX::CheckForConflictingLocks - found two complete conflicting locks - removing both. %s %s", tx.GetHash().ToString().c_str(), mapLockedInputs[in.prevout].ToString().c_str());
-                if(mapTxLocks.count(tx.GetHash())) mapTxLocks[tx.GetHash()].nExpiration = GetTime();
-                if(mapTxLocks.count(mapLockedInputs[in.prevout])) mapTxLocks[mapLockedInputs[in.prevout]].nExpiration = GetTime();
-                return true;
-            }
+    uint256 txHash = tx.GetHash();
+    uint256 hashConflict;
+    if(!mempool.findLockConflict(tx, hashConflict))
+        return false;
+
+    LogPrintf("InstantX::CheckForConflictingLocks - found two complete conflicting locks - removing both. %s %s", txHash.ToString().c_str(), hashConflict.ToString().c_str());
+    uint256 hashes[] = {txHash, hashConflict};
+    for(unsigned int n = 0; n < 2; n++) {
+        std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(hashes[n]);
+        if(i != mapTxLocks.end()) {
+            i->second.fCancelled = true;
+            SetExpiration(i->second, GetTime());
         }
     }
 
-    return false;
+    return true;
 }
 
-int64_t GetAverageVoteTime()
+int64_t CTxLockManager::GetAverageVoteTime()
 {
     std::map<uint256, int64_t>::iterator it = mapUnknownVotes.begin();
     int64_t total = 0;
@@ -426,38 +520,125 @@ int64_t GetAverageVoteTime()
         it++;
     }
 
+    if(count == 0) return 0;
+
     return total / count;
 }
 
-void CleanTransactionLocksList()
+void CTxLockManager::CleanTransactionLocksList()
 {
     if(chainActive.Tip() == NULL) return;
 
-    std::map<uint256, CTransactionLock>::iterator it = mapTxLocks.begin();
-
-    while(it != mapTxLocks.end()) {
-        if(GetTime() > it->second.nExpiration){ //keep them for an hour
-            LogPrintf("Removing old transaction lock %s\n", it->second.txHash.ToString().c_str());
-
-            if(mapTxLockReq.count(it->second.txHash)){
-                CTransaction& tx = mapTxLockReq[it->second.txHash];
+    int64_t nNow = GetTime();
+    bool fReconsider = false;
 
-                BOOST_FOREACH(const CTxIn& in, tx.vin)
-                    mapLockedInputs.erase(in.prevout);
+    {
+    LOCK(cs);
+
+    // only look at what is due, the rest of the maps can be as large as they like
+    while(!mapExpiry.empty() && mapExpiry.begin()->first < nNow) {
+        std::set<uint256> setDue;
+        setDue.swap(mapExpiry.begin()->second);
+        mapExpiry.erase(mapExpiry.begin());
+
+        BOOST_FOREACH(const uint256& txHash, setDue) {
+            std::map<uint256, CTransactionLock>::iterator it = mapTxLocks.find(txHash);
+            if(it != mapTxLocks.end()) {
+                // the lock was created (or cancelled) later, it has its own entry then
+                if(it->second.nExpiration >= nNow) continue;
+
+                LogPrintf("Removing old transaction lock %s\n", txHash.ToString().c_str());
+                fReconsider |= it->second.fCancelled;
+                mapTxLocks.erase(it);
+            }
 
-                mapTxLockReq.erase(it->second.txHash);
-                mapTxLockReqRejected.erase(it->second.txHash);
+            std::map<uint256, CTransaction>* maps[] = {&mapTxLockReq, &mapTxLockReqRejected};
+            for(unsigned int i = 0; i < 2; i++) {
+                std::map<uint256, CTransaction>* pmap = maps[i];
+                std::map<uint256, CTransaction>::iterator itReq = pmap->find(txHash);
+                if(itReq == pmap->end()) continue;
+                BOOST_FOREACH(const CTxIn& in, itReq->second.vin)
+                    mempool.removeLockedInput(in.prevout, txHash);
+                pmap->erase(itReq);
+            }
 
-                BOOST_FOREACH(CConsensusVote& v, it->second.vecConsensusVotes)
-                    mapTxLockVote.erase(v.GetHash());
+            std::map<uint256, std::set<uint256> >::iterator itVotes = mapTxLockVotesByTx.find(txHash);
+            if(itVotes != mapTxLockVotesByTx.end()) {
+                BOOST_FOREACH(const uint256& voteHash, itVotes->second)
+                    mapTxLockVote.erase(voteHash);
+                mapTxLockVotesByTx.erase(itVotes);
             }
+        }
+    }
 
-            mapTxLocks.erase(it++);
+    std::map<uint256, int64_t>::iterator itUnknown = mapUnknownVotes.begin();
+    while(itUnknown != mapUnknownVotes.end()) {
+        if(itUnknown->second < nNow) {
+            mapUnknownVotes.erase(itUnknown++);
         } else {
-            it++;
+            ++itUnknown;
         }
     }
 
+    std::map<int, CInstantXQuorum>::iterator itQuorum = mapQuorums.begin();
+    while(itQuorum != mapQuorums.end()) {
+        if(itQuorum->second.nTimeUsed < nNow - INSTANTX_LOCK_EXPIRATION_SECONDS) {
+            mapQuorums.erase(itQuorum++);
+        } else {
+            ++itQuorum;
+        }
+    }
+    }
+
+    // conflicting locks cancel each other out, blocks rejected because of them may be fine now
+    if(fReconsider)
+        ReconsiderRejectedBlocks(INSTANTX_CONFLICT_SEARCH_BLOCKS);
+}
+
+bool CTxLockManager::HasLockRequest(const uint256& txHash) const
+{
+    LOCK(cs);
+    return mapTxLockReq.count(txHash) || mapTxLockReqRejected.count(txHash);
+}
+
+bool CTxLockManager::GetLockRequest(const uint256& txHash, CTransaction& txRet) const
+{
+    LOCK(cs);
+    std::map<uint256, CTransaction>::const_iterator it = mapTxLockReq.find(txHash);
+    if(it == mapTxLockReq.end()) return false;
+    txRet = it->second;
+    return true;
+}
+
+bool CTxLockManager::HasVote(const uint256& voteHash) const
+{
+    LOCK(cs);
+    return mapTxLockVote.count(voteHash);
+}
+
+bool CTxLockManager::GetVote(const uint256& voteHash, CConsensusVote& voteRet) const
+{
+    LOCK(cs);
+    std::map<uint256, CConsensusVote>::const_iterator it = mapTxLockVote.find(voteHash);
+    if(it == mapTxLockVote.end()) return false;
+    voteRet = it->second;
+    return true;
+}
+
+int CTxLockManager::GetSignatures(const uint256& txHash) const
+{
+    LOCK(cs);
+    std::map<uint256, CTransactionLock>::const_iterator it = mapTxLocks.find(txHash);
+    if(it == mapTxLocks.end()) return -1;
+    return it->second.CountSignatures();
+}
+
+bool CTxLockManager::IsLockTimedOut(const uint256& txHash) const
+{
+    LOCK(cs);
+    std::map<uint256, CTransactionLock>::const_iterator it = mapTxLocks.find(txHash);
+    if(it == mapTxLocks.end()) return false;
+    return GetTime() > it->second.nTimeout;
 }
 
 uint256 CConsensusVote::GetHash() const
@@ -518,40 +699,44 @@ bool CConsensusVote::Sign()
 }
 
 
-bool CTransactionLock::SignaturesValid()
+bool CTransactionLock::SignaturesValid() const
 {
-
-    BOOST_FOREACH(CConsensusVote vote, vecConsensusVotes)
+    // votes are only added once their signature checked out, so all that can
+    // have changed since is who is in the quorum
+    BOOST_FOREACH(const CConsensusVote& vote, vecConsensusVotes)
     {
-        int n = mnodeman.GetMasternodeRank(vote.vinMasternode, vote.nBlockHeight, MIN_INSTANTX_PROTO_VERSION);
-
-        if(n == -1)
+        if(txLockManager.GetQuorumRank(vote.vinMasternode, vote.nBlockHeight) == -1)
         {
-            LogPrintf("CTransactionLock::SignaturesValid() - Unknown Masternode\n");
+            LogPrintf("CTransactionLock::SignaturesValid() - Masternode not in the top %d\n", INSTANTX_SIGNATURES_TOTAL);
             return false;
         }
+    }
 
-        if(n > INSTANTX_SIGNATURES_TOTAL)
-        {
-            LogPrintf("CTransactionLock::SignaturesValid() - Masternode not in the top %s\n", INSTANTX_SIGNATURES_TOTAL);
-            return false;
-        }
+    return true;
+}
 
-        if(!vote.SignatureValid()){
-            LogPrintf("CTransactionLock::SignaturesValid() - Signature not valid\n");
-            return false;
+void CTransactionLock::SetBlockHeight(int nBlockHeightIn)
+{
+    if(nBlockHeightIn == nBlockHeight) return;
+
+    nBlockHeight = nBlockHeightIn;
+    nSignatures = 0;
+    BOOST_FOREACH(const CConsensusVote& v, vecConsensusVotes){
+        if(v.nBlockHeight == nBlockHeight){
+            nSignatures++;
         }
     }
-
-    return true;
 }
 
-void CTransactionLock::AddSignature(CConsensusVote& cv)
+void CTransactionLock::AddSignature(const CConsensusVote& cv)
 {
     vecConsensusVotes.push_back(cv);
+    if(cv.nBlockHeight == nBlockHeight){
+        nSignatures++;
+    }
 }
 
-int CTransactionLock::CountSignatures()
+int CTransactionLock::CountSignatures() const
 {
     /*
         Only count signatures where the BlockHeight matches the transaction's blockheight.
@@ -560,11 +745,5 @@ int CTransactionLock::CountSignatures()
 
     if(nBlockHeight == 0) return -1;
 
-    int n = 0;
-    BOOST_FOREACH(CConsensusVote v, vecConsensusVotes){
-        if(v.nBlockHeight == nBlockHeight){
-            n++;
-        }
-    }
-    return n;
+    return nSignatures;
 }
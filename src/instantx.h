@@ -24,6 +24,10 @@
 */
 #define INSTANTX_SIGNATURES_REQUIRED           6
 #define INSTANTX_SIGNATURES_TOTAL              10
+#define INSTANTX_LOCK_EXPIRATION_SECONDS       (60*60)
+#define INSTANTX_LOCK_TIMEOUT_SECONDS          (60*5)
+#define INSTANTX_QUORUM_REFRESH_SECONDS        5
+#define INSTANTX_CONFLICT_SEARCH_BLOCKS        15
 
 using namespace std;
 using namespace boost;
@@ -31,37 +35,15 @@ using namespace boost;
 class CConsensusVote;
 class CTransaction;
 class CTransactionLock;
+class CTxLockManager;
 
 static const int MIN_INSTANTX_PROTO_VERSION = 70103;
 
-extern map<uint256, CTransaction> mapTxLockReq;
-extern map<uint256, CTransaction> mapTxLockReqRejected;
-extern map<uint256, CConsensusVote> mapTxLockVote;
-extern map<uint256, CTransactionLock> mapTxLocks;
-extern std::map<COutPoint, uint256> mapLockedInputs;
+extern CTxLockManager txLockManager;
 extern int nCompleteTXLocks;
 
-
-int64_t CreateNewLock(CTransaction tx);
-
 bool IsIXTXValid(const CTransaction& txCollateral);
 
-// if two conflicting locks are approved by the network, they will cancel out
-bool CheckForConflictingLocks(CTransaction& tx);
-
-void ProcessMessageInstantX(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
-
-//check if we need to vote on this transaction
-void DoConsensusVote(CTransaction& tx, int64_t nBlockHeight);
-
-//process consensus vote message
-bool ProcessConsensusVote(CNode *pnode, CConsensusVote& ctx);
-
-// keep transaction locks in memory for an hour
-void CleanTransactionLocksList();
-
-int64_t GetAverageVoteTime();
-
 class CConsensusVote
 {
 public:
@@ -88,22 +70,103 @@ public:
 
 class CTransactionLock
 {
-public:
+private:
     int nBlockHeight;
+    // votes for nBlockHeight, kept up to date as votes come in
+    int nSignatures;
+
+public:
     uint256 txHash;
     std::vector<CConsensusVote> vecConsensusVotes;
-    int nExpiration;
-    int nTimeout;
+    int64_t nExpiration;
+    int64_t nTimeout;
+    // expired early because of a conflicting lock
+    bool fCancelled;
 
-    bool SignaturesValid();
-    int CountSignatures();
-    void AddSignature(CConsensusVote& cv);
+    CTransactionLock() : nBlockHeight(0), nSignatures(0), txHash(0), nExpiration(0), nTimeout(0), fCancelled(false) {}
 
-    uint256 GetHash()
+    int GetBlockHeight() const { return nBlockHeight; }
+    void SetBlockHeight(int nBlockHeightIn);
+
+    bool SignaturesValid() const;
+    int CountSignatures() const;
+    // the vote's signature must have been checked already
+    void AddSignature(const CConsensusVote& cv);
+
+    uint256 GetHash() const
     {
         return txHash;
     }
 };
 
+/** The top INSTANTX_SIGNATURES_TOTAL masternodes allowed to vote on locks at a height */
+struct CInstantXQuorum
+{
+    std::vector<CTxIn> vecMembers;
+    int64_t nTimeBuilt;
+    int64_t nTimeUsed;
+
+    CInstantXQuorum() : nTimeBuilt(0), nTimeUsed(0) {}
+};
+
+/** Keeps track of transaction lock requests, votes and the locks they make up
+ */
+class CTxLockManager
+{
+private:
+    // critical section to protect everything below; cs_main and the wallet lock are
+    // never taken while holding it
+    mutable CCriticalSection cs;
+
+    std::map<uint256, CTransaction> mapTxLockReq;
+    std::map<uint256, CTransaction> mapTxLockReqRejected;
+    std::map<uint256, CConsensusVote> mapTxLockVote;
+    // hashes of the votes seen for each transaction, whether or not they made it into a lock
+    std::map<uint256, std::set<uint256> > mapTxLockVotesByTx;
+    std::map<uint256, CTransactionLock> mapTxLocks;
+    // track votes with no tx for DOS
+    std::map<uint256, int64_t> mapUnknownVotes;
+    // transactions to forget about, by the time they are due
+    std::map<int64_t, std::set<uint256> > mapExpiry;
+    // who may vote at which height, see GetQuorumRank
+    std::map<int, CInstantXQuorum> mapQuorums;
+
+    void ScheduleExpiry(const uint256& txHash, int64_t nTime);
+    void SetExpiration(CTransactionLock& txLock, int64_t nTime);
+    CTransactionLock& GetOrCreateLock(const uint256& txHash);
+    bool AddVote(const CConsensusVote& ctx);
+    // if two conflicting locks are approved by the network, they will cancel out
+    bool CheckForConflictingLocks(const CTransaction& tx);
+    int64_t GetAverageVoteTime();
+
+public:
+    void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
+
+    /// Start (or update) the lock for a transaction, returns the height its votes are for, or 0
+    int64_t CreateNewLock(const CTransaction& tx);
+    /// Remember a lock request we're sending ourselves
+    void AddLockRequest(const CTransaction& tx);
+
+    /// Check if we need to vote on this transaction
+    void DoConsensusVote(const CTransaction& tx, int64_t nBlockHeight);
+    /// Process a consensus vote message
+    bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx);
+
+    /// Rank (1 = top) of a masternode among those allowed to vote at this height, -1 if not one of them
+    int GetQuorumRank(const CTxIn& vin, int nBlockHeight);
+
+    /// Forget locks, requests and votes older than INSTANTX_LOCK_EXPIRATION_SECONDS
+    void CleanTransactionLocksList();
+
+    bool HasLockRequest(const uint256& txHash) const;
+    bool GetLockRequest(const uint256& txHash, CTransaction& txRet) const;
+    bool HasVote(const uint256& voteHash) const;
+    bool GetVote(const uint256& voteHash, CConsensusVote& voteRet) const;
+
+    /// Number of valid votes for the transaction's lock, -1 if there is none (yet)
+    int GetSignatures(const uint256& txHash) const;
+    bool IsLockTimedOut(const uint256& txHash) const;
+};
+
 
 #endif
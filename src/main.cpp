@@ -8,9 +8,11 @@
 
 #include "addrman.h"
 #include "alert.h"
+#include "blockfilemap.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "crypto/common.h"
 #include "init.h"
 #include "instantx.h"
 #include "darksend.h"
@@ -19,6 +21,7 @@
 #include "masternode-budget.h"
 #include "merkleblock.h"
 #include "net.h"
+#include "notificationqueue.h"
 #include "pow.h"
 #include "txdb.h"
 #include "txmempool.h"
@@ -60,7 +63,7 @@ bool fReindex = false;
 bool fTxIndex = true;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
 
 /** Fees smaller than this (in duffs) are considered zero fee (for relaying and mining)
@@ -83,6 +86,7 @@ map<uint256, int64_t> mapRejectedBlocks;
 void EraseOrphansFor(NodeId peer);
 
 static void CheckBlockIndex();
+static void PruneBlockIndexCandidates();
 
 /** Constant stuff for coinbase transactions we create: */
 CScript COINBASE_FLAGS;
@@ -115,6 +119,15 @@ namespace {
 
     CBlockIndex *pindexBestInvalid;
 
+    /**
+     * Block a chainstate loaded by loadtxoutset starts at. It and its ancestors
+     * have no block or undo data, so the active chain can't be rewound past it.
+     */
+    CBlockIndex *pindexSnapshotBase;
+
+    /** Set while LoadTxOutSet replaces the coin database; blocks are neither connected nor flushed meanwhile. */
+    bool fLoadingSnapshot = false;
+
     /**
      * The set of all CBlockIndex entries with BLOCK_VALID_TRANSACTIONS (for itself and all ancestors) and
      * as good as our current tip or better. Entries may be failed, though.
@@ -178,6 +191,10 @@ namespace {
 struct CMainSignals {
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
     boost::signals2::signal<void (const CTransaction &, const CBlock *)> SyncTransaction;
+    /** Notifies listeners of a block connected as the new tip, which they get without reading it back from disk. */
+    boost::signals2::signal<void (const CBlock &, const CBlockIndex *)> UpdatedBlockTip;
+    /** Notifies listeners of a transaction that got its InstantX lock. */
+    boost::signals2::signal<void (const CTransaction &)> NotifyTransactionLock;
     /** Notifies listeners of an erased transaction (currently disabled, requires transaction replacement). */
     boost::signals2::signal<void (const uint256 &)> EraseTransaction;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
@@ -192,10 +209,38 @@ struct CMainSignals {
     boost::signals2::signal<void (const CBlock&, const CValidationState&)> BlockChecked;
 } g_signals;
 
+/**
+ * Wallet notifications from block connection and mempool acceptance, which
+ * happen under cs_main, are delivered from here by ThreadValidationNotifications
+ * so that validation doesn't wait for the listeners.
+ */
+CNotificationQueue notificationQueue;
+
+/** Tell listeners about a transaction found in a block, by then possibly no longer the tip */
+void SyncTransactionInBlock(const CTransaction& tx, boost::shared_ptr<const CBlock> pblock)
+{
+    g_signals.SyncTransaction(tx, pblock.get());
+}
+
+/** Tell listeners about all transactions of a block, by then possibly no longer the tip */
+void SyncBlockTransactions(boost::shared_ptr<const CBlock> pblock)
+{
+    BOOST_FOREACH(const CTransaction& tx, pblock->vtx)
+        g_signals.SyncTransaction(tx, pblock.get());
+}
+
+/** Tell listeners about a block connected as the tip, by then possibly no longer the tip */
+void UpdatedBlockTip(boost::shared_ptr<const CBlock> pblock, const CBlockIndex* pindex)
+{
+    g_signals.UpdatedBlockTip(*pblock, pindex);
+}
+
 } // anon namespace
 
 void RegisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
+    g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2));
+    g_signals.NotifyTransactionLock.connect(boost::bind(&CValidationInterface::NotifyTransactionLock, pwalletIn, _1));
     g_signals.EraseTransaction.connect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
     g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
     g_signals.SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
@@ -211,6 +256,8 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.SetBestChain.disconnect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
     g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
     g_signals.EraseTransaction.disconnect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
+    g_signals.NotifyTransactionLock.disconnect(boost::bind(&CValidationInterface::NotifyTransactionLock, pwalletIn, _1));
+    g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2));
     g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
 }
 
@@ -221,11 +268,36 @@ void UnregisterAllValidationInterfaces() {
     g_signals.SetBestChain.disconnect_all_slots();
     g_signals.UpdatedTransaction.disconnect_all_slots();
     g_signals.EraseTransaction.disconnect_all_slots();
+    g_signals.NotifyTransactionLock.disconnect_all_slots();
+    g_signals.UpdatedBlockTip.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
 }
 
 void SyncWithWallets(const CTransaction &tx, const CBlock *pblock) {
-    g_signals.SyncTransaction(tx, pblock);
+    if (g_signals.SyncTransaction.empty())
+        return;
+    if (pblock) {
+        // The block may be gone by the time the notification is delivered
+        boost::shared_ptr<const CBlock> pblockCopy(new CBlock(*pblock));
+        notificationQueue.Push(boost::bind(&SyncTransactionInBlock, tx, pblockCopy));
+    } else {
+        notificationQueue.Push(boost::bind(boost::ref(g_signals.SyncTransaction), tx, (const CBlock*)NULL));
+    }
+}
+
+void NotifyTransactionLock(const CTransaction &tx) {
+    if (g_signals.NotifyTransactionLock.empty())
+        return;
+    notificationQueue.Push(boost::bind(boost::ref(g_signals.NotifyTransactionLock), tx));
+}
+
+void ThreadValidationNotifications() {
+    RenameThread("cintamani-notify");
+    notificationQueue.Thread();
+}
+
+void FlushValidationNotifications() {
+    notificationQueue.Flush();
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -272,6 +344,14 @@ struct CNodeState {
     int64_t nStallingSince;
     list<QueuedBlock> vBlocksInFlight;
     int nBlocksInFlight;
+    //! How many blocks we allow in flight from this peer at once; grows while the peer keeps up, shrinks when it stalls.
+    int nBlocksInFlightWindow;
+    //! Moving average of the time (in microseconds) this peer takes to deliver one block, or 0 if unknown.
+    int64_t nBlockResponseTimeAvg;
+    //! This peer's ping time (in microseconds), standing in for nBlockResponseTimeAvg until it has delivered a block.
+    int64_t nBlockResponseTimePrior;
+    //! When we last received a block we requested from this peer (in microseconds), or 0.
+    int64_t nLastBlockReceived;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
 
@@ -285,6 +365,10 @@ struct CNodeState {
         fSyncStarted = false;
         nStallingSince = 0;
         nBlocksInFlight = 0;
+        nBlocksInFlightWindow = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        nBlockResponseTimeAvg = 0;
+        nBlockResponseTimePrior = 0;
+        nLastBlockReceived = 0;
         fPreferredDownload = false;
     }
 };
@@ -345,11 +429,29 @@ void FinalizeNode(NodeId nodeid) {
     mapNodeState.erase(nodeid);
 }
 
-// Requires cs_main.
-void MarkBlockAsReceived(const uint256& hash) {
+/** Shrink a peer's in-flight window after it held up block download. Requires cs_main. */
+void PenalizeBlockDownloadWindow(CNodeState *state) {
+    state->nBlocksInFlightWindow = ShrinkBlockDownloadWindow(state->nBlocksInFlightWindow);
+}
+
+/** Account for a block delivered by the peer it was requested from. Requires cs_main. */
+void UpdateBlockDownloadStats(CNodeState *state, const QueuedBlock& queued, int64_t nNow) {
+    // While requests are pipelined, the time since the previous delivery is what the peer
+    // spent on this block; otherwise it is the full round trip since the request.
+    int64_t nSample = nNow - std::max(queued.nTime, state->nLastBlockReceived);
+    state->nBlockResponseTimeAvg = UpdateBlockResponseTime(state->nBlockResponseTimeAvg, nSample);
+    state->nLastBlockReceived = nNow;
+    state->nBlocksInFlightWindow = GrowBlockDownloadWindow(state->nBlocksInFlightWindow, state->nBlocksInFlight);
+}
+
+// Requires cs_main. Only the peer the block is in flight from gets credit for delivering it;
+// a late copy from a peer it was taken away from says nothing about either peer.
+void MarkBlockAsReceived(const uint256& hash, NodeId nodeFrom = -1) {
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState *state = State(itInFlight->second.first);
+        if (nodeFrom == itInFlight->second.first)
+            UpdateBlockDownloadStats(state, *itInFlight->second.second, GetTimeMicros());
         nQueuedValidatedHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->vBlocksInFlight.erase(itInFlight->second.second);
         state->nBlocksInFlight--;
@@ -425,8 +527,23 @@ CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
     return pa;
 }
 
+/** Whether the in-flight block hash, which is holding up the download window, should be requested
+ *  again from the peer with the given state because that peer is expected to deliver it much sooner. */
+bool ShouldRerequestBlock(CNodeState *state, const uint256& hash) {
+    map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end())
+        return false;
+    CNodeState *stateHolder = State(itInFlight->second.first);
+    int64_t nInFlightFor = GetTimeMicros() - itInFlight->second.second->nTime;
+    // A holder that has not delivered anything yet is judged by its ping time, so distant peers lose
+    // blocks sooner; the requester itself must have a measured average to take one.
+    int64_t nHolderResponseTime = stateHolder->nBlockResponseTimeAvg ? stateHolder->nBlockResponseTimeAvg : stateHolder->nBlockResponseTimePrior;
+    return IsBlockRerequestWorthwhile(state->nBlockResponseTimeAvg, nHolderResponseTime, nInFlightFor);
+}
+
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
+ *  at most count entries. If the download window is blocked on a much slower peer, the blocking
+ *  block itself may be returned so it gets re-requested. */
 void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller) {
     if (count == 0)
         return;
@@ -463,6 +580,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    CBlockIndex *pindexWaitingFor = NULL;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -493,6 +611,14 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        // If the peer holding up the window is much slower than this one, ask us for its block instead.
+                        if (pindexWaitingFor && ShouldRerequestBlock(state, pindexWaitingFor->GetBlockHash())) {
+                            LogPrint("net", "Re-requesting stalled block %s (%d) from peer=%d instead of peer=%d\n",
+                                pindexWaitingFor->GetBlockHash().ToString(), pindexWaitingFor->nHeight, nodeid, waitingfor);
+                            PenalizeBlockDownloadWindow(State(waitingfor));
+                            vBlocks.push_back(pindexWaitingFor);
+                            nodeStaller = -1;
+                        }
                     }
                     return;
                 }
@@ -503,6 +629,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
@@ -510,6 +637,33 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
 
 } // anon namespace
 
+int64_t UpdateBlockResponseTime(int64_t nAvg, int64_t nSample) {
+    if (nSample < 0)
+        nSample = 0;
+    return nAvg == 0 ? nSample : (nAvg * 7 + nSample) / 8;
+}
+
+int GrowBlockDownloadWindow(int nWindow, int nInFlight) {
+    // Additive increase: a peer that keeps its window full without stalling gets a larger one.
+    if (nInFlight >= nWindow - 1 && nWindow < MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER)
+        nWindow++;
+    return nWindow;
+}
+
+int ShrinkBlockDownloadWindow(int nWindow) {
+    return std::max(MIN_BLOCKS_IN_TRANSIT_PER_PEER, nWindow / 2);
+}
+
+bool IsBlockRerequestWorthwhile(int64_t nResponseTimeAvg, int64_t nHolderResponseTimeAvg, int64_t nInFlightFor) {
+    // Without a delivered block we have no opinion on how fast this peer is.
+    if (nResponseTimeAvg == 0)
+        return false;
+    // A holder we have no measurement for yet is judged by how long it has been sitting on this block.
+    int64_t nHolderTime = std::max(nHolderResponseTimeAvg, nInFlightFor);
+    return nInFlightFor > std::max(nResponseTimeAvg, BLOCK_REREQUEST_MIN_WAIT) &&
+           nHolderTime > BLOCK_DOWNLOAD_STEAL_FACTOR * nResponseTimeAvg;
+}
+
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
@@ -518,6 +672,8 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     stats.nMisbehavior = state->nMisbehavior;
     stats.nSyncHeight = state->pindexBestKnownBlock ? state->pindexBestKnownBlock->nHeight : -1;
     stats.nCommonHeight = state->pindexLastCommonBlock ? state->pindexLastCommonBlock->nHeight : -1;
+    stats.nBlocksInFlightWindow = state->nBlocksInFlightWindow;
+    stats.nBlockResponseTimeAvg = state->nBlockResponseTimeAvg;
     BOOST_FOREACH(const QueuedBlock& queue, state->vBlocksInFlight) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
@@ -559,6 +715,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewBackgroundFlush *pcoinsWriter = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -881,10 +1038,7 @@ int GetInputAgeIX(uint256 nTXHash, CTxIn& vin)
     if(nResult < 0) nResult = 0;
 
     if (nResult < 6){
-        std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(nTXHash);
-        if (i != mapTxLocks.end()){
-            sigs = (*i).second.CountSignatures();
-        }
+        sigs = txLockManager.GetSignatures(nTXHash);
         if(sigs >= INSTANTX_SIGNATURES_REQUIRED){
             return nInstantXDepth+nResult;
         }
@@ -895,12 +1049,7 @@ int GetInputAgeIX(uint256 nTXHash, CTxIn& vin)
 
 int GetIXConfirmations(uint256 nTXHash)
 {    
-    int sigs = 0;
-
-    std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(nTXHash);
-    if (i != mapTxLocks.end()){
-        sigs = (*i).second.CountSignatures();
-    }
+    int sigs = txLockManager.GetSignatures(nTXHash);
     if(sigs >= INSTANTX_SIGNATURES_REQUIRED){
         return nInstantXDepth;
     }
@@ -1023,24 +1172,17 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     if (pool.exists(hash))
         return false;
 
-    // ----------- instantX transaction scanning -----------
-
-    BOOST_FOREACH(const CTxIn& in, tx.vin){
-        if(mapLockedInputs.count(in.prevout)){
-            if(mapLockedInputs[in.prevout] != tx.GetHash()){
-                return state.DoS(0,
-                                 error("AcceptToMemoryPool : conflicts with existing transaction lock: %s", reason),
-                                 REJECT_INVALID, "tx-lock-conflict");
-            }
-        }
-    }
-
-    // Check for conflicts with in-memory transactions
+    // Check for conflicts with instantX transaction locks and in-memory transactions
     {
-    LOCK(pool.cs); // protect pool.mapNextTx
+    LOCK(pool.cs); // protect pool.mapNextTx and pool.mapLockedInputs
     for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
         COutPoint outpoint = tx.vin[i].prevout;
+        std::map<COutPoint, uint256>::const_iterator itLock = pool.mapLockedInputs.find(outpoint);
+        if (itLock != pool.mapLockedInputs.end() && itLock->second != hash)
+            return state.DoS(0,
+                             error("AcceptToMemoryPool : conflicts with existing transaction lock: %s", itLock->second.ToString()),
+                             REJECT_INVALID, "tx-lock-conflict");
         if (pool.mapNextTx.count(outpoint))
         {
             // Disable replacement feature for now
@@ -1217,24 +1359,17 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState &state, const CTransact
     if (pool.exists(hash))
         return false;
 
-    // ----------- instantX transaction scanning -----------
-
-    BOOST_FOREACH(const CTxIn& in, tx.vin){
-        if(mapLockedInputs.count(in.prevout)){
-            if(mapLockedInputs[in.prevout] != tx.GetHash()){
-                return state.DoS(0,
-                                 error("AcceptableInputs : conflicts with existing transaction lock: %s", reason),
-                                 REJECT_INVALID, "tx-lock-conflict");
-            }
-        }
-    }
-
-    // Check for conflicts with in-memory transactions
+    // Check for conflicts with instantX transaction locks and in-memory transactions
     {
-        LOCK(pool.cs); // protect pool.mapNextTx
+        LOCK(pool.cs); // protect pool.mapNextTx and pool.mapLockedInputs
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             COutPoint outpoint = tx.vin[i].prevout;
+            std::map<COutPoint, uint256>::const_iterator itLock = pool.mapLockedInputs.find(outpoint);
+            if (itLock != pool.mapLockedInputs.end() && itLock->second != hash)
+                return state.DoS(0,
+                                 error("AcceptableInputs : conflicts with existing transaction lock: %s", itLock->second.ToString()),
+                                 REJECT_INVALID, "tx-lock-conflict");
             if (pool.mapNextTx.count(outpoint))
             {
                 // Disable replacement feature for now
@@ -1401,16 +1536,32 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
         if (fTxIndex) {
             CDiskTxPos postx;
             if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
                 CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (std::exception &e) {
-                    return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+                bool fRead = false;
+                boost::shared_ptr<const CMappedBlockFile> mapped = blockFileMaps.Get(postx.nFile, postx.nPos, 80 + postx.nTxOffset);
+                if (mapped) {
+                    // Random access, no readahead hint; on a short mapping retry through stdio below
+                    try {
+                        CSpanReader reader(mapped->pbegin + postx.nPos, mapped->pbegin + mapped->nSize, SER_DISK, CLIENT_VERSION);
+                        reader >> header;
+                        reader.ignore(postx.nTxOffset);
+                        reader >> txOut;
+                        fRead = true;
+                    } catch (std::exception &e) {
+                        LogPrint("mmap", "%s : mapped read failed - %s\n", __func__, e.what());
+                    }
+                }
+                if (!fRead) {
+                    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+                    if (file.IsNull())
+                        return error("%s: OpenBlockFile failed", __func__);
+                    try {
+                        file >> header;
+                        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                        file >> txOut;
+                    } catch (std::exception &e) {
+                        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+                    }
                 }
                 hashBlock = header.GetHash();
                 if (txOut.GetHash() != hash)
@@ -1479,21 +1630,71 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+/**
+ * Locate the block stored at pos in a memory-mapped block file. The record
+ * header written by WriteBlockToDisk (magic, length) has to check out,
+ * otherwise the caller falls back to reading through stdio.
+ */
+static bool GetMappedBlock(const CDiskBlockPos& pos, boost::shared_ptr<const CMappedBlockFile>& mapped, unsigned int& nSize)
 {
-    block.SetNull();
+    static const size_t nHeaderSize = MESSAGE_START_SIZE + sizeof(unsigned int);
+    if (pos.nPos < nHeaderSize)
+        return false;
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk : OpenBlockFile failed");
+    mapped = blockFileMaps.Get(pos.nFile, pos.nPos - nHeaderSize, nHeaderSize);
+    if (!mapped)
+        return false;
 
-    // Read block
+    const unsigned char* pheader = mapped->pbegin + pos.nPos - nHeaderSize;
+    if (memcmp(pheader, Params().MessageStart(), MESSAGE_START_SIZE))
+        return false;
     try {
-        filein >> block;
+        CSpanReader header(pheader + MESSAGE_START_SIZE, pheader + nHeaderSize, SER_DISK, CLIENT_VERSION);
+        header >> nSize;
     }
-    catch (std::exception &e) {
-        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    catch (const std::exception&) {
+        return false;
+    }
+    if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+        return false;
+
+    if (!mapped->Contains(pos.nPos, nSize)) {
+        mapped = blockFileMaps.Get(pos.nFile, pos.nPos, nSize);
+        if (!mapped)
+            return false;
+    }
+    mapped->Advise(pos.nPos, nSize, BLOCKFILE_ACCESS_SEQUENTIAL);
+    return true;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+{
+    block.SetNull();
+
+    boost::shared_ptr<const CMappedBlockFile> mapped;
+    unsigned int nSize;
+    if (GetMappedBlock(pos, mapped, nSize)) {
+        // Deserialize straight from the mapping
+        try {
+            CSpanReader reader(mapped->pbegin + pos.nPos, mapped->pbegin + pos.nPos + nSize, SER_DISK, CLIENT_VERSION);
+            reader >> block;
+        }
+        catch (std::exception &e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk : OpenBlockFile failed");
+
+        // Read block
+        try {
+            filein >> block;
+        }
+        catch (std::exception &e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
     // Check the header
@@ -1512,6 +1713,95 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+CRawBlockReader::CRawBlockReader() : pnext(NULL), file(NULL), nSize(0), nLeft(0)
+{
+}
+
+CRawBlockReader::~CRawBlockReader()
+{
+    if (file)
+        fclose(file);
+}
+
+bool CRawBlockReader::Open(const CDiskBlockPos& pos)
+{
+    if (GetMappedBlock(pos, mapped, nSize)) {
+        pnext = mapped->pbegin + pos.nPos;
+        nLeft = nSize;
+        return true;
+    }
+
+    // Seek back to the index header written by WriteBlockToDisk
+    if (pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s : invalid block position %d:%u", __func__, pos.nFile, pos.nPos);
+    CDiskBlockPos hpos = pos;
+    hpos.nPos -= MESSAGE_START_SIZE + sizeof(unsigned int);
+
+    // Open history file to read
+    file = OpenBlockFile(hpos, true);
+    if (file == NULL)
+        return error("%s : OpenBlockFile failed", __func__);
+
+    unsigned char header[MESSAGE_START_SIZE + sizeof(unsigned int)];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header))
+        return error("%s : I/O error reading header at %d:%u", __func__, pos.nFile, pos.nPos);
+    if (memcmp(header, Params().MessageStart(), MESSAGE_START_SIZE))
+        return error("%s : block magic mismatch at %d:%u", __func__, pos.nFile, pos.nPos);
+    unsigned int nSizeHeader = ReadLE32(header + MESSAGE_START_SIZE);
+    if (nSizeHeader < 80 || nSizeHeader > MAX_BLOCK_SIZE)
+        return error("%s : invalid block size %u at %d:%u", __func__, nSizeHeader, pos.nFile, pos.nPos);
+
+    nSize = nLeft = nSizeHeader;
+    return true;
+}
+
+size_t CRawBlockReader::Read(const unsigned char*& pchRet, size_t nMax)
+{
+    size_t nChunk = std::min((size_t)nLeft, nMax);
+    if (nChunk == 0)
+        return 0;
+    if (mapped) {
+        pchRet = pnext;
+        pnext += nChunk;
+    } else {
+        vchBuffer.resize(nChunk);
+        if (fread(&vchBuffer[0], 1, nChunk, file) != nChunk) {
+            LogPrintf("%s : I/O error reading block\n", __func__);
+            nLeft = 0;
+            nSize = 0; // never complete
+            return 0;
+        }
+        pchRet = &vchBuffer[0];
+    }
+    nLeft -= nChunk;
+    return nChunk;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos)
+{
+    vchBlock.clear();
+
+    CRawBlockReader reader;
+    if (!reader.Open(pos))
+        return false;
+
+    vchBlock.reserve(reader.GetSize());
+    const unsigned char* pch;
+    size_t nChunk;
+    while ((nChunk = reader.Read(pch, reader.GetSize())) > 0)
+        vchBlock.insert(vchBlock.end(), pch, pch + nChunk);
+    if (!reader.IsComplete()) {
+        vchBlock.clear();
+        return error("%s : I/O error reading block at %d:%u", __func__, pos.nFile, pos.nPos);
+    }
+
+    return true;
+}
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CBlockIndex* pindex)
+{
+    return ReadRawBlockFromDisk(vchBlock, pindex->GetBlockPos());
+}
+
 
 double ConvertBitsToDouble(unsigned int nBits)
 {
@@ -1790,13 +2080,13 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
 
 bool CScriptCheck::operator()() {
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, cacheStore), &error)) {
+    if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, cacheStore, txdata), &error)) {
         return ::error("CScriptCheck(): %s:%d VerifySignature failed: %s", ptxTo->GetHash().ToString(), nIn, ScriptErrorString(error));
     }
     return true;
 }
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks)
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks, const PrecomputedTransactionData *ptxdata)
 {
     if (!tx.IsCoinBase())
     {
@@ -1859,13 +2149,20 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
         if (fScriptChecks) {
+            // Checks pushed onto pvChecks may run after we return, so only
+            // precompute signature hash data here when verifying inline
+            PrecomputedTransactionData txdata;
+            if (!ptxdata && !pvChecks && tx.vin.size() > 1) {
+                txdata = PrecomputedTransactionData(tx);
+                ptxdata = &txdata;
+            }
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
                 const CCoins* coins = inputs.AccessCoins(prevout.hash);
                 assert(coins);
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(*coins, tx, i, flags, cacheStore, ptxdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1878,7 +2175,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
                         CScriptCheck check(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
+                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, ptxdata);
                         if (check())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
                     }
@@ -2010,13 +2307,100 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128, MAX_SCRIPTCHECK_THREADS);
 
 void ThreadScriptCheck() {
     RenameThread("cintamani-scriptch");
     scriptcheckqueue.Thread();
 }
 
+/** Reads the coins of one transaction from the view below pcoinsTip, for PrefetchBlockInputs */
+class CCoinsPrefetch
+{
+private:
+    const CCoinsView *pview;
+    uint256 txid;
+    CCoins *pcoins;
+    char *pfFound;
+
+public:
+    CCoinsPrefetch() : pview(NULL), pcoins(NULL), pfFound(NULL) {}
+    CCoinsPrefetch(const CCoinsView *pviewIn, const uint256 &txidIn, CCoins *pcoinsIn, char *pfFoundIn) :
+        pview(pviewIn), txid(txidIn), pcoins(pcoinsIn), pfFound(pfFoundIn) { }
+
+    bool operator()() {
+        try {
+            *pfFound = pview->GetCoins(txid, *pcoins);
+        } catch (const std::runtime_error& e) {
+            // Leave it to connecting the block, which reads it again and handles the error
+            *pfFound = false;
+        }
+        return true;
+    }
+
+    void swap(CCoinsPrefetch &prefetch) {
+        std::swap(pview, prefetch.pview);
+        std::swap(txid, prefetch.txid);
+        std::swap(pcoins, prefetch.pcoins);
+        std::swap(pfFound, prefetch.pfFound);
+    }
+};
+
+static CCheckQueue<CCoinsPrefetch> prefetchqueue(16, MAX_SCRIPTCHECK_THREADS);
+
+void ThreadCoinsPrefetch() {
+    RenameThread("cintamani-prefetch");
+    prefetchqueue.Thread();
+}
+
+/**
+ * Read the coins spent by a block into pcoinsTip, in parallel, before it is
+ * connected. Connecting then finds all of them cached instead of reading
+ * them from the database one by one on the way to queuing script checks.
+ */
+static void PrefetchBlockInputs(const CBlock& block)
+{
+    if (!nScriptCheckThreads || pcoinsWriter == NULL)
+        return;
+
+    std::set<uint256> setSeen;
+    std::vector<uint256> vTxid;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                const uint256& txid = txin.prevout.hash;
+                if (setSeen.insert(txid).second && !pcoinsTip->HaveCoinsInCache(txid))
+                    vTxid.push_back(txid);
+            }
+        }
+        // Outputs created earlier in the block are not in the database
+        setSeen.insert(tx.GetHash());
+    }
+    if (vTxid.empty())
+        return;
+
+    int64_t nTimeStart = GetTimeMicros();
+    std::vector<CCoins> vCoins(vTxid.size());
+    std::vector<char> vFound(vTxid.size(), false);
+    std::vector<CCoinsPrefetch> vPrefetch;
+    vPrefetch.reserve(vTxid.size());
+    for (unsigned int i = 0; i < vTxid.size(); i++)
+        vPrefetch.push_back(CCoinsPrefetch(pcoinsWriter, vTxid[i], &vCoins[i], &vFound[i]));
+
+    CCheckQueueControl<CCoinsPrefetch> control(&prefetchqueue);
+    control.Add(vPrefetch);
+    control.Wait();
+
+    unsigned int nFound = 0;
+    for (unsigned int i = 0; i < vTxid.size(); i++) {
+        if (vFound[i]) {
+            pcoinsTip->AddFetchedCoins(vTxid[i], vCoins[i]);
+            nFound++;
+        }
+    }
+    LogPrint("bench", "  - Prefetch inputs: %u/%u txs in %.2fms\n", nFound, (unsigned int)vTxid.size(), (GetTimeMicros() - nTimeStart) * 0.001);
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -2080,6 +2464,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
+    // Signature hash data shared by the queued checks of each transaction;
+    // declared before control so it outlives the checks. Reserved up front,
+    // the checks keep pointers into it.
+    std::vector<PrecomputedTransactionData> txdata;
+    txdata.reserve(block.vtx.size());
+
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
@@ -2119,8 +2509,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             nFees += view.GetValueIn(tx)-tx.GetValueOut();
 
+            const PrecomputedTransactionData *ptxdata = NULL;
+            if (fScriptChecks && nScriptCheckThreads) {
+                txdata.push_back(PrecomputedTransactionData(tx));
+                ptxdata = &txdata.back();
+            }
             std::vector<CScriptCheck> vChecks;
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL))
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL, ptxdata))
                 return false;
             control.Add(vChecks);
         }
@@ -2183,7 +2578,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     // Watch for changes to the previous coinbase transaction.
     static uint256 hashPrevBestCoinBase;
-    g_signals.UpdatedTransaction(hashPrevBestCoinBase);
+    notificationQueue.Push(boost::bind(boost::ref(g_signals.UpdatedTransaction), hashPrevBestCoinBase));
     hashPrevBestCoinBase = block.vtx[0].GetHash();
 
     int64_t nTime4 = GetTimeMicros(); nTimeCallbacks += nTime4 - nTime3;
@@ -2202,14 +2597,24 @@ enum FlushStateMode {
  * Update the on-disk chain state.
  * The caches and indexes are flushed if either they're too large, forceWrite is set, or
  * fast is not set and it's been a while since the last write.
+ * Only FLUSH_STATE_ALWAYS writes the chainstate before returning; otherwise the
+ * dirty coins are handed to pcoinsWriter and written while validation goes on.
  */
 bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
+    // LoadTxOutSet is filling the coin database and writes the best block itself
+    if (fLoadingSnapshot)
+        return true;
     try {
+    bool fCacheFull = pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage;
+    bool fPeriodic = mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000;
+    // A periodic write can wait until the previous one has finished
+    if (fPeriodic && !fCacheFull && pcoinsWriter != NULL && pcoinsWriter->IsWriting())
+        fPeriodic = false;
     if ((mode == FLUSH_STATE_ALWAYS) ||
-        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
-        (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
+        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && fCacheFull) ||
+        fPeriodic) {
         // Typical CCoins structures on disk are around 100 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
@@ -2239,11 +2644,19 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         }
         pblocktree->Sync();
         // Finally flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
-            return state.Abort("Failed to write to coin database");
+        if (mode == FLUSH_STATE_ALWAYS || pcoinsWriter == NULL) {
+            if (!pcoinsTip->Flush())
+                return state.Abort("Failed to write to coin database");
+        } else {
+            // Periodic writes keep the cache warm, a full cache is emptied
+            CCoinsMap mapCoins;
+            uint256 hashBlock = pcoinsTip->ExtractDirty(mapCoins, !fCacheFull);
+            if (!pcoinsWriter->WriteInBackground(mapCoins, hashBlock))
+                return state.Abort("Failed to write to coin database");
+        }
         // Update best block in wallet (so we can detect restored wallets).
         if (mode != FLUSH_STATE_IF_NEEDED) {
-            g_signals.SetBestChain(chainActive.GetLocator());
+            notificationQueue.Push(boost::bind(boost::ref(g_signals.SetBestChain), chainActive.GetLocator()));
         }
         nLastWrite = GetTimeMicros();
     }
@@ -2258,6 +2671,136 @@ void FlushStateToDisk() {
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+bool DumpTxOutSet(CAutoFile& fileout, CCoinsStats& stats, std::string& strError)
+{
+    {
+        LOCK(cs_main);
+        if (fLoadingSnapshot) {
+            strError = "a snapshot is being loaded";
+            return false;
+        }
+        CValidationState state;
+        if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+            strError = "failed to flush the chainstate";
+            return false;
+        }
+    }
+    // The dump reads a database snapshot, blocks may be connected meanwhile
+    CCoinsSnapshotHeader header;
+    memcpy(header.pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE);
+    if (!pcoinsWriter->DumpSnapshot(fileout, header, stats)) {
+        strError = "failed to read the coin database";
+        return false;
+    }
+    LogPrintf("%s: wrote %u transactions at block %s\n", __func__, stats.nTransactions, stats.hashBlock.ToString());
+    return true;
+}
+
+bool LoadTxOutSet(CAutoFile& filein, CCoinsStats& stats, std::string& strError)
+{
+    CCoinsSnapshotHeader header;
+    try {
+        filein >> header;
+    } catch (const std::exception& e) {
+        strError = strprintf("error reading snapshot: %s", e.what());
+        return false;
+    }
+    if (memcmp(header.pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0) {
+        strError = "snapshot is for a different network";
+        return false;
+    }
+    if (header.nVersion != COINS_SNAPSHOT_VERSION) {
+        strError = strprintf("unsupported snapshot version %d", header.nVersion);
+        return false;
+    }
+    // The file's own hashes only show it is intact, not that the set is the right one
+    const MapTxOutSetSnapshots& mapSnapshots = Params().TxOutSetSnapshots();
+    MapTxOutSetSnapshots::const_iterator itSnapshot = mapSnapshots.find(header.hashBlock);
+    if (itSnapshot == mapSnapshots.end()) {
+        strError = strprintf("no snapshot at block %s is known to this version", header.hashBlock.ToString());
+        return false;
+    }
+    if (header.nChainTx != itSnapshot->second.nChainTx) {
+        strError = strprintf("snapshot claims %u transactions up to block %s, expected %u", header.nChainTx, header.hashBlock.ToString(), itSnapshot->second.nChainTx);
+        return false;
+    }
+    // Masternode, InstantX and budget checks read collateral transactions from
+    // block data, which a snapshot node does not have below the snapshot
+    if (!fLiteMode) {
+        strError = "a snapshot can only be loaded with -litemode";
+        return false;
+    }
+
+    CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        if (chainActive.Height() != 0 || pindexSnapshotBase != NULL || fLoadingSnapshot) {
+            strError = "a snapshot can only be loaded before any block is connected";
+            return false;
+        }
+        BlockMap::iterator mi = mapBlockIndex.find(header.hashBlock);
+        if (mi == mapBlockIndex.end()) {
+            strError = strprintf("snapshot block %s is not known yet, wait for the headers to sync", header.hashBlock.ToString());
+            return false;
+        }
+        pindex = mi->second;
+        if (pindex->nHeight == 0 || !pindex->IsValid(BLOCK_VALID_TREE)) {
+            strError = strprintf("snapshot block %s can't be used", header.hashBlock.ToString());
+            return false;
+        }
+
+        CValidationState state;
+        if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+            strError = "failed to flush the chainstate";
+            return false;
+        }
+        // Record the base first: if the load is interrupted, the coin database
+        // is marked incomplete and startup asks for a reindex, which drops both.
+        if (!pblocktree->WriteSnapshotBase(header.hashBlock, header.nChainTx)) {
+            strError = "failed to write to the block index";
+            return false;
+        }
+        // From here on nothing connects blocks or flushes the chainstate, so
+        // the load can run without cs_main
+        fLoadingSnapshot = true;
+    }
+
+    unsigned int nThreads = std::max(1U, boost::thread::hardware_concurrency());
+    bool fLoaded = pcoinsWriter->LoadSnapshot(filein, header, itSnapshot->second.hashSerialized, nThreads, stats, strError);
+
+    {
+        LOCK(cs_main);
+        fLoadingSnapshot = false;
+        if (!fLoaded) {
+            pblocktree->EraseSnapshotBase();
+            return false;
+        }
+
+        pindex->nChainTx = header.nChainTx;
+        pindexSnapshotBase = pindex;
+        pcoinsTip->SetBestBlock(pindex->GetBlockHash());
+        chainActive.SetTip(pindex);
+        setBlockIndexCandidates.insert(pindex);
+        PruneBlockIndexCandidates();
+        mempool.clear();
+        // Peers may have been asked for blocks below the new tip, start over from it
+        for (map<NodeId, CNodeState>::iterator it = mapNodeState.begin(); it != mapNodeState.end(); it++)
+            it->second.pindexLastCommonBlock = NULL;
+        cvBlockChange.notify_all();
+    }
+    CheckBlockIndex();
+    uiInterface.NotifyBlockTip(pindex->GetBlockHash());
+
+    LogPrintf("%s: chainstate loaded at height %d, block %s\n", __func__, pindex->nHeight, pindex->GetBlockHash().ToString());
+    return true;
+}
+
+bool IsSnapshotChainstate()
+{
+    LOCK(cs_main);
+    return pindexSnapshotBase != NULL;
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew) {
     chainActive.SetTip(pindexNew);
@@ -2266,10 +2809,10 @@ void static UpdateTip(CBlockIndex *pindexNew) {
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
       chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble())/log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
       DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-      Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+      Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -2363,6 +2906,7 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    PrefetchBlockInputs(*pblock);
     {
         CCoinsViewCache view(pcoinsTip);
         CInv inv(MSG_BLOCK, pindexNew->GetBlockHash());
@@ -2396,9 +2940,13 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, CBlock *
     BOOST_FOREACH(const CTransaction &tx, txConflicted) {
         SyncWithWallets(tx, NULL);
     }
-    // ... and about transactions that got confirmed:
-    BOOST_FOREACH(const CTransaction &tx, pblock->vtx) {
-        SyncWithWallets(tx, pblock);
+    // ... and about transactions that got confirmed, then the block itself, sharing one copy of it:
+    if (!g_signals.SyncTransaction.empty() || !g_signals.UpdatedBlockTip.empty()) {
+        boost::shared_ptr<const CBlock> pblockCopy(new CBlock(*pblock));
+        if (!g_signals.SyncTransaction.empty())
+            notificationQueue.Push(boost::bind(&SyncBlockTransactions, pblockCopy));
+        if (!g_signals.UpdatedBlockTip.empty())
+            notificationQueue.Push(boost::bind(&UpdatedBlockTip, pblockCopy, pindexNew));
     }
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
@@ -2421,71 +2969,95 @@ bool DisconnectBlocksAndReprocess(int blocks)
 }
 
 /*
-    DisconnectBlockAndInputs
+    DisconnectConflictingBlocks
 
     Remove conflicting blocks for successful InstantX transaction locks
     This should be very rare (Probably will never happen)
+
+    Only the blocks from the most recent one that spends an input of the lock with
+    another transaction are disconnected, nothing at all if the chain doesn't.
 */
-// ***TODO*** clean up here
-bool DisconnectBlockAndInputs(CValidationState &state, CTransaction txLock)
+int static DisconnectConflictingBlocks(CValidationState &state, const CTransaction& txLock, int nMaxBlocks)
 {
+    AssertLockHeld(cs_main);
 
-    // All modifications to the coin state will be done in this cache.
-    // Only when all have succeeded, we push it to pcoinsTip.
-//    CCoinsViewCache view(*pcoinsTip, true);
-
-    CBlockIndex* BlockReading = chainActive.Tip();
-    CBlockIndex* pindexNew = NULL;
-
-    bool foundConflictingTx = false;
-
-    //remove anything conflicting in the memory pool
-    list<CTransaction> txConflicted;
-    mempool.removeConflicts(txLock, txConflicted);
-
-
-    // List of what to disconnect (typically nothing)
-    vector<CBlockIndex*> vDisconnect;
+    uint256 hashLock = txLock.GetHash();
 
-    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0 && !foundConflictingTx && i < 6; i++) {
-        vDisconnect.push_back(BlockReading);
-        pindexNew = BlockReading->pprev; //new best block
+    // Inputs already spent in the chain, usually none, and then there is nothing to look for
+    std::set<COutPoint> setSpent;
+    BOOST_FOREACH(const CTxIn& in, txLock.vin){
+        const CCoins* coins = pcoinsTip->AccessCoins(in.prevout.hash);
+        if (coins == NULL || !coins->IsAvailable(in.prevout.n))
+            setSpent.insert(in.prevout);
+    }
+    if (setSpent.empty())
+        return 0;
 
+    int nDisconnect = 0;
+    CBlockIndex* pindex = chainActive.Tip();
+    for (int i = 1; pindex && pindex->nHeight > 0 && i <= nMaxBlocks && !setSpent.empty(); i++) {
         CBlock block;
-        if (!ReadBlockFromDisk(block, BlockReading))
-            return state.Abort(_("Failed to read block"));
+        if (!ReadBlockFromDisk(block, pindex)) {
+            state.Abort(_("Failed to read block"));
+            return 0;
+        }
 
-        // Queue memory transactions to resurrect.
-        // We only do this for blocks after the last checkpoint (reorganisation before that
-        // point should only happen with -reindex/-loadblock, or a misbehaving peer.
         BOOST_FOREACH(const CTransaction& tx, block.vtx){
-            if (!tx.IsCoinBase()){
-                BOOST_FOREACH(const CTxIn& in1, txLock.vin){
-                    BOOST_FOREACH(const CTxIn& in2, tx.vin){
-                        if(in1.prevout == in2.prevout) foundConflictingTx = true;
-                    }
-                }
+            if (tx.IsCoinBase()) continue;
+            bool fConflict = false;
+            BOOST_FOREACH(const CTxIn& in, tx.vin){
+                if (setSpent.erase(in.prevout) && tx.GetHash() != hashLock)
+                    fConflict = true;
+            }
+            if (fConflict) {
+                LogPrintf("DisconnectConflictingBlocks: %s in block %s conflicts with transaction lock %s\n",
+                    tx.GetHash().ToString(), pindex->GetBlockHash().ToString(), hashLock.ToString());
+                nDisconnect = i;
             }
         }
 
-        if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
-        BlockReading = BlockReading->pprev;
+        pindex = pindex->pprev;
     }
 
-    if(!foundConflictingTx) {
-        LogPrintf("DisconnectBlockAndInputs: Can't find a conflicting transaction to inputs\n");
-        return false;
+    if (nDisconnect == 0) {
+        LogPrint("instantx", "DisconnectConflictingBlocks: no conflicting transaction in the last %d blocks\n", nMaxBlocks);
+        return 0;
     }
 
-    if (vDisconnect.size() > 0) {
-        LogPrintf("REORGANIZE: Disconnect Conflicting Blocks %lli blocks; %s..\n", vDisconnect.size(), pindexNew->GetBlockHash().ToString());
-        BOOST_FOREACH(CBlockIndex* pindex, vDisconnect) {
-            LogPrintf(" -- disconnect %s\n", pindex->GetBlockHash().ToString());
-            DisconnectTip(state);
-        }
+    LogPrintf("REORGANIZE: Disconnect Conflicting Blocks %d blocks\n", nDisconnect);
+    for (int i = 0; i < nDisconnect; i++) {
+        LogPrintf(" -- disconnect %s\n", chainActive.Tip()->GetBlockHash().ToString());
+        if (!DisconnectTip(state))
+            return i;
     }
 
-    return true;
+    return nDisconnect;
+}
+
+void ProcessTransactionLock(const CTransaction& txLock, int nMaxBlocks)
+{
+    CValidationState state;
+    int nDisconnected = 0;
+    {
+        LOCK(cs_main);
+
+        //remove anything conflicting in the memory pool
+        list<CTransaction> txConflicted;
+        mempool.removeConflicts(txLock, txConflicted);
+        BOOST_FOREACH(const CTransaction& tx, txConflicted)
+            SyncWithWallets(tx, NULL);
+
+        nDisconnected = DisconnectConflictingBlocks(state, txLock, nMaxBlocks);
+
+        // with its conflicts gone the locked transaction itself can be mined
+        CValidationState stateAccept;
+        if (!mempool.exists(txLock.GetHash()))
+            AcceptToMemoryPool(mempool, stateAccept, txLock, false, NULL);
+    }
+
+    // the conflicting blocks are rejected by CheckBlock now, so this picks another chain if there is one
+    if (nDisconnected > 0 && state.IsValid())
+        ActivateBestChain(state);
 }
 
 
@@ -2542,6 +3114,14 @@ static CBlockIndex* FindMostWorkChain() {
             }
             pindexTest = pindexTest->pprev;
         }
+        if (!fInvalidAncestor && pindexSnapshotBase != NULL && pindexTest != NULL && pindexTest->nHeight < pindexSnapshotBase->nHeight) {
+            // Switching to this chain would disconnect the loaded snapshot's base,
+            // for which there is no undo data
+            LogPrintf("%s: ignoring chain %s that forks below the snapshot base\n", __func__, pindexNew->GetBlockHash().ToString());
+            for (CBlockIndex *pindexFork = pindexNew; pindexFork != pindexTest; pindexFork = pindexFork->pprev)
+                setBlockIndexCandidates.erase(pindexFork);
+            fInvalidAncestor = true;
+        }
         if (!fInvalidAncestor)
             return pindexNew;
     } while(true);
@@ -2643,6 +3223,10 @@ bool ActivateBestChain(CValidationState &state, CBlock *pblock) {
             TRY_LOCK(cs_main, lockMain);
             if(!lockMain) { MilliSleep(50); continue; }
 
+            // Blocks are stored meanwhile and connected once the snapshot is in place
+            if (fLoadingSnapshot)
+                return true;
+
             pindexMostWork = FindMostWorkChain();
 
             // Whether we have anything to do at all.
@@ -2974,15 +3558,12 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         BOOST_FOREACH(const CTransaction& tx, block.vtx){
             if (!tx.IsCoinBase()){
                 //only reject blocks when it's based on complete consensus
-                BOOST_FOREACH(const CTxIn& in, tx.vin){
-                    if(mapLockedInputs.count(in.prevout)){
-                        if(mapLockedInputs[in.prevout] != tx.GetHash()){
-                            mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
-                            LogPrintf("CheckBlock() : found conflicting transaction with transaction lock %s %s\n", mapLockedInputs[in.prevout].ToString(), tx.GetHash().ToString());
-                            return state.DoS(0, error("CheckBlock() : found conflicting transaction with transaction lock"),
-                                             REJECT_INVALID, "conflicting-tx-ix");
-                        }
-                    }
+                uint256 hashLock;
+                if(mempool.findLockConflict(tx, hashLock)){
+                    mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
+                    LogPrintf("CheckBlock() : found conflicting transaction with transaction lock %s %s\n", hashLock.ToString(), tx.GetHash().ToString());
+                    return state.DoS(0, error("CheckBlock() : found conflicting transaction with transaction lock"),
+                                     REJECT_INVALID, "conflicting-tx-ix");
                 }
             }
         }
@@ -3291,7 +3872,7 @@ bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDis
         TRY_LOCK(cs_main, lockMain);
         if(!lockMain) { MilliSleep(50); continue; }
 
-        MarkBlockAsReceived(pblock->GetHash());
+        MarkBlockAsReceived(pblock->GetHash(), pfrom ? pfrom->GetId() : -1);
         if (!checked) {
             return error("%s : CheckBlock FAILED", __func__);
         }
@@ -3308,7 +3889,13 @@ bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDis
         break;
     }
 
-    if (!ActivateBestChain(state, pblock))
+    bool fActivated = ActivateBestChain(state, pblock);
+
+    // Don't let validation run arbitrarily far ahead of the wallets. No locks
+    // are held here, so the listeners can make progress.
+    notificationQueue.WaitBelow(MAX_QUEUED_NOTIFICATIONS);
+
+    if (!fActivated)
         return error("%s : ActivateBestChain failed", __func__);
 
     if(!fLiteMode){
@@ -3438,6 +4025,11 @@ bool static LoadBlockIndexDB()
 
     boost::this_thread::interruption_point();
 
+    // A chainstate loaded by loadtxoutset starts at a block without data
+    uint256 hashSnapshotBase(0);
+    uint64_t nSnapshotChainTx = 0;
+    pblocktree->ReadSnapshotBase(hashSnapshotBase, nSnapshotChainTx);
+
     // Calculate nChainWork
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
@@ -3463,6 +4055,11 @@ bool static LoadBlockIndexDB()
                 pindex->nChainTx = pindex->nTx;
             }
         }
+        if (hashSnapshotBase != uint256(0) && pindex->GetBlockHash() == hashSnapshotBase) {
+            pindex->nChainTx = nSnapshotChainTx;
+            pindexSnapshotBase = pindex;
+            setBlockIndexCandidates.insert(pindex);
+        }
         if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL))
             setBlockIndexCandidates.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
@@ -3523,6 +4120,14 @@ bool static LoadBlockIndexDB()
         return true;
     chainActive.SetTip(it->second);
 
+    if (pindexSnapshotBase != NULL && !chainActive.Contains(pindexSnapshotBase)) {
+        // The snapshot never made it into the coin database
+        LogPrintf("LoadBlockIndexDB(): ignoring unused snapshot base %s\n", pindexSnapshotBase->GetBlockHash().ToString());
+        pindexSnapshotBase->nChainTx = 0;
+        setBlockIndexCandidates.erase(pindexSnapshotBase);
+        pindexSnapshotBase = NULL;
+    }
+
     PruneBlockIndexCandidates();
 
     LogPrintf("LoadBlockIndexDB(): hashBestChain=%s height=%d date=%s progress=%f\n",
@@ -3567,6 +4172,9 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
+        // Blocks below a loaded snapshot were never downloaded
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            break;
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
@@ -3584,7 +4192,7 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -3623,10 +4231,24 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
 
 void UnloadBlockIndex()
 {
-    mapBlockIndex.clear();
+    LOCK(cs_main);
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
+    pindexBestHeader = NULL;
+    pindexSnapshotBase = NULL;
+    mapBlocksUnlinked.clear();
+    vinfoBlockFile.clear();
+    nLastBlockFile = 0;
+    nBlockSequenceId = 1;
+    mapBlockSource.clear();
+    setDirtyBlockIndex.clear();
+    setDirtyFileInfo.clear();
+
+    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
+        delete entry.second;
+    }
+    mapBlockIndex.clear();
 }
 
 bool LoadBlockIndex()
@@ -3816,16 +4438,23 @@ void static CheckBlockIndex()
     int nHeight = 0;
     CBlockIndex* pindexFirstInvalid = NULL; // Oldest ancestor of pindex which is invalid.
     CBlockIndex* pindexFirstMissing = NULL; // Oldest ancestor of pindex which does not have BLOCK_HAVE_DATA.
+    CBlockIndex* pindexFirstMissingAboveBase = NULL; // Same, but not counting a loaded snapshot's base and its ancestors.
     CBlockIndex* pindexFirstNotTreeValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_TREE (regardless of being valid or not).
     CBlockIndex* pindexFirstNotChainValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
     CBlockIndex* pindexFirstNotScriptsValid = NULL; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
     while (pindex != NULL) {
         nNodes++;
         if (pindexFirstInvalid == NULL && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
+        // A loaded snapshot's base and its ancestors have no data and were never connected, yet the chain continues from the base.
+        bool fAssumed = pindexSnapshotBase != NULL && pindexSnapshotBase->GetAncestor(pindex->nHeight) == pindex;
+        bool fFromBase = pindexSnapshotBase != NULL && pindex->GetAncestor(pindexSnapshotBase->nHeight) == pindexSnapshotBase;
         if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        if (pindexFirstMissingAboveBase == NULL && !fAssumed && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissingAboveBase = pindex;
         if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
-        if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
-        if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
+        if (pindex->pprev != NULL && !fAssumed && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
+        if (pindex->pprev != NULL && !fAssumed && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
+        // The base and the blocks built on it are linked through the base, whatever is missing below it.
+        CBlockIndex* pindexFirstUnlinked = fFromBase ? pindexFirstMissingAboveBase : pindexFirstMissing;
 
         // Begin: actual consistency checks.
         if (pindex->pprev == NULL) {
@@ -3838,7 +4467,7 @@ void static CheckBlockIndex()
         assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0));
         if (pindex->nChainTx == 0) assert(pindex->nSequenceId == 0);  // nSequenceId can't be set for blocks that aren't linked
         // All parents having data is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
-        assert((pindexFirstMissing != NULL) == (pindex->nChainTx == 0)); // nChainTx == 0 is used to signal that all parent block's transaction data is available.
+        assert((pindexFirstUnlinked != NULL) == (pindex->nChainTx == 0)); // nChainTx == 0 is used to signal that all parent block's transaction data is available.
         assert(pindex->nHeight == nHeight); // nHeight must be consistent.
         assert(pindex->pprev == NULL || pindex->nChainWork >= pindex->pprev->nChainWork); // For every block except the genesis block, the chainwork must be larger than the parent's.
         assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight))); // The pskip pointer must point back for all but the first 2 blocks.
@@ -3850,7 +4479,7 @@ void static CheckBlockIndex()
             // Checks for not-invalid blocks.
             assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
         }
-        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstMissing == NULL) {
+        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstUnlinked == NULL) {
             if (pindexFirstInvalid == NULL) { // If this block sorts at least as good as the current tip and is valid, it must be in setBlockIndexCandidates.
                  assert(setBlockIndexCandidates.count(pindex));
             }
@@ -3868,7 +4497,7 @@ void static CheckBlockIndex()
             }
             rangeUnlinked.first++;
         }
-        if (pindex->pprev && pindex->nStatus & BLOCK_HAVE_DATA && pindexFirstMissing != NULL) {
+        if (pindex->pprev && pindex->nStatus & BLOCK_HAVE_DATA && pindexFirstUnlinked != NULL) {
             if (pindexFirstInvalid == NULL) { // If this block has block data available, some parent doesn't, and has no invalid parents, it must be in mapBlocksUnlinked.
                 assert(foundInUnlinked);
             }
@@ -3893,6 +4522,7 @@ void static CheckBlockIndex()
             // If pindex was the first with a certain property, unset the corresponding variable.
             if (pindex == pindexFirstInvalid) pindexFirstInvalid = NULL;
             if (pindex == pindexFirstMissing) pindexFirstMissing = NULL;
+            if (pindex == pindexFirstMissingAboveBase) pindexFirstMissingAboveBase = NULL;
             if (pindex == pindexFirstNotTreeValid) pindexFirstNotTreeValid = NULL;
             if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = NULL;
             if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = NULL;
@@ -4009,10 +4639,9 @@ bool static AlreadyHave(const CInv& inv)
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash);
     case MSG_TXLOCK_REQUEST:
-        return mapTxLockReq.count(inv.hash) ||
-               mapTxLockReqRejected.count(inv.hash);
+        return txLockManager.HasLockRequest(inv.hash);
     case MSG_TXLOCK_VOTE:
-        return mapTxLockVote.count(inv.hash);
+        return txLockManager.HasVote(inv.hash);
     case MSG_SPORK:
         return mapSporks.count(inv.hash);
     case MSG_MASTERNODE_WINNER:
@@ -4095,17 +4724,28 @@ void static ProcessGetData(CNode* pfrom)
                             LogPrintf("ProcessGetData(): ignoring request from peer=%i for old block that isn't in the main chain\n", pfrom->GetId());
                         }
                     }
+                    // Blocks below a snapshot loaded with loadtxoutset are in the main chain without data
+                    if (send && !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                        LogPrint("net", "ProcessGetData(): ignoring request from peer=%i for block %s we don't have\n", pfrom->GetId(), inv.hash.ToString());
+                        send = false;
+                    }
                 }
                 if (send)
                 {
                     // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                    {
+                        // Forward the stored bytes as-is, the hash is known from the index
+                        std::vector<unsigned char> vchBlock;
+                        if (!ReadRawBlockFromDisk(vchBlock, (*mi).second))
+                            assert(!"cannot load block from disk");
+                        pfrom->PushMessage("block", CFlatData(vchBlock));
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
@@ -4119,7 +4759,7 @@ void static ProcessGetData(CNode* pfrom)
                             // however we MUST always provide at least what the remote peer needs
                             typedef std::pair<unsigned int, uint256> PairType;
                             BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
+                                if (!pfrom->HasInventoryKnown(CInv(MSG_TX, pair.second)))
                                     pfrom->PushMessage("tx", block.vtx[pair.first]);
                         }
                         // else
@@ -4164,19 +4804,21 @@ void static ProcessGetData(CNode* pfrom)
                     }
                 }
                 if (!pushed && inv.type == MSG_TXLOCK_VOTE) {
-                    if(mapTxLockVote.count(inv.hash)){
+                    CConsensusVote vote;
+                    if(txLockManager.GetVote(inv.hash, vote)){
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mapTxLockVote[inv.hash];
+                        ss << vote;
                         pfrom->PushMessage("txlvote", ss);
                         pushed = true;
                     }
                 }
                 if (!pushed && inv.type == MSG_TXLOCK_REQUEST) {
-                    if(mapTxLockReq.count(inv.hash)){
+                    CTransaction tx;
+                    if(txLockManager.GetLockRequest(inv.hash, tx)){
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mapTxLockReq[inv.hash];
+                        ss << tx;
                         pfrom->PushMessage("ix", ss);
                         pushed = true;
                     }
@@ -4560,7 +5202,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
                     CNodeState *nodestate = State(pfrom->GetId());
                     if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - Params().TargetSpacing() * 20 &&
-                        nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                        nodestate->nBlocksInFlight < nodestate->nBlocksInFlightWindow) {
                         vToFetch.push_back(inv);
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
@@ -5152,7 +5794,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         mnodeman.ProcessMessage(pfrom, strCommand, vRecv);
         budget.ProcessMessage(pfrom, strCommand, vRecv);
         masternodePayments.ProcessMessageMasternodePayments(pfrom, strCommand, vRecv);
-        ProcessMessageInstantX(pfrom, strCommand, vRecv);
+        txLockManager.ProcessMessage(pfrom, strCommand, vRecv);
         ProcessSpork(pfrom, strCommand, vRecv);
         masternodeSync.ProcessMessage(pfrom, strCommand, vRecv);
     }
@@ -5284,6 +5926,68 @@ bool ProcessMessages(CNode* pfrom)
 }
 
 
+/** Relay position of a queued transaction announcement. */
+struct CInvTxRelayOrder
+{
+    int nDepth;
+    CFeeRate feeRate;
+    std::map<uint256, int64_t>::iterator it;
+};
+
+/** Heap order for transaction announcements: a transaction comes after any queued mempool
+ *  transaction it spends, otherwise higher fee rates go first. */
+struct CompareInvTxRelayOrder
+{
+    //! True if a should be sent after b.
+    bool operator()(const CInvTxRelayOrder& a, const CInvTxRelayOrder& b) const
+    {
+        if (a.nDepth != b.nDepth)
+            return a.nDepth > b.nDepth;
+        return a.feeRate < b.feeRate;
+    }
+};
+
+/** Number of unconfirmed generations of mempool parents below hash, capped at MAX_RELAY_DEPTH.
+ *  Results are memoized in mapDepth. Requires mempool.cs. */
+static int GetMempoolDepth(const uint256& hash, std::map<uint256, int>& mapDepth, int nRecursion = 0)
+{
+    static const int MAX_RELAY_DEPTH = 25;
+    std::map<uint256, int>::const_iterator itDepth = mapDepth.find(hash);
+    if (itDepth != mapDepth.end())
+        return itDepth->second;
+
+    int nDepth = 0;
+    std::map<uint256, CTxMemPoolEntry>::const_iterator mi = mempool.mapTx.find(hash);
+    if (mi != mempool.mapTx.end() && nRecursion < MAX_RELAY_DEPTH) {
+        BOOST_FOREACH(const CTxIn& txin, mi->second.GetTx().vin) {
+            if (mempool.mapTx.count(txin.prevout.hash))
+                nDepth = std::max(nDepth, 1 + GetMempoolDepth(txin.prevout.hash, mapDepth, nRecursion + 1));
+        }
+    }
+    nDepth = std::min(nDepth, MAX_RELAY_DEPTH);
+    mapDepth[hash] = nDepth;
+    return nDepth;
+}
+
+/** Fold the time an announcement spent queued into a peer's moving average. */
+static void UpdateRelayDelay(int64_t& nDelayAvg, int64_t nDelay)
+{
+    nDelayAvg = nDelayAvg == 0 ? nDelay : (nDelayAvg * 15 + nDelay) / 16;
+}
+
+/** Add inv to the pending inv message, flushing it when it reaches the protocol limit. */
+static void PushInventoryBatched(CNode* pto, vector<CInv>& vInv, const CInv& inv)
+{
+    vInv.push_back(inv);
+    if (vInv.size() >= 1000)
+    {
+        pto->nInvSent += vInv.size();
+        pto->nInvMessagesSent++;
+        pto->PushMessage("inv", vInv);
+        vInv.clear();
+    }
+}
+
 bool SendMessages(CNode* pto, bool fSendTrickle)
 {
     {
@@ -5414,53 +6118,92 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         // Message: inventory
         //
+        int64_t nNow = GetTimeMicros();
         vector<CInv> vInv;
-        vector<CInv> vInvWait;
         {
             LOCK(pto->cs_inventory);
-            vInv.reserve(pto->vInventoryToSend.size());
-            vInvWait.reserve(pto->vInventoryToSend.size());
+            vInv.reserve(std::max<size_t>(pto->vInventoryToSend.size(), INVENTORY_BROADCAST_MAX));
+
+            // Blocks, InstantX and other latency-critical items go out right away
             BOOST_FOREACH(const CInv& inv, pto->vInventoryToSend)
             {
-                if (pto->setInventoryKnown.count(inv))
+                if (pto->HasInventoryKnown(inv))
                     continue;
-
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle)
+                pto->SetInventoryKnown(inv);
+                PushInventoryBatched(pto, vInv, inv);
+            }
+            pto->vInventoryToSend.clear();
+
+            // Masternode and budget items are batched on their own timer, so a burst of them
+            // neither waits for nor delays transaction relay
+            if (pto->nNextMasternodeInvSend < nNow) {
+                pto->nNextMasternodeInvSend = PoissonNextSend(nNow, MASTERNODE_INVENTORY_BROADCAST_INTERVAL);
+                typedef std::pair<CInv, int64_t> QueuedInv;
+                BOOST_FOREACH(const QueuedInv& queued, pto->vInventoryMasternodeToSend)
                 {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt == 0)
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = inv.hash ^ hashSalt;
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((hashRand & 3) != 0);
-
-                    if (fTrickleWait)
-                    {
-                        vInvWait.push_back(inv);
+                    if (pto->HasInventoryKnown(queued.first))
                         continue;
-                    }
+                    pto->SetInventoryKnown(queued.first);
+                    UpdateRelayDelay(pto->nMasternodeRelayDelayAvg, nNow - queued.second);
+                    PushInventoryBatched(pto, vInv, queued.first);
                 }
+                pto->vInventoryMasternodeToSend.clear();
+            }
 
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second)
+            // Transactions are trickled on a Poisson timer per peer to protect privacy; outbound
+            // peers get a shorter interval to make them the main path for our own relay
+            bool fSendTxTrickle = pto->fWhitelisted;
+            if (pto->nNextInvSend < nNow) {
+                fSendTxTrickle = true;
+                pto->nNextInvSend = PoissonNextSend(nNow, INVENTORY_BROADCAST_INTERVAL >> !pto->fInbound);
+            }
+            if (fSendTxTrickle && !pto->mapInventoryTxToSend.empty()) {
+                vector<CInvTxRelayOrder> vInvTx;
+                vInvTx.reserve(pto->mapInventoryTxToSend.size());
                 {
-                    vInv.push_back(inv);
-                    if (vInv.size() >= 1000)
-                    {
-                        pto->PushMessage("inv", vInv);
-                        vInv.clear();
+                    LOCK(mempool.cs);
+                    std::map<uint256, int> mapDepth;
+                    std::map<uint256, int64_t>::iterator it = pto->mapInventoryTxToSend.begin();
+                    while (it != pto->mapInventoryTxToSend.end()) {
+                        std::map<uint256, CTxMemPoolEntry>::const_iterator mi = mempool.mapTx.find(it->first);
+                        if (mi == mempool.mapTx.end() || pto->HasInventoryKnown(CInv(MSG_TX, it->first))) {
+                            // Not in the mempool anymore, or already known to the peer: don't bother sending it.
+                            pto->mapInventoryTxToSend.erase(it++);
+                            continue;
+                        }
+                        CInvTxRelayOrder order;
+                        order.nDepth = GetMempoolDepth(it->first, mapDepth);
+                        order.feeRate = CFeeRate(mi->second.GetFee(), mi->second.GetTxSize());
+                        order.it = it;
+                        vInvTx.push_back(order);
+                        ++it;
                     }
                 }
+                // Parents before children, then highest fee rate first. A heap is used so that
+                // not all items need sorting if only a few are being sent.
+                CompareInvTxRelayOrder compare;
+                std::make_heap(vInvTx.begin(), vInvTx.end(), compare);
+                unsigned int nRelayedTransactions = 0;
+                while (!vInvTx.empty() && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
+                    std::pop_heap(vInvTx.begin(), vInvTx.end(), compare);
+                    std::map<uint256, int64_t>::iterator it = vInvTx.back().it;
+                    vInvTx.pop_back();
+                    pto->SetInventoryKnown(CInv(MSG_TX, it->first));
+                    UpdateRelayDelay(pto->nTxRelayDelayAvg, nNow - it->second);
+                    PushInventoryBatched(pto, vInv, CInv(MSG_TX, it->first));
+                    pto->mapInventoryTxToSend.erase(it);
+                    nRelayedTransactions++;
+                }
+            }
+
+            if (!vInv.empty()) {
+                pto->nInvSent += vInv.size();
+                pto->nInvMessagesSent++;
+                pto->PushMessage("inv", vInv);
             }
-            pto->vInventoryToSend = vInvWait;
         }
-        if (!vInv.empty())
-            pto->PushMessage("inv", vInv);
 
         // Detect whether we're stalling
-        int64_t nNow = GetTimeMicros();
         if (!pto->fDisconnect && state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
             // Stalling only triggers when the block download window cannot move. During normal steady state,
             // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
@@ -5482,10 +6225,12 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && fFetch && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        if (state.nBlockResponseTimeAvg == 0)
+            state.nBlockResponseTimePrior = pto->nPingUsecTime;
+        if (!pto->fDisconnect && !pto->fClient && fFetch && state.nBlocksInFlight < state.nBlocksInFlightWindow) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            FindNextBlocksToDownload(pto->GetId(), state.nBlocksInFlightWindow - state.nBlocksInFlight, vToDownload, staller);
             BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), pindex);
@@ -5495,6 +6240,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             if (state.nBlocksInFlight == 0 && staller != -1) {
                 if (State(staller)->nStallingSince == 0) {
                     State(staller)->nStallingSince = nNow;
+                    PenalizeBlockDownloadWindow(State(staller));
                     LogPrint("net", "Stall started peer=%d\n", staller);
                 }
             }
@@ -5517,6 +6263,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     vGetData.clear();
                 }
             }
+            pto->setAskFor.erase(inv);
             pto->mapAskFor.erase(pto->mapAskFor.begin());
         }
         if (!vGetData.empty())
@@ -37,12 +37,15 @@
 #include <utility>
 #include <vector>
 
+#include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewBackgroundFlush;
 class CBloomFilter;
 class CInv;
+class CMappedBlockFile;
 class CScriptCheck;
 class CValidationInterface;
 class CValidationState;
@@ -81,8 +84,17 @@ static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Wallet notifications that may be waiting for delivery before block processing holds back */
+static const unsigned int MAX_QUEUED_NOTIFICATIONS = 1000;
+/** Number of blocks that can be requested at any given time from a single peer we know nothing about yet. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds for the per-peer in-flight window, which adapts to the peer's observed block delivery rate. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 64;
+/** A block in flight from a peer at least this many times slower than us may be re-requested from us. */
+static const int BLOCK_DOWNLOAD_STEAL_FACTOR = 2;
+/** Minimum time in microseconds a block must have been in flight before it may be re-requested from another peer. */
+static const int64_t BLOCK_REREQUEST_MIN_WAIT = 500000;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -130,7 +142,7 @@ extern int nScriptCheckThreads;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 
@@ -153,6 +165,8 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 void UnregisterAllValidationInterfaces();
 /** Push an updated transaction to all registered wallets */
 void SyncWithWallets(const CTransaction& tx, const CBlock* pblock = NULL);
+/** Tell all registered listeners that a transaction got its InstantX lock */
+void NotifyTransactionLock(const CTransaction& tx);
 
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
@@ -193,11 +207,18 @@ bool ProcessMessages(CNode* pfrom);
  * Send queued protocol messages to be sent to a give node.
  *
  * @param[in]   pto             The node which we are sending messages to.
- * @param[in]   fSendTrickle    When true send the trickled data, otherwise trickle the data until true.
+ * @param[in]   fSendTrickle    When true send the trickled addr data, otherwise trickle the data until true.
+ *                              Inventory is trickled on per-peer Poisson timers instead.
  */
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the thread that reads a block's inputs ahead of connecting it */
+void ThreadCoinsPrefetch();
+/** Run the thread that delivers wallet notifications queued during validation */
+void ThreadValidationNotifications();
+/** Wait until every wallet notification queued so far has been delivered */
+void FlushValidationNotifications();
 
 // ***TODO*** probably not the right place for these 2
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
@@ -227,10 +248,30 @@ CBlockIndex * InsertBlockIndex(uint256 hash);
 bool AbortNode(const std::string &msg, const std::string &userMessage="");
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
+/** Fold a block delivery time (in microseconds) into a peer's moving average; 0 means no sample yet. */
+int64_t UpdateBlockResponseTime(int64_t nAvg, int64_t nSample);
+/** A peer's in-flight window after it delivered a block with nInFlight others still outstanding. */
+int GrowBlockDownloadWindow(int nWindow, int nInFlight);
+/** A peer's in-flight window after it held up block download. */
+int ShrinkBlockDownloadWindow(int nWindow);
+/** Whether a block that has been in flight for nInFlightFor microseconds from a peer with response time
+ *  nHolderResponseTimeAvg should be requested again from a peer with nResponseTimeAvg. */
+bool IsBlockRerequestWorthwhile(int64_t nResponseTimeAvg, int64_t nHolderResponseTimeAvg, int64_t nInFlightFor);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Flush the chainstate and write the UTXO set it holds to fileout (dumptxoutset) */
+bool DumpTxOutSet(CAutoFile& fileout, CCoinsStats& stats, std::string& strError);
+/**
+ * Replace the chainstate of a node that has not connected any blocks yet with a
+ * dumptxoutset file, and continue the active chain from the block it was taken at
+ * (loadtxoutset). Only snapshots listed in the chain parameters are accepted, and
+ * only in -litemode. Blocks below the snapshot are never downloaded or validated.
+ */
+bool LoadTxOutSet(CAutoFile& filein, CCoinsStats& stats, std::string& strError);
+/** Whether the active chain continues from a snapshot loaded with loadtxoutset */
+bool IsSnapshotChainstate();
 
 
 /** (try to) add transaction to memory pool **/
@@ -248,6 +289,8 @@ struct CNodeStateStats {
     int nMisbehavior;
     int nSyncHeight;
     int nCommonHeight;
+    int nBlocksInFlightWindow;
+    int64_t nBlockResponseTimeAvg;
     std::vector<int> vHeightInFlight;
 };
 
@@ -318,10 +361,12 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * instead of being performed inline. Signature hashes use ptxdata, which must outlive the pushed
+ * checks; inline checks of multi-input transactions compute their own when it is NULL.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                 unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks = NULL);
+                 unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks = NULL,
+                 const PrecomputedTransactionData *ptxdata = NULL);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, CTxUndo &txundo, int nHeight);
@@ -367,12 +412,13 @@ private:
     unsigned int nFlags;
     bool cacheStore;
     ScriptError error;
+    const PrecomputedTransactionData *txdata;
 
 public:
-    CScriptCheck(): ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
+    CScriptCheck(): ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(NULL) {}
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, const PrecomputedTransactionData* txdataIn = NULL) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
 
@@ -383,6 +429,7 @@ public:
         std::swap(nFlags, check.nFlags);
         std::swap(cacheStore, check.cacheStore);
         std::swap(error, check.error);
+        std::swap(txdata, check.txdata);
     }
 
     ScriptError GetScriptError() const { return error; }
@@ -393,6 +440,54 @@ public:
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/**
+ * Read the serialized bytes of a block without deserializing it or
+ * recomputing its hash. The on-disk record header (network magic and
+ * length) is checked; the block hash is trusted from the block index.
+ */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos);
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CBlockIndex* pindex);
+
+/**
+ * Sequential reader of a block's serialized bytes, for passing a block on a
+ * chunk at a time instead of first copying all of it into memory. The
+ * record header is checked as in ReadRawBlockFromDisk(); chunks point
+ * straight into the memory-mapped block file when it is available.
+ */
+class CRawBlockReader
+{
+private:
+    boost::shared_ptr<const CMappedBlockFile> mapped;
+    const unsigned char* pnext;
+    FILE* file;
+    std::vector<unsigned char> vchBuffer;
+    unsigned int nSize;
+    unsigned int nLeft;
+
+    // Disallow copies
+    CRawBlockReader(const CRawBlockReader&);
+    CRawBlockReader& operator=(const CRawBlockReader&);
+
+public:
+    CRawBlockReader();
+    ~CRawBlockReader();
+
+    //! Start reading the block stored at pos
+    bool Open(const CDiskBlockPos& pos);
+
+    //! Size of the serialized block, once opened
+    unsigned int GetSize() const { return nSize; }
+
+    /**
+     * Get the next chunk of at most nMax bytes. Returns its length and sets
+     * pchRet to it, valid until the next call; returns 0 once the whole
+     * block has been read or on a read error.
+     */
+    size_t Read(const unsigned char*& pchRet, size_t nMax);
+
+    //! Whether the whole block has been read
+    bool IsComplete() const { return nSize > 0 && nLeft == 0; }
+};
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -406,6 +501,10 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
 /** Reprocess a number of blocks to try and get on the correct chain again **/
 bool DisconnectBlocksAndReprocess(int blocks);
 
+/** Make way for a complete transaction lock: drop conflicting mempool transactions, and disconnect
+ *  the last nMaxBlocks blocks back to the most recent one spending an input of it, if any **/
+void ProcessTransactionLock(const CTransaction& txLock, int nMaxBlocks);
+
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false);
 
@@ -566,6 +665,9 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Global variable that points to the view writing pcoinsTip's flushes to the coin database (protected by cs_main) */
+extern CCoinsViewBackgroundFlush *pcoinsWriter;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -584,6 +686,8 @@ struct CBlockTemplate
 class CValidationInterface {
 protected:
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock) {};
+    virtual void UpdatedBlockTip(const CBlock &block, const CBlockIndex *pindex) {};
+    virtual void NotifyTransactionLock(const CTransaction &tx) {};
     virtual void EraseFromWallet(const uint256 &hash) {};
     virtual void SetBestChain(const CBlockLocator &locator) {};
     virtual bool UpdatedTransaction(const uint256 &hash) {return false;};
@@ -460,6 +460,7 @@ bool CMasternodeBroadcast::CheckAndUpdate(int& nDos)
         //take the newest entry
         LogPrintf("mnb - Got updated entry for %s\n", addr.ToString());
         if(pmn->UpdateFromNewBroadcast((*this))){
+            mnodeman.ListChanged();
             pmn->Check();
             if(pmn->IsEnabled()) Relay();
         }
@@ -705,6 +706,9 @@ bool CMasternodePing::CheckAndUpdate(int& nDos, bool fRequireEnabled, bool fChec
                 return false;
             }
 
+            // last seen and active seconds are picked up by the next list view rebuild,
+            // only a status change makes the list itself change
+            int nActiveStatePrev = pmn->activeState;
             pmn->lastPing = *this;
 
             //mnodeman.mapSeenMasternodeBroadcast.lastPing is probably outdated, so we'll update it
@@ -715,6 +719,7 @@ bool CMasternodePing::CheckAndUpdate(int& nDos, bool fRequireEnabled, bool fChec
             }
 
             pmn->Check(true);
+            if(pmn->activeState != nActiveStatePrev) mnodeman.ListChanged();
             if(!pmn->IsEnabled()) return false;
 
             LogPrint("masternode", "CMasternodePing::CheckAndUpdate - Masternode ping accepted, vin: %s\n", vin.ToString());
@@ -42,6 +42,15 @@ struct CompareScoreMN
     }
 };
 
+struct CompareScoreIndex
+{
+    bool operator()(const pair<int64_t, size_t>& t1,
+                    const pair<int64_t, size_t>& t2) const
+    {
+        return t1.first < t2.first;
+    }
+};
+
 //
 // CMasternodeDB
 //
@@ -204,6 +213,8 @@ void DumpMasternodes()
 
 CMasternodeMan::CMasternodeMan() {
     nDsqCount = 0;
+    nListChanges = 0;
+    nListChangesView = 0;
 }
 
 bool CMasternodeMan::Add(CMasternode &mn)
@@ -218,6 +229,7 @@ bool CMasternodeMan::Add(CMasternode &mn)
     {
         LogPrint("masternode", "CMasternodeMan: Adding new Masternode %s - %i now\n", mn.addr.ToString(), size() + 1);
         vMasternodes.push_back(mn);
+        nListChanges++;
         return true;
     }
 
@@ -289,6 +301,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
             }
 
             it = vMasternodes.erase(it);
+            nListChanges++;
         } else {
             ++it;
         }
@@ -358,6 +371,7 @@ void CMasternodeMan::Clear()
     mapSeenMasternodeBroadcast.clear();
     mapSeenMasternodePing.clear();
     nDsqCount = 0;
+    nListChanges++;
 }
 
 int CMasternodeMan::CountEnabled(int protocolVersion)
@@ -626,6 +640,140 @@ std::vector<pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t
     return vecMasternodeRanks;
 }
 
+boost::shared_ptr<const CMasternodeListView> CMasternodeMan::GetListView()
+{
+    int nHeight = -1;
+    uint256 hashTip = 0;
+    {
+        LOCK(cs_main);
+        if(chainActive.Tip() != NULL) {
+            nHeight = chainActive.Tip()->nHeight;
+            hashTip = chainActive.Tip()->GetBlockHash();
+        }
+    }
+
+    LOCK(cs_view);
+
+    bool fListChanged;
+    {
+        LOCK(cs);
+        fListChanged = nListChanges != nListChangesView;
+    }
+
+    // statuses also expire with time alone, so don't trust a view for longer than a check interval
+    if(pListView && !fListChanged && pListView->hashTip == hashTip &&
+            GetTime() - pListView->nTime < MASTERNODE_CHECK_SECONDS)
+        return pListView;
+
+    pListView = BuildListView(pListView, nHeight, hashTip);
+    return pListView;
+}
+
+boost::shared_ptr<const CMasternodeListView> CMasternodeMan::BuildListView(const boost::shared_ptr<const CMasternodeListView>& pPrev, int nHeight, const uint256& hashTip)
+{
+    boost::shared_ptr<CMasternodeListView> pView(new CMasternodeListView());
+    pView->nHeight = nHeight;
+    pView->hashTip = hashTip;
+    pView->nTime = GetTime();
+
+    // previous entries by vin, to carry over last paid times while the tip stays the same
+    std::map<COutPoint, const CMasternodeListEntry*> mapPrev;
+    bool fSameTip = pPrev && pPrev->hashTip == hashTip;
+    if(fSameTip) {
+        BOOST_FOREACH(const CMasternodeListEntry& entry, pPrev->vEntries)
+            mapPrev[entry.vin.prevout] = &entry;
+    }
+
+    LOCK(cs);
+    nListChangesView = nListChanges;
+
+    int nMinPaymentsProto = masternodePayments.GetMinMasternodePaymentsProto();
+    uint256 hashBlock = 0;
+    bool fRanks = nHeight >= 0 && GetBlockHash(hashBlock, nHeight);
+    std::vector<pair<int64_t, size_t> > vecScores;
+
+    pView->vEntries.reserve(vMasternodes.size());
+    BOOST_FOREACH(CMasternode& mn, vMasternodes) {
+        mn.Check();
+
+        CMasternodeListEntry entry;
+        entry.vin = mn.vin;
+        entry.strVin = mn.vin.prevout.ToStringShort();
+        entry.strStatus = mn.Status();
+        entry.protocolVersion = mn.protocolVersion;
+        entry.strPubKey = CBitcoinAddress(mn.pubkey.GetID()).ToString();
+        entry.strAddr = mn.addr.ToString();
+        entry.nLastSeen = mn.lastPing.sigTime;
+        entry.nActiveSeconds = mn.lastPing.sigTime - mn.sigTime;
+        entry.nRank = 0;
+        entry.nVersion = 0;
+
+        std::map<COutPoint, const CMasternodeListEntry*>::const_iterator it = mapPrev.find(mn.vin.prevout);
+        entry.nLastPaid = it != mapPrev.end() ? it->second->nLastPaid : mn.GetLastPaid();
+
+        if(mn.IsEnabled()) {
+            if(mn.protocolVersion >= nMinPaymentsProto) pView->nCountEnabled++;
+            if(mn.protocolVersion >= MIN_POOL_PEER_PROTO_VERSION) pView->nCountDarksend++;
+            if(fRanks) vecScores.push_back(make_pair(mn.CalculateScore(1, nHeight).GetCompact(false), pView->vEntries.size()));
+        }
+
+        pView->vEntries.push_back(entry);
+    }
+
+    // same order as GetMasternodeRanks, without copying the masternodes around
+    sort(vecScores.rbegin(), vecScores.rend(), CompareScoreIndex());
+    for(size_t i = 0; i < vecScores.size(); i++)
+        pView->vEntries[vecScores[i].second].nRank = i + 1;
+
+    pView->AssignVersions(pPrev.get());
+    return pView;
+}
+
+void CMasternodeListView::AssignVersions(const CMasternodeListView* pPrev)
+{
+    std::map<COutPoint, const CMasternodeListEntry*> mapPrev;
+    if(pPrev) {
+        BOOST_FOREACH(const CMasternodeListEntry& entry, pPrev->vEntries)
+            mapPrev[entry.vin.prevout] = &entry;
+        mapRemoved = pPrev->mapRemoved;
+    }
+    uint64_t nNewVersion = pPrev ? pPrev->nVersion + 1 : 1;
+    bool fChanged = !pPrev;
+
+    BOOST_FOREACH(CMasternodeListEntry& entry, vEntries) {
+        std::map<COutPoint, const CMasternodeListEntry*>::iterator it = mapPrev.find(entry.vin.prevout);
+        if(it != mapPrev.end() && entry.SameAs(*it->second)) {
+            entry.nVersion = it->second->nVersion;
+        } else {
+            entry.nVersion = nNewVersion;
+            mapRemoved.erase(entry.vin.prevout);
+            fChanged = true;
+        }
+        if(it != mapPrev.end()) mapPrev.erase(it);
+    }
+
+    // whatever is left was removed from the list
+    for(std::map<COutPoint, const CMasternodeListEntry*>::iterator it = mapPrev.begin(); it != mapPrev.end(); ++it) {
+        mapRemoved[it->first] = nNewVersion;
+        fChanged = true;
+    }
+
+    nVersion = fChanged ? nNewVersion : pPrev->nVersion;
+
+    // forget removals too old to be asked about
+    nOldestVersion = pPrev ? pPrev->nOldestVersion : 0;
+    if(nVersion > MASTERNODES_LIST_DELTA_VERSIONS)
+        nOldestVersion = std::max(nOldestVersion, nVersion - (uint64_t)MASTERNODES_LIST_DELTA_VERSIONS);
+    std::map<COutPoint, uint64_t>::iterator itRemoved = mapRemoved.begin();
+    while(itRemoved != mapRemoved.end()) {
+        if(itRemoved->second <= nOldestVersion) {
+            mapRemoved.erase(itRemoved++);
+        } else {
+            ++itRemoved;
+        }
+    }
+}
+
 CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
     std::vector<pair<int64_t, CTxIn> > vecMasternodeScores;
@@ -786,6 +934,7 @@ void CMasternodeMan::Remove(CTxIn vin)
         if((*it).vin == vin){
             LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).addr.ToString(), size() - 1);
             vMasternodes.erase(it);
+            nListChanges++;
             break;
         }
         ++it;
@@ -818,7 +967,7 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb) {
         CMasternode mn(mnb);
         Add(mn);
     } else {
-        pmn->UpdateFromNewBroadcast(mnb);
+        if(pmn->UpdateFromNewBroadcast(mnb)) ListChanged();
     }
 }
 
@@ -13,8 +13,11 @@
 #include "main.h"
 #include "masternode.h"
 
+#include <boost/shared_ptr.hpp>
+
 #define MASTERNODES_DUMP_SECONDS               (15*60)
 #define MASTERNODES_DSEG_SECONDS               (3*60*60)
+#define MASTERNODES_LIST_DELTA_VERSIONS        1000
 
 using namespace std;
 
@@ -46,6 +49,65 @@ public:
     ReadResult Read(CMasternodeMan& mnodemanToLoad, bool fDryRun = false);
 };
 
+/** A masternode as shown by masternodelist, precomputed for a list view
+ */
+struct CMasternodeListEntry
+{
+    CTxIn vin;
+    std::string strVin;
+    std::string strStatus;
+    int protocolVersion;
+    std::string strPubKey;
+    std::string strAddr;
+    // list version in which any of the above last changed
+    uint64_t nVersion;
+
+    // refreshed by every ping, so they are not versioned either: a ping would otherwise change the whole list
+    int64_t nLastSeen;
+    int64_t nActiveSeconds;
+    // tied to the tip rather than to the masternode, so they are not versioned
+    int64_t nLastPaid;
+    // rank by score at the view's height, 0 if not enabled
+    int nRank;
+
+    bool SameAs(const CMasternodeListEntry& other) const
+    {
+        return strStatus == other.strStatus && protocolVersion == other.protocolVersion &&
+               strPubKey == other.strPubKey && strAddr == other.strAddr;
+    }
+};
+
+/** Immutable, versioned snapshot of the masternode list. It is rebuilt when
+ *  the tip or the list changes (or statuses may have expired), and shared by
+ *  all callers until then, so polling it does not touch the list itself.
+ */
+class CMasternodeListView
+{
+public:
+    // bumped whenever an entry is added, changed or removed
+    uint64_t nVersion;
+    // oldest version changes can be reported from, see HasChangesSince
+    uint64_t nOldestVersion;
+    int nHeight;
+    uint256 hashTip;
+    int64_t nTime;
+
+    std::vector<CMasternodeListEntry> vEntries;
+    // entries removed in recent versions, by vin, with the version they were removed in
+    std::map<COutPoint, uint64_t> mapRemoved;
+
+    int nCountEnabled;
+    int nCountDarksend;
+
+    CMasternodeListView() : nVersion(0), nOldestVersion(0), nHeight(-1), hashTip(0), nTime(0), nCountEnabled(0), nCountDarksend(0) {}
+
+    /// Whether changes since nSinceVersion can be told apart, rather than needing the full list
+    bool HasChangesSince(uint64_t nSinceVersion) const { return nSinceVersion >= nOldestVersion && nSinceVersion <= nVersion; }
+
+    /// Set the versions of vEntries, the removals and the view version by comparing against pPrev (may be NULL)
+    void AssignVersions(const CMasternodeListView* pPrev);
+};
+
 class CMasternodeMan
 {
 private:
@@ -64,6 +126,15 @@ private:
     // which Masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
 
+    // critical section for the list view, taken before cs
+    mutable CCriticalSection cs_view;
+    boost::shared_ptr<const CMasternodeListView> pListView;
+    // number of changes to the list, and the number the list view includes
+    uint64_t nListChanges;
+    uint64_t nListChangesView;
+
+    boost::shared_ptr<const CMasternodeListView> BuildListView(const boost::shared_ptr<const CMasternodeListView>& pPrev, int nHeight, const uint256& hashTip);
+
 public:
     // Keep track of all broadcasts I've seen
     map<uint256, CMasternodeBroadcast> mapSeenMasternodeBroadcast;
@@ -126,6 +197,12 @@ public:
 
     std::vector<CMasternode> GetFullMasternodeVector() { Check(); return vMasternodes; }
 
+    /// Get an up to date snapshot of the list, rebuilding it only if needed
+    boost::shared_ptr<const CMasternodeListView> GetListView();
+
+    /// Note that an entry was added, removed or updated
+    void ListChanged() { LOCK(cs); nListChanges++; }
+
     std::vector<pair<int, CMasternode> > GetMasternodeRanks(int64_t nBlockHeight, int minProtocol=0);
     int GetMasternodeRank(const CTxIn &vin, int64_t nBlockHeight, int minProtocol=0, bool fOnlyActive=true);
     CMasternode* GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol=0, bool fOnlyActive=true);
@@ -569,6 +569,14 @@ void CNode::copyStats(CNodeStats &stats)
     stats.dPingTime = (((double)nPingUsecTime) / 1e6);
     stats.dPingWait = (((double)nPingUsecWait) / 1e6);
 
+    {
+        LOCK(cs_inventory);
+        stats.dTxRelayDelay = (((double)nTxRelayDelayAvg) / 1e6);
+        stats.dMasternodeRelayDelay = (((double)nMasternodeRelayDelayAvg) / 1e6);
+        X(nInvSent);
+        X(nInvMessagesSent);
+    }
+
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
 }
@@ -1774,6 +1782,11 @@ void CExplicitNetCleanup::callCleanup()
     delete tmp; // Stroustrup's gonna kill me for that
 }
 
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds)
+{
+    return nNow + (int64_t)(log1p(GetRand(1ULL << 48) * -0.0000000000000035527136788 /* -1/2^48 */) * average_interval_seconds * -1000000.0 + 0.5);
+}
+
 void RelayTransaction(const CTransaction& tx)
 {
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
@@ -1994,7 +2007,8 @@ bool CAddrDB::Read(CAddrMan& addr)
 unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
 
-CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000)
+CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fInboundIn) : ssSend(SER_NETWORK, INIT_PROTO_VERSION), setAddrKnown(5000),
+    filterInventoryKnown(INVENTORY_KNOWN_FILTER_SIZE, INVENTORY_KNOWN_FILTER_FPRATE)
 {
     nServices = 0;
     hSocket = hSocketIn;
@@ -2022,7 +2036,12 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
-    setInventoryKnown.max_size(SendBufferSize() / 1000);
+    nNextInvSend = 0;
+    nNextMasternodeInvSend = 0;
+    nTxRelayDelayAvg = 0;
+    nMasternodeRelayDelayAvg = 0;
+    nInvSent = 0;
+    nInvMessagesSent = 0;
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
     nPingUsecStart = 0;
@@ -2057,10 +2076,61 @@ CNode::~CNode()
     GetNodeSignals().FinalizeNode(GetId());
 }
 
+std::vector<unsigned char> CNode::InventoryKnownKey(const CInv& inv)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << inv;
+    return std::vector<unsigned char>(ss.begin(), ss.end());
+}
+
+void CNode::PushInventory(const CInv& inv)
+{
+    LOCK(cs_inventory);
+    if (HasInventoryKnown(inv))
+        return;
+    if (inv.type == MSG_TX) {
+        if (mapInventoryTxToSend.size() >= INVENTORY_TX_QUEUE_MAX)
+            TrimInventoryTxToSend();
+        mapInventoryTxToSend.insert(std::make_pair(inv.hash, GetTimeMicros()));
+    }
+    else if (inv.IsMasternodeType())
+        vInventoryMasternodeToSend.push_back(std::make_pair(inv, GetTimeMicros()));
+    else
+        vInventoryToSend.push_back(inv);
+}
+
+void CNode::TrimInventoryTxToSend()
+{
+    // Drop the oldest tenth at once, so a peer that never drains its queue costs one scan
+    // per INVENTORY_TX_QUEUE_MAX / 10 pushes rather than one per push
+    std::vector<int64_t> vQueued;
+    vQueued.reserve(mapInventoryTxToSend.size());
+    for (std::map<uint256, int64_t>::const_iterator it = mapInventoryTxToSend.begin(); it != mapInventoryTxToSend.end(); ++it)
+        vQueued.push_back(it->second);
+    std::vector<int64_t>::iterator itCutoff = vQueued.begin() + vQueued.size() / 10;
+    std::nth_element(vQueued.begin(), itCutoff, vQueued.end());
+    int64_t nCutoff = *itCutoff;
+
+    size_t nDropped = 0;
+    std::map<uint256, int64_t>::iterator it = mapInventoryTxToSend.begin();
+    while (it != mapInventoryTxToSend.end()) {
+        if (it->second <= nCutoff) {
+            mapInventoryTxToSend.erase(it++);
+            nDropped++;
+        } else
+            ++it;
+    }
+    LogPrint("net", "tx announce queue to peer=%d full, dropped %u oldest\n", id, nDropped);
+}
+
 void CNode::AskFor(const CInv& inv)
 {
-    if (mapAskFor.size() > MAPASKFOR_MAX_SZ)
+    if (mapAskFor.size() > MAPASKFOR_MAX_SZ || setAskFor.size() > SETASKFOR_MAX_SZ)
         return;
+    // a peer may not have multiple queue positions for a single inv item
+    if (!setAskFor.insert(inv).second)
+        return;
+
     // We're using mapAskFor as a priority queue,
     // the key is the earliest time the request can be sent
     int64_t nRequestTime;
@@ -58,6 +58,20 @@ static const bool DEFAULT_UPNP = false;
 #endif
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
+/** The maximum number of entries in setAskFor (larger due to getdata latency)*/
+static const size_t SETASKFOR_MAX_SZ = 2 * MAX_INV_SZ;
+/** Average delay between trickled transaction inventory transmissions in seconds.
+ *  Blocks, InstantX and other latency-critical inventory is not affected by this. */
+static const unsigned int INVENTORY_BROADCAST_INTERVAL = 5;
+/** Maximum number of transaction inventory items sent to a peer per trickle. */
+static const unsigned int INVENTORY_BROADCAST_MAX = 7 * INVENTORY_BROADCAST_INTERVAL;
+/** Maximum number of transactions queued for announcement to a single peer; the oldest are dropped beyond it. */
+static const size_t INVENTORY_TX_QUEUE_MAX = MAX_INV_SZ;
+/** Average delay between masternode and budget inventory transmissions in seconds. */
+static const unsigned int MASTERNODE_INVENTORY_BROADCAST_INTERVAL = 1;
+/** Number of recent inventory items remembered per peer, and the false-positive rate for forgetting one early */
+static const unsigned int INVENTORY_KNOWN_FILTER_SIZE = 10000;
+static const double INVENTORY_KNOWN_FILTER_FPRATE = 0.000001;
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
@@ -167,6 +181,10 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    double dTxRelayDelay;
+    double dMasternodeRelayDelay;
+    uint64_t nInvSent;
+    uint64_t nInvMessagesSent;
 };
 
 
@@ -286,6 +304,9 @@ protected:
     // Basic fuzz-testing
     void Fuzz(int nChance); // modifies ssSend
 
+    //! Key of inv in filterInventoryKnown: its serialization, so the type is part of it
+    static std::vector<unsigned char> InventoryKnownKey(const CInv& inv);
+
 public:
     uint256 hashContinue;
     int nStartingHeight;
@@ -297,9 +318,22 @@ public:
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
+    CRollingBloomFilter filterInventoryKnown;
+    //! Announced on the next SendMessages call: blocks, InstantX, sporks and darksend broadcasts
     std::vector<CInv> vInventoryToSend;
+    //! Transactions to announce once nNextInvSend passes, with the time (usec) each was queued
+    std::map<uint256, int64_t> mapInventoryTxToSend;
+    //! Masternode and budget items to announce once nNextMasternodeInvSend passes, in queue order
+    std::vector<std::pair<CInv, int64_t> > vInventoryMasternodeToSend;
+    int64_t nNextInvSend;
+    int64_t nNextMasternodeInvSend;
+    //! Moving averages (usec) of the time announcements spent queued, for tuning the intervals above
+    int64_t nTxRelayDelayAvg;
+    int64_t nMasternodeRelayDelayAvg;
+    uint64_t nInvSent;
+    uint64_t nInvMessagesSent;
     CCriticalSection cs_inventory;
+    std::set<CInv> setAskFor;
     std::multimap<int64_t, CInv> mapAskFor;
 
     // Ping time measurement:
@@ -390,23 +424,32 @@ public:
     }
 
 
-    void AddInventoryKnown(const CInv& inv)
+    /**
+     * Whether the peer is known to have inv. Items are told apart by type as
+     * well as hash, since MSG_TX, MSG_TXLOCK_REQUEST and MSG_DSTX all carry
+     * the transaction hash. Callers should hold cs_inventory.
+     */
+    bool HasInventoryKnown(const CInv& inv) const
     {
-        {
-            LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
-        }
+        return filterInventoryKnown.contains(InventoryKnownKey(inv));
     }
 
-    void PushInventory(const CInv& inv)
+    void SetInventoryKnown(const CInv& inv)
+    {
+        filterInventoryKnown.insert(InventoryKnownKey(inv));
+    }
+
+    void AddInventoryKnown(const CInv& inv)
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
-                vInventoryToSend.push_back(inv);
+            SetInventoryKnown(inv);
         }
     }
 
+    void PushInventory(const CInv& inv);
+    void TrimInventoryTxToSend();
+
     void AskFor(const CInv& inv);
 
     // TODO: Document the postcondition of this function.  Is cs_vSend locked?
@@ -701,6 +744,9 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss);
 void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll=false);    
 void RelayInv(CInv &inv, const int minProtoVersion = MIN_PEER_PROTO_VERSION);
 
+/** Return a timestamp in the future (in microseconds) for exponentially distributed events. */
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds);
+
 /** Access to the (IP) address database (peers.dat) */
 class CAddrDB
 {
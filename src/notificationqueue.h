@@ -0,0 +1,142 @@
+// Copyright (c) 2015 The Cintamani developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NOTIFICATIONQUEUE_H
+#define BITCOIN_NOTIFICATIONQUEUE_H
+
+#include <deque>
+
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+/**
+ * Ordered queue of notifications, delivered one at a time by a single
+ * background thread.
+ *
+ * Producers (typically holding cs_main) never block in Push(); back-pressure
+ * is applied separately with WaitBelow(), which must only be called by a
+ * thread that holds none of the locks the listeners take. While no thread is
+ * servicing the queue, Push() delivers synchronously, so code running
+ * before startup or after shutdown sees the old behaviour.
+ */
+class CNotificationQueue
+{
+public:
+    typedef boost::function<void()> Notification;
+
+private:
+    //! Protects all members below; never held while delivering
+    boost::mutex mutex;
+
+    //! The service thread blocks on this when out of work
+    boost::condition_variable condWork;
+
+    //! Producers waiting for room, and Flush(), block on this
+    boost::condition_variable condDelivered;
+
+    std::deque<Notification> queue;
+
+    //! Whether a thread is servicing the queue
+    bool fRunning;
+
+    //! Whether the service thread is delivering a notification right now
+    bool fDelivering;
+
+public:
+    CNotificationQueue() : fRunning(false), fDelivering(false) {}
+
+    //! Queue a notification, or deliver it right away if nothing services the queue
+    void Push(const Notification& notification)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fRunning) {
+                queue.push_back(notification);
+                condWork.notify_one();
+                return;
+            }
+        }
+        notification();
+    }
+
+    //! Whether a thread is servicing the queue
+    bool IsRunning()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return fRunning;
+    }
+
+    //! Number of notifications queued and not yet delivered
+    size_t Size()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return queue.size();
+    }
+
+    //! Wait until no more than nMax notifications are queued
+    void WaitBelow(size_t nMax)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (fRunning && queue.size() > nMax)
+            condDelivered.wait(lock);
+    }
+
+    //! Wait until everything queued so far has been delivered
+    void Flush()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (fRunning && (!queue.empty() || fDelivering))
+            condDelivered.wait(lock);
+    }
+
+    //! Service the queue until interrupted, then deliver what is left
+    void Thread()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fRunning)
+            return; // one thread at a time keeps the order
+        fRunning = true;
+        try {
+            while (true) {
+                while (queue.empty())
+                    condWork.wait(lock); // interruption point
+                Deliver(lock);
+            }
+        } catch (...) {
+            // Interrupted (or a listener threw): listeners must not miss
+            // anything that happened before shutdown
+            boost::this_thread::disable_interruption di;
+            while (!queue.empty())
+                Deliver(lock);
+            fRunning = false;
+            condDelivered.notify_all();
+            throw;
+        }
+    }
+
+private:
+    void Deliver(boost::unique_lock<boost::mutex>& lock)
+    {
+        Notification notification;
+        notification.swap(queue.front());
+        queue.pop_front();
+        fDelivering = true;
+        lock.unlock();
+        try {
+            notification();
+        } catch (...) {
+            lock.lock();
+            fDelivering = false;
+            throw;
+        }
+        lock.lock();
+        fDelivering = false;
+        condDelivered.notify_all();
+    }
+};
+
+#endif // BITCOIN_NOTIFICATIONQUEUE_H
@@ -9,6 +9,8 @@
 #include "tinyformat.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+
 std::string COutPoint::ToString() const
 {
     return strprintf("COutPoint(%s, %u)", hash.ToString()/*.substr(0,10)*/, n);
@@ -113,6 +115,14 @@ CTransaction& CTransaction::operator=(const CTransaction &tx) {
     return *this;
 }
 
+void CTransaction::Swap(CMutableTransaction &tx) {
+    std::swap(*const_cast<int32_t*>(&nVersion), tx.nVersion);
+    const_cast<std::vector<CTxIn>*>(&vin)->swap(tx.vin);
+    const_cast<std::vector<CTxOut>*>(&vout)->swap(tx.vout);
+    std::swap(*const_cast<uint32_t*>(&nLockTime), tx.nLockTime);
+    UpdateHash();
+}
+
 CAmount CTransaction::GetValueOut() const
 {
     CAmount nValueOut = 0;
@@ -202,6 +202,10 @@ public:
 
     CTransaction& operator=(const CTransaction& tx);
 
+    /** Exchange contents with a CMutableTransaction, for when tx is done
+     *  with: the inputs and outputs change hands instead of being copied. */
+    void Swap(CMutableTransaction &tx);
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -144,6 +144,24 @@ bool CInv::IsKnownType() const
     return (type >= 1 && type < (int)ARRAYLEN(ppszTypeName));
 }
 
+bool CInv::IsMasternodeType() const
+{
+    switch (type) {
+    case MSG_MASTERNODE_WINNER:
+    case MSG_MASTERNODE_SCANNING_ERROR:
+    case MSG_BUDGET_VOTE:
+    case MSG_BUDGET_PROPOSAL:
+    case MSG_BUDGET_FINALIZED:
+    case MSG_BUDGET_FINALIZED_VOTE:
+    case MSG_MASTERNODE_QUORUM:
+    case MSG_MASTERNODE_ANNOUNCE:
+    case MSG_MASTERNODE_PING:
+        return true;
+    default:
+        return false;
+    }
+}
+
 const char* CInv::GetCommand() const
 {
     if (!IsKnownType())
@@ -132,6 +132,8 @@ public:
     friend bool operator<(const CInv& a, const CInv& b);
 
     bool IsKnownType() const;
+    //! Masternode list, payment and budget items, which are relayed on their own schedule
+    bool IsMasternodeType() const;
     const char* GetCommand() const;
     std::string ToString() const;
 
@@ -9,14 +9,21 @@
 #include "rpcserver.h"
 #include "streams.h"
 #include "sync.h"
+#include "txmempool.h"
 #include "utilstrencodings.h"
 #include "version.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/foreach.hpp>
 
 using namespace std;
 using namespace json_spirit;
 
+//! Maximum number of headers /rest/headers returns at once
+static const size_t MAX_REST_HEADERS_RESULTS = 2000;
+//! Maximum number of outpoints /rest/getutxos looks up at once
+static const size_t MAX_GETUTXOS_OUTPOINTS = 15;
+
 enum RetFormat {
     RF_UNDEF,
     RF_BINARY,
@@ -41,8 +48,29 @@ public:
     string message;
 };
 
+/** An unspent output as returned by /rest/getutxos, in the BIP64 layout */
+struct CCoin {
+    uint32_t nTxVer; // Don't call this nVersion, that name has a special meaning inside ADD_SERIALIZE_METHODS
+    uint32_t nHeight;
+    CTxOut out;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nTxVer);
+        READWRITE(nHeight);
+        READWRITE(out);
+    }
+};
+
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry);
+extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, Object& out, bool fIncludeHex);
 extern Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern Object blockHeaderToJSON(const CBlock& block, const CBlockIndex* blockindex);
+extern void mempoolToJSON(CJSONWriter& result, bool fVerbose = false);
+extern Object mempoolInfoToJSON();
 
 static RestErr RESTERR(enum HTTPStatusCode status, string message)
 {
@@ -89,6 +117,111 @@ static bool ParseHashStr(const string& strReq, uint256& v)
     return true;
 }
 
+/**
+ * Send the serialized block straight from its block file, a chunk at a time,
+ * as binary or as hex. The size is known up front, so the reply carries a
+ * Content-Length and works for HTTP/1.0 clients too.
+ */
+static bool SendRawBlock(AcceptedConnection* conn, const CBlockIndex* pblockindex, const string& hashStr, bool fHex, bool fRun)
+{
+    CRawBlockReader reader;
+    if (!reader.Open(pblockindex->GetBlockPos()))
+        throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
+
+    if (fHex)
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, 2 * (size_t)reader.GetSize() + 1, "text/plain");
+    else
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, reader.GetSize(), "application/octet-stream");
+
+    const unsigned char* pch;
+    size_t nChunk;
+    while ((nChunk = reader.Read(pch, HTTP_CHUNK_SIZE)) > 0) {
+        if (fHex)
+            conn->stream() << HexStr(pch, pch + nChunk);
+        else
+            conn->stream().write((const char*)pch, nChunk);
+    }
+    if (!reader.IsComplete())
+        return false; // the reply has been cut short, drop the connection
+    if (fHex)
+        conn->stream() << "\n";
+    conn->stream() << std::flush;
+    return true;
+}
+
+static bool rest_headers(AcceptedConnection* conn,
+                         string& strReq,
+                         map<string, string>& mapHeaders,
+                         bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        throw RESTERR(HTTP_BAD_REQUEST, "No header count specified. Use /rest/headers/<count>/<hash>.<ext>.");
+
+    long count = strtol(path[0].c_str(), NULL, 10);
+    if (count < 1 || (size_t)count > MAX_REST_HEADERS_RESULTS)
+        throw RESTERR(HTTP_BAD_REQUEST, "Header count out of range: " + path[0]);
+
+    string hashStr = path[1];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    // Headers along the active chain, starting at hash
+    vector<const CBlockIndex*> headers;
+    headers.reserve(count);
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        const CBlockIndex* pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
+        while (pindex != NULL && chainActive.Contains(pindex)) {
+            headers.push_back(pindex);
+            if (headers.size() == (size_t)count)
+                break;
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_FOREACH(const CBlockIndex* pindex, headers)
+        ssHeader << pindex->GetBlockHeader();
+
+    switch (rf) {
+    case RF_BINARY: {
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, ssHeader.size(), "application/octet-stream");
+        conn->stream().write(&ssHeader[0], ssHeader.size());
+        conn->stream() << std::flush;
+        return true;
+    }
+
+    case RF_HEX: {
+        string strHex = HexStr(ssHeader.begin(), ssHeader.end()) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        return true;
+    }
+
+    case RF_JSON: {
+        Array jsonHeaders;
+        BOOST_FOREACH(const CBlockIndex* pindex, headers)
+            jsonHeaders.push_back(blockHeaderToJSON(CBlock(pindex->GetBlockHeader()), pindex));
+        string strJSON = write_string(Value(jsonHeaders), false) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: .bin, .hex, .json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static bool rest_block(AcceptedConnection* conn,
                        string& strReq,
                        map<string, string>& mapHeaders,
@@ -103,7 +236,6 @@ static bool rest_block(AcceptedConnection* conn,
     if (!ParseHashStr(hashStr, hash))
         throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
-    CBlock block;
     CBlockIndex* pblockindex = NULL;
     {
         LOCK(cs_main);
@@ -111,27 +243,22 @@ static bool rest_block(AcceptedConnection* conn,
             throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
 
         pblockindex = mapBlockIndex[hash];
-        if (!ReadBlockFromDisk(block, pblockindex))
-            throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
-
     switch (rf) {
-    case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
-        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryBlock.size(), "application/octet-stream") << binaryBlock << std::flush;
-        return true;
-    }
+    case RF_BINARY:
+        return SendRawBlock(conn, pblockindex, hashStr, false, fRun);
 
-    case RF_HEX: {
-        string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
-        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
-        return true;
-    }
+    case RF_HEX:
+        return SendRawBlock(conn, pblockindex, hashStr, true, fRun);
 
     case RF_JSON: {
+        CBlock block;
+        {
+            LOCK(cs_main);
+            if (!ReadBlockFromDisk(block, pblockindex))
+                throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
+        }
         Object objBlock = blockToJSON(block, pblockindex, showTxDetails);
         string strJSON = write_string(Value(objBlock), false) + "\n";
         conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
@@ -214,6 +341,223 @@ static bool rest_tx(AcceptedConnection* conn,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_chaininfo(AcceptedConnection* conn,
+                           string& strReq,
+                           map<string, string>& mapHeaders,
+                           bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    switch (rf) {
+    case RF_JSON: {
+        Value chainInfo;
+        {
+            LOCK(cs_main);
+            chainInfo = getblockchaininfo(Array(), false);
+        }
+        string strJSON = write_string(chainInfo, false) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_mempool_info(AcceptedConnection* conn,
+                              string& strReq,
+                              map<string, string>& mapHeaders,
+                              bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    switch (rf) {
+    case RF_JSON: {
+        Object mempoolInfo;
+        {
+            LOCK(mempool.cs);
+            mempoolInfo = mempoolInfoToJSON();
+        }
+        string strJSON = write_string(Value(mempoolInfo), false) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_mempool_contents(AcceptedConnection* conn,
+                                  string& strReq,
+                                  map<string, string>& mapHeaders,
+                                  bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    switch (rf) {
+    case RF_JSON: {
+        std::ostringstream os;
+        {
+            LOCK(cs_main);
+            CJSONWriter result(os);
+            mempoolToJSON(result, true);
+        }
+        os << "\n";
+        conn->stream() << HTTPReply(HTTP_OK, os.str(), fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_getutxos(AcceptedConnection* conn,
+                          string& strReq,
+                          map<string, string>& mapHeaders,
+                          bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    // Outpoints are passed in the URI: /rest/getutxos[/checkmempool]/<txid>-<n>/<txid>-<n>/...
+    vector<string> uriParts;
+    boost::split(uriParts, params[0], boost::is_any_of("/"));
+    uriParts.erase(std::remove(uriParts.begin(), uriParts.end(), string()), uriParts.end());
+
+    bool fCheckMemPool = false;
+    size_t nFirst = 0;
+    if (!uriParts.empty() && uriParts[0] == "checkmempool") {
+        fCheckMemPool = true;
+        nFirst = 1;
+    }
+
+    vector<COutPoint> vOutPoints;
+    for (size_t i = nFirst; i < uriParts.size(); i++) {
+        size_t nDash = uriParts[i].find('-');
+        if (nDash == string::npos)
+            throw RESTERR(HTTP_BAD_REQUEST, "Parse error");
+        string strTxid = uriParts[i].substr(0, nDash);
+        int32_t nOutput;
+        uint256 txid;
+        if (!ParseInt32(uriParts[i].substr(nDash + 1), &nOutput) || nOutput < 0 || !ParseHashStr(strTxid, txid))
+            throw RESTERR(HTTP_BAD_REQUEST, "Parse error");
+        vOutPoints.push_back(COutPoint(txid, (uint32_t)nOutput));
+    }
+
+    if (vOutPoints.empty())
+        throw RESTERR(HTTP_BAD_REQUEST, "Error: empty request");
+    if (vOutPoints.size() > MAX_GETUTXOS_OUTPOINTS)
+        throw RESTERR(HTTP_BAD_REQUEST, strprintf("Error: max outpoints exceeded (max: %d, tried: %d)", MAX_GETUTXOS_OUTPOINTS, vOutPoints.size()));
+
+    // Check spentness and form a bitmap, plus a human-readable version of it for JSON
+    vector<unsigned char> bitmap((vOutPoints.size() + 7) / 8, 0);
+    vector<CCoin> outs;
+    string bitmapStringRepresentation;
+    int nChainHeight;
+    uint256 hashChainTip;
+    {
+        LOCK2(cs_main, mempool.cs);
+
+        CCoinsView viewDummy;
+        CCoinsViewCache view(&viewDummy);
+        CCoinsViewMemPool viewMempool(pcoinsTip, mempool);
+        if (fCheckMemPool)
+            view.SetBackend(viewMempool); // include the mempool
+        else
+            view.SetBackend(*pcoinsTip);
+
+        for (size_t i = 0; i < vOutPoints.size(); i++) {
+            CCoins coins;
+            const uint256& hash = vOutPoints[i].hash;
+            bool fHit = false;
+            if (view.GetCoins(hash, coins)) {
+                mempool.pruneSpent(hash, coins);
+                if (coins.IsAvailable(vOutPoints[i].n)) {
+                    fHit = true;
+                    CCoin coin;
+                    coin.nTxVer = coins.nVersion;
+                    coin.nHeight = coins.nHeight;
+                    coin.out = coins.vout.at(vOutPoints[i].n);
+                    outs.push_back(coin);
+                }
+            }
+            if (fHit)
+                bitmap[i / 8] |= (1 << (i % 8));
+            bitmapStringRepresentation.append(fHit ? "1" : "0");
+        }
+
+        nChainHeight = chainActive.Height();
+        hashChainTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        // The same layout as BIP64
+        CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
+        ssGetUTXOResponse << nChainHeight << hashChainTip << bitmap << outs;
+
+        if (rf == RF_HEX) {
+            string strHex = HexStr(ssGetUTXOResponse.begin(), ssGetUTXOResponse.end()) + "\n";
+            conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        } else {
+            string strBinary = ssGetUTXOResponse.str();
+            conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, strBinary.size(), "application/octet-stream") << strBinary << std::flush;
+        }
+        return true;
+    }
+
+    case RF_JSON: {
+        Object objGetUTXOResponse;
+        objGetUTXOResponse.push_back(Pair("chainHeight", nChainHeight));
+        objGetUTXOResponse.push_back(Pair("chaintipHash", hashChainTip.GetHex()));
+        objGetUTXOResponse.push_back(Pair("bitmap", bitmapStringRepresentation));
+
+        Array utxos;
+        BOOST_FOREACH(const CCoin& coin, outs) {
+            Object utxo;
+            utxo.push_back(Pair("txvers", (int32_t)coin.nTxVer));
+            utxo.push_back(Pair("height", (int32_t)coin.nHeight));
+            utxo.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
+            Object o;
+            ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
+            utxo.push_back(Pair("scriptPubKey", o));
+            utxos.push_back(utxo);
+        }
+        objGetUTXOResponse.push_back(Pair("utxos", utxos));
+
+        string strJSON = write_string(Value(objGetUTXOResponse), false) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(AcceptedConnection* conn,
@@ -224,6 +568,11 @@ static const struct {
       {"/rest/tx/", rest_tx},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
+      {"/rest/chaininfo", rest_chaininfo},
+      {"/rest/mempool/info", rest_mempool_info},
+      {"/rest/mempool/contents", rest_mempool_contents},
+      {"/rest/headers/", rest_headers},
+      {"/rest/getutxos", rest_getutxos},
 };
 
 bool HTTPReq_REST(AcceptedConnection* conn,
@@ -5,6 +5,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "checkpoints.h"
+#include "clientversion.h"
 #include "main.h"
 #include "rpcserver.h"
 #include "sync.h"
@@ -12,6 +13,8 @@
 
 #include <stdint.h>
 
+#include <boost/filesystem.hpp>
+
 #include "json/json_spirit_value.h"
 
 using namespace json_spirit;
@@ -156,7 +159,49 @@ Value getdifficulty(const Array& params, bool fHelp)
 }
 
 
-Value getrawmempool(const Array& params, bool fHelp)
+void mempoolToJSON(CJSONWriter& result, bool fVerbose)
+{
+    if (fVerbose)
+    {
+        LOCK(mempool.cs);
+        result.BeginObject();
+        BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx)
+        {
+            const uint256& hash = entry.first;
+            const CTxMemPoolEntry& e = entry.second;
+            Object info;
+            info.push_back(Pair("size", (int)e.GetTxSize()));
+            info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
+            info.push_back(Pair("time", e.GetTime()));
+            info.push_back(Pair("height", (int)e.GetHeight()));
+            info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
+            info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+            const CTransaction& tx = e.GetTx();
+            set<string> setDepends;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            {
+                if (mempool.exists(txin.prevout.hash))
+                    setDepends.insert(txin.prevout.hash.ToString());
+            }
+            Array depends(setDepends.begin(), setDepends.end());
+            info.push_back(Pair("depends", depends));
+            result.Pair(hash.ToString(), info);
+        }
+        result.EndObject();
+    }
+    else
+    {
+        vector<uint256> vtxid;
+        mempool.queryHashes(vtxid);
+
+        result.BeginArray();
+        BOOST_FOREACH(const uint256& hash, vtxid)
+            result.Write(hash.ToString());
+        result.EndArray();
+    }
+}
+
+void getrawmempool(const Array& params, bool fHelp, CJSONWriter& result)
 {
     if (fHelp || params.size() > 1)
         throw runtime_error(
@@ -192,45 +237,7 @@ Value getrawmempool(const Array& params, bool fHelp)
     if (params.size() > 0)
         fVerbose = params[0].get_bool();
 
-    if (fVerbose)
-    {
-        LOCK(mempool.cs);
-        Object o;
-        BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx)
-        {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
-            Object info;
-            info.push_back(Pair("size", (int)e.GetTxSize()));
-            info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
-            info.push_back(Pair("time", e.GetTime()));
-            info.push_back(Pair("height", (int)e.GetHeight()));
-            info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
-            info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
-            const CTransaction& tx = e.GetTx();
-            set<string> setDepends;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                if (mempool.exists(txin.prevout.hash))
-                    setDepends.insert(txin.prevout.hash.ToString());
-            }
-            Array depends(setDepends.begin(), setDepends.end());
-            info.push_back(Pair("depends", depends));
-            o.push_back(Pair(hash.ToString(), info));
-        }
-        return o;
-    }
-    else
-    {
-        vector<uint256> vtxid;
-        mempool.queryHashes(vtxid);
-
-        Array a;
-        BOOST_FOREACH(const uint256& hash, vtxid)
-            a.push_back(hash.ToString());
-
-        return a;
-    }
+    mempoolToJSON(result, fVerbose);
 }
 
 Value getblockhash(const Array& params, bool fHelp)
@@ -305,17 +312,18 @@ Value getblock(const Array& params, bool fHelp)
     CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
-    if(!ReadBlockFromDisk(block, pblockindex))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
-
     if (!fVerbose)
     {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        // The stored bytes are the network serialization, no need to decode and re-encode them
+        std::vector<unsigned char> vchBlock;
+        if(!ReadRawBlockFromDisk(vchBlock, pblockindex))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        return HexStr(vchBlock.begin(), vchBlock.end());
     }
 
+    if(!ReadBlockFromDisk(block, pblockindex))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
     return blockToJSON(block, pblockindex);
 }
 
@@ -374,11 +382,14 @@ Value getblockheader(const Array& params, bool fHelp)
 
 Value gettxoutsetinfo(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( hash )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time unless hash is false.\n"
+            "\nArguments:\n"
+            "1. hash          (boolean, optional, default=true) Scan the whole set to compute hash_serialized_2,\n"
+            "                 false returns the running counters instantly (if they are available)\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -386,30 +397,153 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized_2\": \"hash\", (string) Hash over the set, computed in 16 key ranges (only with hash=true)\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "false")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    bool fHash = true;
+    if (params.size() > 0)
+        fHash = params[0].get_bool();
+
     Object ret;
 
     CCoinsStats stats;
     FlushStateToDisk();
-    if (pcoinsTip->GetStats(stats)) {
+    // The scan runs on a database snapshot, cs_main is not held meanwhile
+    bool fStats = (!fHash && pcoinsTip->GetRunningStats(stats));
+    if (!fStats) {
+        stats = CCoinsStats();
+        fStats = pcoinsTip->GetStats(stats);
+        fHash = true;
+    }
+    if (fStats) {
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
-        ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+        if (fHash)
+            ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     }
     return ret;
 }
 
+//! Snapshot files are looked up relative to the data directory unless given as absolute paths
+static boost::filesystem::path GetTxOutSetPath(const std::string& strPath)
+{
+    boost::filesystem::path path(strPath);
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+    return path;
+}
+
+Value dumptxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"filename\"\n"
+            "\nWrite the unspent transaction output set to a checksummed snapshot file that\n"
+            "loadtxoutset can bootstrap a new node from. The chainstate is flushed first and\n"
+            "the set is dumped as of the block it was flushed at.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The file to write, relative to the data directory\n"
+            "                  unless absolute. It must not exist yet.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\": n,              (numeric) Height of the block the set belongs to\n"
+            "  \"bestblock\": \"hex\",       (string) Hash of that block\n"
+            "  \"transactions\": n,        (numeric) The number of transactions written\n"
+            "  \"hash_serialized_2\": \"hash\", (string) Hash over the set, as reported by gettxoutsetinfo\n"
+            "  \"path\": \"path\"            (string) The file written\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = GetTxOutSetPath(params[0].get_str());
+    boost::filesystem::path pathTmp = path.string() + ".incomplete";
+    if (boost::filesystem::exists(path) || boost::filesystem::exists(pathTmp))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    CCoinsStats stats;
+    std::string strError;
+    bool fOk = false;
+    {
+        CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (fileout.IsNull())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Couldn't open " + pathTmp.string() + " for writing");
+        try {
+            fOk = DumpTxOutSet(fileout, stats, strError);
+        } catch (const std::exception& e) {
+            strError = e.what();
+        }
+    }
+    if (!fOk) {
+        boost::filesystem::remove(pathTmp);
+        throw JSONRPCError(RPC_MISC_ERROR, "Dumping the UTXO set failed: " + strError);
+    }
+    boost::filesystem::rename(pathTmp, path);
+
+    Object ret;
+    ret.push_back(Pair("height", (int64_t)stats.nHeight));
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
+Value loadtxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "loadtxoutset \"filename\"\n"
+            "\nReplace the chainstate with a snapshot written by dumptxoutset and continue the\n"
+            "active chain from the block it was taken at. Only possible before the node has\n"
+            "connected any block, once the headers up to that block are known, and only with\n"
+            "-litemode. The snapshot must be one this version lists for the network, and the\n"
+            "loaded set must match the hash_serialized_2 listed for it.\n"
+            "Blocks below the snapshot are never downloaded or validated, not even in the\n"
+            "background; -reindex without the snapshot does that.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The snapshot, relative to the data directory unless absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\": n,              (numeric) The new chain height\n"
+            "  \"bestblock\": \"hex\",       (string) The new tip\n"
+            "  \"transactions\": n,        (numeric) The number of transactions loaded\n"
+            "  \"hash_serialized_2\": \"hash\" (string) Hash over the loaded set\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = GetTxOutSetPath(params[0].get_str());
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Couldn't open " + path.string());
+
+    CCoinsStats stats;
+    std::string strError;
+    if (!LoadTxOutSet(filein, stats, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, "Loading the UTXO set failed: " + strError);
+
+    Object ret;
+    ret.push_back(Pair("height", (int64_t)stats.nHeight));
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+    return ret;
+}
+
 Value gettxout(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -649,6 +783,15 @@ Value getchaintips(const Array& params, bool fHelp)
     return res;
 }
 
+Object mempoolInfoToJSON()
+{
+    Object ret;
+    ret.push_back(Pair("size", (int64_t) mempool.size()));
+    ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
+
+    return ret;
+}
+
 Value getmempoolinfo(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -665,11 +808,7 @@ Value getmempoolinfo(const Array& params, bool fHelp)
             + HelpExampleRpc("getmempoolinfo", "")
         );
 
-    Object ret;
-    ret.push_back(Pair("size", (int64_t) mempool.size()));
-    ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
-
-    return ret;
+    return mempoolInfoToJSON();
 }
 
 Value invalidateblock(const Array& params, bool fHelp)
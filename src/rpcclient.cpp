@@ -79,6 +79,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "signrawtransaction", 2 },
     { "sendrawtransaction", 1 },
     { "gettxout", 1 },
+    { "gettxoutsetinfo", 0 },
     { "gettxout", 2 },
     { "lockunspent", 0 },
     { "lockunspent", 1 },
@@ -93,6 +94,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "prioritisetransaction", 1 },
     { "prioritisetransaction", 2 },
     { "spork", 1 },
+    { "masternodelist", 2 },
     { "mnbudget", 3 },
     { "mnbudget", 4 },
     { "mnbudget", 6 },
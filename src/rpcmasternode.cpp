@@ -153,7 +153,7 @@ Value masternode(const Array& params, bool fHelp)
     {
         Array newParams(params.size() - 1);
         std::copy(params.begin() + 1, params.end(), newParams.begin());
-        return masternodelist(newParams, fHelp);
+        return tableRPC.execute("masternodelist", newParams);
     }
 
     if (strCommand == "budget")
@@ -186,23 +186,27 @@ Value masternode(const Array& params, bool fHelp)
         if (params.size() > 2){
             throw runtime_error("too many parameters\n");
         }
+        boost::shared_ptr<const CMasternodeListView> pView = mnodeman.GetListView();
         if (params.size() == 2)
         {
-            int nCount = 0;
+            if(params[1] == "ds") return pView->nCountDarksend;
+            if(params[1] == "enabled") return pView->nCountEnabled;
 
-            if(chainActive.Tip())
-                mnodeman.GetNextMasternodeInQueueForPayment(chainActive.Tip()->nHeight, true, nCount);
+            // the payment queue is the one count that still walks the list itself
+            int nCount = 0;
+            if(params[1] == "qualify" || params[1] == "all") {
+                if(pView->nHeight >= 0)
+                    mnodeman.GetNextMasternodeInQueueForPayment(pView->nHeight, true, nCount);
+            }
 
-            if(params[1] == "ds") return mnodeman.CountEnabled(MIN_POOL_PEER_PROTO_VERSION);
-            if(params[1] == "enabled") return mnodeman.CountEnabled();
             if(params[1] == "qualify") return nCount;
             if(params[1] == "all") return strprintf("Total: %d (DS Compatible: %d / Enabled: %d / Qualify: %d)",
-                                                    mnodeman.size(),
-                                                    mnodeman.CountEnabled(MIN_POOL_PEER_PROTO_VERSION),
-                                                    mnodeman.CountEnabled(),
+                                                    (int)pView->vEntries.size(),
+                                                    pView->nCountDarksend,
+                                                    pView->nCountEnabled,
                                                     nCount);
         }
-        return mnodeman.size();
+        return (int)pView->vEntries.size();
     }
 
     if (strCommand == "current")
@@ -231,7 +235,7 @@ Value masternode(const Array& params, bool fHelp)
             return activeMasternode.GetStatus();
 
         CTxIn vin = CTxIn();
-        CPubKey pubkey = CScript();
+        CPubKey pubkey = CPubKey();
         CKey key;
         bool found = activeMasternode.GetMasterNodeVin(vin, pubkey, key);
         if(!found){
@@ -517,25 +521,102 @@ Value masternode(const Array& params, bool fHelp)
     return Value::null;
 }
 
-Value masternodelist(const Array& params, bool fHelp)
+// Write a masternode list entry in the given masternodelist mode, unless the filter excludes it
+static void MasternodeListEntryToJSON(const CMasternodeListEntry& entry, const std::string& strMode, const std::string& strFilter, CJSONWriter& result)
+{
+    const std::string& strVin = entry.strVin;
+    if (strMode == "activeseconds") {
+        if(strFilter !="" && strVin.find(strFilter) == string::npos) return;
+        result.Pair(strVin,       entry.nActiveSeconds);
+    } else if (strMode == "addr") {
+        if(strFilter !="" && entry.vin.prevout.hash.ToString().find(strFilter) == string::npos &&
+            strVin.find(strFilter) == string::npos) return;
+        result.Pair(strVin,       entry.strAddr);
+    } else if (strMode == "full") {
+        std::ostringstream addrStream;
+        addrStream << setw(21) << strVin;
+
+        std::ostringstream stringStream;
+        stringStream << setw(9) <<
+                       entry.strStatus << " " <<
+                       entry.protocolVersion << " " <<
+                       entry.strPubKey << " " << setw(21) <<
+                       entry.strAddr << " " <<
+                       entry.nLastSeen << " " << setw(8) <<
+                       entry.nActiveSeconds << " " <<
+                       entry.nLastPaid;
+        std::string output = stringStream.str();
+        stringStream << " " << strVin;
+        if(strFilter !="" && stringStream.str().find(strFilter) == string::npos &&
+                strVin.find(strFilter) == string::npos) return;
+        result.Pair(addrStream.str(), output);
+    } else if (strMode == "lastseen") {
+        if(strFilter !="" && strVin.find(strFilter) == string::npos) return;
+        result.Pair(strVin,       entry.nLastSeen);
+    } else if (strMode == "lastpaid"){
+        if(strFilter !="" && entry.vin.prevout.hash.ToString().find(strFilter) == string::npos &&
+            strVin.find(strFilter) == string::npos) return;
+        result.Pair(strVin,      entry.nLastPaid);
+    } else if (strMode == "protocol") {
+        if(strFilter !="" && strFilter != strprintf("%d", entry.protocolVersion) &&
+            strVin.find(strFilter) == string::npos) return;
+        result.Pair(strVin,       (int64_t)entry.protocolVersion);
+    } else if (strMode == "pubkey") {
+        if(strFilter !="" && entry.strPubKey.find(strFilter) == string::npos &&
+            strVin.find(strFilter) == string::npos) return;
+        result.Pair(strVin,       entry.strPubKey);
+    } else if (strMode == "rank") {
+        if(entry.nRank == 0) return;
+        if(strFilter !="" && strVin.find(strFilter) == string::npos) return;
+        result.Pair(strVin,       entry.nRank);
+    } else if(strMode == "status") {
+        if(strFilter !="" && strVin.find(strFilter) == string::npos && entry.strStatus.find(strFilter) == string::npos) return;
+        result.Pair(strVin,       entry.strStatus);
+    }
+}
+
+struct CompareListEntryRank
+{
+    bool operator()(const CMasternodeListEntry* a, const CMasternodeListEntry* b) const
+    {
+        return a->nRank < b->nRank;
+    }
+};
+
+void masternodelist(const Array& params, bool fHelp, CJSONWriter& result)
 {
     std::string strMode = "status";
     std::string strFilter = "";
+    bool fSince = false;
+    uint64_t nSinceVersion = 0;
 
     if (params.size() >= 1) strMode = params[0].get_str();
-    if (params.size() == 2) strFilter = params[1].get_str();
+    if (params.size() >= 2) strFilter = params[1].get_str();
+    if (params.size() >= 3) {
+        // "masternode list" passes everything through as strings
+        int64_t nSince = params[2].type() == str_type ? atoi64(params[2].get_str()) : params[2].get_int64();
+        if (nSince < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid sinceversion");
+        fSince = true;
+        nSinceVersion = nSince;
+    }
 
-    if (fHelp ||
+    if (fHelp || params.size() > 3 ||
             (strMode != "status" && strMode != "vin" && strMode != "pubkey" && strMode != "lastseen" && strMode != "activeseconds" && strMode != "rank" && strMode != "addr"
                 && strMode != "protocol" && strMode != "full" && strMode != "lastpaid"))
     {
         throw runtime_error(
-                "masternodelist ( \"mode\" \"filter\" )\n"
+                "masternodelist ( \"mode\" \"filter\" sinceversion )\n"
                 "Get a list of masternodes in different modes\n"
                 "\nArguments:\n"
                 "1. \"mode\"      (string, optional/required to use filter, defaults = status) The mode to run list in\n"
                 "2. \"filter\"    (string, optional) Filter results. Partial match by IP by default in all modes,\n"
                 "                                    additional matches in some modes are also available\n"
+                "3. sinceversion  (numeric, optional) Only return masternodes changed after this list version,\n"
+                "                 as {\"version\", \"full\", \"masternodes\", \"removed\"}. If \"full\" is true the\n"
+                "                 version was too old (or unknown) and \"masternodes\" holds the whole list.\n"
+                "                 Ranks, last paid times, last seen times and active seconds are not versioned:\n"
+                "                 the rank, lastpaid, lastseen and activeseconds modes always return the whole list\n"
                 "\nAvailable modes:\n"
                 "  activeseconds  - Print number of seconds masternode recognized by the network as enabled\n"
                 "                   (since latest issued \"masternode start/start-many/start-alias\")\n"
@@ -553,69 +634,46 @@ Value masternodelist(const Array& params, bool fHelp)
                 );
     }
 
-    Object obj;
-    if (strMode == "rank") {
-        std::vector<pair<int, CMasternode> > vMasternodeRanks = mnodeman.GetMasternodeRanks(chainActive.Tip()->nHeight);
-        BOOST_FOREACH(PAIRTYPE(int, CMasternode)& s, vMasternodeRanks) {
-            std::string strVin = s.second.vin.prevout.ToStringShort();
-            if(strFilter !="" && strVin.find(strFilter) == string::npos) continue;
-            obj.push_back(Pair(strVin,       s.first));
-        }
-    } else {
-        std::vector<CMasternode> vMasternodes = mnodeman.GetFullMasternodeVector();
-        BOOST_FOREACH(CMasternode& mn, vMasternodes) {
-            std::string strVin = mn.vin.prevout.ToStringShort();
-            if (strMode == "activeseconds") {
-                if(strFilter !="" && strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,       (int64_t)(mn.lastPing.sigTime - mn.sigTime)));
-            } else if (strMode == "addr") {
-                if(strFilter !="" && mn.vin.prevout.hash.ToString().find(strFilter) == string::npos &&
-                    strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,       mn.addr.ToString()));
-            } else if (strMode == "full") {
-                std::ostringstream addrStream;
-                addrStream << setw(21) << strVin;
-
-                std::ostringstream stringStream;
-                stringStream << setw(9) <<
-                               mn.Status() << " " <<
-                               mn.protocolVersion << " " <<
-                               CBitcoinAddress(mn.pubkey.GetID()).ToString() << " " << setw(21) <<
-                               mn.addr.ToString() << " " <<
-                               (int64_t)mn.lastPing.sigTime << " " << setw(8) <<
-                               (int64_t)(mn.lastPing.sigTime - mn.sigTime) << " " <<
-                               (int64_t)mn.GetLastPaid();
-                std::string output = stringStream.str();
-                stringStream << " " << strVin;
-                if(strFilter !="" && stringStream.str().find(strFilter) == string::npos &&
-                        strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(addrStream.str(), output));
-            } else if (strMode == "lastseen") {
-                if(strFilter !="" && strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,       (int64_t)mn.lastPing.sigTime));
-            } else if (strMode == "lastpaid"){
-                if(strFilter !="" && mn.vin.prevout.hash.ToString().find(strFilter) == string::npos &&
-                    strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,      (int64_t)mn.GetLastPaid()));
-            } else if (strMode == "protocol") {
-                if(strFilter !="" && strFilter != strprintf("%d", mn.protocolVersion) &&
-                    strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,       (int64_t)mn.protocolVersion));
-            } else if (strMode == "pubkey") {
-                CBitcoinAddress address(mn.pubkey.GetID());
-
-                if(strFilter !="" && address.ToString().find(strFilter) == string::npos &&
-                    strVin.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,       address.ToString()));
-            } else if(strMode == "status") {
-                std::string strStatus = mn.Status();
-                if(strFilter !="" && strVin.find(strFilter) == string::npos && strStatus.find(strFilter) == string::npos) continue;
-                obj.push_back(Pair(strVin,       strStatus));
-            }
-        }
+    boost::shared_ptr<const CMasternodeListView> pView = mnodeman.GetListView();
+    // ranks and last paid times follow the tip and last seen times follow pings rather than list versions,
+    // so those modes always list everything
+    bool fUnversioned = strMode == "rank" || strMode == "lastpaid" || strMode == "lastseen" || strMode == "activeseconds";
+    bool fDelta = fSince && !fUnversioned && pView->HasChangesSince(nSinceVersion);
+
+    std::vector<const CMasternodeListEntry*> vEntries;
+    vEntries.reserve(pView->vEntries.size());
+    BOOST_FOREACH(const CMasternodeListEntry& entry, pView->vEntries) {
+        if (fDelta && entry.nVersion <= nSinceVersion) continue;
+        vEntries.push_back(&entry);
     }
-    return obj;
+    if (strMode == "rank")
+        std::sort(vEntries.begin(), vEntries.end(), CompareListEntryRank());
+
+    if (fSince) {
+        result.BeginObject();
+        result.Pair("version", (uint64_t)pView->nVersion);
+        result.Pair("full", !fDelta);
+        result.Key("masternodes");
+    }
+
+    result.BeginObject();
+    BOOST_FOREACH(const CMasternodeListEntry* pentry, vEntries)
+        MasternodeListEntryToJSON(*pentry, strMode, strFilter, result);
+    result.EndObject();
+
+    if (!fSince)
+        return;
 
+    result.Key("removed");
+    result.BeginArray();
+    if (fDelta) {
+        for (std::map<COutPoint, uint64_t>::const_iterator it = pView->mapRemoved.begin(); it != pView->mapRemoved.end(); ++it) {
+            if (it->second > nSinceVersion)
+                result.Write(it->first.ToStringShort());
+        }
+    }
+    result.EndArray();
+    result.EndObject();
 }
 
 bool DecodeHexVecMnb(std::vector<CMasternodeBroadcast>& vecMnb, std::string strHexMnb) {
@@ -192,6 +192,8 @@ Value setgenerate(const Array& params, bool fHelp)
             ++nHeight;
             blockHashes.push_back(pblock->GetHash().GetHex());
         }
+        // Let the wallet see the new coinbases before the caller asks for them
+        FlushValidationNotifications();
         return blockHashes;
     }
     else // Not -regtest: start generate thread, return immediately
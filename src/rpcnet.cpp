@@ -94,6 +94,10 @@ Value getpeerinfo(const Array& params, bool fHelp)
             "    \"conntime\": ttt,           (numeric) The connection time in seconds since epoch (Jan 1 1970 GMT)\n"
             "    \"pingtime\": n,             (numeric) ping time\n"
             "    \"pingwait\": n,             (numeric) ping wait\n"
+            "    \"txrelaydelay\": n,         (numeric) Average seconds a transaction announcement waited before being sent\n"
+            "    \"mnrelaydelay\": n,         (numeric) Average seconds a masternode or budget announcement waited before being sent\n"
+            "    \"invsent\": n,              (numeric) The total number of inventory items announced\n"
+            "    \"invmsgsent\": n,           (numeric) The total number of inv messages sent\n"
             "    \"version\": v,              (numeric) The peer version, such as 7001\n"
             "    \"subver\": \"/Cintamani Core:x.x.x/\",  (string) The string version\n"
             "    \"inbound\": true|false,     (boolean) Inbound (true) or Outbound (false)\n"
@@ -104,7 +108,9 @@ Value getpeerinfo(const Array& params, bool fHelp)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"inflightwindow\": n,       (numeric) How many blocks we currently allow in flight from this peer\n"
+            "    \"blockresponsetime\": n,    (numeric) Average time in seconds the peer takes to deliver a block\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -135,6 +141,10 @@ Value getpeerinfo(const Array& params, bool fHelp)
         obj.push_back(Pair("pingtime", stats.dPingTime));
         if (stats.dPingWait > 0.0)
             obj.push_back(Pair("pingwait", stats.dPingWait));
+        obj.push_back(Pair("txrelaydelay", stats.dTxRelayDelay));
+        obj.push_back(Pair("mnrelaydelay", stats.dMasternodeRelayDelay));
+        obj.push_back(Pair("invsent", stats.nInvSent));
+        obj.push_back(Pair("invmsgsent", stats.nInvMessagesSent));
         obj.push_back(Pair("version", stats.nVersion));
         // Use the sanitized form of subver here, to avoid tricksy remote peers from
         // corrupting or modifiying the JSON output by putting special characters in
@@ -151,6 +161,8 @@ Value getpeerinfo(const Array& params, bool fHelp)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("inflightwindow", statestats.nBlocksInFlightWindow));
+            obj.push_back(Pair("blockresponsetime", (double)statestats.nBlockResponseTimeAvg / 1e6));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
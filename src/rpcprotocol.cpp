@@ -129,6 +129,77 @@ string HTTPReply(int nStatus, const string& strMsg, bool keepalive,
     }
 }
 
+string HTTPChunkedReplyHeader(int nStatus, bool keepalive, const char *contentType)
+{
+    return strprintf(
+            "HTTP/1.1 %d %s\r\n"
+            "Date: %s\r\n"
+            "Connection: %s\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "Content-Type: %s\r\n"
+            "Server: cintamani-json-rpc/%s\r\n"
+            "\r\n",
+        nStatus,
+        httpStatusDescription(nStatus),
+        rfc1123Time(),
+        keepalive ? "keep-alive" : "close",
+        contentType,
+        FormatFullVersion());
+}
+
+HTTPChunkedStreamBuf::HTTPChunkedStreamBuf(std::ostream& streamIn, const std::string& strHeaderIn, size_t nChunkSize) :
+    stream(streamIn), strHeader(strHeaderIn), fStarted(false), vBuffer(std::max(nChunkSize, (size_t)1))
+{
+    setp(&vBuffer[0], &vBuffer[0] + vBuffer.size());
+}
+
+bool HTTPChunkedStreamBuf::WriteChunk()
+{
+    size_t nSize = pptr() - pbase();
+    if (nSize == 0)
+        return stream.good(); // a zero-length chunk would end the reply
+    if (!fStarted) {
+        stream << strHeader;
+        fStarted = true;
+    }
+    stream << strprintf("%x\r\n", nSize);
+    stream.write(pbase(), nSize);
+    stream << "\r\n";
+    setp(&vBuffer[0], &vBuffer[0] + vBuffer.size());
+    return stream.good();
+}
+
+HTTPChunkedStreamBuf::int_type HTTPChunkedStreamBuf::overflow(int_type ch)
+{
+    if (!WriteChunk())
+        return traits_type::eof();
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+int HTTPChunkedStreamBuf::sync()
+{
+    if (!WriteChunk())
+        return -1;
+    stream.flush();
+    return stream.good() ? 0 : -1;
+}
+
+bool HTTPChunkedStreamBuf::Finish()
+{
+    if (!WriteChunk())
+        return false;
+    if (!fStarted) {
+        stream << strHeader;
+        fStarted = true;
+    }
+    stream << "0\r\n\r\n" << std::flush;
+    return stream.good();
+}
+
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
                          string& http_method, string& http_uri)
 {
@@ -219,7 +290,33 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
         return HTTP_INTERNAL_SERVER_ERROR;
 
     // Read message
-    if (nLen > 0)
+    map<string, string>::const_iterator it = mapHeadersRet.find("transfer-encoding");
+    if (it != mapHeadersRet.end() && boost::iequals(it->second, "chunked"))
+    {
+        // Chunk sizes in hex, each chunk followed by CRLF, ending with an
+        // empty chunk and optional trailer headers
+        while (true)
+        {
+            string str;
+            std::getline(stream, str);
+            if (!stream)
+                return HTTP_INTERNAL_SERVER_ERROR;
+            size_t nChunk = strtoul(str.c_str(), NULL, 16);
+            if (nChunk == 0)
+                break;
+            if (nChunk > max_size - strMessageRet.size())
+                return HTTP_INTERNAL_SERVER_ERROR;
+            size_t ptr = strMessageRet.size();
+            strMessageRet.resize(ptr + nChunk);
+            stream.read(&strMessageRet[ptr], nChunk);
+            std::getline(stream, str);
+            if (!stream) // Connection lost while reading
+                return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        map<string, string> mapTrailers;
+        ReadHTTPHeaders(stream, mapTrailers);
+    }
+    else if (nLen > 0)
     {
         vector<char> vch;
         size_t ptr = 0;
@@ -279,10 +376,27 @@ Object JSONRPCReplyObj(const Value& result, const Value& error, const Value& id)
     return reply;
 }
 
+/**
+ * Write the same reply JSONRPCReplyObj() would build, without first copying
+ * the result into a reply object.
+ */
+void JSONRPCWriteReply(std::ostream& os, const Value& result, const Value& error, const Value& id)
+{
+    os << "{\"result\":";
+    write_stream(error.type() != null_type ? Value::null : result, os, false);
+    os << ",\"error\":";
+    write_stream(error, os, false);
+    os << ",\"id\":";
+    write_stream(id, os, false);
+    os << '}';
+}
+
 string JSONRPCReply(const Value& result, const Value& error, const Value& id)
 {
-    Object reply = JSONRPCReplyObj(result, error, id);
-    return write_string(Value(reply), false) + "\n";
+    ostringstream os;
+    JSONRPCWriteReply(os, result, error, id);
+    os << "\n";
+    return os.str();
 }
 
 Object JSONRPCError(int code, const string& message)
@@ -292,3 +406,68 @@ Object JSONRPCError(int code, const string& message)
     error.push_back(Pair("message", message));
     return error;
 }
+
+CJSONWriter::CJSONWriter(std::ostream& osIn, const std::string& strPrefixIn) :
+    os(osIn), strPrefix(strPrefixIn), fStarted(false), fAfterKey(false)
+{
+}
+
+void CJSONWriter::BeginValue()
+{
+    if (!fStarted) {
+        os << strPrefix;
+        fStarted = true;
+    }
+    if (fAfterKey) {
+        fAfterKey = false;
+    } else if (!vHasElements.empty()) {
+        if (vHasElements.back())
+            os << ',';
+        vHasElements.back() = true;
+    }
+}
+
+void CJSONWriter::BeginObject()
+{
+    BeginValue();
+    os << '{';
+    vHasElements.push_back(false);
+}
+
+void CJSONWriter::EndObject()
+{
+    assert(!vHasElements.empty() && !fAfterKey);
+    vHasElements.pop_back();
+    os << '}';
+}
+
+void CJSONWriter::BeginArray()
+{
+    BeginValue();
+    os << '[';
+    vHasElements.push_back(false);
+}
+
+void CJSONWriter::EndArray()
+{
+    assert(!vHasElements.empty());
+    vHasElements.pop_back();
+    os << ']';
+}
+
+void CJSONWriter::Key(const std::string& strKey)
+{
+    assert(!vHasElements.empty() && !fAfterKey);
+    if (vHasElements.back())
+        os << ',';
+    vHasElements.back() = true;
+    write_stream(Value(strKey), os, false);
+    os << ':';
+    fAfterKey = true;
+}
+
+void CJSONWriter::Write(const Value& value)
+{
+    BeginValue();
+    write_stream(value, os, false);
+}
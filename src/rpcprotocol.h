@@ -8,8 +8,10 @@
 
 #include <list>
 #include <map>
+#include <ostream>
 #include <stdint.h>
 #include <string>
+#include <vector>
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/asio.hpp>
@@ -147,6 +149,80 @@ private:
     boost::asio::ssl::stream<typename Protocol::socket>& stream;
 };
 
+//! Bytes of a streamed reply collected into each HTTP chunk
+static const size_t HTTP_CHUNK_SIZE = 64 * 1024;
+
+/**
+ * Output buffer that frames everything written through it with HTTP/1.1
+ * chunked transfer encoding, so a reply can be sent while it is still being
+ * serialized instead of first being built up as one string. The header is
+ * held back until the first chunk, so up to then the reply can be dropped.
+ */
+class HTTPChunkedStreamBuf : public std::streambuf
+{
+public:
+    explicit HTTPChunkedStreamBuf(std::ostream& streamIn, const std::string& strHeaderIn = "", size_t nChunkSize = HTTP_CHUNK_SIZE);
+
+    //! Send what is buffered followed by the terminating zero-length chunk
+    bool Finish();
+    //! Has any of the reply been sent yet?
+    bool IsStarted() const { return fStarted; }
+
+protected:
+    int_type overflow(int_type ch);
+    int sync();
+
+private:
+    std::ostream& stream;
+    std::string strHeader;
+    bool fStarted;
+    std::vector<char> vBuffer;
+
+    bool WriteChunk();
+};
+
+/**
+ * Writes JSON to a stream as it is produced, so RPC commands with large
+ * results don't build them as a json_spirit value first. The output is what
+ * write_string(value, false) would give. Nothing reaches the stream before
+ * the first value, which is preceded by the prefix, so until then the caller
+ * can still write something else, e.g. an error.
+ */
+class CJSONWriter
+{
+public:
+    explicit CJSONWriter(std::ostream& osIn, const std::string& strPrefixIn = "");
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    //! Name the next value of the current object
+    void Key(const std::string& strKey);
+    //! Write a whole value, or an element of the current array
+    void Write(const json_spirit::Value& value);
+    void Pair(const std::string& strKey, const json_spirit::Value& value)
+    {
+        Key(strKey);
+        Write(value);
+    }
+
+    //! Has anything been written yet?
+    bool IsStarted() const { return fStarted; }
+    //! Has exactly one whole value been written?
+    bool IsComplete() const { return fStarted && vHasElements.empty() && !fAfterKey; }
+
+private:
+    std::ostream& os;
+    std::string strPrefix;
+    bool fStarted;
+    bool fAfterKey;
+    //! For each open object or array, whether it has an element yet
+    std::vector<bool> vHasElements;
+
+    void BeginValue();
+};
+
 std::string HTTPPost(const std::string& strMsg, const std::map<std::string,std::string>& mapRequestHeaders);
 std::string HTTPError(int nStatus, bool keepalive,
                       bool headerOnly = false);
@@ -155,6 +231,8 @@ std::string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength,
 std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive,
                       bool headerOnly = false,
                       const char *contentType = "application/json");
+std::string HTTPChunkedReplyHeader(int nStatus, bool keepalive,
+                      const char *contentType = "application/json");
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
                          std::string& http_method, std::string& http_uri);
 int ReadHTTPStatus(std::basic_istream<char>& stream, int &proto);
@@ -163,6 +241,7 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, std::map<std::string, std:
                     std::string& strMessageRet, int nProto, size_t max_size);
 std::string JSONRPCRequest(const std::string& strMethod, const json_spirit::Array& params, const json_spirit::Value& id);
 json_spirit::Object JSONRPCReplyObj(const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& id);
+void JSONRPCWriteReply(std::ostream& os, const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& id);
 std::string JSONRPCReply(const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& id);
 json_spirit::Object JSONRPCError(int code, const std::string& message);
 
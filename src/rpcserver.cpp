@@ -21,6 +21,7 @@
 #include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
+#include <boost/function.hpp>
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/shared_ptr.hpp>
@@ -148,6 +149,7 @@ string CRPCTable::help(string strCommand) const
     string strRet;
     string category;
     set<rpcfn_type> setDone;
+    set<rpcstreamfn_type> setStreamDone;
     vector<pair<string, const CRPCCommand*> > vCommands;
 
     for (map<string, const CRPCCommand*>::const_iterator mi = mapCommands.begin(); mi != mapCommands.end(); ++mi)
@@ -171,9 +173,16 @@ string CRPCTable::help(string strCommand) const
         try
         {
             Array params;
-            rpcfn_type pfn = pcmd->actor;
-            if (setDone.insert(pfn).second)
-                (*pfn)(params, true);
+            if (pcmd->streamActor) {
+                std::ostringstream os;
+                CJSONWriter result(os);
+                if (setStreamDone.insert(pcmd->streamActor).second)
+                    (*pcmd->streamActor)(params, true, result);
+            } else {
+                rpcfn_type pfn = pcmd->actor;
+                if (setDone.insert(pfn).second)
+                    (*pfn)(params, true);
+            }
         }
         catch (std::exception& e)
         {
@@ -241,127 +250,129 @@ Value stop(const Array& params, bool fHelp)
  * Call Table
  */
 static const CRPCCommand vRPCCommands[] =
-{ //  category              name                      actor (function)         okSafeMode threadSafe reqWallet
-  //  --------------------- ------------------------  -----------------------  ---------- ---------- ---------
+{ //  category              name                      actor (function)         okSafeMode locks             reqWallet streamActor
+  //  --------------------- ------------------------  -----------------------  ---------- ----------------- --------- -----------
     /* Overall control/query calls */
-    { "control",            "getinfo",                &getinfo,                true,      false,      false }, /* uses wallet if enabled */
-    { "control",            "help",                   &help,                   true,      true,       false },
-    { "control",            "stop",                   &stop,                   true,      true,       false },
+    { "control",            "getinfo",                &getinfo,                true,      RPC_LOCK_WALLET,  false }, /* uses wallet if enabled */
+    { "control",            "help",                   &help,                   true,      RPC_LOCK_NONE,    false },
+    { "control",            "stop",                   &stop,                   true,      RPC_LOCK_NONE,    false },
 
     /* P2P networking */
-    { "network",            "getnetworkinfo",         &getnetworkinfo,         true,      false,      false },
-    { "network",            "addnode",                &addnode,                true,      true,       false },
-    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,      true,       false },
-    { "network",            "getconnectioncount",     &getconnectioncount,     true,      false,      false },
-    { "network",            "getnettotals",           &getnettotals,           true,      true,       false },
-    { "network",            "getpeerinfo",            &getpeerinfo,            true,      false,      false },
-    { "network",            "ping",                   &ping,                   true,      false,      false },
+    { "network",            "getnetworkinfo",         &getnetworkinfo,         true,      RPC_LOCK_MAIN,    false },
+    { "network",            "addnode",                &addnode,                true,      RPC_LOCK_NONE,    false },
+    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,      RPC_LOCK_NONE,    false },
+    { "network",            "getconnectioncount",     &getconnectioncount,     true,      RPC_LOCK_MAIN,    false },
+    { "network",            "getnettotals",           &getnettotals,           true,      RPC_LOCK_NONE,    false },
+    { "network",            "getpeerinfo",            &getpeerinfo,            true,      RPC_LOCK_MAIN,    false },
+    { "network",            "ping",                   &ping,                   true,      RPC_LOCK_MAIN,    false },
 
     /* Block chain and UTXO */
-    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,      false,      false },
-    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,      false,      false },
-    { "blockchain",         "getblockcount",          &getblockcount,          true,      false,      false },
-    { "blockchain",         "getblock",               &getblock,               true,      false,      false },
-    { "blockchain",         "getblockhash",           &getblockhash,           true,      false,      false },
-    { "blockchain",         "getblockheader",         &getblockheader,         false,     false,      false },
-    { "blockchain",         "getchaintips",           &getchaintips,           true,      false,      false },
-    { "blockchain",         "getdifficulty",          &getdifficulty,          true,      false,      false },
-    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,      true,       false },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          true,      false,      false },
-    { "blockchain",         "gettxout",               &gettxout,               true,      false,      false },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false,      false },
-    { "blockchain",         "verifychain",            &verifychain,            true,      false,      false },
-    { "blockchain",         "invalidateblock",        &invalidateblock,        true,      true,       false },
-    { "blockchain",         "reconsiderblock",        &reconsiderblock,        true,      true,       false },
+    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,      RPC_LOCK_MAIN,    false },
+    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,      RPC_LOCK_MAIN,    false },
+    { "blockchain",         "getblockcount",          &getblockcount,          true,      RPC_LOCK_MAIN,    false },
+    { "blockchain",         "getblock",               &getblock,               true,      RPC_LOCK_MAIN,    false },
+    { "blockchain",         "getblockhash",           &getblockhash,           true,      RPC_LOCK_MAIN,    false },
+    { "blockchain",         "getblockheader",         &getblockheader,         false,     RPC_LOCK_MAIN,    false },
+    { "blockchain",         "getchaintips",           &getchaintips,           true,      RPC_LOCK_MAIN,    false },
+    { "blockchain",         "getdifficulty",          &getdifficulty,          true,      RPC_LOCK_MAIN,    false },
+    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,      RPC_LOCK_MEMPOOL, false },
+    { "blockchain",         "getrawmempool",          NULL,                    true,      RPC_LOCK_MAIN,    false, &getrawmempool },
+    { "blockchain",         "gettxout",               &gettxout,               true,      RPC_LOCK_MAIN,    false },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      RPC_LOCK_NONE,    false },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true,      RPC_LOCK_NONE,    false },
+    { "blockchain",         "loadtxoutset",           &loadtxoutset,           false,     RPC_LOCK_NONE,    false },
+    { "blockchain",         "verifychain",            &verifychain,            true,      RPC_LOCK_MAIN,    false },
+    { "blockchain",         "invalidateblock",        &invalidateblock,        true,      RPC_LOCK_NONE,    false },
+    { "blockchain",         "reconsiderblock",        &reconsiderblock,        true,      RPC_LOCK_NONE,    false },
 
     /* Mining */
-    { "mining",             "getblocktemplate",       &getblocktemplate,       true,      false,      false },
-    { "mining",             "getmininginfo",          &getmininginfo,          true,      false,      false },
-    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true,      false,      false },
-    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true,      false,      false },
-    { "mining",             "submitblock",            &submitblock,            true,      true,       false },
+    { "mining",             "getblocktemplate",       &getblocktemplate,       true,      RPC_LOCK_MAIN,    false },
+    { "mining",             "getmininginfo",          &getmininginfo,          true,      RPC_LOCK_MAIN,    false },
+    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true,      RPC_LOCK_MAIN,    false },
+    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true,      RPC_LOCK_MEMPOOL, false },
+    { "mining",             "submitblock",            &submitblock,            true,      RPC_LOCK_NONE,    false },
 
 #ifdef ENABLE_WALLET
     /* Coin generation */
-    { "generating",         "getgenerate",            &getgenerate,            true,      false,      false },
-    { "generating",         "gethashespersec",        &gethashespersec,        true,      false,      false },
-    { "generating",         "setgenerate",            &setgenerate,            true,      true,       false },
+    { "generating",         "getgenerate",            &getgenerate,            true,      RPC_LOCK_MAIN,    false },
+    { "generating",         "gethashespersec",        &gethashespersec,        true,      RPC_LOCK_MAIN,    false },
+    { "generating",         "setgenerate",            &setgenerate,            true,      RPC_LOCK_NONE,    false },
 #endif
 
     /* Raw transactions */
-    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true,      false,      false },
-    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true,      false,      false },
-    { "rawtransactions",    "decodescript",           &decodescript,           true,      false,      false },
-    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true,      false,      false },
-    { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false,     false,      false },
-    { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false,     false,      false }, /* uses wallet if enabled */
+    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true,      RPC_LOCK_NONE,    false },
+    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true,      RPC_LOCK_NONE,    false },
+    { "rawtransactions",    "decodescript",           &decodescript,           true,      RPC_LOCK_NONE,    false },
+    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true,      RPC_LOCK_NONE,    false },
+    { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false,     RPC_LOCK_MAIN,    false },
+    { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false,     RPC_LOCK_WALLET,  false }, /* uses wallet if enabled */
 
     /* Utility functions */
-    { "util",               "createmultisig",         &createmultisig,         true,      true ,      false },
-    { "util",               "validateaddress",        &validateaddress,        true,      false,      false }, /* uses wallet if enabled */
-    { "util",               "verifymessage",          &verifymessage,          true,      false,      false },
-    { "util",               "estimatefee",            &estimatefee,            true,      true,       false },
-    { "util",               "estimatepriority",       &estimatepriority,       true,      true,       false },
+    { "util",               "createmultisig",         &createmultisig,         true,      RPC_LOCK_NONE,    false },
+    { "util",               "validateaddress",        &validateaddress,        true,      RPC_LOCK_NONE,    false }, /* uses wallet if enabled */
+    { "util",               "verifymessage",          &verifymessage,          true,      RPC_LOCK_NONE,    false },
+    { "util",               "estimatefee",            &estimatefee,            true,      RPC_LOCK_NONE,    false },
+    { "util",               "estimatepriority",       &estimatepriority,       true,      RPC_LOCK_NONE,    false },
 
     /* Not shown in help */
-    { "hidden",             "invalidateblock",        &invalidateblock,        true,      true,       false },
-    { "hidden",             "reconsiderblock",        &reconsiderblock,        true,      true,       false },
-    { "hidden",             "setmocktime",            &setmocktime,            true,      false,      false },
+    { "hidden",             "invalidateblock",        &invalidateblock,        true,      RPC_LOCK_NONE,    false },
+    { "hidden",             "reconsiderblock",        &reconsiderblock,        true,      RPC_LOCK_NONE,    false },
+    { "hidden",             "setmocktime",            &setmocktime,            true,      RPC_LOCK_MAIN,    false },
 
     /* Cintamani features */
-    { "cintamani",               "masternode",             &masternode,             true,      true,       false },
-    { "cintamani",               "masternodelist",         &masternodelist,         true,      true,       false },
-    { "cintamani",               "masternodebroadcast",    &masternodebroadcast,    true,      true,       false },
-    { "cintamani",               "mnbudget",               &mnbudget,               true,      true,       false },
-    { "cintamani",               "mnbudgetvoteraw",        &mnbudgetvoteraw,        true,      true,       false },
-    { "cintamani",               "mnfinalbudget",          &mnfinalbudget,          true,      true,       false },
-    { "cintamani",               "mnsync",                 &mnsync,                 true,      true,       false },
-    { "cintamani",               "spork",                  &spork,                  true,      true,       false },
+    { "cintamani",               "masternode",             &masternode,             true,      RPC_LOCK_NONE,    false },
+    { "cintamani",               "masternodelist",         NULL,                    true,      RPC_LOCK_NONE,    false, &masternodelist },
+    { "cintamani",               "masternodebroadcast",    &masternodebroadcast,    true,      RPC_LOCK_NONE,    false },
+    { "cintamani",               "mnbudget",               &mnbudget,               true,      RPC_LOCK_NONE,    false },
+    { "cintamani",               "mnbudgetvoteraw",        &mnbudgetvoteraw,        true,      RPC_LOCK_NONE,    false },
+    { "cintamani",               "mnfinalbudget",          &mnfinalbudget,          true,      RPC_LOCK_NONE,    false },
+    { "cintamani",               "mnsync",                 &mnsync,                 true,      RPC_LOCK_NONE,    false },
+    { "cintamani",               "spork",                  &spork,                  true,      RPC_LOCK_NONE,    false },
 #ifdef ENABLE_WALLET
-    { "cintamani",               "darksend",               &darksend,               false,     false,      true  }, /* not threadSafe because of SendMoney */
+    { "cintamani",               "darksend",               &darksend,               false,     RPC_LOCK_WALLET,  true  }, /* needs the wallet lock because of SendMoney */
 
     /* Wallet */
-    { "wallet",             "addmultisigaddress",     &addmultisigaddress,     true,      false,      true },
-    { "wallet",             "backupwallet",           &backupwallet,           true,      false,      true },
-    { "wallet",             "dumpprivkey",            &dumpprivkey,            true,      false,      true },
-    { "wallet",             "dumpwallet",             &dumpwallet,             true,      false,      true },
-    { "wallet",             "encryptwallet",          &encryptwallet,          true,      false,      true },
-    { "wallet",             "getaccountaddress",      &getaccountaddress,      true,      false,      true },
-    { "wallet",             "getaccount",             &getaccount,             true,      false,      true },
-    { "wallet",             "getaddressesbyaccount",  &getaddressesbyaccount,  true,      false,      true },
-    { "wallet",             "getbalance",             &getbalance,             false,     false,      true },
-    { "wallet",             "getnewaddress",          &getnewaddress,          true,      false,      true },
-    { "wallet",             "getrawchangeaddress",    &getrawchangeaddress,    true,      false,      true },
-    { "wallet",             "getreceivedbyaccount",   &getreceivedbyaccount,   false,     false,      true },
-    { "wallet",             "getreceivedbyaddress",   &getreceivedbyaddress,   false,     false,      true },
-    { "wallet",             "gettransaction",         &gettransaction,         false,     false,      true },
-    { "wallet",             "getunconfirmedbalance",  &getunconfirmedbalance,  false,     false,      true },
-    { "wallet",             "getwalletinfo",          &getwalletinfo,          false,     false,      true },
-    { "wallet",             "importprivkey",          &importprivkey,          true,      false,      true },
-    { "wallet",             "importwallet",           &importwallet,           true,      false,      true },
-    { "wallet",             "importaddress",          &importaddress,          true,      false,      true },
-    { "wallet",             "keypoolrefill",          &keypoolrefill,          true,      false,      true },
-    { "wallet",             "keepass",                &keepass,                false,     false,      true },
-    { "wallet",             "listaccounts",           &listaccounts,           false,     false,      true },
-    { "wallet",             "listaddressgroupings",   &listaddressgroupings,   false,     false,      true },
-    { "wallet",             "listlockunspent",        &listlockunspent,        false,     false,      true },
-    { "wallet",             "listreceivedbyaccount",  &listreceivedbyaccount,  false,     false,      true },
-    { "wallet",             "listreceivedbyaddress",  &listreceivedbyaddress,  false,     false,      true },
-    { "wallet",             "listsinceblock",         &listsinceblock,         false,     false,      true },
-    { "wallet",             "listtransactions",       &listtransactions,       false,     false,      true },
-    { "wallet",             "listunspent",            &listunspent,            false,     false,      true },
-    { "wallet",             "lockunspent",            &lockunspent,            true,      false,      true },
-    { "wallet",             "move",                   &movecmd,                false,     false,      true },
-    { "wallet",             "sendfrom",               &sendfrom,               false,     false,      true },
-    { "wallet",             "sendmany",               &sendmany,               false,     false,      true },
-    { "wallet",             "sendtoaddress",          &sendtoaddress,          false,     false,      true },
-    { "wallet",             "sendtoaddressix",        &sendtoaddressix,        false,     false,      true },
-    { "wallet",             "setaccount",             &setaccount,             true,      false,      true },
-    { "wallet",             "settxfee",               &settxfee,               true,      false,      true },
-    { "wallet",             "signmessage",            &signmessage,            true,      false,      true },
-    { "wallet",             "walletlock",             &walletlock,             true,      false,      true },
-    { "wallet",             "walletpassphrasechange", &walletpassphrasechange, true,      false,      true },
-    { "wallet",             "walletpassphrase",       &walletpassphrase,       true,      false,      true },
+    { "wallet",             "addmultisigaddress",     &addmultisigaddress,     true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "backupwallet",           &backupwallet,           true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "dumpprivkey",            &dumpprivkey,            true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "dumpwallet",             &dumpwallet,             true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "encryptwallet",          &encryptwallet,          true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "getaccountaddress",      &getaccountaddress,      true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "getaccount",             &getaccount,             true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "getaddressesbyaccount",  &getaddressesbyaccount,  true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "getbalance",             &getbalance,             false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "getnewaddress",          &getnewaddress,          true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "getrawchangeaddress",    &getrawchangeaddress,    true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "getreceivedbyaccount",   &getreceivedbyaccount,   false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "getreceivedbyaddress",   &getreceivedbyaddress,   false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "gettransaction",         &gettransaction,         false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "getunconfirmedbalance",  &getunconfirmedbalance,  false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "getwalletinfo",          &getwalletinfo,          false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "importprivkey",          &importprivkey,          true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "importwallet",           &importwallet,           true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "importaddress",          &importaddress,          true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "keypoolrefill",          &keypoolrefill,          true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "keepass",                &keepass,                false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "listaccounts",           &listaccounts,           false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "listaddressgroupings",   &listaddressgroupings,   false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "listlockunspent",        &listlockunspent,        false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "listreceivedbyaccount",  &listreceivedbyaccount,  false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "listreceivedbyaddress",  &listreceivedbyaddress,  false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "listsinceblock",         &listsinceblock,         false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "listtransactions",       NULL,                    false,     RPC_LOCK_WALLET,  true, &listtransactions },
+    { "wallet",             "listunspent",            &listunspent,            false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "lockunspent",            &lockunspent,            true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "move",                   &movecmd,                false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "sendfrom",               &sendfrom,               false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "sendmany",               &sendmany,               false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "sendtoaddress",          &sendtoaddress,          false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "sendtoaddressix",        &sendtoaddressix,        false,     RPC_LOCK_WALLET,  true },
+    { "wallet",             "setaccount",             &setaccount,             true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "settxfee",               &settxfee,               true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "signmessage",            &signmessage,            true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "walletlock",             &walletlock,             true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "walletpassphrasechange", &walletpassphrasechange, true,      RPC_LOCK_WALLET,  true },
+    { "wallet",             "walletpassphrase",       &walletpassphrase,       true,      RPC_LOCK_WALLET,  true },
 #endif // ENABLE_WALLET
 };
 
@@ -849,42 +860,180 @@ void JSONRequest::parse(const Value& valRequest)
 }
 
 
-static Object JSONRPCExecOne(const Value& req)
+/**
+ * Execute a request, writing the reply as the command produces its result.
+ * result must write to os, prefixed with the start of the reply.
+ */
+static void JSONRPCExecResult(std::ostream& os, CJSONWriter& result, const JSONRequest& jreq)
 {
-    Object rpc_result;
+    tableRPC.execute(jreq.strMethod, jreq.params, result);
+    os << ",\"error\":null,\"id\":";
+    write_stream(jreq.id, os, false);
+    os << '}';
+}
 
+static void JSONRPCExecOne(std::ostream& os, const Value& req)
+{
     JSONRequest jreq;
+    CJSONWriter result(os, "{\"result\":");
     try {
         jreq.parse(req);
-
-        Value result = tableRPC.execute(jreq.strMethod, jreq.params);
-        rpc_result = JSONRPCReplyObj(result, Value::null, jreq.id);
+        JSONRPCExecResult(os, result, jreq);
     }
     catch (Object& objError)
     {
-        rpc_result = JSONRPCReplyObj(Value::null, objError, jreq.id);
+        // Once part of the result is out, the reply can't be an error any more
+        if (result.IsStarted())
+            throw;
+        JSONRPCWriteReply(os, Value::null, objError, jreq.id);
     }
     catch (std::exception& e)
     {
-        rpc_result = JSONRPCReplyObj(Value::null,
-                                     JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
+        if (result.IsStarted())
+            throw;
+        JSONRPCWriteReply(os, Value::null, JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
+    }
+}
+
+/**
+ * The requests of one JSON-RPC batch. Any thread can claim and execute the
+ * next request with RunNext(), so idle RPC threads help out while the thread
+ * that received the batch works through it and writes the replies in order.
+ */
+class CRPCBatch
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable condDone;
+    const Array& vReq;
+    //! Index of the next request to claim
+    size_t nNext;
+    std::vector<std::string> vReply;
+    std::vector<bool> vDone;
+
+public:
+    CRPCBatch(const Array& vReqIn) : vReq(vReqIn), nNext(0), vReply(vReqIn.size()), vDone(vReqIn.size(), false) {}
+
+    size_t size() const { return vDone.size(); }
+
+    //! Execute the next unclaimed request, if any
+    bool RunNext()
+    {
+        size_t i;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (nNext >= vDone.size())
+                return false; // vReq may be gone already
+            i = nNext++;
+        }
+        std::ostringstream os;
+        try {
+            JSONRPCExecOne(os, vReq[i]);
+        } catch (...) {
+            os.str("");
+            JSONRPCWriteReply(os, Value::null, JSONRPCError(RPC_INTERNAL_ERROR, "Internal error"), Value::null);
+        }
+        boost::unique_lock<boost::mutex> lock(mutex);
+        vReply[i] = os.str();
+        vDone[i] = true;
+        condDone.notify_all();
+        return true;
     }
 
-    return rpc_result;
+    //! Take the reply to request i, waiting for it if fWait is set
+    bool TakeReply(size_t i, std::string& strReply, bool fWait)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!vDone[i]) {
+            if (!fWait)
+                return false;
+            condDone.wait(lock);
+        }
+        strReply.swap(vReply[i]);
+        return true;
+    }
+};
+
+static void RPCBatchHelp(boost::shared_ptr<CRPCBatch> batch)
+{
+    while (batch->RunNext()) {}
 }
 
-static string JSONRPCExecBatch(const Array& vReq)
+/**
+ * Execute the requests of a batch, spread over the RPC threads, writing the
+ * replies in order as soon as they are ready.
+ */
+static void JSONRPCExecBatch(std::ostream& os, const Array& vReq)
 {
-    Array ret;
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    boost::shared_ptr<CRPCBatch> batch(new CRPCBatch(vReq));
+
+    // Each helper keeps claiming requests, so one per idle thread is enough
+    if (rpc_io_service != NULL && rpc_worker_group != NULL) {
+        size_t nThreads = std::min(rpc_worker_group->size(), vReq.size());
+        for (size_t i = 1; i < nThreads; i++)
+            rpc_io_service->post(boost::bind(&RPCBatchHelp, batch));
+    }
 
-    return write_string(Value(ret), false) + "\n";
+    os << '[';
+    size_t nWritten = 0;
+    std::string strReply;
+    while (nWritten < batch->size()) {
+        // Work on the batch ourselves, so it completes even if every other
+        // thread is busy; stop to send replies that are ready
+        bool fRan = batch->RunNext();
+        while (nWritten < batch->size() && batch->TakeReply(nWritten, strReply, !fRan)) {
+            if (nWritten > 0)
+                os << ',';
+            os << strReply;
+            nWritten++;
+        }
+    }
+    os << "]\n";
+}
+
+static void JSONRPCExecSingle(std::ostream& os, const JSONRequest& jreq)
+{
+    CJSONWriter result(os, "{\"result\":");
+    JSONRPCExecResult(os, result, jreq);
+    os << "\n";
+}
+
+/**
+ * Send a successful reply produced by writer. HTTP/1.1 clients get it
+ * streamed with chunked transfer encoding while it is being serialized;
+ * older clients need a Content-Length, so it is buffered first. Errors
+ * thrown by writer before anything was sent are passed on to be replied to.
+ * @return false if the reply broke off after part of it was sent, so the
+ *         connection must be closed
+ */
+static bool JSONRPCSendReply(AcceptedConnection *conn, int nProto, bool fRun,
+                             const boost::function<void(std::ostream&)>& writer)
+{
+    if (nProto >= 1) {
+        HTTPChunkedStreamBuf buf(conn->stream(), HTTPChunkedReplyHeader(HTTP_OK, fRun));
+        std::ostream os(&buf);
+        try {
+            writer(os);
+        } catch (...) {
+            if (!buf.IsStarted())
+                throw;
+            LogPrintf("ThreadRPCServer reply to %s failed after it was partly sent\n", conn->peer_address_to_string());
+            return false;
+        }
+        buf.Finish();
+    } else {
+        std::ostringstream os;
+        writer(os);
+        const string strReply = os.str();
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, strReply.size()) << strReply << std::flush;
+    }
+    return true;
 }
 
 static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
                             string& strRequest,
                             map<string, string>& mapHeaders,
+                            int nProto,
                             bool fRun)
 {
     // Check authorization
@@ -921,24 +1070,18 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
                 throw JSONRPCError(RPC_IN_WARMUP, rpcWarmupStatus);
         }
 
-        string strReply;
-
         // singleton request
         if (valRequest.type() == obj_type) {
             jreq.parse(valRequest);
 
-            Value result = tableRPC.execute(jreq.strMethod, jreq.params);
-
-            // Send reply
-            strReply = JSONRPCReply(result, Value::null, jreq.id);
+            // Execute while sending the reply
+            return JSONRPCSendReply(conn, nProto, fRun, boost::bind(&JSONRPCExecSingle, _1, boost::cref(jreq)));
 
         // array of requests
         } else if (valRequest.type() == array_type)
-            strReply = JSONRPCExecBatch(valRequest.get_array());
+            return JSONRPCSendReply(conn, nProto, fRun, boost::bind(&JSONRPCExecBatch, _1, boost::cref(valRequest.get_array())));
         else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
-
-        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, strReply.size()) << strReply << std::flush;
     }
     catch (Object& objError)
     {
@@ -975,7 +1118,7 @@ void ServiceConnection(AcceptedConnection *conn)
 
         // Process via JSON-RPC API
         if (strURI == "/") {
-            if (!HTTPReq_JSONRPC(conn, strRequest, mapHeaders, fRun))
+            if (!HTTPReq_JSONRPC(conn, strRequest, mapHeaders, nProto, fRun))
                 break;
 
         // Process via HTTP REST API
@@ -990,7 +1133,58 @@ void ServiceConnection(AcceptedConnection *conn)
     }
 }
 
-json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+/** Call the command, with the locks it asks for taken. A command with a streamActor writes into *presult */
+static void ExecuteCommand(const CRPCCommand *pcmd, const Array &params, Value &result, CJSONWriter *presult)
+{
+    if (pcmd->streamActor)
+        pcmd->streamActor(params, false, *presult);
+    else
+        result = pcmd->actor(params, false);
+}
+
+static void ExecuteLocked(const CRPCCommand *pcmd, const Array &params, Value &result, CJSONWriter *presult)
+{
+    switch (pcmd->locks) {
+    case RPC_LOCK_NONE:
+        ExecuteCommand(pcmd, params, result, presult);
+        break;
+    case RPC_LOCK_MEMPOOL: {
+        LOCK(mempool.cs);
+        ExecuteCommand(pcmd, params, result, presult);
+        break;
+    }
+    case RPC_LOCK_MAIN: {
+        LOCK(cs_main);
+        ExecuteCommand(pcmd, params, result, presult);
+        break;
+    }
+    case RPC_LOCK_WALLET:
+#ifdef ENABLE_WALLET
+        if (pwalletMain) {
+            while (true) {
+                TRY_LOCK(cs_main, lockMain);
+                if(!lockMain) { MilliSleep(50); continue; }
+                while (true) {
+                    TRY_LOCK(pwalletMain->cs_wallet, lockWallet);
+                    if(!lockWallet) { MilliSleep(50); continue; }
+                    ExecuteCommand(pcmd, params, result, presult);
+                    break;
+                }
+                break;
+            }
+            break;
+        }
+#endif // ENABLE_WALLET
+        {
+            LOCK(cs_main);
+            ExecuteCommand(pcmd, params, result, presult);
+        }
+        break;
+    }
+}
+
+/** Find the command and check it may run now */
+static const CRPCCommand *PrepareCommand(const std::string &strMethod)
 {
     // Find method
     const CRPCCommand *pcmd = tableRPC[strMethod];
@@ -1007,37 +1201,34 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
         !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
 
+    // Wallet notifications are delivered in the background; let the wallet catch up with
+    // everything validated so far, so it agrees with what earlier calls (e.g. submitblock,
+    // sendrawtransaction) reported. Done before taking locks, as delivery needs them.
+    if (pcmd->reqWallet || pcmd->locks == RPC_LOCK_WALLET)
+        FlushValidationNotifications();
+
+    return pcmd;
+}
+
+json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+{
+    const CRPCCommand *pcmd = PrepareCommand(strMethod);
+
     try
     {
         // Execute
         Value result;
-        {
-            if (pcmd->threadSafe)
-                result = pcmd->actor(params, false);
-#ifdef ENABLE_WALLET
-            else if (!pwalletMain) {
-                LOCK(cs_main);
-                result = pcmd->actor(params, false);
-            } else {
-                while (true) {
-                    TRY_LOCK(cs_main, lockMain);
-                    if(!lockMain) { MilliSleep(50); continue; }
-                    while (true) {
-                        TRY_LOCK(pwalletMain->cs_wallet, lockWallet);
-                        if(!lockMain) { MilliSleep(50); continue; }
-                        result = pcmd->actor(params, false);
-                        break;
-                    }
-                    break;
-                }
-            }
-#else // ENABLE_WALLET
-            else {
-                LOCK(cs_main);
-                result = pcmd->actor(params, false);
-            }
-#endif // !ENABLE_WALLET
+        if (!pcmd->streamActor) {
+            ExecuteLocked(pcmd, params, result, NULL);
+            return result;
         }
+
+        // Callers that want a value get the streamed result read back
+        std::ostringstream os;
+        CJSONWriter writer(os);
+        ExecuteLocked(pcmd, params, result, &writer);
+        if (!writer.IsComplete() || !read_string(os.str(), result))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Incomplete result");
         return result;
     }
     catch (std::exception& e)
@@ -1046,6 +1237,26 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
     }
 }
 
+void CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params, CJSONWriter &result) const
+{
+    const CRPCCommand *pcmd = PrepareCommand(strMethod);
+
+    try
+    {
+        // Execute
+        Value value;
+        ExecuteLocked(pcmd, params, value, &result);
+        if (!pcmd->streamActor)
+            result.Write(value); // after the locks are released
+        else if (!result.IsComplete())
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Incomplete result");
+    }
+    catch (std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+}
+
 std::string HelpExampleCli(string methodname, string args){
     return "> cintamani-cli " + methodname + " " + args + "\n";
 }
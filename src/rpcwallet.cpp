@@ -1306,7 +1306,7 @@ void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, Ar
     }
 }
 
-Value listtransactions(const Array& params, bool fHelp)
+void listtransactions(const Array& params, bool fHelp, CJSONWriter& result)
 {
     if (fHelp || params.size() > 4)
         throw runtime_error(
@@ -1407,17 +1407,15 @@ Value listtransactions(const Array& params, bool fHelp)
         nFrom = ret.size();
     if ((nFrom + nCount) > (int)ret.size())
         nCount = ret.size() - nFrom;
-    Array::iterator first = ret.begin();
-    std::advance(first, nFrom);
-    Array::iterator last = ret.begin();
-    std::advance(last, nFrom+nCount);
+    ret.resize(nFrom + nCount);
 
-    if (last != ret.end()) ret.erase(last, ret.end());
-    if (first != ret.begin()) ret.erase(ret.begin(), first);
-
-    std::reverse(ret.begin(), ret.end()); // Return oldest to newest
-
-    return ret;
+    // Return oldest to newest, letting go of each entry once it is written
+    result.BeginArray();
+    while ((int)ret.size() > nFrom) {
+        result.Write(ret.back());
+        ret.pop_back();
+    }
+    result.EndArray();
 }
 
 Value listaccounts(const Array& params, bool fHelp)
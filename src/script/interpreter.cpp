@@ -12,6 +12,7 @@
 #include "eccryptoverify.h"
 #include "pubkey.h"
 #include "script/script.h"
+#include "streams.h"
 #include "uint256.h"
 
 using namespace std;
@@ -936,6 +937,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, un
 
 namespace {
 
+/** Size of an input with a blank scriptSig: prevout, empty script and nSequence */
+const size_t BLANK_INPUT_SIZE = 32 + 4 + 1 + 4;
+
 /**
  * Wrapper that serializes like CTransaction, but with the modifications
  *  required for the signature hash done in-place
@@ -1029,11 +1033,69 @@ public:
         // Serialize nLockTime
         ::Serialize(s, txTo.nLockTime, nType, nVersion);
     }
+
+    /** Hash txTo and nHashType, taking everything but the signed input from cache */
+    uint256 GetHash(const PrecomputedTransactionData& cache, int nHashType) const {
+        CHashWriter ss(SER_GETHASH, 0);
+        // nVersion, vin size and the inputs before nIn
+        if (fAnyoneCanPay) {
+            ss << txTo.nVersion;
+            ::WriteCompactSize(ss, 1);
+        } else if (fHashSingle || fHashNone) {
+            ss << txTo.nVersion;
+            ::WriteCompactSize(ss, txTo.vin.size());
+            if (nIn > 0)
+                ss.write((const char*)&cache.vchInputsNoSequence[0], nIn * BLANK_INPUT_SIZE);
+        } else {
+            ss = cache.vMidstates[nIn];
+        }
+        // The input being signed
+        SerializeInput(ss, nIn, SER_GETHASH, 0);
+        // The inputs after nIn
+        if (!fAnyoneCanPay) {
+            const std::vector<unsigned char>& vchInputs = (fHashSingle || fHashNone) ? cache.vchInputsNoSequence : cache.vchInputs;
+            size_t nPos = (nIn + 1) * BLANK_INPUT_SIZE;
+            if (nPos < vchInputs.size())
+                ss.write((const char*)&vchInputs[nPos], vchInputs.size() - nPos);
+        }
+        // vout
+        if (fHashSingle || fHashNone) {
+            unsigned int nOutputs = fHashNone ? 0 : nIn+1;
+            ::WriteCompactSize(ss, nOutputs);
+            for (unsigned int nOutput = 0; nOutput < nOutputs; nOutput++)
+                SerializeOutput(ss, nOutput, SER_GETHASH, 0);
+        } else {
+            ss.write((const char*)&cache.vchOutputs[0], cache.vchOutputs.size());
+        }
+        ss << txTo.nLockTime << nHashType;
+        return ss.GetHash();
+    }
 };
 
 } // anon namespace
 
-uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
+{
+    CDataStream ssInputs(SER_GETHASH, 0), ssInputsNoSequence(SER_GETHASH, 0), ssOutputs(SER_GETHASH, 0);
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion;
+    ::WriteCompactSize(ss, txTo.vin.size());
+    vMidstates.reserve(txTo.vin.size());
+    for (unsigned int i = 0; i < txTo.vin.size(); i++) {
+        vMidstates.push_back(ss);
+        size_t nStart = ssInputs.size();
+        ssInputs << txTo.vin[i].prevout << CScript() << txTo.vin[i].nSequence;
+        ssInputsNoSequence << txTo.vin[i].prevout << CScript() << (int)0;
+        assert(ssInputs.size() - nStart == BLANK_INPUT_SIZE);
+        ss.write(&ssInputs[nStart], BLANK_INPUT_SIZE);
+    }
+    ssOutputs << txTo.vout;
+    vchInputs.assign(ssInputs.begin(), ssInputs.end());
+    vchInputsNoSequence.assign(ssInputsNoSequence.begin(), ssInputsNoSequence.end());
+    vchOutputs.assign(ssOutputs.begin(), ssOutputs.end());
+}
+
+uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const PrecomputedTransactionData* cache)
 {
     if (nIn >= txTo.vin.size()) {
         //  nIn out of range
@@ -1051,6 +1113,9 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
+    if (cache && cache->vMidstates.size() == txTo.vin.size())
+        return txTmp.GetHash(*cache, nHashType);
+
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
     ss << txTmp << nHashType;
@@ -1075,7 +1140,7 @@ bool TransactionSignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn
     int nHashType = vchSig.back();
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType);
+    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, txdata);
 
     if (!VerifySignature(vchSig, pubkey, sighash))
         return false;
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_INTERPRETER_H
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
+#include "hash.h"
 #include "script_error.h"
 #include "primitives/transaction.h"
 
@@ -72,7 +73,29 @@ enum
 
 };
 
-uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+/**
+ * Parts of a transaction's signature hash preimages that are the same for all
+ * of its inputs. Computed once per transaction, so verifying n inputs no
+ * longer re-serializes the whole transaction n times, and the hashing of the
+ * inputs before the one being signed starts from a saved SHA256 midstate.
+ * Never modified after construction, so script check threads can share it.
+ */
+struct PrecomputedTransactionData
+{
+    //! Every input as serialized when another input is signed: blank scriptSig and its own nSequence
+    std::vector<unsigned char> vchInputs;
+    //! The same with a zero nSequence, as committed to by SIGHASH_NONE and SIGHASH_SINGLE
+    std::vector<unsigned char> vchInputsNoSequence;
+    //! Output count and outputs, as committed to by SIGHASH_ALL
+    std::vector<unsigned char> vchOutputs;
+    //! vMidstates[i]: hash of nVersion, the input count and the first i entries of vchInputs
+    std::vector<CHashWriter> vMidstates;
+
+    PrecomputedTransactionData() {}
+    explicit PrecomputedTransactionData(const CTransaction& txTo);
+};
+
+uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const PrecomputedTransactionData* cache = NULL);
 
 class BaseSignatureChecker
 {
@@ -90,12 +113,13 @@ class TransactionSignatureChecker : public BaseSignatureChecker
 private:
     const CTransaction* txTo;
     unsigned int nIn;
+    const PrecomputedTransactionData* txdata;
 
 protected:
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 
 public:
-    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn) : txTo(txToIn), nIn(nInIn) {}
+    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const PrecomputedTransactionData* txdataIn = NULL) : txTo(txToIn), nIn(nInIn), txdata(txdataIn) {}
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const;
 };
 
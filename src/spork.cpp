@@ -139,8 +139,9 @@ void ExecuteSpork(int nSporkID, int nValue)
     }
 }
 
-void ReprocessBlocks(int nBlocks) 
-{   
+// Clear the failure of blocks rejected in the window of the last nBlocks
+static void ReconsiderBlocks(int nBlocks)
+{
     std::map<uint256, int64_t>::iterator it = mapRejectedBlocks.begin();
     while(it != mapRejectedBlocks.end()){
         //use a window twice as large as is usual for the nBlocks we want to reset
@@ -158,6 +159,19 @@ void ReprocessBlocks(int nBlocks)
         }
         ++it;
     }
+}
+
+void ReconsiderRejectedBlocks(int nBlocks)
+{
+    ReconsiderBlocks(nBlocks);
+
+    CValidationState state;
+    ActivateBestChain(state);
+}
+
+void ReprocessBlocks(int nBlocks) 
+{   
+    ReconsiderBlocks(nBlocks);
 
     CValidationState state;
     {
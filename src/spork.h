@@ -60,6 +60,7 @@ int64_t GetSporkValue(int nSporkID);
 bool IsSporkActive(int nSporkID);
 void ExecuteSpork(int nSporkID, int nValue);
 void ReprocessBlocks(int nBlocks);
+void ReconsiderRejectedBlocks(int nBlocks);
 
 //
 // Spork Class
@@ -306,6 +306,69 @@ public:
 
 
 
+/** Non-owning, bounds-checked input stream over a contiguous byte range.
+ *
+ * Used to deserialize straight out of memory the caller keeps alive (e.g. a
+ * memory-mapped block file) without copying it into a CDataStream first.
+ */
+class CSpanReader
+{
+private:
+    const char* pbegin;
+    const char* pend;
+    const char* pcur;
+
+    int nType;
+    int nVersion;
+
+public:
+    CSpanReader(const unsigned char* pbeginIn, const unsigned char* pendIn, int nTypeIn, int nVersionIn) :
+        pbegin((const char*)pbeginIn), pend((const char*)pendIn), pcur((const char*)pbeginIn),
+        nType(nTypeIn), nVersion(nVersionIn) { }
+
+    //
+    // Stream subset
+    //
+    int GetType()                { return nType; }
+    int GetVersion()             { return nVersion; }
+    size_t size() const          { return pend - pcur; }
+    bool empty() const           { return pcur == pend; }
+    size_t GetPos() const        { return pcur - pbegin; }
+
+    CSpanReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::read() : end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+        return (*this);
+    }
+
+    CSpanReader& ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::ignore() : end of data");
+        pcur += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    CSpanReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+
+
+
+
+
+
+
+
 /** Non-refcounted RAII wrapper for FILE*
  *
  * Will automatically close the file when it goes out of scope if not null.
@@ -0,0 +1,77 @@
+// Copyright (c) 2015 The Cintamani developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+/** Check that counts how often it ran and passes unless told to fail */
+class CCountingCheck
+{
+public:
+    boost::mutex* pmutex;
+    unsigned int* pnRun;
+    bool fPass;
+
+    CCountingCheck() : pmutex(NULL), pnRun(NULL), fPass(true) {}
+    CCountingCheck(boost::mutex* pmutexIn, unsigned int* pnRunIn, bool fPassIn) : pmutex(pmutexIn), pnRun(pnRunIn), fPass(fPassIn) {}
+
+    bool operator()()
+    {
+        boost::unique_lock<boost::mutex> lock(*pmutex);
+        (*pnRun)++;
+        return fPass;
+    }
+
+    void swap(CCountingCheck& check)
+    {
+        std::swap(pmutex, check.pmutex);
+        std::swap(pnRun, check.pnRun);
+        std::swap(fPass, check.fPass);
+    }
+};
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+BOOST_AUTO_TEST_CASE(checkqueue_rounds)
+{
+    // Fewer queues than workers, so some of them share one
+    CCheckQueue<CCountingCheck> queue(16, 3);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 4; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CCountingCheck>::Thread, &queue));
+
+    boost::mutex mutex;
+    for (unsigned int nRound = 0; nRound < 50; nRound++) {
+        unsigned int nRun = 0;
+        unsigned int nAdded = 0;
+        bool fFail = (nRound % 5 == 4);
+        {
+            CCheckQueueControl<CCountingCheck> control(&queue);
+            // Batches of varying size, like the inputs of a block's transactions
+            for (unsigned int nBatch = 0; nBatch < 40; nBatch++) {
+                std::vector<CCountingCheck> vChecks;
+                for (unsigned int i = 0; i < (nBatch * 7 + nRound) % 13; i++)
+                    vChecks.push_back(CCountingCheck(&mutex, &nRun, true));
+                if (fFail && nBatch == 20)
+                    vChecks.push_back(CCountingCheck(&mutex, &nRun, false));
+                nAdded += vChecks.size();
+                control.Add(vChecks);
+            }
+            BOOST_CHECK_EQUAL(control.Wait(), !fFail);
+        }
+        // Every check ran unless a failure allowed skipping the rest
+        if (!fFail)
+            BOOST_CHECK_EQUAL(nRun, nAdded);
+        BOOST_CHECK(nRun <= nAdded);
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include <vector>
 #include <map>
 
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
 namespace
@@ -19,6 +20,10 @@ class CCoinsViewTest : public CCoinsView
     std::map<uint256, CCoins> map_;
 
 public:
+    size_t nOriginsChecked;
+
+    CCoinsViewTest() : nOriginsChecked(0) {}
+
     bool GetCoins(const uint256& txid, CCoins& coins) const
     {
         std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
@@ -44,6 +49,15 @@ public:
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
+            if (it->second.flags & CCoinsCacheEntry::ORIGIN) {
+                // What the cache remembers of our version must match what we have
+                std::map<uint256, CCoins>::const_iterator itOld = map_.find(it->first);
+                CCoinsContribution old = itOld == map_.end() ? CCoinsContribution() : CCoinsContribution(itOld->second);
+                BOOST_CHECK_EQUAL(it->second.origin.nOutputs, old.nOutputs);
+                BOOST_CHECK_EQUAL(it->second.origin.nSerializedSize, old.nSerializedSize);
+                BOOST_CHECK_EQUAL(it->second.origin.nAmount, old.nAmount);
+                nOriginsChecked++;
+            }
             map_[it->first] = it->second.coins;
             if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
                 // Randomly delete empty entries on write.
@@ -58,6 +72,22 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base, bool fTrackOrigin = false) : CCoinsViewCache(base, fTrackOrigin) {}
+
+    void SelfTest() const
+    {
+        // Manually recompute the dynamic usage of the whole data, and compare it.
+        size_t ret = memusage::DynamicUsage(cacheCoins);
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+            ret += it->second.coins.DynamicMemoryUsage();
+        }
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+};
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -83,14 +113,15 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool extracted_dirty = false;
 
     // A simple map to track what we expect the cache stack to represent.
     std::map<uint256, CCoins> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base, true)); // Start with one cache, tracking origins like pcoinsTip.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -135,6 +166,19 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                     missed_an_entry = true;
                 }
             }
+            BOOST_FOREACH(const CCoinsViewCacheTest *test, stack) {
+                test->SelfTest();
+            }
+        }
+
+        if (insecure_rand() % 100 == 50 && stack.size() > 0) {
+            // Every 100 iterations, hand the top cache's changes to its base
+            // the way a background flush does, possibly keeping the cache warm.
+            CCoinsView* tip = stack.size() > 1 ? (CCoinsView*)stack[stack.size() - 2] : (CCoinsView*)&base;
+            CCoinsMap mapCoins;
+            uint256 hashBlock = stack.back()->ExtractDirty(mapCoins, insecure_rand() % 2);
+            BOOST_CHECK(tip->BatchWrite(mapCoins, hashBlock));
+            extracted_dirty = true;
         }
 
         if (insecure_rand() % 100 == 0) {
@@ -151,7 +195,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip, tip == &base));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -173,6 +217,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(extracted_dirty);
+    BOOST_CHECK(base.nOriginsChecked > 0);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,9 +9,11 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "hash.h"
 #include "random.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
 #include <vector>
 
 #include <boost/assign/list_of.hpp>
@@ -263,6 +265,40 @@ void TestRFC6979(const std::string& hexkey, const std::string& hexmsg, const std
     }
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Reference results from the portable code
+    SHA256AutoDetect(SHA256_STANDARD);
+    std::vector<unsigned char> in(64 * 32), expected(32 * 32);
+    for (size_t j = 0; j < in.size(); ++j)
+        in[j] = insecure_rand();
+    for (int j = 0; j < 32; ++j)
+        CHash256().Write(&in[64 * j], 64).Finalize(&expected[32 * j]);
+
+    // Run every implementation on its own, so the multi-way transforms are
+    // checked even on CPUs where SHA-NI would otherwise be picked
+    static const int implementations[] = {SHA256_STANDARD, SHA256_USE_SSE41, SHA256_USE_AVX2,
+                                          SHA256_USE_SSE41 | SHA256_USE_AVX2, SHA256_USE_SHANI};
+    for (size_t n = 0; n < sizeof(implementations) / sizeof(implementations[0]); ++n) {
+        const int nUse = implementations[n];
+        const std::string strImpl = SHA256AutoDetect(nUse);
+        BOOST_TEST_MESSAGE("SHA256 implementation: " << strImpl);
+        BOOST_CHECK(strImpl == "standard" || strImpl == "shani(1way)" || strImpl.find("standard(1way),") == 0);
+        BOOST_CHECK((nUse & SHA256_USE_SSE41) || strImpl.find("sse41") == std::string::npos);
+        BOOST_CHECK((nUse & SHA256_USE_AVX2) || strImpl.find("avx2") == std::string::npos);
+        BOOST_CHECK((nUse & SHA256_USE_SHANI) || strImpl.find("shani") == std::string::npos);
+
+        TestSHA256("abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        // Covers the 8-way, 4-way and single code paths and their remainders
+        for (int i = 0; i <= 32; ++i) {
+            std::vector<unsigned char> out(32 * 32);
+            SHA256D64(&out[0], &in[0], i);
+            BOOST_CHECK(std::equal(out.begin(), out.begin() + 32 * i, expected.begin()));
+        }
+    }
+    SHA256AutoDetect();
+}
+
 BOOST_AUTO_TEST_CASE(rfc6979_hmac_sha256)
 {
     TestRFC6979(
@@ -0,0 +1,185 @@
+// Copyright (c) 2014-2015 The Cintamani developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "darksend.h"
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "random.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <list>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(darksend_tests)
+
+static CDarksendQueue MakeQueue(int64_t nTime)
+{
+    CDarksendQueue dsq;
+    dsq.vin = CTxIn(COutPoint(GetRandHash(), 0));
+    dsq.time = nTime;
+    return dsq;
+}
+
+BOOST_AUTO_TEST_CASE(queue_list)
+{
+    CDarksendQueueList queues;
+    int64_t nNow = GetTime();
+    BOOST_CHECK_EQUAL(queues.GetNextExpiry(), 0);
+    BOOST_CHECK_EQUAL(queues.RemoveExpired(), 0);
+
+    // Added newest first, handed out oldest first
+    CDarksendQueue dsqNew = MakeQueue(nNow);
+    CDarksendQueue dsqOld = MakeQueue(nNow - DARKSEND_QUEUE_TIMEOUT - 10);
+    CDarksendQueue dsqMid = MakeQueue(nNow - 5);
+    BOOST_CHECK(queues.Add(dsqNew));
+    BOOST_CHECK(queues.Add(dsqOld));
+    BOOST_CHECK(queues.Add(dsqMid));
+    BOOST_CHECK(queues.Has(dsqOld.vin));
+    BOOST_CHECK(!queues.Has(MakeQueue(nNow).vin));
+
+    // One queue per Masternode, a second announcement doesn't move the first
+    CDarksendQueue dsqAgain = dsqOld;
+    dsqAgain.time = nNow;
+    BOOST_CHECK(!queues.Add(dsqAgain));
+
+    std::vector<CDarksendQueue> vecQueues;
+    queues.GetQueues(vecQueues);
+    BOOST_CHECK_EQUAL(vecQueues.size(), 3U);
+    BOOST_CHECK(vecQueues[0].vin == dsqOld.vin && vecQueues[0].time == dsqOld.time);
+    BOOST_CHECK(vecQueues[1].vin == dsqMid.vin);
+    BOOST_CHECK(vecQueues[2].vin == dsqNew.vin);
+    BOOST_CHECK_EQUAL(queues.GetNextExpiry(), dsqOld.time + DARKSEND_QUEUE_TIMEOUT + 1);
+
+    // Only the expired one goes, the next deadline is the following queue's
+    BOOST_CHECK_EQUAL(queues.RemoveExpired(), 1);
+    BOOST_CHECK(!queues.Has(dsqOld.vin));
+    BOOST_CHECK(queues.Has(dsqMid.vin));
+    BOOST_CHECK(queues.Has(dsqNew.vin));
+    BOOST_CHECK_EQUAL(queues.GetNextExpiry(), dsqMid.time + DARKSEND_QUEUE_TIMEOUT + 1);
+    BOOST_CHECK_EQUAL(queues.RemoveExpired(), 0);
+
+    // Removing by vin keeps the time order in step
+    queues.Remove(dsqMid.vin);
+    BOOST_CHECK(!queues.Has(dsqMid.vin));
+    BOOST_CHECK_EQUAL(queues.GetNextExpiry(), dsqNew.time + DARKSEND_QUEUE_TIMEOUT + 1);
+    queues.GetQueues(vecQueues);
+    BOOST_CHECK_EQUAL(vecQueues.size(), 1U);
+
+    // The Masternode can announce again once its queue is gone
+    BOOST_CHECK(queues.Add(dsqAgain));
+    queues.Remove(dsqAgain.vin);
+    queues.Remove(dsqNew.vin);
+    BOOST_CHECK_EQUAL(queues.GetNextExpiry(), 0);
+}
+
+//! Inputs spending made up outpoints of scriptPubKey, which AddEntry doesn't look up
+static std::vector<CTxIn> MakeEntryInputs(const CScript& scriptPubKey, int nInputs)
+{
+    std::vector<CTxIn> vin;
+    for (int i = 0; i < nInputs; i++) {
+        CTxIn in(COutPoint(GetRandHash(), i));
+        in.prevPubKey = scriptPubKey;
+        vin.push_back(in);
+    }
+    return vin;
+}
+
+//! Sign input nIn of the entries merged the way CDarksendPool::IndexEntries() does
+static CTxIn SignEntryInput(const CKeyStore& keystore, const std::vector<std::vector<CTxIn> >& vecEntryVin,
+                            const std::vector<std::vector<CTxOut> >& vecEntryVout, unsigned int nIn)
+{
+    CMutableTransaction txMerged;
+    for (unsigned int i = 0; i < vecEntryVin.size(); i++) {
+        txMerged.vout.insert(txMerged.vout.end(), vecEntryVout[i].begin(), vecEntryVout[i].end());
+        txMerged.vin.insert(txMerged.vin.end(), vecEntryVin[i].begin(), vecEntryVin[i].end());
+    }
+    BOOST_CHECK(SignSignature(keystore, txMerged.vin[nIn].prevPubKey, txMerged, nIn, int(SIGHASH_ALL|SIGHASH_ANYONECANPAY)));
+    return txMerged.vin[nIn];
+}
+
+BOOST_AUTO_TEST_CASE(entry_signatures)
+{
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+    CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    // Collateral paying DARKSEND_COLLATERAL in fees, spending a mempool transaction
+    CMutableTransaction txFunding;
+    txFunding.vin.resize(1);
+    txFunding.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txFunding.vout.push_back(CTxOut(COIN, scriptPubKey));
+    mempool.addUnchecked(txFunding.GetHash(), CTxMemPoolEntry(txFunding, 0, GetTime(), 0.0, 1));
+
+    CMutableTransaction txCollateral;
+    txCollateral.vin.push_back(CTxIn(COutPoint(txFunding.GetHash(), 0)));
+    txCollateral.vout.push_back(CTxOut(COIN - DARKSEND_COLLATERAL, scriptPubKey));
+    BOOST_CHECK(SignSignature(keystore, CTransaction(txFunding), txCollateral, 0));
+
+    bool fMasterNodeOld = fMasterNode;
+    fMasterNode = true;
+    CDarksendPool pool;
+    int errorID;
+
+    std::vector<std::vector<CTxIn> > vecEntryVin;
+    std::vector<std::vector<CTxOut> > vecEntryVout;
+    for (int i = 0; i < 2; i++) {
+        vecEntryVin.push_back(MakeEntryInputs(scriptPubKey, 2));
+        vecEntryVout.push_back(std::vector<CTxOut>(2, CTxOut(COIN / 10 + 100, scriptPubKey)));
+    }
+
+    BOOST_CHECK(pool.AddEntry(vecEntryVin[0], 0, txCollateral, vecEntryVout[0], errorID));
+    BOOST_CHECK_EQUAL(errorID, CDarksendPool::MSG_ENTRIES_ADDED);
+    BOOST_CHECK(!pool.SignaturesComplete());
+
+    // An input already in an entry is refused, even next to new ones
+    std::vector<CTxIn> vinOverlap = MakeEntryInputs(scriptPubKey, 1);
+    vinOverlap.push_back(vecEntryVin[0][1]);
+    BOOST_CHECK(!pool.AddEntry(vinOverlap, 0, txCollateral, vecEntryVout[1], errorID));
+    BOOST_CHECK_EQUAL(errorID, CDarksendPool::ERR_ALREADY_HAVE);
+
+    BOOST_CHECK(pool.AddEntry(vecEntryVin[1], 0, txCollateral, vecEntryVout[1], errorID));
+    BOOST_CHECK(!pool.SignaturesComplete());
+
+    // A signature for another input of the merged transaction doesn't verify
+    CTxIn vinWrong = SignEntryInput(keystore, vecEntryVin, vecEntryVout, 1);
+    vinWrong.prevout = vecEntryVin[1][0].prevout;
+    BOOST_CHECK(!pool.AddScriptSig(vinWrong));
+
+    // Nor does one signed before the second entry joined
+    std::vector<std::vector<CTxIn> > vecFirstVin(1, vecEntryVin[0]);
+    std::vector<std::vector<CTxOut> > vecFirstVout(1, vecEntryVout[0]);
+    BOOST_CHECK(!pool.AddScriptSig(SignEntryInput(keystore, vecFirstVin, vecFirstVout, 0)));
+
+    // Each input takes its signature once, the same scriptSig can't come back
+    std::vector<CTxIn> vecSigned;
+    for (unsigned int n = 0; n < 4; n++)
+        vecSigned.push_back(SignEntryInput(keystore, vecEntryVin, vecEntryVout, n));
+    for (unsigned int n = 0; n < 4; n++) {
+        BOOST_CHECK(!pool.SignaturesComplete());
+        BOOST_CHECK(pool.AddScriptSig(vecSigned[n]));
+        BOOST_CHECK(!pool.AddScriptSig(vecSigned[n]));
+    }
+    BOOST_CHECK(pool.SignaturesComplete());
+
+    // Reset clears the indexes with the entries
+    pool.SetNull();
+    BOOST_CHECK(pool.SignaturesComplete());
+    BOOST_CHECK(!pool.AddScriptSig(vecSigned[0]));
+    BOOST_CHECK(pool.AddEntry(vecEntryVin[0], 0, txCollateral, vecEntryVout[0], errorID));
+    BOOST_CHECK(!pool.SignaturesComplete());
+
+    fMasterNode = fMasterNodeOld;
+    std::list<CTransaction> removed;
+    mempool.remove(txFunding, removed, true);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -23,4 +23,54 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK(nSum == 1350824726649000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(block_download_window)
+{
+    // A peer that keeps its window full grows it by one per delivery, up to the cap
+    int nWindow = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    BOOST_CHECK_EQUAL(GrowBlockDownloadWindow(nWindow, nWindow - 1), nWindow + 1);
+    for (int i = 0; i < 2 * MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER; i++)
+        nWindow = GrowBlockDownloadWindow(nWindow, nWindow);
+    BOOST_CHECK_EQUAL(nWindow, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // One that does not use its window keeps it as is
+    BOOST_CHECK_EQUAL(GrowBlockDownloadWindow(MAX_BLOCKS_IN_TRANSIT_PER_PEER, 3), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // Stalling halves it, down to the floor
+    BOOST_CHECK_EQUAL(ShrinkBlockDownloadWindow(MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER), MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER / 2);
+    for (int i = 0; i < 10; i++)
+        nWindow = ShrinkBlockDownloadWindow(nWindow);
+    BOOST_CHECK_EQUAL(nWindow, MIN_BLOCKS_IN_TRANSIT_PER_PEER);
+}
+
+BOOST_AUTO_TEST_CASE(block_response_time)
+{
+    // The first sample is taken as is, later ones are averaged in
+    int64_t nAvg = UpdateBlockResponseTime(0, 800000);
+    BOOST_CHECK_EQUAL(nAvg, 800000);
+    nAvg = UpdateBlockResponseTime(nAvg, 0);
+    BOOST_CHECK_EQUAL(nAvg, 700000);
+    BOOST_CHECK_EQUAL(UpdateBlockResponseTime(nAvg, -5), 612500);
+}
+
+BOOST_AUTO_TEST_CASE(block_rerequest)
+{
+    const int64_t nAvg = 300000;
+    const int64_t nWait = BLOCK_REREQUEST_MIN_WAIT + 1;
+
+    // A peer that has not delivered a block yet has no claim to anyone else's
+    BOOST_CHECK(!IsBlockRerequestWorthwhile(0, 0, 60 * 1000000));
+    BOOST_CHECK(!IsBlockRerequestWorthwhile(0, 10 * nAvg, 60 * 1000000));
+
+    // Nothing is re-requested before the minimum wait, however slow the holder is
+    BOOST_CHECK(!IsBlockRerequestWorthwhile(nAvg, 10 * nAvg, BLOCK_REREQUEST_MIN_WAIT));
+
+    // A much slower holder loses the block, a comparable one keeps it
+    BOOST_CHECK(IsBlockRerequestWorthwhile(nAvg, BLOCK_DOWNLOAD_STEAL_FACTOR * nAvg + 1, nWait));
+    BOOST_CHECK(!IsBlockRerequestWorthwhile(nAvg, nAvg, nWait));
+
+    // An unmeasured holder is judged by how long it has been sitting on the block
+    BOOST_CHECK(!IsBlockRerequestWorthwhile(nAvg, 0, nWait));
+    BOOST_CHECK(IsBlockRerequestWorthwhile(nAvg, 0, BLOCK_DOWNLOAD_STEAL_FACTOR * nAvg + 1));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
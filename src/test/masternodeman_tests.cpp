@@ -0,0 +1,74 @@
+// Copyright (c) 2014-2015 The Cintamani developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternodeman.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(masternodeman_tests)
+
+static CMasternodeListEntry ListEntry(int n)
+{
+    CMasternodeListEntry entry;
+    entry.vin = CTxIn(COutPoint(uint256(n + 1), n));
+    entry.strVin = entry.vin.prevout.ToStringShort();
+    entry.strStatus = "ENABLED";
+    entry.protocolVersion = 70103;
+    entry.strPubKey = strprintf("pubkey%d", n);
+    entry.strAddr = strprintf("10.0.0.%d:9999", n);
+    entry.nLastSeen = 1000 + n;
+    entry.nActiveSeconds = 100 * n;
+    entry.nVersion = 0;
+    entry.nLastPaid = 0;
+    entry.nRank = n + 1;
+    return entry;
+}
+
+static int CountChangedSince(const CMasternodeListView& view, uint64_t nSinceVersion)
+{
+    int nChanged = 0;
+    BOOST_FOREACH(const CMasternodeListEntry& entry, view.vEntries)
+        if (entry.nVersion > nSinceVersion) nChanged++;
+    for (std::map<COutPoint, uint64_t>::const_iterator it = view.mapRemoved.begin(); it != view.mapRemoved.end(); ++it)
+        if (it->second > nSinceVersion) nChanged++;
+    return nChanged;
+}
+
+BOOST_AUTO_TEST_CASE(list_view_versions)
+{
+    CMasternodeListView view1;
+    for (int i = 0; i < 5; i++)
+        view1.vEntries.push_back(ListEntry(i));
+    view1.AssignVersions(NULL);
+    BOOST_CHECK_EQUAL(view1.nVersion, 1U);
+    BOOST_CHECK_EQUAL(CountChangedSince(view1, 0), 5);
+
+    // A new tip reshuffles ranks and last paid times and pings move last seen times, but the list itself is unchanged
+    CMasternodeListView view2;
+    view2.vEntries = view1.vEntries;
+    for (size_t i = 0; i < view2.vEntries.size(); i++) {
+        view2.vEntries[i].nRank = view2.vEntries.size() - i;
+        view2.vEntries[i].nLastPaid = 5000 + i;
+        view2.vEntries[i].nLastSeen += 600;
+        view2.vEntries[i].nActiveSeconds += 600;
+    }
+    view2.AssignVersions(&view1);
+    BOOST_CHECK_EQUAL(view2.nVersion, view1.nVersion);
+    BOOST_CHECK(view2.HasChangesSince(view1.nVersion));
+    BOOST_CHECK_EQUAL(CountChangedSince(view2, view1.nVersion), 0);
+
+    // A status change and a removal show up in the next delta, and nothing else does
+    CMasternodeListView view3;
+    view3.vEntries = view2.vEntries;
+    view3.vEntries[1].strStatus = "EXPIRED";
+    view3.vEntries.pop_back();
+    view3.AssignVersions(&view2);
+    BOOST_CHECK_EQUAL(view3.nVersion, view2.nVersion + 1);
+    BOOST_CHECK_EQUAL(CountChangedSince(view3, view2.nVersion), 2);
+    BOOST_CHECK_EQUAL(view3.vEntries[1].nVersion, view3.nVersion);
+    BOOST_CHECK_EQUAL(view3.mapRemoved.count(ListEntry(4).vin.prevout), 1U);
+    BOOST_CHECK_EQUAL(CountChangedSince(view3, view3.nVersion), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -99,4 +99,44 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolLockedInputsTest)
+{
+    // Test CTxMemPool locked input tracking
+    CTxMemPool testPool(CFeeRate(0));
+
+    CMutableTransaction txLocked;
+    txLocked.vin.resize(2);
+    txLocked.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txLocked.vin[1].prevout = COutPoint(GetRandHash(), 1);
+    txLocked.vout.resize(1);
+    txLocked.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txLocked.vout[0].nValue = 11000LL;
+    uint256 hashLocked = txLocked.GetHash();
+
+    // Spends the second input of txLocked
+    CMutableTransaction txConflict;
+    txConflict.vin.resize(1);
+    txConflict.vin[0].prevout = txLocked.vin[1].prevout;
+    txConflict.vout = txLocked.vout;
+    uint256 hashConflict = txConflict.GetHash();
+
+    uint256 hashRet;
+    BOOST_CHECK(!testPool.findLockConflict(txConflict, hashRet));
+
+    for (unsigned int i = 0; i < txLocked.vin.size(); i++)
+        BOOST_CHECK(testPool.addLockedInput(txLocked.vin[i].prevout, hashLocked));
+    BOOST_CHECK(!testPool.findLockConflict(txLocked, hashRet));
+    BOOST_CHECK(testPool.findLockConflict(txConflict, hashRet));
+    BOOST_CHECK(hashRet == hashLocked);
+
+    // The first lock wins, and only it can release the input
+    BOOST_CHECK(!testPool.addLockedInput(txConflict.vin[0].prevout, hashConflict));
+    testPool.removeLockedInput(txConflict.vin[0].prevout, hashConflict);
+    BOOST_CHECK(testPool.findLockConflict(txConflict, hashRet));
+
+    testPool.removeLockedInput(txLocked.vin[1].prevout, hashLocked);
+    BOOST_CHECK(!testPool.findLockConflict(txConflict, hashRet));
+    BOOST_CHECK_EQUAL(testPool.mapLockedInputs.size(), 1U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
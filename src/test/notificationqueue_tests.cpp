@@ -0,0 +1,101 @@
+// Copyright (c) 2015 The Cintamani developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "notificationqueue.h"
+#include "utiltime.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+static void Record(boost::mutex* pmutex, std::vector<int>* pvSeen, int n)
+{
+    boost::unique_lock<boost::mutex> lock(*pmutex);
+    pvSeen->push_back(n);
+}
+
+static void Block(boost::mutex* pmutex, boost::condition_variable* pcond, bool* pfRelease)
+{
+    boost::unique_lock<boost::mutex> lock(*pmutex);
+    while (!*pfRelease)
+        pcond->wait(lock);
+}
+
+BOOST_AUTO_TEST_SUITE(notificationqueue_tests)
+
+BOOST_AUTO_TEST_CASE(notificationqueue_synchronous)
+{
+    // Without a thread servicing it, notifications are delivered right away
+    CNotificationQueue queue;
+    boost::mutex mutex;
+    std::vector<int> vSeen;
+    queue.Push(boost::bind(&Record, &mutex, &vSeen, 1));
+    BOOST_CHECK_EQUAL(vSeen.size(), 1U);
+    BOOST_CHECK_EQUAL(queue.Size(), 0U);
+    queue.Flush();
+    queue.WaitBelow(0);
+}
+
+BOOST_AUTO_TEST_CASE(notificationqueue_order)
+{
+    CNotificationQueue queue;
+    boost::thread thread(boost::bind(&CNotificationQueue::Thread, &queue));
+
+    // Hold the service thread so notifications pile up
+    boost::mutex mutexBlock;
+    boost::condition_variable condBlock;
+    bool fRelease = false;
+    while (!queue.IsRunning())
+        MilliSleep(10);
+    queue.Push(boost::bind(&Block, &mutexBlock, &condBlock, &fRelease));
+
+    boost::mutex mutex;
+    std::vector<int> vSeen;
+    for (int i = 0; i < 100; i++)
+        queue.Push(boost::bind(&Record, &mutex, &vSeen, i));
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        BOOST_CHECK(vSeen.empty());
+    }
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutexBlock);
+        fRelease = true;
+        condBlock.notify_all();
+    }
+    queue.WaitBelow(10);
+    BOOST_CHECK(queue.Size() <= 10);
+    queue.Flush();
+    BOOST_CHECK_EQUAL(queue.Size(), 0U);
+    BOOST_CHECK_EQUAL(vSeen.size(), 100U);
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK_EQUAL(vSeen[i], i);
+
+    thread.interrupt();
+    thread.join();
+}
+
+BOOST_AUTO_TEST_CASE(notificationqueue_drain_on_interrupt)
+{
+    CNotificationQueue queue;
+    boost::thread thread(boost::bind(&CNotificationQueue::Thread, &queue));
+
+    boost::mutex mutex;
+    std::vector<int> vSeen;
+    for (int i = 0; i < 50; i++)
+        queue.Push(boost::bind(&Record, &mutex, &vSeen, i));
+    thread.interrupt();
+    thread.join();
+
+    // Nothing queued before shutdown is lost, and later ones are synchronous
+    BOOST_CHECK_EQUAL(vSeen.size(), 50U);
+    queue.Push(boost::bind(&Record, &mutex, &vSeen, 50));
+    BOOST_CHECK_EQUAL(vSeen.size(), 51U);
+    for (int i = 0; i < 51; i++)
+        BOOST_CHECK_EQUAL(vSeen[i], i);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,7 +6,10 @@
 #include "rpcclient.h"
 
 #include "base58.h"
+#include "main.h"
 #include "netbase.h"
+#include "txmempool.h"
+#include "util.h"
 
 #include <boost/algorithm/string.hpp>
 #include <boost/test/unit_test.hpp>
@@ -36,6 +39,8 @@ Value CallRPC(string args)
 
     rpcfn_type method = tableRPC[strMethod]->actor;
     try {
+        if (!method)
+            return tableRPC.execute(strMethod, params);
         Value result = (*method)(params, false);
         return result;
     }
@@ -172,4 +177,151 @@ BOOST_AUTO_TEST_CASE(rpc_boostasiotocnetaddr)
     BOOST_CHECK_EQUAL(BoostAsioToCNetAddr(boost::asio::ip::address::from_string("::ffff:127.0.0.1")).ToString(), "127.0.0.1");
 }
 
+BOOST_AUTO_TEST_CASE(rpc_streamed_reply)
+{
+    // Writing a reply directly must match serializing the reply object
+    Object result;
+    result.push_back(Pair("a", 1));
+    result.push_back(Pair("b", "two\n"));
+    result.push_back(Pair("c", 0.5));
+    Array ids;
+    ids.push_back(Value(result));
+    ids.push_back(Value::null);
+    BOOST_CHECK_EQUAL(JSONRPCReply(ids, Value::null, 7),
+                      write_string(Value(JSONRPCReplyObj(ids, Value::null, 7)), false) + "\n");
+    Object error = JSONRPCError(RPC_MISC_ERROR, "oops");
+    BOOST_CHECK_EQUAL(JSONRPCReply(ids, error, "x"),
+                      write_string(Value(JSONRPCReplyObj(ids, error, "x")), false) + "\n");
+}
+
+BOOST_AUTO_TEST_CASE(rpc_chunked_reply)
+{
+    string strBody;
+    for (int i = 0; i < 1000; i++)
+        strBody += strprintf("%d,", i);
+
+    // Small chunks so the body spans many of them
+    stringstream ss;
+    {
+        HTTPChunkedStreamBuf buf(ss, HTTPChunkedReplyHeader(HTTP_OK, true), 100);
+        ostream os(&buf);
+        os << strBody.substr(0, 50);
+        // Nothing, not even the header, goes out before the first chunk is full
+        BOOST_CHECK(!buf.IsStarted());
+        BOOST_CHECK(ss.str().empty());
+        os << strBody.substr(50);
+        BOOST_CHECK(buf.IsStarted());
+        BOOST_CHECK(buf.Finish());
+    }
+    BOOST_CHECK(ss.str().find("\r\n64\r\n") != string::npos);
+    BOOST_CHECK(boost::algorithm::ends_with(ss.str(), "\r\n0\r\n\r\n"));
+
+    int nProto = 0;
+    BOOST_CHECK_EQUAL(ReadHTTPStatus(ss, nProto), HTTP_OK);
+    BOOST_CHECK_EQUAL(nProto, 1);
+    map<string, string> mapHeaders;
+    string strMessage;
+    BOOST_CHECK_EQUAL(ReadHTTPMessage(ss, mapHeaders, strMessage, nProto, 1000000), HTTP_OK);
+    BOOST_CHECK_EQUAL(mapHeaders["transfer-encoding"], "chunked");
+    BOOST_CHECK(strMessage == strBody);
+
+    // Replies larger than the limit are rejected
+    stringstream ssLarge;
+    {
+        HTTPChunkedStreamBuf buf(ssLarge, HTTPChunkedReplyHeader(HTTP_OK, true), 100);
+        ostream os(&buf);
+        os << strBody;
+        buf.Finish();
+    }
+    ReadHTTPStatus(ssLarge, nProto);
+    BOOST_CHECK_EQUAL(ReadHTTPMessage(ssLarge, mapHeaders, strMessage, nProto, 1000), HTTP_INTERNAL_SERVER_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_json_writer)
+{
+    Object info;
+    info.push_back(Pair("size", 250));
+    info.push_back(Pair("fee", 0.0001));
+    Array depends;
+    depends.push_back("a\"b");
+    Object list;
+    list.push_back(Pair("tx1", info));
+    list.push_back(Pair("tx2", Object()));
+    Object reply;
+    reply.push_back(Pair("version", 3));
+    reply.push_back(Pair("list", list));
+    reply.push_back(Pair("depends", depends));
+    reply.push_back(Pair("none", Array()));
+
+    // The same value streamed piece by piece must serialize the same way
+    ostringstream os;
+    CJSONWriter writer(os, "prefix:");
+    BOOST_CHECK(!writer.IsStarted());
+    writer.BeginObject();
+    BOOST_CHECK_EQUAL(os.str(), "prefix:{");
+    writer.Pair("version", 3);
+    writer.Key("list");
+    writer.BeginObject();
+    writer.Pair("tx1", info);
+    writer.Key("tx2");
+    writer.BeginObject();
+    writer.EndObject();
+    writer.EndObject();
+    writer.Key("depends");
+    writer.BeginArray();
+    writer.Write("a\"b");
+    writer.EndArray();
+    BOOST_CHECK(!writer.IsComplete());
+    writer.Key("none");
+    writer.BeginArray();
+    writer.EndArray();
+    writer.EndObject();
+    BOOST_CHECK(writer.IsComplete());
+    BOOST_CHECK_EQUAL(os.str(), "prefix:" + write_string(Value(reply), false));
+}
+
+BOOST_AUTO_TEST_CASE(rpc_streamed_commands)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1000;
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 10, 1000, 0.0, 1));
+
+    // A streaming command gives callers that want a value the value it wrote
+    Value r = CallRPC("getrawmempool");
+    BOOST_CHECK_EQUAL(r.get_array().size(), 1U);
+    BOOST_CHECK_EQUAL(r.get_array()[0].get_str(), tx.GetHash().ToString());
+    r = CallRPC("getrawmempool true");
+    const Object& entry = find_value(r.get_obj(), tx.GetHash().ToString()).get_obj();
+    BOOST_CHECK_EQUAL(find_value(entry, "time").get_int64(), 1000);
+    BOOST_CHECK_EQUAL(find_value(entry, "depends").get_array().size(), 0U);
+
+    Array params;
+    params.push_back(true);
+    ostringstream os;
+    CJSONWriter writer(os);
+    tableRPC.execute("getrawmempool", params, writer);
+    BOOST_CHECK(writer.IsComplete());
+    BOOST_CHECK_EQUAL(os.str(), write_string(r, false));
+
+    // Errors are thrown before anything is written
+    params[0] = "notabool";
+    ostringstream osError;
+    CJSONWriter writerError(osError);
+    BOOST_CHECK_THROW(tableRPC.execute("getrawmempool", params, writerError), Object);
+    BOOST_CHECK(!writerError.IsStarted());
+
+    // Commands that return a value are written the same way
+    ostringstream osCount;
+    CJSONWriter writerCount(osCount);
+    tableRPC.execute("getblockcount", Array(), writerCount);
+    BOOST_CHECK_EQUAL(osCount.str(), write_string(CallRPC("getblockcount"), false));
+
+    std::list<CTransaction> removed;
+    mempool.remove(tx, removed);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
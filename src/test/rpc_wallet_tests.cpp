@@ -104,6 +104,25 @@ BOOST_AUTO_TEST_CASE(rpc_wallet)
     BOOST_CHECK_NO_THROW(r = CallRPC("listunspent 0 1 []"));
     BOOST_CHECK(r.get_array().empty());
 
+    /*********************************
+     * 			listtransactions
+     *********************************/
+    BOOST_CHECK_NO_THROW(r = CallRPC("listtransactions"));
+    BOOST_CHECK(r.type() == array_type);
+    BOOST_CHECK_THROW(CallRPC("listtransactions * -1"), runtime_error);
+    BOOST_CHECK_THROW(CallRPC("listtransactions * 10 0 false extra"), runtime_error);
+    for (int i = 0; i < 3; i++)
+        BOOST_CHECK_NO_THROW(CallRPC(strprintf("move listtxsource listtxaccount 0.0%d 1 c%d", i + 1, i)));
+    // A window counted back from the newest, returned oldest first
+    BOOST_CHECK_NO_THROW(r = CallRPC("listtransactions listtxaccount 2 1"));
+    BOOST_CHECK_EQUAL(r.get_array().size(), 2U);
+    BOOST_CHECK_EQUAL(find_value(r.get_array()[0].get_obj(), "comment").get_str(), "c0");
+    BOOST_CHECK_EQUAL(find_value(r.get_array()[1].get_obj(), "comment").get_str(), "c1");
+    BOOST_CHECK_NO_THROW(r = CallRPC("listtransactions listtxaccount 10 2"));
+    BOOST_CHECK_EQUAL(r.get_array().size(), 1U);
+    BOOST_CHECK_NO_THROW(r = CallRPC("listtransactions listtxaccount 10 5"));
+    BOOST_CHECK(r.get_array().empty());
+
     /*********************************
      * 		listreceivedbyaddress
      *********************************/
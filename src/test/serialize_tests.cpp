@@ -161,4 +161,66 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     BOOST_CHECK_EQUAL(ss.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(span_reader)
+{
+    CDataStream ss(SER_DISK, 0);
+    std::vector<int> vIn;
+    for (int i = 0; i < 10; i++)
+        vIn.push_back(i * 1000);
+    ss << (uint32_t)0xdeadbeef << vIn << std::string("tail");
+    std::vector<unsigned char> vch(ss.begin(), ss.end());
+
+    // Same objects come back out as through a CDataStream
+    CSpanReader reader(&vch[0], &vch[0] + vch.size(), SER_DISK, 0);
+    uint32_t n;
+    std::vector<int> vOut;
+    std::string str;
+    reader >> n >> vOut >> str;
+    BOOST_CHECK_EQUAL(n, 0xdeadbeef);
+    BOOST_CHECK(vOut == vIn);
+    BOOST_CHECK_EQUAL(str, "tail");
+    BOOST_CHECK(reader.empty());
+
+    // Skipping and reading past the end
+    CSpanReader reader2(&vch[0], &vch[0] + vch.size(), SER_DISK, 0);
+    reader2.ignore(4);
+    BOOST_CHECK_EQUAL(reader2.GetPos(), 4U);
+    reader2 >> vOut;
+    BOOST_CHECK(vOut == vIn);
+    BOOST_CHECK_THROW(reader2.ignore(reader2.size() + 1), std::ios_base::failure);
+    BOOST_CHECK_THROW(reader2 >> vOut, std::ios_base::failure);
+
+    // A truncated span must not be read past its end
+    CSpanReader reader3(&vch[0], &vch[0] + 6, SER_DISK, 0);
+    BOOST_CHECK_THROW(reader3 >> n >> vOut, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(prevector_compat)
+{
+    // A prevector serializes exactly like a vector with the same contents,
+    // both while its elements are stored inline and once they are on the heap
+    for (unsigned int nSize = 0; nSize < 40; nSize += 3) {
+        std::vector<unsigned char> vch;
+        std::vector<int> vn;
+        for (unsigned int i = 0; i < nSize; i++) {
+            vch.push_back(i * 7);
+            vn.push_back(i * 100000);
+        }
+        prevector<28, unsigned char> pvch(vch.begin(), vch.end());
+        prevector<8, int> pvn(vn.begin(), vn.end());
+
+        CDataStream ssVector(SER_DISK, 0), ssPrevector(SER_DISK, 0);
+        ssVector << vch << vn;
+        ssPrevector << pvch << pvn;
+        BOOST_CHECK(ssVector.str() == ssPrevector.str());
+        BOOST_CHECK_EQUAL(ssPrevector.size(), GetSerializeSize(pvch, SER_DISK, 0) + GetSerializeSize(pvn, SER_DISK, 0));
+
+        prevector<28, unsigned char> pvchOut;
+        prevector<8, int> pvnOut;
+        ssVector >> pvchOut >> pvnOut;
+        BOOST_CHECK(pvchOut == pvch);
+        BOOST_CHECK(pvnOut == pvn);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
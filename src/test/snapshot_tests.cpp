@@ -0,0 +1,334 @@
+// Copyright (c) 2014-2015 The Cintamani developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "main.h"
+#include "pow.h"
+#include "random.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(snapshot_tests)
+
+//! Fill an empty coin database at the genesis block with nTx random transactions
+static std::vector<uint256> FillCoinsDB(CCoinsViewDB &db, int nTx)
+{
+    std::vector<uint256> vTxid;
+    CCoinsViewCache cache(&db);
+    for (int i = 0; i < nTx; i++) {
+        vTxid.push_back(GetRandHash());
+        CCoinsModifier coins = cache.ModifyCoins(vTxid.back());
+        coins->nVersion = 1;
+        coins->nHeight = i;
+        coins->fCoinBase = i % 10 == 0;
+        coins->vout.resize(1 + i % 3);
+        for (unsigned int n = 0; n < coins->vout.size(); n++) {
+            coins->vout[n].nValue = 1 + GetRand(1000 * COIN);
+            coins->vout[n].scriptPubKey = CScript() << OP_TRUE;
+        }
+    }
+    cache.SetBestBlock(Params().HashGenesisBlock());
+    BOOST_CHECK(cache.Flush());
+    return vTxid;
+}
+
+//! Write db as a snapshot to path and return what it hashed to
+static CCoinsStats DumpCoinsDB(const CCoinsViewDB &db, const boost::filesystem::path &path)
+{
+    CCoinsSnapshotHeader header;
+    memcpy(header.pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE);
+    CCoinsStats stats;
+    CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(db.DumpSnapshot(fileout, header, stats));
+    BOOST_CHECK(header.hashBlock == Params().HashGenesisBlock());
+    return stats;
+}
+
+//! Load the snapshot at path into db, expecting it to hash to hashExpected
+static bool LoadCoinsDB(CCoinsViewDB &db, const boost::filesystem::path &path, const uint256 &hashExpected, std::string &strError)
+{
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    CCoinsSnapshotHeader header;
+    filein >> header;
+    CCoinsStats stats;
+    if (!db.LoadSnapshot(filein, header, hashExpected, 4, stats, strError))
+        return false;
+    BOOST_CHECK(stats.hashSerialized == hashExpected);
+    return true;
+}
+
+//! Write a snapshot header for hashBlock, with no entries behind it, to path
+static void WriteSnapshotHeader(const boost::filesystem::path &path, const uint256 &hashBlock, uint64_t nChainTx)
+{
+    CCoinsSnapshotHeader header;
+    memcpy(header.pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE);
+    header.hashBlock = hashBlock;
+    header.nChainTx = nChainTx;
+    CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    fileout << header;
+}
+
+//! Height of the regtest block the snapshot in the regtest parameters was taken at
+static const int REGTEST_SNAPSHOT_HEIGHT = 30;
+
+/**
+ * The next block of the regtest chain that snapshot is of: a coinbase paying
+ * the full block value to OP_TRUE, one minute after its parent, and once
+ * coinbases mature a transaction splitting the one COINBASE_MATURITY blocks
+ * back in two. vBlocks holds the chain's blocks from height 1 on.
+ */
+static CBlock MakeRegtestBlock(const std::vector<CBlock> &vBlocks)
+{
+    CBlockIndex *pindexPrev = chainActive.Tip();
+    int nHeight = pindexPrev->nHeight + 1;
+    CBlock block;
+    CMutableTransaction txCoinbase;
+    txCoinbase.vin.resize(1);
+    txCoinbase.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    txCoinbase.vout.push_back(CTxOut(GetBlockValue(pindexPrev->nBits, pindexPrev->nHeight, 0), CScript() << OP_TRUE));
+    block.vtx.push_back(txCoinbase);
+    if (nHeight > COINBASE_MATURITY) {
+        const CTransaction &txMatured = vBlocks[nHeight - COINBASE_MATURITY - 1].vtx[0];
+        CMutableTransaction txSplit;
+        txSplit.vin.push_back(CTxIn(COutPoint(txMatured.GetHash(), 0)));
+        txSplit.vout.resize(2, CTxOut(txMatured.vout[0].nValue / 2, CScript() << OP_TRUE));
+        block.vtx.push_back(txSplit);
+    }
+    block.hashPrevBlock = pindexPrev->GetBlockHash();
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    block.nTime = pindexPrev->nTime + Params().TargetSpacing();
+    block.nBits = GetNextWorkRequired(pindexPrev, &block);
+    while (!CheckProofOfWork(block.GetHash(), block.nBits))
+        block.nNonce++;
+    return block;
+}
+
+/**
+ * While it exists, an empty in-memory regtest chainstate replaces the unit
+ * test one, which is flushed first and loaded back afterwards.
+ */
+class CRegtestChainstate
+{
+private:
+    CBlockTreeDB *pblocktreeSaved;
+    CCoinsViewBackgroundFlush *pcoinsWriterSaved;
+    CCoinsViewCache *pcoinsTipSaved;
+    CCoinsViewDB *pcoinsdbview;
+
+public:
+    CRegtestChainstate() {
+        FlushStateToDisk();
+        pblocktreeSaved = pblocktree;
+        pcoinsWriterSaved = pcoinsWriter;
+        pcoinsTipSaved = pcoinsTip;
+        UnloadBlockIndex();
+
+        SelectParams(CBaseChainParams::REGTEST);
+        ClearDatadirCache();
+        boost::filesystem::remove_all(GetDataDir() / "blocks");
+        pblocktree = new CBlockTreeDB(1 << 20, true);
+        pcoinsdbview = new CCoinsViewDB(1 << 20, true);
+        pcoinsWriter = new CCoinsViewBackgroundFlush(pcoinsdbview);
+        pcoinsTip = new CCoinsViewCache(pcoinsWriter, true);
+        BOOST_CHECK(InitBlockIndex());
+    }
+
+    ~CRegtestChainstate() {
+        FlushStateToDisk();
+        UnloadBlockIndex();
+        delete pcoinsTip;
+        delete pcoinsWriter;
+        delete pcoinsdbview;
+        delete pblocktree;
+
+        SelectParams(CBaseChainParams::UNITTEST);
+        ClearDatadirCache();
+        pblocktree = pblocktreeSaved;
+        pcoinsWriter = pcoinsWriterSaved;
+        pcoinsTip = pcoinsTipSaved;
+        BOOST_CHECK(LoadBlockIndex());
+    }
+};
+
+BOOST_AUTO_TEST_CASE(snapshot_roundtrip)
+{
+    boost::filesystem::path path = GetDataDir() / "snapshot_roundtrip.dat";
+    CCoinsViewDB dbSource(1 << 20, true);
+    // More than one chunk, so several writer threads get work
+    std::vector<uint256> vTxid = FillCoinsDB(dbSource, COINS_SNAPSHOT_CHUNK + COINS_SNAPSHOT_CHUNK / 2);
+    CCoinsStats statsSource;
+    BOOST_CHECK(dbSource.GetStats(statsSource));
+    CCoinsStats statsDump = DumpCoinsDB(dbSource, path);
+    BOOST_CHECK(statsDump.hashSerialized == statsSource.hashSerialized);
+    BOOST_CHECK_EQUAL(statsDump.nTransactions, vTxid.size());
+
+    CCoinsViewDB dbTarget(1 << 20, true);
+    std::string strError;
+    BOOST_CHECK_MESSAGE(LoadCoinsDB(dbTarget, path, statsDump.hashSerialized, strError), strError);
+    BOOST_CHECK(dbTarget.GetBestBlock() == Params().HashGenesisBlock());
+    BOOST_CHECK(!dbTarget.HaveIncompleteSnapshot());
+    for (unsigned int i = 0; i < vTxid.size(); i += 997) {
+        CCoins coinsSource, coinsTarget;
+        BOOST_CHECK(dbSource.GetCoins(vTxid[i], coinsSource));
+        BOOST_CHECK(dbTarget.GetCoins(vTxid[i], coinsTarget));
+        BOOST_CHECK(coinsSource == coinsTarget);
+    }
+
+    // Only an empty coin database can be loaded into
+    BOOST_CHECK(!LoadCoinsDB(dbTarget, path, statsDump.hashSerialized, strError));
+    BOOST_CHECK_EQUAL(strError, "coin database is not empty");
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_rejected)
+{
+    boost::filesystem::path path = GetDataDir() / "snapshot_rejected.dat";
+    CCoinsViewDB dbSource(1 << 20, true);
+    std::vector<uint256> vTxid = FillCoinsDB(dbSource, 500);
+    CCoinsStats statsDump = DumpCoinsDB(dbSource, path);
+
+    // An intact file whose set is not the expected one leaves nothing behind
+    CCoinsViewDB dbTarget(1 << 20, true);
+    std::string strError;
+    BOOST_CHECK(!LoadCoinsDB(dbTarget, path, GetRandHash(), strError));
+    BOOST_FOREACH(const uint256 &txid, vTxid)
+        BOOST_CHECK(!dbTarget.HaveCoins(txid));
+    BOOST_CHECK(dbTarget.GetBestBlock() == uint256(0));
+    BOOST_CHECK(!dbTarget.HaveIncompleteSnapshot());
+
+    // Neither does a damaged one
+    std::vector<char> vData(boost::filesystem::file_size(path));
+    {
+        CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        file.read(&vData[0], vData.size());
+    }
+    vData[vData.size() / 2] ^= 0x01;
+    {
+        CAutoFile file(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        file.write(&vData[0], vData.size());
+    }
+    BOOST_CHECK(!LoadCoinsDB(dbTarget, path, statsDump.hashSerialized, strError));
+    BOOST_FOREACH(const uint256 &txid, vTxid)
+        BOOST_CHECK(!dbTarget.HaveCoins(txid));
+    BOOST_CHECK(!dbTarget.HaveIncompleteSnapshot());
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_trust_anchor)
+{
+    boost::filesystem::path path = GetDataDir() / "snapshot_trust_anchor.dat";
+    uint256 hashBlock = GetRandHash();
+    WriteSnapshotHeader(path, hashBlock, 1000);
+    bool fLiteModeOld = fLiteMode;
+    fLiteMode = true;
+    CCoinsStats stats;
+    std::string strError;
+
+    // A snapshot that the chain parameters don't list is refused
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(!LoadTxOutSet(filein, stats, strError));
+        BOOST_CHECK(strError.find("no snapshot") != std::string::npos);
+    }
+
+    MapTxOutSetSnapshots mapSnapshotsOld = Params().TxOutSetSnapshots();
+    MapTxOutSetSnapshots mapSnapshots;
+    mapSnapshots.insert(std::make_pair(hashBlock, CTxOutSetSnapshotData(GetRandHash(), 1001)));
+    ModifiableParams()->setTxOutSetSnapshots(mapSnapshots);
+    // So is one that disagrees with them about the chain's transaction count
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(!LoadTxOutSet(filein, stats, strError));
+        BOOST_CHECK(strError.find("expected 1001") != std::string::npos);
+    }
+
+    // A listed one still needs -litemode
+    WriteSnapshotHeader(path, hashBlock, 1001);
+    fLiteMode = false;
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(!LoadTxOutSet(filein, stats, strError));
+        BOOST_CHECK(strError.find("-litemode") != std::string::npos);
+    }
+
+    ModifiableParams()->setTxOutSetSnapshots(mapSnapshotsOld);
+    fLiteMode = fLiteModeOld;
+    BOOST_CHECK(!IsSnapshotChainstate());
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_regtest)
+{
+    boost::filesystem::path path = GetDataDir() / "snapshot_regtest.dat";
+    bool fLiteModeOld = fLiteMode;
+    fLiteMode = true;
+    std::vector<CBlock> vBlocks;
+    CCoinsStats stats;
+    std::string strError;
+
+    // Build the chain up to the snapshot block, dump it there and add one more block
+    {
+        CRegtestChainstate chainstate;
+        for (int i = 0; i < REGTEST_SNAPSHOT_HEIGHT; i++) {
+            vBlocks.push_back(MakeRegtestBlock(vBlocks));
+            CValidationState state;
+            BOOST_CHECK(ProcessNewBlock(state, NULL, &vBlocks.back()));
+        }
+        BOOST_REQUIRE_EQUAL(chainActive.Height(), REGTEST_SNAPSHOT_HEIGHT);
+        {
+            CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+            BOOST_CHECK_MESSAGE(DumpTxOutSet(fileout, stats, strError), strError);
+        }
+
+        // The regtest parameters list exactly this set
+        const MapTxOutSetSnapshots &mapSnapshots = Params().TxOutSetSnapshots();
+        MapTxOutSetSnapshots::const_iterator it = mapSnapshots.find(chainActive.Tip()->GetBlockHash());
+        BOOST_REQUIRE_MESSAGE(it != mapSnapshots.end(), "no regtest snapshot at " + chainActive.Tip()->GetBlockHash().ToString());
+        BOOST_CHECK_MESSAGE(it->second.hashSerialized == stats.hashSerialized, "regtest snapshot hash is " + stats.hashSerialized.ToString());
+        BOOST_CHECK_EQUAL(it->second.nChainTx, chainActive.Tip()->nChainTx);
+
+        vBlocks.push_back(MakeRegtestBlock(vBlocks));
+    }
+
+    // A node that only has the headers loads it and continues from the snapshot block
+    {
+        CRegtestChainstate chainstate;
+        {
+            LOCK(cs_main);
+            BOOST_FOREACH(const CBlock &block, vBlocks) {
+                CValidationState state;
+                BOOST_CHECK(AcceptBlockHeader(block, state));
+            }
+        }
+        {
+            CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+            CCoinsStats statsLoaded;
+            BOOST_CHECK_MESSAGE(LoadTxOutSet(filein, statsLoaded, strError), strError);
+            BOOST_CHECK(statsLoaded.hashSerialized == stats.hashSerialized);
+        }
+        BOOST_CHECK(IsSnapshotChainstate());
+        BOOST_CHECK_EQUAL(chainActive.Height(), REGTEST_SNAPSHOT_HEIGHT);
+
+        // The last block spends a coinbase that only the snapshot has
+        CValidationState state;
+        BOOST_CHECK(ProcessNewBlock(state, NULL, &vBlocks.back()));
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == vBlocks.back().GetHash());
+        BOOST_CHECK(!pcoinsTip->HaveCoins(vBlocks.back().vtx[1].vin[0].prevout.hash));
+        BOOST_CHECK(pcoinsTip->HaveCoins(vBlocks.back().vtx[1].GetHash()));
+    }
+
+    BOOST_CHECK(!IsSnapshotChainstate());
+    fLiteMode = fLiteModeOld;
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -244,6 +244,28 @@ BOOST_AUTO_TEST_CASE(basic_transaction_tests)
     BOOST_CHECK_MESSAGE(!CheckTransaction(tx, state) || !state.IsValid(), "Transaction with duplicate txins should be invalid.");
 }
 
+BOOST_AUTO_TEST_CASE(test_Swap)
+{
+    CMutableTransaction txA, txB;
+    txA.vin.resize(2);
+    txA.vin[1].prevout.n = 1;
+    txA.vout.resize(1);
+    txA.vout[0].nValue = 5000;
+    txA.nLockTime = 100;
+    txB.vout.resize(3);
+
+    // Same result as converting, and tx takes the old contents with it
+    CTransaction tx(txB);
+    uint256 hashA = txA.GetHash();
+    tx.Swap(txA);
+    BOOST_CHECK(tx.GetHash() == hashA);
+    BOOST_CHECK(tx == CTransaction(CMutableTransaction(tx)));
+    BOOST_CHECK_EQUAL(tx.vin.size(), 2U);
+    BOOST_CHECK_EQUAL(tx.nLockTime, 100U);
+    BOOST_CHECK(txA.GetHash() == txB.GetHash());
+    BOOST_CHECK(txA.vin.empty());
+}
+
 //
 // Helper: create two dummy transactions, each with
 // two outputs.  The first has 11 and 50 CENT outputs
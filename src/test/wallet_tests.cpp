@@ -4,6 +4,9 @@
 
 #include "wallet.h"
 
+#include "main.h"
+#include "random.h"
+
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -305,4 +308,91 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+static const CAmount DENOM_10 = (10 * COIN) + 10000;
+static const CAmount DENOM_1 = (1 * COIN) + 1000;
+static const CAmount DENOM_DOT1 = (.1 * COIN) + 100;
+
+//! Add a transaction paying vValue to script to denomWallet, confirmed in the genesis block
+static CTransaction add_denominated_tx(CWallet& denomWallet, const CScript& script, const CTxIn& txin, const std::vector<CAmount>& vValue)
+{
+    CMutableTransaction tx;
+    tx.vin.push_back(txin);
+    BOOST_FOREACH(const CAmount& nValue, vValue)
+        tx.vout.push_back(CTxOut(nValue, script));
+    CWalletTx wtx(&denomWallet, tx);
+    wtx.hashBlock = chainActive.Genesis()->GetBlockHash();
+    wtx.nIndex = 0;
+    wtx.fMerkleVerified = true;
+    BOOST_CHECK(denomWallet.AddToWallet(wtx));
+    return tx;
+}
+
+static int select_denominated(CWallet& denomWallet, int nDenom, CAmount nValueMax, int nRoundsMin, int nRoundsMax, std::vector<CTxIn>& vin)
+{
+    std::vector<COutput> vOut;
+    CAmount nValueRet;
+    if (!denomWallet.SelectCoinsByDenominations(nDenom, 1, nValueMax, vin, vOut, nValueRet, nRoundsMin, nRoundsMax))
+        vin.clear();
+    return vin.size();
+}
+
+BOOST_AUTO_TEST_CASE(denominated_coin_selection)
+{
+    std::vector<int64_t> vDenominationsOld = darkSendDenominations;
+    darkSendDenominations.clear();
+    darkSendDenominations.push_back((100 * COIN) + 100000);
+    darkSendDenominations.push_back(DENOM_10);
+    darkSendDenominations.push_back(DENOM_1);
+    darkSendDenominations.push_back(DENOM_DOT1);
+    const int nBit10 = 1 << 1, nBit1 = 1 << 2, nBitDot1 = 1 << 3;
+
+    CWallet denomWallet("wallet_denom.dat");
+    LOCK2(cs_main, denomWallet.cs_wallet);
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(denomWallet.AddKey(key));
+    CScript script = GetScriptForDestination(key.GetPubKey().GetID());
+    std::vector<CTxIn> vin;
+
+    // Denominations received from outside are round 0
+    std::vector<CAmount> vValue;
+    vValue.push_back(DENOM_1);
+    vValue.push_back(DENOM_10);
+    CTransaction tx1 = add_denominated_tx(denomWallet, script, CTxIn(COutPoint(GetRandHash(), 0)), vValue);
+    BOOST_CHECK_EQUAL(select_denominated(denomWallet, nBit1, 100 * COIN, 0, 1, vin), 1);
+    BOOST_CHECK(vin[0].prevout == COutPoint(tx1.GetHash(), 0));
+    BOOST_CHECK_EQUAL(select_denominated(denomWallet, nBit1, 100 * COIN, 1, 2, vin), 0);
+    BOOST_CHECK_EQUAL(select_denominated(denomWallet, nBit10, 100 * COIN, 0, 1, vin), 1);
+    BOOST_CHECK(vin[0].prevout == COutPoint(tx1.GetHash(), 1));
+
+    // Mixing one spends it and gives a round 1 output instead
+    CTransaction tx2 = add_denominated_tx(denomWallet, script, CTxIn(COutPoint(tx1.GetHash(), 0)), std::vector<CAmount>(1, DENOM_1));
+    BOOST_CHECK_EQUAL(select_denominated(denomWallet, nBit1, 100 * COIN, 0, 1, vin), 0);
+    BOOST_CHECK_EQUAL(select_denominated(denomWallet, nBit1, 100 * COIN, 1, 2, vin), 1);
+    BOOST_CHECK(vin[0].prevout == COutPoint(tx2.GetHash(), 0));
+
+    // A full rebuild of the index gives the same answers
+    denomWallet.MarkDirty();
+    BOOST_CHECK_EQUAL(select_denominated(denomWallet, nBit1, 100 * COIN, 1, 2, vin), 1);
+    BOOST_CHECK_EQUAL(select_denominated(denomWallet, nBit10, 100 * COIN, 0, 1, vin), 1);
+
+    // Erasing the mixing transaction drops its output and makes the round 0 one spendable again
+    denomWallet.EraseFromWallet(tx2.GetHash());
+    BOOST_CHECK_EQUAL(select_denominated(denomWallet, nBit1, 100 * COIN, 1, 2, vin), 0);
+    BOOST_CHECK_EQUAL(select_denominated(denomWallet, nBit1, 100 * COIN, 0, 1, vin), 1);
+    BOOST_CHECK(vin[0].prevout == COutPoint(tx1.GetHash(), 0));
+
+    // No more coins are taken than fit in the maximum, however many the wallet has
+    CTransaction tx3 = add_denominated_tx(denomWallet, script, CTxIn(COutPoint(GetRandHash(), 0)), std::vector<CAmount>(50, DENOM_DOT1));
+    for (int i = 0; i < RUN_TESTS; i++) {
+        int nSelected = select_denominated(denomWallet, nBitDot1, 5 * DENOM_DOT1, 0, 1, vin);
+        BOOST_CHECK(nSelected >= 1 && nSelected <= 5);
+        BOOST_FOREACH(const CTxIn& txin, vin)
+            BOOST_CHECK(txin.prevout.hash == tx3.GetHash());
+    }
+    BOOST_CHECK(select_denominated(denomWallet, nBitDot1 | nBit10, 20 * COIN, 0, 1, vin) > 1);
+
+    darkSendDenominations = vDenominationsOld;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,8 +8,11 @@
 #include "pow.h"
 #include "uint256.h"
 
+#include <deque>
 #include <stdint.h>
 
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -25,7 +28,34 @@ void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
     batch.Write('B', hash);
 }
 
+/** Add (nSign = 1) or remove (nSign = -1) the contribution of one coin database entry */
+void static UpdateCoinsCounters(CCoinsCounters &counters, const CCoinsContribution &contribution, int nSign) {
+    if (contribution.IsNull())
+        return;
+    if (nSign > 0) {
+        counters.nTransactions++;
+        counters.nTransactionOutputs += contribution.nOutputs;
+        counters.nSerializedSize += contribution.nSerializedSize;
+        counters.nTotalAmount += contribution.nAmount;
+    } else {
+        counters.nTransactions--;
+        counters.nTransactionOutputs -= contribution.nOutputs;
+        counters.nSerializedSize -= contribution.nSerializedSize;
+        counters.nTotalAmount -= contribution.nAmount;
+    }
+}
+
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) {
+    nWriteSequence = 0;
+    // Counters written by a version that did not update them on every write carry a stale block hash
+    fCountersValid = db.Read('S', counters) && counters.hashBlock == GetBestBlock();
+    if (!fCountersValid) {
+        counters = CCoinsCounters();
+        if (GetBestBlock() == uint256(0)) {
+            // Fresh database, nothing to count yet
+            fCountersValid = true;
+        }
+    }
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
@@ -44,23 +74,183 @@ uint256 CCoinsViewDB::GetBestBlock() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    bool ret = WriteCoins(mapCoins, hashBlock);
+    mapCoins.clear();
+    return ret;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    LOCK(cs_stats);
     CLevelDBBatch batch;
+    CCoinsCounters countersNew = counters;
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            if (fCountersValid) {
+                // Entries the database does not have (FRESH) contribute nothing yet. The cache
+                // normally remembers what the old version contributed (ORIGIN); reading it back
+                // is only needed for entries from a cache that does not track that.
+                if (it->second.flags & CCoinsCacheEntry::ORIGIN) {
+                    UpdateCoinsCounters(countersNew, it->second.origin, -1);
+                } else if (!(it->second.flags & CCoinsCacheEntry::FRESH)) {
+                    CCoins coinsOld;
+                    if (db.Read(make_pair('c', it->first), coinsOld))
+                        UpdateCoinsCounters(countersNew, CCoinsContribution(coinsOld), -1);
+                }
+                UpdateCoinsCounters(countersNew, CCoinsContribution(it->second.coins), 1);
+            }
             BatchWriteCoins(batch, it->first, it->second.coins);
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
-    if (hashBlock != uint256(0))
+    if (hashBlock != uint256(0)) {
         BatchWriteHashBestChain(batch, hashBlock);
+        countersNew.hashBlock = hashBlock;
+    }
+    if (fCountersValid)
+        batch.Write('S', countersNew);
 
     LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+    bool ret = db.WriteBatch(batch);
+    if (ret && fCountersValid)
+        counters = countersNew;
+    nWriteSequence++;
+    return ret;
+}
+
+CCoinsViewBackgroundFlush::CCoinsViewBackgroundFlush(CCoinsViewDB *pdbIn) : CCoinsViewBacked(pdbIn), pdb(pdbIn), hashBlockWriting(0), fWriting(false), fWriteFailed(false) {
+}
+
+CCoinsViewBackgroundFlush::~CCoinsViewBackgroundFlush() {
+    Wait();
+    if (threadWrite.joinable())
+        threadWrite.join();
+}
+
+bool CCoinsViewBackgroundFlush::GetCoins(const uint256 &txid, CCoins &coins) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        CCoinsMap::const_iterator it = mapWriting.find(txid);
+        if (it != mapWriting.end()) {
+            // Not (or not yet known to be) in the database, answer as it will
+            if (it->second.coins.IsPruned())
+                return false;
+            coins = it->second.coins;
+            return true;
+        }
+    }
+    // Entries missing from mapWriting are not touched by the write in flight
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewBackgroundFlush::HaveCoins(const uint256 &txid) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        CCoinsMap::const_iterator it = mapWriting.find(txid);
+        if (it != mapWriting.end())
+            return !it->second.coins.IsPruned();
+    }
+    return base->HaveCoins(txid);
+}
+
+uint256 CCoinsViewBackgroundFlush::GetBestBlock() const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (hashBlockWriting != uint256(0))
+            return hashBlockWriting;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewBackgroundFlush::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    if (!Wait())
+        return false;
+    return base->BatchWrite(mapCoins, hashBlock);
+}
+
+bool CCoinsViewBackgroundFlush::GetStats(CCoinsStats &stats) const {
+    if (!Wait())
+        return false;
+    return base->GetStats(stats);
+}
+
+bool CCoinsViewBackgroundFlush::GetRunningStats(CCoinsStats &stats) const {
+    if (!Wait())
+        return false;
+    return base->GetRunningStats(stats);
+}
+
+bool CCoinsViewBackgroundFlush::DumpSnapshot(CAutoFile &fileout, CCoinsSnapshotHeader &header, CCoinsStats &stats) const {
+    if (!Wait())
+        return false;
+    return pdb->DumpSnapshot(fileout, header, stats);
+}
+
+bool CCoinsViewBackgroundFlush::LoadSnapshot(CAutoFile &filein, const CCoinsSnapshotHeader &header, const uint256 &hashExpected, unsigned int nThreads, CCoinsStats &stats, std::string &strError) {
+    if (!Wait()) {
+        strError = "background write to the coin database failed";
+        return false;
+    }
+    return pdb->LoadSnapshot(filein, header, hashExpected, nThreads, stats, strError);
+}
+
+bool CCoinsViewBackgroundFlush::WriteInBackground(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    if (!Wait())
+        return false;
+    if (threadWrite.joinable())
+        threadWrite.join();
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        assert(mapWriting.empty());
+        mapWriting.swap(mapCoins);
+        hashBlockWriting = hashBlock;
+        fWriting = true;
+    }
+    threadWrite = boost::thread(boost::bind(&CCoinsViewBackgroundFlush::ThreadWrite, this));
+    return true;
+}
+
+bool CCoinsViewBackgroundFlush::IsWriting() const {
+    boost::unique_lock<boost::mutex> lock(cs);
+    return fWriting;
+}
+
+bool CCoinsViewBackgroundFlush::Wait() const {
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (fWriting)
+        condWritten.wait(lock);
+    return !fWriteFailed;
+}
+
+void CCoinsViewBackgroundFlush::ThreadWrite() {
+    RenameThread("cintamani-coinsflush");
+    int64_t nStart = GetTimeMillis();
+    bool fOk = false;
+    try {
+        // mapWriting is only read here and by lookups until fWriting is cleared
+        fOk = pdb->WriteCoins(mapWriting, hashBlockWriting);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    LogPrint("coindb", "Background coin database write of %u entries %s: %dms\n", (unsigned int)mapWriting.size(), fOk ? "done" : "FAILED", GetTimeMillis() - nStart);
+
+    CCoinsMap mapDone;
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fOk) {
+            // Everything is in the database now; keep serving it from there.
+            // On failure mapWriting stays, so reads remain consistent until shutdown.
+            mapDone.swap(mapWriting);
+            hashBlockWriting = uint256(0);
+        } else {
+            fWriteFailed = true;
+        }
+        fWriting = false;
+    }
+    condWritten.notify_all();
+    // mapDone is freed here, outside the lock
 }
 
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
@@ -99,59 +289,489 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read('l', nFile);
 }
 
+/** Result of hashing one key range of the coin database */
+struct CCoinsStatsRange
+{
+    uint256 hashSerialized;
+    CCoinsStats stats;
+    bool fOk;
+    std::string strError;
+
+    CCoinsStatsRange() : hashSerialized(0), fOk(false) {}
+};
+
+/** Add one coin database entry, nValueSize bytes on disk, to a range hash and its statistics */
+void static HashStatsEntry(CHashWriter &ss, CCoinsStats &stats, const uint256 &txhash, const CCoins &coins, size_t nValueSize) {
+    ss << txhash;
+    ss << VARINT(coins.nVersion);
+    ss << (coins.fCoinBase ? 'c' : 'n');
+    ss << VARINT(coins.nHeight);
+    stats.nTransactions++;
+    for (unsigned int i=0; i<coins.vout.size(); i++) {
+        const CTxOut &out = coins.vout[i];
+        if (!out.IsNull()) {
+            stats.nTransactionOutputs++;
+            ss << VARINT(i+1);
+            ss << out;
+            stats.nTotalAmount += out.nValue;
+        }
+    }
+    stats.nSerializedSize += 32 + nValueSize;
+    ss << VARINT(0);
+}
+
+//! Index of the GetStats() key range a txid belongs to
+static unsigned int StatsRangeOf(unsigned char chFirst) {
+    return (unsigned int)chFirst * COINS_STATS_RANGES / 256;
+}
+
+/**
+ * Hash and count all coins whose txid starts (in serialized order) with a
+ * byte in [nBegin, nEnd). Runs on its own thread against a shared snapshot.
+ */
+void static GetStatsRange(const CLevelDBWrapper *pdb, const leveldb::Snapshot *snapshot, unsigned int nBegin, unsigned int nEnd, CCoinsStatsRange *presult) {
+    try {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(pdb->NewIterator(snapshot));
+        char pchStart[2] = {'c', (char)nBegin};
+        pcursor->Seek(leveldb::Slice(pchStart, 2));
+
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        CCoinsStats &stats = presult->stats;
+        while (pcursor->Valid()) {
+            leveldb::Slice slKey = pcursor->key();
+            if (slKey.size() < 2 || slKey[0] != 'c' || (unsigned char)slKey[1] >= nEnd)
+                break;
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoins coins;
+            ssValue >> coins;
+            uint256 txhash;
+            ssKey >> txhash;
+            HashStatsEntry(ss, stats, txhash, coins, slValue.size());
+            pcursor->Next();
+        }
+        presult->hashSerialized = ss.GetHash();
+        presult->fOk = true;
+    } catch (std::exception &e) {
+        presult->strError = e.what();
+    }
+}
+
+/**
+ * Walk the coin database on a snapshot, so neither cs_main nor writers are
+ * held up. The key space is cut into COINS_STATS_RANGES fixed ranges which
+ * are hashed in parallel; hashSerialized commits to the best block and the
+ * range hashes in key order, so it does not depend on the number of threads.
+ */
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
-    /* It seems that there are no "const iterators" for LevelDB.  Since we
-       only need read operations on it, use a const-cast to get around
-       that restriction.  */
-    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    const leveldb::Snapshot *snapshot;
+    uint64_t nSequence;
+    {
+        LOCK(cs_stats);
+        snapshot = db.GetSnapshot();
+        nSequence = nWriteSequence;
+    }
+
+    uint256 hashBlock(0);
+    db.Read('B', hashBlock, snapshot);
+
+    std::vector<CCoinsStatsRange> vRanges(COINS_STATS_RANGES);
+    unsigned int nThreads = std::max(1U, std::min(boost::thread::hardware_concurrency(), COINS_STATS_RANGES));
+    {
+        // Workers use the snapshot and vRanges, don't leave before they are done
+        boost::this_thread::disable_interruption di;
+        for (unsigned int nFirst = 0; nFirst < COINS_STATS_RANGES; nFirst += nThreads) {
+            boost::thread_group threadGroup;
+            for (unsigned int i = nFirst; i < std::min(nFirst + nThreads, COINS_STATS_RANGES); i++)
+                threadGroup.create_thread(boost::bind(&GetStatsRange, &db, snapshot, i * 256 / COINS_STATS_RANGES, (i + 1) * 256 / COINS_STATS_RANGES, &vRanges[i]));
+            threadGroup.join_all();
+        }
+    }
+    db.ReleaseSnapshot(snapshot);
+    boost::this_thread::interruption_point();
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
+    stats.hashBlock = hashBlock;
     ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
+    BOOST_FOREACH(const CCoinsStatsRange &range, vRanges) {
+        if (!range.fOk)
+            return error("%s : Deserialize or I/O error - %s", __func__, range.strError);
+        ss << range.hashSerialized;
+        stats.nTransactions += range.stats.nTransactions;
+        stats.nTransactionOutputs += range.stats.nTransactionOutputs;
+        stats.nSerializedSize += range.stats.nSerializedSize;
+        stats.nTotalAmount += range.stats.nTotalAmount;
+    }
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi == mapBlockIndex.end())
+            return error("%s : best block %s not in block index", __func__, hashBlock.ToString());
+        stats.nHeight = mi->second->nHeight;
+    }
+    stats.hashSerialized = ss.GetHash();
+
+    // Seed the running counters if nothing was written since the snapshot
+    LOCK(cs_stats);
+    if (!fCountersValid && nSequence == nWriteSequence) {
+        counters.hashBlock = stats.hashBlock;
+        counters.nTransactions = stats.nTransactions;
+        counters.nTransactionOutputs = stats.nTransactionOutputs;
+        counters.nSerializedSize = stats.nSerializedSize;
+        counters.nTotalAmount = stats.nTotalAmount;
+        fCountersValid = const_cast<CLevelDBWrapper&>(db).Write('S', counters);
+    }
+    return true;
+}
+
+bool CCoinsViewDB::GetRunningStats(CCoinsStats &stats) const {
+    {
+        LOCK(cs_stats);
+        if (!fCountersValid)
+            return false;
+        stats.hashBlock = counters.hashBlock;
+        stats.nTransactions = counters.nTransactions;
+        stats.nTransactionOutputs = counters.nTransactionOutputs;
+        stats.nSerializedSize = counters.nSerializedSize;
+        stats.nTotalAmount = counters.nTotalAmount;
+    }
+    LOCK(cs_main);
+    BlockMap::const_iterator mi = mapBlockIndex.find(stats.hashBlock);
+    if (mi != mapBlockIndex.end())
+        stats.nHeight = mi->second->nHeight;
+    return true;
+}
+
+/** Releases a snapshot of a LevelDB database when it goes out of scope */
+class CLevelDBSnapshotRef
+{
+private:
+    const CLevelDBWrapper &db;
+
+public:
+    const leveldb::Snapshot * const snapshot;
+
+    CLevelDBSnapshotRef(const CLevelDBWrapper &dbIn) : db(dbIn), snapshot(dbIn.GetSnapshot()) {}
+    ~CLevelDBSnapshotRef() { db.ReleaseSnapshot(snapshot); }
+};
+
+//! Serialize obj to a snapshot file and into its running checksum
+template<typename T>
+void static WriteHashed(CAutoFile &fileout, CHashWriter &hasher, const T &obj) {
+    fileout << obj;
+    hasher << obj;
+}
+
+//! Deserialize obj from a snapshot file and add it to its running checksum
+template<typename T>
+void static ReadHashed(CAutoFile &filein, CHashWriter &hasher, T &obj) {
+    filein >> obj;
+    hasher << obj;
+}
+
+bool CCoinsViewDB::DumpSnapshot(CAutoFile &fileout, CCoinsSnapshotHeader &header, CCoinsStats &stats) const {
+    CLevelDBSnapshotRef snap(db);
+
+    uint256 hashBlock(0);
+    if (!db.Read('B', hashBlock, snap.snapshot))
+        return error("%s : coin database has no best block", __func__);
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(hashBlock);
+        if (mi == mapBlockIndex.end())
+            return error("%s : best block %s not in block index", __func__, hashBlock.ToString());
+        stats.nHeight = mi->second->nHeight;
+        header.nChainTx = mi->second->nChainTx;
+    }
+    header.hashBlock = hashBlock;
+    stats.hashBlock = hashBlock;
+
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    WriteHashed(fileout, hasher, header);
+
+    // Entries come in key order, so the GetStats() range hashes can be built on the way
+    std::vector<CHashWriter> vRangeHashers(COINS_STATS_RANGES, CHashWriter(SER_GETHASH, PROTOCOL_VERSION));
+    CDataStream ssChunk(SER_DISK, CLIENT_VERSION);
+    uint32_t nChunk = 0;
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator(snap.snapshot));
+    for (pcursor->Seek(std::string(1, 'c')); pcursor->Valid(); pcursor->Next()) {
         boost::this_thread::interruption_point();
+        leveldb::Slice slKey = pcursor->key();
+        if (slKey.size() < 2 || slKey[0] != 'c')
+            break;
+        CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+        char chType;
+        uint256 txhash;
+        ssKey >> chType >> txhash;
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+        CCoins coins;
+        ssValue >> coins;
+        HashStatsEntry(vRangeHashers[StatsRangeOf(slKey[1])], stats, txhash, coins, slValue.size());
+
+        // The stored value is a serialized CCoins already, copy it as-is
+        ssChunk << txhash;
+        ssChunk.write(slValue.data(), slValue.size());
+        if (++nChunk == COINS_SNAPSHOT_CHUNK) {
+            WriteHashed(fileout, hasher, nChunk);
+            WriteHashed(fileout, hasher, ssChunk.str());
+            ssChunk.clear();
+            nChunk = 0;
+        }
+    }
+    if (nChunk > 0) {
+        WriteHashed(fileout, hasher, nChunk);
+        WriteHashed(fileout, hasher, ssChunk.str());
+    }
+    // An empty chunk ends the entries
+    WriteHashed(fileout, hasher, (uint32_t)0);
+    WriteHashed(fileout, hasher, std::string());
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << hashBlock;
+    BOOST_FOREACH(CHashWriter &rangeHasher, vRangeHashers)
+        ss << rangeHasher.GetHash();
+    stats.hashSerialized = ss.GetHash();
+
+    WriteHashed(fileout, hasher, stats.nTransactions);
+    WriteHashed(fileout, hasher, stats.hashSerialized);
+    fileout << hasher.GetHash();
+    return true;
+}
+
+/** Chunks of a snapshot being loaded, handed from the file reader to the database writers */
+class CSnapshotLoadQueue
+{
+private:
+    boost::mutex cs;
+    boost::condition_variable condChunk; //! a chunk was queued, or there will be no more
+    boost::condition_variable condSpace; //! a chunk was taken off the queue, or a writer failed
+    std::deque<std::pair<uint32_t, std::string> > queue;
+    unsigned int nMaxQueued;
+    bool fDone;
+
+public:
+    bool fFailed;
+    std::string strError;
+    uint64_t nWritten;
+
+    CSnapshotLoadQueue(unsigned int nMaxQueuedIn) : nMaxQueued(nMaxQueuedIn), fDone(false), fFailed(false), nWritten(0) {}
+
+    //! Queue a chunk (taking over strChunk), waiting for room. Returns false if a writer failed.
+    bool Push(uint32_t nCount, std::string &strChunk) {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (queue.size() >= nMaxQueued && !fFailed)
+            condSpace.wait(lock);
+        if (fFailed)
+            return false;
+        queue.push_back(std::make_pair(nCount, std::string()));
+        queue.back().second.swap(strChunk);
+        condChunk.notify_one();
+        return true;
+    }
+
+    //! Take the next chunk. Returns false once all chunks are taken, or a writer failed.
+    bool Pop(uint32_t &nCount, std::string &strChunk) {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (queue.empty() && !fDone && !fFailed)
+            condChunk.wait(lock);
+        if (queue.empty() || fFailed)
+            return false;
+        nCount = queue.front().first;
+        strChunk.swap(queue.front().second);
+        queue.pop_front();
+        condSpace.notify_one();
+        return true;
+    }
+
+    void Written(uint32_t nCount) {
+        boost::unique_lock<boost::mutex> lock(cs);
+        nWritten += nCount;
+    }
+
+    void Fail(const std::string &strErrorIn) {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!fFailed)
+            strError = strErrorIn;
+        fFailed = true;
+        condChunk.notify_all();
+        condSpace.notify_all();
+    }
+
+    //! No more chunks will be pushed
+    void Finish() {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fDone = true;
+        condChunk.notify_all();
+    }
+};
+
+/** Decode queued snapshot chunks and write them to the coin database, until there are none left */
+void static LoadSnapshotChunks(CLevelDBWrapper *pdb, CSnapshotLoadQueue *pqueue) {
+    uint32_t nCount;
+    std::string strChunk;
+    while (pqueue->Pop(nCount, strChunk)) {
         try {
+            CDataStream ssChunk(strChunk.data(), strChunk.data() + strChunk.size(), SER_DISK, CLIENT_VERSION);
+            CLevelDBBatch batch;
+            for (uint32_t i = 0; i < nCount; i++) {
+                uint256 txhash;
+                CCoins coins;
+                ssChunk >> txhash >> coins;
+                if (coins.IsPruned())
+                    throw std::runtime_error("snapshot contains a spent entry");
+                batch.Write(make_pair('c', txhash), coins);
+            }
+            if (!ssChunk.empty())
+                throw std::runtime_error("snapshot chunk has trailing data");
+            pdb->WriteBatch(batch);
+            pqueue->Written(nCount);
+        } catch (const std::exception &e) {
+            pqueue->Fail(e.what());
+            return;
+        }
+    }
+}
+
+void CCoinsViewDB::WipeCoins() {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::string(1, 'c'));
+    while (pcursor->Valid()) {
+        CLevelDBBatch batch;
+        for (unsigned int n = 0; n < COINS_SNAPSHOT_CHUNK && pcursor->Valid(); n++, pcursor->Next()) {
             leveldb::Slice slKey = pcursor->key();
+            if (slKey.size() < 2 || slKey[0] != 'c')
+                break;
             CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
-            ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+            uint256 txhash;
+            ssKey >> chType >> txhash;
+            batch.Erase(make_pair('c', txhash));
+        }
+        db.WriteBatch(batch);
+        if (pcursor->Valid() && (pcursor->key().size() < 2 || pcursor->key()[0] != 'c'))
+            break;
+    }
+}
+
+bool CCoinsViewDB::LoadSnapshot(CAutoFile &filein, const CCoinsSnapshotHeader &header, const uint256 &hashExpected, unsigned int nThreads, CCoinsStats &stats, std::string &strError) {
+    LOCK(cs_stats);
+    {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+        pcursor->Seek(std::string(1, 'c'));
+        if (pcursor->Valid() && pcursor->key().size() > 0 && pcursor->key()[0] == 'c') {
+            strError = "coin database is not empty";
+            return false;
+        }
+    }
+    uint256 hashBlockOld = GetBestBlock();
+
+    // Until the set is complete and verified the database is unusable, see HaveIncompleteSnapshot()
+    db.Write('L', header.hashBlock, true);
+    fCountersValid = false;
+
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << header;
+    uint64_t nRead = 0;
+    bool fOk = true;
+    CSnapshotLoadQueue queue(2 * nThreads);
+    {
+        // Writers use the queue, don't leave before they are done
+        boost::this_thread::disable_interruption di;
+        boost::thread_group threadGroup;
+        for (unsigned int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&LoadSnapshotChunks, &db, &queue));
+        try {
+            while (true) {
+                uint32_t nCount;
+                std::string strChunk;
+                ReadHashed(filein, hasher, nCount);
+                ReadHashed(filein, hasher, strChunk);
+                if (nCount == 0)
+                    break;
+                nRead += nCount;
+                if (!queue.Push(nCount, strChunk))
+                    break;
             }
-            pcursor->Next();
-        } catch (std::exception &e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        } catch (const std::exception &e) {
+            strError = strprintf("error reading snapshot: %s", e.what());
+            fOk = false;
         }
+        queue.Finish();
+        threadGroup.join_all();
     }
-    stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
+    if (queue.fFailed) {
+        strError = strprintf("error loading snapshot: %s", queue.strError);
+        fOk = false;
+    }
+
+    uint64_t nTransactions = 0;
+    uint256 hashSerialized(0);
+    if (fOk) {
+        try {
+            ReadHashed(filein, hasher, nTransactions);
+            ReadHashed(filein, hasher, hashSerialized);
+            uint256 hashChecksum;
+            filein >> hashChecksum;
+            if (hashChecksum != hasher.GetHash()) {
+                strError = "snapshot checksum mismatch";
+                fOk = false;
+            }
+        } catch (const std::exception &e) {
+            strError = strprintf("error reading snapshot: %s", e.what());
+            fOk = false;
+        }
+    }
+    if (fOk && (nTransactions != nRead || queue.nWritten != nRead)) {
+        strError = strprintf("snapshot has %u entries, %u read, %u written", nTransactions, nRead, queue.nWritten);
+        fOk = false;
+    }
+    if (fOk && hashExpected != uint256(0) && hashSerialized != hashExpected) {
+        strError = strprintf("snapshot hash %s does not match expected %s", hashSerialized.ToString(), hashExpected.ToString());
+        fOk = false;
+    }
+    if (fOk) {
+        // Hash what actually ended up in the database, this also seeds the running counters
+        db.Write('B', header.hashBlock);
+        if (!GetStats(stats)) {
+            strError = "failed to hash the loaded coin database";
+            fOk = false;
+        } else if (stats.hashSerialized != hashSerialized || stats.nTransactions != nTransactions) {
+            strError = strprintf("loaded coin database hashes to %s, snapshot says %s", stats.hashSerialized.ToString(), hashSerialized.ToString());
+            fOk = false;
+        }
+    }
+
+    if (!fOk) {
+        LogPrintf("%s: %s, removing loaded entries\n", __func__, strError);
+        WipeCoins();
+        CLevelDBBatch batch;
+        if (hashBlockOld != uint256(0))
+            BatchWriteHashBestChain(batch, hashBlockOld);
+        else
+            batch.Erase('B');
+        counters = CCoinsCounters();
+        counters.hashBlock = hashBlockOld;
+        batch.Write('S', counters);
+        batch.Erase('L');
+        fCountersValid = db.WriteBatch(batch, true);
+        nWriteSequence++;
+        return false;
+    }
+
+    db.Erase('L', true);
+    nWriteSequence++;
+    LogPrintf("%s: loaded %u transactions at block %s\n", __func__, nTransactions, header.hashBlock.ToString());
     return true;
 }
 
+bool CCoinsViewDB::HaveIncompleteSnapshot() const {
+    return db.Exists('L');
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair('t', txid), pos);
 }
@@ -175,6 +795,23 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+bool CBlockTreeDB::WriteSnapshotBase(const uint256 &hash, uint64_t nChainTx) {
+    return Write('U', std::make_pair(hash, nChainTx), true);
+}
+
+bool CBlockTreeDB::ReadSnapshotBase(uint256 &hash, uint64_t &nChainTx) {
+    std::pair<uint256, uint64_t> base;
+    if (!Read('U', base))
+        return false;
+    hash = base.first;
+    nChainTx = base.second;
+    return true;
+}
+
+bool CBlockTreeDB::EraseSnapshotBase() {
+    return Erase('U', true);
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
@@ -14,6 +14,11 @@
 #include <utility>
 #include <vector>
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+class CAutoFile;
 class CCoins;
 class uint256;
 
@@ -23,12 +28,86 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! Number of fixed key ranges GetStats splits the coin database into
+static const unsigned int COINS_STATS_RANGES = 16;
+//! Version of the dumptxoutset file format
+static const int COINS_SNAPSHOT_VERSION = 1;
+//! Number of coin database entries per chunk of a dumptxoutset file
+static const unsigned int COINS_SNAPSHOT_CHUNK = 10000;
+
+/** Running totals over the coin database, stored next to it so they stay in step */
+struct CCoinsCounters
+{
+    uint256 hashBlock; //! best block the counters belong to
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nSerializedSize;
+    CAmount nTotalAmount;
+
+    CCoinsCounters() : hashBlock(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashBlock);
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nSerializedSize);
+        READWRITE(nTotalAmount);
+    }
+};
+
+/**
+ * Start of a UTXO set snapshot written by dumptxoutset. It is followed by
+ * chunks of (txid, CCoins) entries, each framed as a count and a byte vector
+ * so they can be decoded in parallel, an empty chunk, the entry count and
+ * GetStats() hash of the set, and finally a double-SHA256 checksum of
+ * everything before it.
+ */
+struct CCoinsSnapshotHeader
+{
+    unsigned char pchMessageStart[MESSAGE_START_SIZE]; //! network the snapshot belongs to
+    int nVersion;
+    uint256 hashBlock; //! block the set is the result of
+    uint64_t nChainTx; //! number of transactions up to and including that block
+
+    CCoinsSnapshotHeader() : nVersion(COINS_SNAPSHOT_VERSION), hashBlock(0), nChainTx(0)
+    {
+        memset(pchMessageStart, 0, sizeof(pchMessageStart));
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(this->nVersion);
+        READWRITE(hashBlock);
+        READWRITE(nChainTx);
+    }
+};
 
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDBWrapper db;
+
+    /**
+     * Running counters, adjusted by every BatchWrite. They are unknown on a
+     * chainstate written by an older version until the first full GetStats()
+     * scan seeds them. cs_stats is held for the whole of BatchWrite so seeding
+     * can tell whether the snapshot it scanned is still current.
+     */
+    mutable CCriticalSection cs_stats;
+    mutable CCoinsCounters counters;
+    mutable bool fCountersValid;
+    mutable uint64_t nWriteSequence;
+
+    //! Remove every coin entry, undoing a failed LoadSnapshot
+    void WipeCoins();
+
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -37,6 +116,73 @@ public:
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+    bool GetRunningStats(CCoinsStats &stats) const;
+
+    //! Write the dirty entries of mapCoins and the best block marker in one atomic batch, leaving mapCoins untouched
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock);
+
+    /**
+     * Write all unspent entries, as of a single point in time, as a snapshot
+     * after the already filled in header (see CCoinsSnapshotHeader). Sets
+     * header.hashBlock/nChainTx and returns the GetStats() figures of what was written.
+     */
+    bool DumpSnapshot(CAutoFile &fileout, CCoinsSnapshotHeader &header, CCoinsStats &stats) const;
+    /**
+     * Fill the empty coin database from a snapshot whose header has already
+     * been read from filein, decoding and writing chunks on nThreads threads.
+     * The result must hash to the value stored in the file (and to hashExpected,
+     * unless that is 0); otherwise everything written is removed again.
+     */
+    bool LoadSnapshot(CAutoFile &filein, const CCoinsSnapshotHeader &header, const uint256 &hashExpected, unsigned int nThreads, CCoinsStats &stats, std::string &strError);
+    //! Whether a LoadSnapshot was interrupted, leaving a partial set behind
+    bool HaveIncompleteSnapshot() const;
+};
+
+/**
+ * Sits directly on top of the coin database and writes a frozen set of cache
+ * entries to it on a background thread, so cs_main is not held for the
+ * duration of a LevelDB write. Until the write completes, reads of those
+ * entries are answered from the frozen set; the best block marker is written
+ * in the same batch as the coins, so a crash leaves the database at the
+ * previous flush and the blocks after it are connected again on startup.
+ *
+ * Only one write is in flight at a time. Anything that needs the database
+ * itself to be current (a synchronous BatchWrite, statistics) waits for it.
+ */
+class CCoinsViewBackgroundFlush : public CCoinsViewBacked
+{
+private:
+    CCoinsViewDB *pdb;
+
+    mutable boost::mutex cs;
+    mutable boost::condition_variable condWritten;
+    CCoinsMap mapWriting;     //! entries being written, read-only while fWriting
+    uint256 hashBlockWriting; //! best block of mapWriting, 0 if none
+    bool fWriting;
+    bool fWriteFailed;
+    boost::thread threadWrite;
+
+    void ThreadWrite();
+
+public:
+    CCoinsViewBackgroundFlush(CCoinsViewDB *pdbIn);
+    ~CCoinsViewBackgroundFlush();
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    uint256 GetBestBlock() const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool GetStats(CCoinsStats &stats) const;
+    bool GetRunningStats(CCoinsStats &stats) const;
+    bool DumpSnapshot(CAutoFile &fileout, CCoinsSnapshotHeader &header, CCoinsStats &stats) const;
+    bool LoadSnapshot(CAutoFile &filein, const CCoinsSnapshotHeader &header, const uint256 &hashExpected, unsigned int nThreads, CCoinsStats &stats, std::string &strError);
+
+    //! Take over mapCoins (left empty) and start writing it, after any write still in flight
+    bool WriteInBackground(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! Whether a background write is still in flight
+    bool IsWriting() const;
+    //! Wait for the write in flight, if any. Returns false if a background write failed.
+    bool Wait() const;
 };
 
 /** Access to the block database (blocks/index/) */
@@ -59,6 +205,9 @@ public:
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    bool WriteSnapshotBase(const uint256 &hash, uint64_t nChainTx);
+    bool ReadSnapshotBase(uint256 &hash, uint64_t &nChainTx);
+    bool EraseSnapshotBase();
     bool LoadBlockIndexGuts();
 };
 
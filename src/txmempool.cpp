@@ -724,6 +724,36 @@ void CTxMemPool::ClearPrioritisation(const uint256 hash)
     mapDeltas.erase(hash);
 }
 
+bool CTxMemPool::addLockedInput(const COutPoint& outpoint, const uint256& hashLock)
+{
+    LOCK(cs);
+    return mapLockedInputs.insert(std::make_pair(outpoint, hashLock)).first->second == hashLock;
+}
+
+void CTxMemPool::removeLockedInput(const COutPoint& outpoint, const uint256& hashLock)
+{
+    LOCK(cs);
+    std::map<COutPoint, uint256>::iterator it = mapLockedInputs.find(outpoint);
+    if (it != mapLockedInputs.end() && it->second == hashLock)
+        mapLockedInputs.erase(it);
+}
+
+bool CTxMemPool::findLockConflict(const CTransaction& tx, uint256& hashLockRet) const
+{
+    LOCK(cs);
+    if (mapLockedInputs.empty())
+        return false;
+    uint256 hash = tx.GetHash();
+    BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+        std::map<COutPoint, uint256>::const_iterator it = mapLockedInputs.find(txin.prevout);
+        if (it != mapLockedInputs.end() && it->second != hash) {
+            hashLockRet = it->second;
+            return true;
+        }
+    }
+    return false;
+}
+
 
 CCoinsViewMemPool::CCoinsViewMemPool(CCoinsView *baseIn, CTxMemPool &mempoolIn) : CCoinsViewBacked(baseIn), mempool(mempoolIn) { }
 
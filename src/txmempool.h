@@ -98,6 +98,8 @@ public:
     mutable CCriticalSection cs;
     std::map<uint256, CTxMemPoolEntry> mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
+    //! Inputs of InstantX transaction locks, with the only transaction allowed to spend each
+    std::map<COutPoint, uint256> mapLockedInputs;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
     CTxMemPool(const CFeeRate& _minRelayFee);
@@ -129,6 +131,16 @@ public:
     void ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount &nFeeDelta);
     void ClearPrioritisation(const uint256 hash);
 
+    /**
+     * Transaction locks. Inputs are checked against these next to mapNextTx,
+     * so a conflicting transaction is turned away in O(inputs). The first
+     * lock on an input wins; it can only be removed by the same transaction.
+     */
+    bool addLockedInput(const COutPoint& outpoint, const uint256& hashLock);
+    void removeLockedInput(const COutPoint& outpoint, const uint256& hashLock);
+    /** Find an input of tx that is locked by another transaction */
+    bool findLockConflict(const CTransaction& tx, uint256& hashLockRet) const;
+
     unsigned long size()
     {
         LOCK(cs);
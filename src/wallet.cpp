@@ -622,6 +622,10 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        // IsMine() may have changed (key import, watch-only), rebuild the index on next use
+        fWalletUTXODirty = true;
+        MarkBalancesDirty();
+        ClearDarksendRounds();
     }
 }
 
@@ -634,6 +638,9 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
         mapWallet[hash] = wtxIn;
         mapWallet[hash].BindWallet(this);
         AddToSpends(hash);
+        // Keys and watch-only scripts may not all be loaded yet, index lazily
+        fWalletUTXODirty = true;
+        MarkBalancesDirty();
     }
     else
     {
@@ -694,6 +701,11 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
                              wtxIn.hashBlock.ToString());
             }
             AddToSpends(hash);
+
+            // Wallet already has descendants of this transaction, their rounds were computed without it
+            TxSpends::const_iterator itSpend = mapTxSpends.lower_bound(COutPoint(hash, 0));
+            if (itSpend != mapTxSpends.end() && itSpend->first.hash == hash)
+                ClearDarksendRounds();
         }
 
         bool fUpdated = false;
@@ -728,6 +740,9 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
+        if (!fWalletUTXODirty)
+            AddToWalletUTXO(wtx);
+        MarkBalancesDirty();
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -782,6 +797,7 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
         if (mapWallet.count(txin.prevout.hash))
             mapWallet[txin.prevout.hash].MarkDirty();
     }
+    MarkBalancesDirty();
 }
 
 void CWallet::EraseFromWallet(const uint256 &hash)
@@ -791,7 +807,21 @@ void CWallet::EraseFromWallet(const uint256 &hash)
     {
         LOCK(cs_wallet);
         if (mapWallet.erase(hash))
+        {
             CWalletDB(strWalletFile).EraseTx(hash);
+            setWalletUTXO.erase(setWalletUTXO.lower_bound(COutPoint(hash, 0)),
+                                setWalletUTXO.lower_bound(COutPoint(hash, std::numeric_limits<uint32_t>::max())));
+            while (true)
+            {
+                map<COutPoint, pair<CAmount, int> >::iterator it = mapDenomUTXOBucket.lower_bound(COutPoint(hash, 0));
+                if (it == mapDenomUTXOBucket.end() || it->first.hash != hash)
+                    break;
+                EraseFromDenomUTXO(it->first);
+            }
+            MarkBalancesDirty();
+            // rounds of its descendants were derived from it
+            ClearDarksendRounds();
+        }
     }
     return;
 }
@@ -831,7 +861,7 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter& filter) const
 // Recursively determine the rounds of a given input (How deep is the Darksend chain for a given input)
 int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds) const
 {
-    static std::map<uint256, CMutableTransaction> mDenomWtxes;
+    AssertLockHeld(cs_wallet); // mapDarksendRounds
 
     if(rounds >= 16) return 15; // 16 rounds max
 
@@ -841,19 +871,10 @@ int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds) const
     const CWalletTx* wtx = GetWalletTx(hash);
     if(wtx != NULL)
     {
-        std::map<uint256, CMutableTransaction>::const_iterator mdwi = mDenomWtxes.find(hash);
-        // not known yet, let's add it
-        if(mdwi == mDenomWtxes.end())
-        {
-            LogPrint("darksend", "GetInputDarksendRounds INSERTING %s\n", hash.ToString());
-            mDenomWtxes[hash] = CMutableTransaction(*wtx);
-        }
-        // found and it's not an initial value, just return it
-        else if(mDenomWtxes[hash].vout[nout].nRounds != -10)
-        {
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
-
+        // already known, just return it
+        std::map<COutPoint, int>::const_iterator mdri = mapDarksendRounds.find(in.prevout);
+        if(mdri != mapDarksendRounds.end())
+            return mdri->second;
 
         // bounds check
         if(nout >= wtx->vout.size())
@@ -863,55 +884,52 @@ int CWallet::GetRealInputDarksendRounds(CTxIn in, int rounds) const
             return -4;
         }
 
-        if(pwalletMain->IsCollateralAmount(wtx->vout[nout].nValue))
+        int nRounds;
+        if(IsCollateralAmount(wtx->vout[nout].nValue))
         {
-            mDenomWtxes[hash].vout[nout].nRounds = -3;
-            LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
+            nRounds = -3;
         }
-
         //make sure the final output is non-denominate
-        if(/*rounds == 0 && */!IsDenominatedAmount(wtx->vout[nout].nValue)) //NOT DENOM
-        {
-            mDenomWtxes[hash].vout[nout].nRounds = -2;
-            LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
-
-        bool fAllDenoms = true;
-        BOOST_FOREACH(CTxOut out, wtx->vout)
+        else if(/*rounds == 0 && */!IsDenominatedAmount(wtx->vout[nout].nValue)) //NOT DENOM
         {
-            fAllDenoms = fAllDenoms && IsDenominatedAmount(out.nValue);
+            nRounds = -2;
         }
-        // this one is denominated but there is another non-denominated output found in the same tx
-        if(!fAllDenoms)
+        else
         {
-            mDenomWtxes[hash].vout[nout].nRounds = 0;
-            LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+            bool fAllDenoms = true;
+            BOOST_FOREACH(const CTxOut& out, wtx->vout)
+            {
+                fAllDenoms = fAllDenoms && IsDenominatedAmount(out.nValue);
+            }
 
-        int nShortest = -10; // an initial value, should be no way to get this by calculations
-        bool fDenomFound = false;
-        // only denoms here so let's look up
-        BOOST_FOREACH(CTxIn in2, wtx->vin)
-        {
-            if(IsMine(in2))
+            int nShortest = -10; // an initial value, should be no way to get this by calculations
+            bool fDenomFound = false;
+            // this one is denominated but there is another non-denominated output found in the same tx
+            if(fAllDenoms)
             {
-                int n = GetRealInputDarksendRounds(in2, rounds+1);
-                // denom found, find the shortest chain or initially assign nShortest with the first found value
-                if(n >= 0 && (n < nShortest || nShortest == -10))
+                // only denoms here so let's look up
+                BOOST_FOREACH(const CTxIn& in2, wtx->vin)
                 {
-                    nShortest = n;
-                    fDenomFound = true;
+                    if(IsMine(in2))
+                    {
+                        int n = GetRealInputDarksendRounds(in2, rounds+1);
+                        // denom found, find the shortest chain or initially assign nShortest with the first found value
+                        if(n >= 0 && (n < nShortest || nShortest == -10))
+                        {
+                            nShortest = n;
+                            fDenomFound = true;
+                        }
+                    }
                 }
             }
+            nRounds = fDenomFound
+                    ? (nShortest >= 15 ? 16 : nShortest + 1) // good, we a +1 to the shortest one but only 16 rounds max allowed
+                    : 0;            // too bad, we are the fist one in that chain
         }
-        mDenomWtxes[hash].vout[nout].nRounds = fDenomFound
-                ? (nShortest >= 15 ? 16 : nShortest + 1) // good, we a +1 to the shortest one but only 16 rounds max allowed
-                : 0;            // too bad, we are the fist one in that chain
-        LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-        return mDenomWtxes[hash].vout[nout].nRounds;
+
+        mapDarksendRounds[in.prevout] = nRounds;
+        LogPrint("darksend", "GetInputDarksendRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, nRounds);
+        return nRounds;
     }
 
     return rounds-1;
@@ -924,6 +942,20 @@ int CWallet::GetInputDarksendRounds(CTxIn in) const {
     return realDarksendRounds > nDarksendRounds ? nDarksendRounds : realDarksendRounds;
 }
 
+void CWallet::ClearDarksendRounds() const
+{
+    AssertLockHeld(cs_wallet); // mapDarksendRounds
+
+    // the denomination buckets are keyed by rounds
+    fDenomUTXODirty = true;
+
+    if (mapDarksendRounds.empty())
+        return;
+
+    LogPrint("darksend", "ClearDarksendRounds -- dropping %u cached entries\n", mapDarksendRounds.size());
+    mapDarksendRounds.clear();
+}
+
 bool CWallet::IsDenominated(const CTxIn &txin) const
 {
     {
@@ -1199,8 +1231,8 @@ void CWalletTx::RelayWalletTransaction(std::string strCommand)
             LogPrintf("Relaying wtx %s\n", hash.ToString());
 
             if(strCommand == "ix"){
-                mapTxLockReq.insert(make_pair(hash, (CTransaction)*this));
-                CreateNewLock(((CTransaction)*this));
+                txLockManager.AddLockRequest((CTransaction)*this);
+                txLockManager.CreateNewLock((CTransaction)*this);
                 RelayTransactionLockReq((CTransaction)*this, true);
             } else {
                 RelayTransaction((CTransaction)*this);
@@ -1270,58 +1302,173 @@ void CWallet::ResendWalletTransactions()
  */
 
 
-CAmount CWallet::GetBalance() const
+void CWallet::AddToWalletUTXO(const CWalletTx& wtx) const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    AssertLockHeld(cs_wallet);
+    uint256 hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+        if (IsMine(wtx.vout[i]) != ISMINE_NO)
         {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
+            setWalletUTXO.insert(COutPoint(hash, i));
+            if (!fDenomUTXODirty && IsDenominatedAmount(wtx.vout[i].nValue))
+                AddToDenomUTXO(COutPoint(hash, i), wtx.vout[i].nValue);
         }
-    }
+}
 
-    return nTotal;
+void CWallet::RebuildWalletUTXO() const
+{
+    AssertLockHeld(cs_wallet);
+
+    // the buckets follow, see AvailableDenominatedCoins
+    fDenomUTXODirty = true;
+    setWalletUTXO.clear();
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        AddToWalletUTXO(it->second);
+    fWalletUTXODirty = false;
 }
 
-CAmount CWallet::GetAnonymizableBalance() const
+void CWallet::AddToDenomUTXO(const COutPoint& outpoint, CAmount nValue) const
 {
-    if(fLiteMode) return 0;
+    AssertLockHeld(cs_wallet);
+    if (mapDenomUTXOBucket.count(outpoint))
+        return;
+    int nRounds = GetRealInputDarksendRounds(CTxIn(outpoint), 0);
+    mapDenomUTXO[nValue][nRounds].insert(outpoint);
+    mapDenomUTXOBucket.insert(make_pair(outpoint, make_pair(nValue, nRounds)));
+}
 
-    CAmount nTotal = 0;
+void CWallet::EraseFromDenomUTXO(const COutPoint& outpoint) const
+{
+    AssertLockHeld(cs_wallet);
+    map<COutPoint, pair<CAmount, int> >::iterator it = mapDenomUTXOBucket.find(outpoint);
+    if (it == mapDenomUTXOBucket.end())
+        return;
+    map<int, set<COutPoint> >& mapRounds = mapDenomUTXO[it->second.first];
+    mapRounds[it->second.second].erase(outpoint);
+    if (mapRounds[it->second.second].empty())
+        mapRounds.erase(it->second.second);
+    if (mapRounds.empty())
+        mapDenomUTXO.erase(it->second.first);
+    mapDenomUTXOBucket.erase(it);
+}
+
+/**
+ * Outpoint is spent by a wallet transaction that is buried too deep to be
+ * reorganized away in practice, so it never needs to be visited again.
+ */
+bool CWallet::IsSpentDeep(const COutPoint& outpoint) const
+{
+    pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(outpoint);
+    for (TxSpends::const_iterator it = range.first; it != range.second; ++it)
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
+        map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain(false) >= WALLET_UTXO_PRUNE_DEPTH)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Collect the distinct wallet transactions that still have (possibly) unspent
+ * outputs of ours, in mapWallet order. Prunes deeply spent outputs on the way.
+ */
+void CWallet::GetWalletUTXOTxs(vector<const CWalletTx*>& vWalletTxs) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    vWalletTxs.clear();
 
-            if (pcoin->IsTrusted())
-               nTotal += pcoin->GetAnonymizableCredit();
+    if (fWalletUTXODirty)
+        RebuildWalletUTXO();
+
+    const CWalletTx* pcoin = NULL;
+    set<COutPoint>::iterator it = setWalletUTXO.begin();
+    while (it != setWalletUTXO.end())
+    {
+        if (pcoin == NULL || pcoin->GetHash() != it->hash)
+        {
+            map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->hash);
+            pcoin = (mit != mapWallet.end()) ? &mit->second : NULL;
+        }
+        if (pcoin == NULL || IsSpentDeep(*it))
+        {
+            EraseFromDenomUTXO(*it);
+            setWalletUTXO.erase(it++);
+            continue;
         }
+        if (vWalletTxs.empty() || vWalletTxs.back() != pcoin)
+            vWalletTxs.push_back(pcoin);
+        ++it;
     }
-
-    return nTotal;
 }
 
-CAmount CWallet::GetAnonymizedBalance() const
+const CWallet::CWalletBalances& CWallet::GetCachedBalances() const
 {
-    if(fLiteMode) return 0;
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
 
-    CAmount nTotal = 0;
+    if (fBalancesCached && pindexBalancesCached == chainActive.Tip())
+        return cachedBalances;
+
+    CWalletBalances balances = CWalletBalances();
+    vector<const CWalletTx*> vWalletTxs;
+    GetWalletUTXOTxs(vWalletTxs);
+    BOOST_FOREACH(const CWalletTx* pcoin, vWalletTxs)
     {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        bool fTrusted = pcoin->IsTrusted();
+        bool fUnconfirmed = !IsFinalTx(*pcoin) || (!fTrusted && pcoin->GetDepthInMainChain() == 0);
+
+        if (fTrusted)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            balances.nTrusted += pcoin->GetAvailableCredit();
+            balances.nWatchOnlyTrusted += pcoin->GetAvailableWatchOnlyCredit();
+        }
+        if (fUnconfirmed)
+        {
+            balances.nUnconfirmed += pcoin->GetAvailableCredit();
+            balances.nWatchOnlyUnconfirmed += pcoin->GetAvailableWatchOnlyCredit();
+        }
+        balances.nImmature += pcoin->GetImmatureCredit();
+        balances.nWatchOnlyImmature += pcoin->GetImmatureWatchOnlyCredit();
 
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAnonymizedCredit();
+        if (fLiteMode) continue;
+
+        if (fTrusted)
+        {
+            balances.nAnonymizable += pcoin->GetAnonymizableCredit();
+            balances.nAnonymized += pcoin->GetAnonymizedCredit();
         }
+        balances.nDenominatedConf += pcoin->GetDenominatedCredit(false);
+        balances.nDenominatedUnconf += pcoin->GetDenominatedCredit(true);
     }
 
-    return nTotal;
+    cachedBalances = balances;
+    fBalancesCached = true;
+    pindexBalancesCached = chainActive.Tip();
+    return cachedBalances;
+}
+
+CAmount CWallet::GetBalance() const
+{
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalances().nTrusted;
+}
+
+CAmount CWallet::GetAnonymizableBalance() const
+{
+    if(fLiteMode) return 0;
+
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalances().nAnonymizable;
+}
+
+CAmount CWallet::GetAnonymizedBalance() const
+{
+    if(fLiteMode) return 0;
+
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalances().nAnonymized;
 }
 
 // Note: calculated including unconfirmed,
@@ -1335,11 +1482,11 @@ double CWallet::GetAverageAnonymizedRounds() const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        vector<const CWalletTx*> vWalletTxs;
+        GetWalletUTXOTxs(vWalletTxs);
+        BOOST_FOREACH(const CWalletTx* pcoin, vWalletTxs)
         {
-            const CWalletTx* pcoin = &(*it).second;
-
-            uint256 hash = (*it).first;
+            uint256 hash = pcoin->GetHash();
 
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
 
@@ -1369,11 +1516,11 @@ CAmount CWallet::GetNormalizedAnonymizedBalance() const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        vector<const CWalletTx*> vWalletTxs;
+        GetWalletUTXOTxs(vWalletTxs);
+        BOOST_FOREACH(const CWalletTx* pcoin, vWalletTxs)
         {
-            const CWalletTx* pcoin = &(*it).second;
-
-            uint256 hash = (*it).first;
+            uint256 hash = pcoin->GetHash();
 
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
 
@@ -1395,92 +1542,39 @@ CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
 {
     if(fLiteMode) return 0;
 
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-
-            nTotal += pcoin->GetDenominatedCredit(unconfirmed);
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    const CWalletBalances& balances = GetCachedBalances();
+    return unconfirmed ? balances.nDenominatedUnconf : balances.nDenominatedConf;
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalances().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalances().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalances().nWatchOnlyTrusted;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalances().nWatchOnlyUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetCachedBalances().nWatchOnlyImmature;
 }
 
 /**
@@ -1492,10 +1586,11 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        vector<const CWalletTx*> vWalletTxs;
+        GetWalletUTXOTxs(vWalletTxs);
+        BOOST_FOREACH(const CWalletTx* pcoin, vWalletTxs)
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const uint256& wtxid = pcoin->GetHash();
 
             if (!IsFinalTx(*pcoin))
                 continue;
@@ -1528,14 +1623,104 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
                 isminetype mine = IsMine(pcoin->vout[i]);
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && pcoin->vout[i].nValue > 0 &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i)))
+                    !IsLockedCoin(wtxid, i) && pcoin->vout[i].nValue > 0 &&
+                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected(wtxid, i)))
                         vCoins.push_back(COutput(pcoin, i, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
             }
         }
     }
 }
 
+/**
+ * populate vCoins with the denominated COutputs AvailableCoins(vCoins, true, NULL, ONLY_DENOMINATED)
+ * would return, limited to the denominations in nDenom (bits as in CDarksendPool::GetDenominations,
+ * 0 for all) with GetInputDarksendRounds() in [nDarksendRoundsMin, nDarksendRoundsMax). Only the
+ * matching buckets of mapDenomUTXO are visited. If nValueMax is not 0, each denomination stops after
+ * as many coins as fit in nValueMax; buckets are then visited in random order, each starting at a
+ * random outpoint, so which coins are returned is not biased towards low rounds or hashes.
+ */
+void CWallet::AvailableDenominatedCoins(vector<COutput>& vCoins, int nDenom, int nDarksendRoundsMin, int nDarksendRoundsMax, CAmount nValueMax) const
+{
+    vCoins.clear();
+
+    {
+        LOCK2(cs_main, cs_wallet);
+        if (fWalletUTXODirty)
+            RebuildWalletUTXO();
+        if (fDenomUTXODirty)
+        {
+            mapDenomUTXO.clear();
+            mapDenomUTXOBucket.clear();
+            fDenomUTXODirty = false;
+            BOOST_FOREACH(const COutPoint& outpoint, setWalletUTXO)
+            {
+                const CWalletTx* pcoin = GetWalletTx(outpoint.hash);
+                if (pcoin != NULL && IsDenominatedAmount(pcoin->vout[outpoint.n].nValue))
+                    AddToDenomUTXO(outpoint, pcoin->vout[outpoint.n].nValue);
+            }
+        }
+
+        vector<COutPoint> vPruned;
+        for (unsigned int nBit = 0; nBit < darkSendDenominations.size(); nBit++)
+        {
+            if (nDenom != 0 && !(nDenom & (1 << nBit)))
+                continue;
+            map<CAmount, map<int, set<COutPoint> > >::const_iterator itDenom = mapDenomUTXO.find(darkSendDenominations[nBit]);
+            if (itDenom == mapDenomUTXO.end())
+                continue;
+
+            vector<const set<COutPoint>*> vBuckets;
+            for (map<int, set<COutPoint> >::const_iterator itRounds = itDenom->second.begin(); itRounds != itDenom->second.end(); ++itRounds)
+            {
+                // same cap as GetInputDarksendRounds
+                int nRounds = std::min(itRounds->first, nDarksendRounds);
+                if (nRounds >= nDarksendRoundsMin && nRounds < nDarksendRoundsMax)
+                    vBuckets.push_back(&itRounds->second);
+            }
+
+            size_t nMaxCoins = nValueMax > 0 ? std::max<size_t>(1, nValueMax / itDenom->first) : 0;
+            if (nMaxCoins > 0)
+                std::random_shuffle(vBuckets.begin(), vBuckets.end(), GetRandInt);
+            size_t nFound = 0;
+            BOOST_FOREACH(const set<COutPoint>* pBucket, vBuckets)
+            {
+                set<COutPoint>::const_iterator it = nMaxCoins > 0 ? pBucket->lower_bound(COutPoint(GetRandHash(), 0)) : pBucket->begin();
+                for (size_t n = 0; n < pBucket->size() && (nMaxCoins == 0 || nFound < nMaxCoins); n++, ++it)
+                {
+                    if (it == pBucket->end())
+                        it = pBucket->begin();
+                    const COutPoint& outpoint = *it;
+                    const CWalletTx* pcoin = GetWalletTx(outpoint.hash);
+                    if (pcoin == NULL || IsSpentDeep(outpoint))
+                    {
+                        vPruned.push_back(outpoint);
+                        continue;
+                    }
+
+                    if (!IsFinalTx(*pcoin) || !pcoin->IsTrusted())
+                        continue;
+
+                    if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
+                        continue;
+
+                    isminetype mine = IsMine(pcoin->vout[outpoint.n]);
+                    if (!IsSpent(outpoint.hash, outpoint.n) && mine != ISMINE_NO && !IsLockedCoin(outpoint.hash, outpoint.n))
+                    {
+                        vCoins.push_back(COutput(pcoin, outpoint.n, pcoin->GetDepthInMainChain(false), (mine & ISMINE_SPENDABLE) != ISMINE_NO));
+                        nFound++;
+                    }
+                }
+            }
+        }
+
+        BOOST_FOREACH(const COutPoint& outpoint, vPruned)
+        {
+            EraseFromDenomUTXO(outpoint);
+            setWalletUTXO.erase(outpoint);
+        }
+    }
+}
+
 static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
                                   vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
 {
@@ -1794,7 +1979,8 @@ bool CWallet::SelectCoinsByDenominations(int nDenom, int64_t nValueMin, int64_t
 
     vCoinsRet2.clear();
     vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, NULL, ONLY_DENOMINATED);
+    // no more coins of a denomination than could fit in nValueMax are ever taken, so don't look further
+    AvailableDenominatedCoins(vCoins, nDenom, nDarksendRoundsMin, nDarksendRoundsMax, nValueMax);
 
     std::random_shuffle(vCoins.rbegin(), vCoins.rend());
 
@@ -1824,12 +2010,9 @@ bool CWallet::SelectCoinsByDenominations(int nDenom, int64_t nValueMin, int64_t
             // bit 2 - 1DRK+1
             // bit 3 - .1DRK+1
 
+            // already limited to the rounds asked for
             CTxIn vin = CTxIn(out.tx->GetHash(),out.i);
 
-            int rounds = GetInputDarksendRounds(vin);
-            if(rounds >= nDarksendRoundsMax) continue;
-            if(rounds < nDarksendRoundsMin) continue;
-
             if(fFound100 && fFound10 && fFound1 && fFoundDot1){ //if fulfilled
                 //we can return this for submission
                 if(nValueRet >= nValueMin){
@@ -1871,7 +2054,10 @@ bool CWallet::SelectCoinsDark(CAmount nValueMin, CAmount nValueMax, std::vector<
     nValueRet = 0;
 
     vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, coinControl, nDarksendRoundsMin < 0 ? ONLY_NONDENOMINATED_NOT1000IFMN : ONLY_DENOMINATED);
+    if(nDarksendRoundsMin < 0)
+        AvailableCoins(vCoins, true, coinControl, ONLY_NONDENOMINATED_NOT1000IFMN);
+    else
+        AvailableDenominatedCoins(vCoins, 0, nDarksendRoundsMin, nDarksendRoundsMax);
 
     set<pair<const CWalletTx*,unsigned int> > setCoinsRet2;
 
@@ -2969,6 +3155,8 @@ bool CWallet::UpdatedTransaction(const uint256 &hashTx)
         // Only notify UI if this transaction is in this wallet
         map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hashTx);
         if (mi != mapWallet.end()){
+            // InstantX lock completed: depth and trust of this transaction changed
+            MarkBalancesDirty();
             NotifyTransactionChanged(this, hashTx, CT_UPDATED);
             return true;
         }
@@ -2980,18 +3168,21 @@ void CWallet::LockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.insert(output);
+    MarkBalancesDirty();
 }
 
 void CWallet::UnlockCoin(COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.erase(output);
+    MarkBalancesDirty();
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
     setLockedCoins.clear();
+    MarkBalancesDirty();
 }
 
 bool CWallet::IsLockedCoin(uint256 hash, unsigned int n) const
@@ -3256,24 +3447,12 @@ int CMerkleTx::GetTransactionLockSignatures() const
     if(!IsSporkActive(SPORK_2_INSTANTX)) return -3;
     if(!fEnableInstantX) return -1;
 
-    //compile consessus vote
-    std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(GetHash());
-    if (i != mapTxLocks.end()){
-        return (*i).second.CountSignatures();
-    }
-
-    return -1;
+    return txLockManager.GetSignatures(GetHash());
 }
 
 bool CMerkleTx::IsTransactionLockTimedOut() const
 {
     if(!fEnableInstantX) return 0;
 
-    //compile consessus vote
-    std::map<uint256, CTransactionLock>::iterator i = mapTxLocks.find(GetHash());
-    if (i != mapTxLocks.end()){
-        return GetTime() > (*i).second.nTimeout;
-    }
-
-    return false;
+    return txLockManager.IsLockTimedOut(GetHash());
 }
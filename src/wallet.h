@@ -48,6 +48,8 @@ static const CAmount DEFAULT_TRANSACTION_MAXFEE = 0.2 * COIN; // "smallest denom
 static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWarning;
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
+//! Outputs whose spending wallet transaction is buried this deep are dropped from the unspent output index
+static const int WALLET_UTXO_PRUNE_DEPTH = 100;
 
 class CAccountingEntry;
 class CCoinControl;
@@ -146,6 +148,61 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Index of wallet outputs (IsMine != ISMINE_NO) that may still be unspent.
+     * Balance queries and AvailableCoins only visit the transactions referenced
+     * from here instead of walking all of mapWallet. Outputs are added by
+     * AddToWallet and dropped lazily once their spender is buried
+     * WALLET_UTXO_PRUNE_DEPTH blocks deep; MarkDirty() forces a rebuild.
+     */
+    mutable std::set<COutPoint> setWalletUTXO;
+    mutable bool fWalletUTXODirty;
+    void AddToWalletUTXO(const CWalletTx& wtx) const;
+    bool IsSpentDeep(const COutPoint& outpoint) const;
+    void GetWalletUTXOTxs(std::vector<const CWalletTx*>& vWalletTxs) const;
+    void RebuildWalletUTXO() const;
+
+    /**
+     * The denominated outputs of setWalletUTXO, bucketed by denomination and
+     * then by Darksend rounds (uncapped, see GetRealInputDarksendRounds), so
+     * mixing coin selection only visits the buckets it asks for. Follows
+     * setWalletUTXO; rebuilt with it and whenever the memoized rounds are
+     * dropped, as rounds of existing outputs may have changed then.
+     */
+    mutable std::map<CAmount, std::map<int, std::set<COutPoint> > > mapDenomUTXO;
+    mutable std::map<COutPoint, std::pair<CAmount, int> > mapDenomUTXOBucket;
+    mutable bool fDenomUTXODirty;
+    void AddToDenomUTXO(const COutPoint& outpoint, CAmount nValue) const;
+    void EraseFromDenomUTXO(const COutPoint& outpoint) const;
+    void AvailableDenominatedCoins(std::vector<COutput>& vCoins, int nDenom, int nDarksendRoundsMin, int nDarksendRoundsMax, CAmount nValueMax = 0) const;
+
+    /** All balance categories, computed together in a single pass over the unspent output index */
+    struct CWalletBalances
+    {
+        CAmount nTrusted;
+        CAmount nUnconfirmed;
+        CAmount nImmature;
+        CAmount nAnonymizable;
+        CAmount nAnonymized;
+        CAmount nDenominatedConf;
+        CAmount nDenominatedUnconf;
+        CAmount nWatchOnlyTrusted;
+        CAmount nWatchOnlyUnconfirmed;
+        CAmount nWatchOnlyImmature;
+    };
+
+    /**
+     * Balances stay valid until the wallet changes (AddToWallet, EraseFromWallet,
+     * MarkDirty, coin (un)locking, InstantX lock completion) or the chain tip moves.
+     * Mempool changes only matter for our own transactions, and those reach us
+     * through SyncTransaction, so unrelated mempool traffic keeps the cache.
+     */
+    mutable CWalletBalances cachedBalances;
+    mutable bool fBalancesCached;
+    mutable const CBlockIndex* pindexBalancesCached;
+    const CWalletBalances& GetCachedBalances() const;
+    void MarkBalancesDirty() const { fBalancesCached = false; }
+
 public:
 //    bool SelectCoins(int64_t nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet, const CCoinControl *coinControl = NULL, AvailableCoinsType coin_type=ALL_COINS, bool useIX = true) const;
     bool SelectCoinsDark(int64_t nValueMin, int64_t nValueMax, std::vector<CTxIn>& setCoinsRet, int64_t& nValueRet, int nDarksendRoundsMin, int nDarksendRoundsMax) const;
@@ -207,6 +264,10 @@ public:
         nLastResend = 0;
         nTimeFirstKey = 0;
         fWalletUnlockAnonymizeOnly = false;
+        fWalletUTXODirty = true;
+        fDenomUTXODirty = true;
+        fBalancesCached = false;
+        pindexBalancesCached = NULL;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -220,6 +281,16 @@ public:
 
     std::set<COutPoint> setLockedCoins;
 
+    /**
+     * Memoized Darksend rounds per wallet outpoint, kept in memory only and
+     * rebuilt on demand after a restart. Entries only depend on the wallet's
+     * own transaction graph, so they are dropped when that graph changes under
+     * them: an ancestor arrives late, a transaction is erased (conflicts,
+     * reorgs) or IsMine() may have changed (MarkDirty).
+     */
+    mutable std::map<COutPoint, int> mapDarksendRounds;
+    void ClearDarksendRounds() const;
+
     int64_t nTimeFirstKey;
 
     const CWalletTx* GetWalletTx(const uint256& hash) const;
@@ -7,15 +7,25 @@
 
 #include "zmqconfig.h"
 
+#include <boost/shared_ptr.hpp>
+
 class CBlockIndex;
+class CDataStream;
 class CZMQAbstractNotifier;
 
 typedef CZMQAbstractNotifier* (*CZMQNotifierFactory)();
 
+/**
+ * A serialized block or transaction, made once and shared by every notifier
+ * that publishes it; ZMQ holds a reference until the message is sent. Empty
+ * when no raw notifier is configured.
+ */
+typedef boost::shared_ptr<const CDataStream> CZMQPayload;
+
 class CZMQAbstractNotifier
 {
 public:
-    CZMQAbstractNotifier() : psocket(0) { }
+    CZMQAbstractNotifier() : psocket(0), nHighWaterMark(0) { }
     virtual ~CZMQAbstractNotifier();
 
     template <typename T>
@@ -28,18 +38,29 @@ public:
     void SetType(const std::string &t) { type = t; }
     std::string GetAddress() const { return address; }
     void SetAddress(const std::string &a) { address = a; }
+    int GetHighWaterMark() const { return nHighWaterMark; }
+    void SetHighWaterMark(int n) { nHighWaterMark = n; }
 
     virtual bool Initialize(void *pcontext) = 0;
     virtual void Shutdown() = 0;
 
-    virtual bool NotifyBlock(const CBlockIndex *pindex);
-    virtual bool NotifyTransaction(const CTransaction &transaction);
-    virtual bool NotifyTransactionLock(const CTransaction &transaction);
+    virtual bool NotifyBlock(const CBlockIndex *pindex, const CZMQPayload &rawBlock);
+    virtual bool NotifyTransaction(const CTransaction &transaction, const CZMQPayload &rawTx);
+    virtual bool NotifyTransactionLock(const CTransaction &transaction, const CZMQPayload &rawTx);
+
+    //! Events for which this notifier publishes serialized data, so the caller must provide it
+    enum PayloadType {
+        PAYLOAD_BLOCK = (1 << 0),
+        PAYLOAD_TX = (1 << 1),
+        PAYLOAD_TXLOCK = (1 << 2),
+    };
+    virtual int GetPayloadTypes() const { return 0; }
 
 protected:
     void *psocket;
     std::string type;
     std::string address;
+    int nHighWaterMark;
 };
 
 #endif // BITCOIN_ZMQ_ZMQABSTRACTNOTIFIER_H
@@ -10,12 +10,14 @@
 #include "streams.h"
 #include "util.h"
 
+#include <algorithm>
+
 void zmqError(const char *str)
 {
     LogPrint("zmq", "zmq: Error: %s, errno=%s\n", str, zmq_strerror(errno));
 }
 
-CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL)
+CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL), nPayloadTypes(0)
 {
 }
 
@@ -52,14 +54,28 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
             CZMQAbstractNotifier *notifier = factory();
             notifier->SetType(i->first);
             notifier->SetAddress(address);
+            std::map<std::string, std::string>::const_iterator k = args.find("-zmq" + i->first + "hwm");
+            notifier->SetHighWaterMark(k != args.end() ? std::max(0, atoi(k->second)) : DEFAULT_ZMQ_SNDHWM);
             notifiers.push_back(notifier);
         }
     }
 
+    // Notifiers on the same address share a socket, which gets the largest of their limits
+    std::map<std::string, int> mapHighWaterMarks;
+    for (std::list<CZMQAbstractNotifier*>::const_iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
+    {
+        int &nHighWaterMark = mapHighWaterMarks[(*i)->GetAddress()];
+        nHighWaterMark = std::max(nHighWaterMark, (*i)->GetHighWaterMark());
+    }
+    for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
+        (*i)->SetHighWaterMark(mapHighWaterMarks[(*i)->GetAddress()]);
+
     if (!notifiers.empty())
     {
         notificationInterface = new CZMQNotificationInterface();
         notificationInterface->notifiers = notifiers;
+        for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
+            notificationInterface->nPayloadTypes |= (*i)->GetPayloadTypes();
 
         if (!notificationInterface->Initialize())
         {
@@ -91,7 +107,7 @@ bool CZMQNotificationInterface::Initialize()
         CZMQAbstractNotifier *notifier = *i;
         if (notifier->Initialize(pcontext))
         {
-            LogPrint("zmq", "  Notifier %s ready (address = %s)\n", notifier->GetType(), notifier->GetAddress());
+            LogPrint("zmq", "  Notifier %s ready (address = %s, hwm = %d)\n", notifier->GetType(), notifier->GetAddress(), notifier->GetHighWaterMark());
         }
         else
         {
@@ -126,12 +142,25 @@ void CZMQNotificationInterface::Shutdown()
     }
 }
 
-void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
+// Serialize once for all notifiers, which share the buffer with ZMQ
+template <typename T>
+static CZMQPayload MakePayload(const T &obj, bool fNeeded)
+{
+    if (!fNeeded)
+        return CZMQPayload();
+    boost::shared_ptr<CDataStream> pss(new CDataStream(SER_NETWORK, PROTOCOL_VERSION));
+    pss->reserve(::GetSerializeSize(obj, SER_NETWORK, PROTOCOL_VERSION));
+    *pss << obj;
+    return pss;
+}
+
+void CZMQNotificationInterface::UpdatedBlockTip(const CBlock &block, const CBlockIndex *pindex)
 {
+    CZMQPayload rawBlock = MakePayload(block, nPayloadTypes & CZMQAbstractNotifier::PAYLOAD_BLOCK);
     for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
     {
         CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(pindex))
+        if (notifier->NotifyBlock(pindex, rawBlock))
         {
             i++;
         }
@@ -145,10 +174,11 @@ void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
 
 void CZMQNotificationInterface::SyncTransaction(const CTransaction &tx, const CBlock *pblock)
 {
+    CZMQPayload rawTx = MakePayload(tx, nPayloadTypes & CZMQAbstractNotifier::PAYLOAD_TX);
     for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
     {
         CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransaction(tx))
+        if (notifier->NotifyTransaction(tx, rawTx))
         {
             i++;
         }
@@ -162,10 +192,11 @@ void CZMQNotificationInterface::SyncTransaction(const CTransaction &tx, const CB
 
 void CZMQNotificationInterface::NotifyTransactionLock(const CTransaction &tx)
 {
+    CZMQPayload rawTx = MakePayload(tx, nPayloadTypes & CZMQAbstractNotifier::PAYLOAD_TXLOCK);
     for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
     {
         CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransactionLock(tx))
+        if (notifier->NotifyTransactionLock(tx, rawTx))
         {
             i++;
         }
@@ -5,13 +5,22 @@
 #ifndef BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
 #define BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
 
-#include "validationinterface.h"
+#include "main.h"
+#include <list>
 #include <string>
 #include <map>
 
 class CBlockIndex;
 class CZMQAbstractNotifier;
 
+//! Default outbound queue limit (ZMQ_SNDHWM) per subscriber, in messages
+static const int DEFAULT_ZMQ_SNDHWM = 1000;
+
+/**
+ * Publishes validation events on ZMQ sockets. The signals reach it from the
+ * validation notification thread only, which is what keeps the sockets, that
+ * are not thread safe, on a single thread.
+ */
 class CZMQNotificationInterface : public CValidationInterface
 {
 public:
@@ -25,7 +34,7 @@ protected:
 
     // CValidationInterface
     void SyncTransaction(const CTransaction &tx, const CBlock *pblock);
-    void UpdatedBlockTip(const CBlockIndex *pindex);
+    void UpdatedBlockTip(const CBlock &block, const CBlockIndex *pindex);
     void NotifyTransactionLock(const CTransaction &tx);
 
 private:
@@ -33,6 +42,8 @@ private:
 
     void *pcontext;
     std::list<CZMQAbstractNotifier*> notifiers;
+    //! Events any notifier publishes raw data for, only those are serialized
+    int nPayloadTypes;
 };
 
 #endif // BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
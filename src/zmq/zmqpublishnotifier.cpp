@@ -2,9 +2,10 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
-#include "chainparams.h"
 #include "zmqpublishnotifier.h"
+#include "crypto/common.h"
 #include "main.h"
+#include "streams.h"
 #include "util.h"
 
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
@@ -16,44 +17,10 @@ static const char *MSG_RAWBLOCK   = "rawblock";
 static const char *MSG_RAWTX      = "rawtx";
 static const char *MSG_RAWTXLOCK = "rawtxlock";
 
-// Internal function to send multipart message
-static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
+// Called by ZMQ once it no longer needs a shared payload
+static void zmq_free_payload(void * /*data*/, void *hint)
 {
-    va_list args;
-    va_start(args, size);
-
-    while (1)
-    {
-        zmq_msg_t msg;
-
-        int rc = zmq_msg_init_size(&msg, size);
-        if (rc != 0)
-        {
-            zmqError("Unable to initialize ZMQ msg");
-            return -1;
-        }
-
-        void *buf = zmq_msg_data(&msg);
-        memcpy(buf, data, size);
-
-        data = va_arg(args, const void*);
-
-        rc = zmq_msg_send(&msg, sock, data ? ZMQ_SNDMORE : 0);
-        if (rc == -1)
-        {
-            zmqError("Unable to send ZMQ msg");
-            zmq_msg_close(&msg);
-            return -1;
-        }
-
-        zmq_msg_close(&msg);
-
-        if (!data)
-            break;
-
-        size = va_arg(args, size_t);
-    }
-    return 0;
+    delete static_cast<CZMQPayload*>(hint);
 }
 
 bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
@@ -65,18 +32,41 @@ bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
 
     if (i==mapPublishNotifiers.end())
     {
+#ifdef ZMQ_XPUB_NODROP
+        // Unlike PUB, which silently drops for a subscriber that is too far
+        // behind, XPUB can report it, so drops are counted. The message is
+        // then dropped for every subscriber to the topic, indexers that must
+        // not miss messages because of another one use their own address.
+        psocket = zmq_socket(pcontext, ZMQ_XPUB);
+#else
         psocket = zmq_socket(pcontext, ZMQ_PUB);
+#endif
         if (!psocket)
         {
             zmqError("Failed to create socket");
             return false;
         }
 
-        int rc = zmq_bind(psocket, address.c_str());
+        int rc = zmq_setsockopt(psocket, ZMQ_SNDHWM, &nHighWaterMark, sizeof(nHighWaterMark));
+#ifdef ZMQ_XPUB_NODROP
+        int nodrop = 1;
+        if (rc == 0)
+            rc = zmq_setsockopt(psocket, ZMQ_XPUB_NODROP, &nodrop, sizeof(nodrop));
+#endif
+        if (rc!=0)
+        {
+            zmqError("Failed to set socket options");
+            zmq_close(psocket);
+            psocket = 0;
+            return false;
+        }
+
+        rc = zmq_bind(psocket, address.c_str());
         if (rc!=0)
         {
             zmqError("Failed to bind address");
             zmq_close(psocket);
+            psocket = 0;
             return false;
         }
 
@@ -101,6 +91,9 @@ void CZMQAbstractPublishNotifier::Shutdown()
 
     int count = mapPublishNotifiers.count(address);
 
+    if (nDropped > 0)
+        LogPrintf("zmq: %s at %s dropped %u of %u messages\n", type, address, nDropped, nSequence);
+
     // remove this notifier from the list of publishers using this address
     typedef std::multimap<std::string, CZMQAbstractPublishNotifier*>::iterator iterator;
     std::pair<iterator, iterator> iterpair = mapPublishNotifiers.equal_range(address);
@@ -125,16 +118,43 @@ void CZMQAbstractPublishNotifier::Shutdown()
     psocket = 0;
 }
 
-bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* data, size_t size)
+bool CZMQAbstractPublishNotifier::SendParts(const char *command, zmq_msg_t &msgData)
 {
     assert(psocket);
 
+#ifdef ZMQ_XPUB_NODROP
+    // Discard subscription messages, nobody reads them
+    char buf[256];
+    while (zmq_recv(psocket, buf, sizeof(buf), ZMQ_DONTWAIT) >= 0) { }
+#endif
+
     /* send three parts, command & data & a LE 4byte sequence number */
     unsigned char msgseq[sizeof(uint32_t)];
     WriteLE32(&msgseq[0], nSequence);
-    int rc = zmq_send_multipart(psocket, command, strlen(command), data, size, msgseq, (size_t)sizeof(uint32_t), (void*)0);
+
+    // The first part decides: a full queue refuses the whole message
+    int rc = zmq_send(psocket, command, strlen(command), ZMQ_SNDMORE | ZMQ_DONTWAIT);
     if (rc == -1)
+    {
+        zmq_msg_close(&msgData);
+        if (zmq_errno() == EAGAIN)
+        {
+            if (nDropped++ % 1000 == 0)
+                LogPrint("zmq", "zmq: %s subscriber too slow at %s, %u messages dropped\n", command, address, nDropped);
+            nSequence++;
+            return true;
+        }
+        zmqError("Unable to send ZMQ msg");
         return false;
+    }
+
+    rc = zmq_msg_send(&msgData, psocket, ZMQ_SNDMORE);
+    zmq_msg_close(&msgData);
+    if (rc == -1 || zmq_send(psocket, msgseq, sizeof(msgseq), 0) == -1)
+    {
+        zmqError("Unable to send ZMQ msg");
+        return false;
+    }
 
     /* increment memory only sequence number after sending */
     nSequence++;
@@ -142,7 +162,35 @@ bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* d
     return true;
 }
 
-bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* data, size_t size)
+{
+    zmq_msg_t msg;
+    if (zmq_msg_init_size(&msg, size) != 0)
+    {
+        zmqError("Unable to initialize ZMQ msg");
+        return false;
+    }
+    memcpy(zmq_msg_data(&msg), data, size);
+    return SendParts(command, msg);
+}
+
+bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const CZMQPayload &payload)
+{
+    assert(payload);
+
+    // ZMQ keeps a reference to the buffer until it has been sent to every subscriber
+    zmq_msg_t msg;
+    CZMQPayload *pref = new CZMQPayload(payload);
+    if (zmq_msg_init_data(&msg, (void*)&(*payload->begin()), payload->size(), zmq_free_payload, pref) != 0)
+    {
+        delete pref;
+        zmqError("Unable to initialize ZMQ msg");
+        return false;
+    }
+    return SendParts(command, msg);
+}
+
+bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex, const CZMQPayload &/*rawBlock*/)
 {
     uint256 hash = pindex->GetBlockHash();
     LogPrint("zmq", "zmq: Publish hashblock %s\n", hash.GetHex());
@@ -152,7 +200,7 @@ bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
     return SendMessage(MSG_HASHBLOCK, data, 32);
 }
 
-bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
+bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &transaction, const CZMQPayload &/*rawTx*/)
 {
     uint256 hash = transaction.GetHash();
     LogPrint("zmq", "zmq: Publish hashtx %s\n", hash.GetHex());
@@ -162,7 +210,7 @@ bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &t
     return SendMessage(MSG_HASHTX, data, 32);
 }
 
-bool CZMQPublishHashTransactionLockNotifier::NotifyTransactionLock(const CTransaction &transaction)
+bool CZMQPublishHashTransactionLockNotifier::NotifyTransactionLock(const CTransaction &transaction, const CZMQPayload &/*rawTx*/)
 {
     uint256 hash = transaction.GetHash();
     LogPrint("zmq", "zmq: Publish hashtxlock %s\n", hash.GetHex());
@@ -172,41 +220,22 @@ bool CZMQPublishHashTransactionLockNotifier::NotifyTransactionLock(const CTransa
     return SendMessage(MSG_HASHTXLOCK, data, 32);
 }
 
-bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex, const CZMQPayload &rawBlock)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
-
-    const Consensus::Params& consensusParams = Params().GetConsensus();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    {
-        LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex, consensusParams))
-        {
-            zmqError("Can't read block from disk");
-            return false;
-        }
-
-        ss << block;
-    }
-
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+    return SendMessage(MSG_RAWBLOCK, rawBlock);
 }
 
-bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
+bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction, const CZMQPayload &rawTx)
 {
     uint256 hash = transaction.GetHash();
     LogPrint("zmq", "zmq: Publish rawtx %s\n", hash.GetHex());
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << transaction;
-    return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
+    return SendMessage(MSG_RAWTX, rawTx);
 }
 
-bool CZMQPublishRawTransactionLockNotifier::NotifyTransactionLock(const CTransaction &transaction)
+bool CZMQPublishRawTransactionLockNotifier::NotifyTransactionLock(const CTransaction &transaction, const CZMQPayload &rawTx)
 {
     uint256 hash = transaction.GetHash();
     LogPrint("zmq", "zmq: Publish rawtxlock %s\n", hash.GetHex());
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    ss << transaction;
-    return SendMessage(MSG_RAWTXLOCK, &(*ss.begin()), ss.size());
+    return SendMessage(MSG_RAWTXLOCK, rawTx);
 }
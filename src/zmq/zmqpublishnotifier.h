@@ -13,55 +13,71 @@ class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
 private:
     uint32_t nSequence; // upcounting per message sequence number
+    uint64_t nDropped;  // messages not sent because a subscriber was too far behind
 
 public:
+    CZMQAbstractPublishNotifier() : nSequence(0), nDropped(0) { }
 
     /* send zmq multipart message
        parts:
           * command
           * data
           * message sequence number
+       Never blocks: a message that doesn't fit under the socket's high-water
+       mark is dropped and counted, and its sequence number is skipped so
+       subscribers can tell.
     */
     bool SendMessage(const char *command, const void* data, size_t size);
+    //! Same, sending a shared payload without copying it
+    bool SendMessage(const char *command, const CZMQPayload &payload);
+
+    uint32_t GetSequence() const { return nSequence; }
+    uint64_t GetDropped() const { return nDropped; }
 
     bool Initialize(void *pcontext);
     void Shutdown();
+
+private:
+    bool SendParts(const char *command, zmq_msg_t &msgData);
 };
 
 class CZMQPublishHashBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex);
+    bool NotifyBlock(const CBlockIndex *pindex, const CZMQPayload &rawBlock);
 };
 
 class CZMQPublishHashTransactionNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyTransaction(const CTransaction &transaction);
+    bool NotifyTransaction(const CTransaction &transaction, const CZMQPayload &rawTx);
 };
 
 class CZMQPublishHashTransactionLockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyTransactionLock(const CTransaction &transaction);
+    bool NotifyTransactionLock(const CTransaction &transaction, const CZMQPayload &rawTx);
 };
 
 class CZMQPublishRawBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex);
+    bool NotifyBlock(const CBlockIndex *pindex, const CZMQPayload &rawBlock);
+    int GetPayloadTypes() const { return PAYLOAD_BLOCK; }
 };
 
 class CZMQPublishRawTransactionNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyTransaction(const CTransaction &transaction);
+    bool NotifyTransaction(const CTransaction &transaction, const CZMQPayload &rawTx);
+    int GetPayloadTypes() const { return PAYLOAD_TX; }
 };
 
 class CZMQPublishRawTransactionLockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyTransactionLock(const CTransaction &transaction);
+    bool NotifyTransactionLock(const CTransaction &transaction, const CZMQPayload &rawTx);
+    int GetPayloadTypes() const { return PAYLOAD_TXLOCK; }
 };
 
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H